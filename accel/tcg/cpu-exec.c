@@ -222,9 +222,9 @@ static bool tb_lookup_cmp(const void *p, const void *d)
     return false;
 }
 
-static TranslationBlock *tb_htable_lookup(CPUState *cpu, vaddr pc,
-                                          uint64_t cs_base, uint32_t flags,
-                                          uint32_t cflags)
+TranslationBlock *tb_htable_lookup(CPUState *cpu, vaddr pc,
+                                   uint64_t cs_base, uint32_t flags,
+                                   uint32_t cflags)
 {
     tb_page_addr_t phys_pc;
     struct tb_desc desc;
@@ -245,6 +245,19 @@ static TranslationBlock *tb_htable_lookup(CPUState *cpu, vaddr pc,
     return qht_lookup_custom(&tb_ctx.htable, &desc, h, tb_lookup_cmp);
 }
 
+/*
+ * Tell tcg_region_evict that the region holding @tb is in use.
+ * Read first, so that hot regions do not keep bouncing the cache line.
+ */
+static inline void tb_mark_referenced(const TranslationBlock *tb)
+{
+    uint8_t *ref = &tcg_region_referenced[tb->region];
+
+    if (unlikely(!qatomic_read(ref))) {
+        qatomic_set(ref, 1);
+    }
+}
+
 /* Might cause an exception, so have a longjmp destination ready */
 static inline TranslationBlock *tb_lookup(CPUState *cpu, vaddr pc,
                                           uint64_t cs_base, uint32_t flags,
@@ -283,6 +296,7 @@ hit:
      * the virtual PC has to match for non-CF_PCREL translations.
      */
     assert((tb_cflags(tb) & CF_PCREL) || tb->pc == pc);
+    tb_mark_referenced(tb);
     return tb;
 }
 
@@ -1099,6 +1113,7 @@ void tcg_exec_unrealizefn(CPUState *cpu)
     tcg_iommu_free_notifier_list(cpu);
 #endif /* !CONFIG_USER_ONLY */
 
+    tb_spec_cpu_unrealize(cpu);
     tlb_destroy(cpu);
     g_free_rcu(cpu->tb_jmp_cache, rcu);
 }
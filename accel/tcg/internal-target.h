@@ -71,6 +71,34 @@ G_NORETURN void cpu_io_recompile(CPUState *cpu, uintptr_t retaddr);
 
 bool tb_invalidate_phys_page_unwind(tb_page_addr_t addr, uintptr_t pc);
 
+#ifdef CONFIG_LINUX_USER
+TranslationBlock *tb_cache_lookup(vaddr pc, uint64_t cs_base,
+                                  uint32_t flags, uint32_t cflags);
+void tb_cache_flush(void);
+void tb_cache_maps_changed(void);
+#else
+static inline TranslationBlock *tb_cache_lookup(vaddr pc, uint64_t cs_base,
+                                                uint32_t flags,
+                                                uint32_t cflags)
+{
+    return NULL;
+}
+static inline void tb_cache_flush(void) { }
+static inline void tb_cache_maps_changed(void) { }
+#endif
+
+#ifdef CONFIG_LINUX_USER
+void tb_spec_queue(CPUState *cpu, const TranslationBlock *tb,
+                   const vaddr *dest, int n);
+void tb_spec_cpu_unrealize(CPUState *cpu);
+#else
+static inline void tb_spec_queue(CPUState *cpu, const TranslationBlock *tb,
+                                 const vaddr *dest, int n)
+{
+}
+static inline void tb_spec_cpu_unrealize(CPUState *cpu) { }
+#endif
+
 /* Return the current PC from CPU, which may be cached in TB. */
 static inline vaddr log_pc(CPUState *cpu, const TranslationBlock *tb)
 {
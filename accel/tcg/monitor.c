@@ -189,8 +189,15 @@ static void dump_exec_info(GString *buf)
     g_string_append_printf(buf, "\nStatistics:\n");
     g_string_append_printf(buf, "TB flush count      %u\n",
                            qatomic_read(&tb_ctx.tb_flush_count));
+    g_string_append_printf(buf, "TB evict count      %u (%u TBs)\n",
+                           qatomic_read(&tb_ctx.tb_evict_count),
+                           qatomic_read(&tb_ctx.tb_evicted_count));
     g_string_append_printf(buf, "TB invalidate count %u\n",
                            qatomic_read(&tb_ctx.tb_phys_invalidate_count));
+    g_string_append_printf(buf, "TB retranslations   %u\n",
+                           qatomic_read(&tb_ctx.tb_retranslate_count));
+    g_string_append_printf(buf, "SMC writes skipped  %u\n",
+                           qatomic_read(&tb_ctx.tb_smc_skip_count));
 
     tlb_flush_counts(&flush_full, &flush_part, &flush_elide);
     g_string_append_printf(buf, "TLB full flushes    %zu\n", flush_full);
@@ -0,0 +1,624 @@
+/*
+ * Persistent translation cache for linux-user
+ *
+ * Short-lived processes that run the same programs over and over, such
+ * as compilers started through binfmt_misc, spend much of their time
+ * translating the same code from the dynamic loader and shared libraries.
+ * When the guest exits, the translation buffer is written to disk together
+ * with an index of the TranslationBlocks it contains.  The next process
+ * maps it back into its own translation buffer.
+ *
+ * Generated code refers to helpers, to the prologue and to other TBs
+ * through host addresses, so it is only reused at the address where it
+ * was generated.  The cache is ignored unless the translation buffer, the
+ * QEMU binary and guest_base are at the same addresses as in the process
+ * that wrote it, which holds for non-PIE builds such as the static
+ * binaries usually registered with binfmt_misc.
+ *
+ * Cached TBs are not published when the cache is loaded.  When
+ * tb_gen_code() misses, the index is searched by (pc, cs_base, flags,
+ * cflags) and the cached TB is linked instead of translating, provided the
+ * guest code is still mapped from the same file at the same offset and its
+ * bytes are unchanged.
+ *
+ * The cache holds host code that is executed as is, so it is only used
+ * from a directory and files that belong to the user and that nobody else
+ * can write to, and never by setuid programs.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "elf.h"
+#include "qemu/crc32c.h"
+#include "qemu/error-report.h"
+#include "qemu/selfmap.h"
+#include "qemu/timer.h"
+#include "exec/cpu_ldst.h"
+#include "exec/exec-all.h"
+#include "exec/page-protection.h"
+#include "exec/translation-block.h"
+#include "tcg/perf.h"
+#include "tcg/startup.h"
+#include "tcg/tcg.h"
+#include "user/guest-base.h"
+#include "user/tb-cache.h"
+#include "host/cpuinfo.h"
+#include "tb-hash.h"
+#include "internal-common.h"
+#include "internal-target.h"
+#include "trace.h"
+
+#define TB_CACHE_MAGIC "QEMUTBC1"
+
+/*
+ * File layout: the header, nr_entries TBCacheEntry, then at the host
+ * page aligned image_offset the first image_size bytes of the
+ * translation buffer, starting with the prologue.
+ */
+typedef struct TBCacheHeader {
+    char magic[8];
+
+    /* Identity of the QEMU binary and of the guest executable */
+    uint64_t qemu_dev;
+    uint64_t qemu_ino;
+    uint64_t qemu_mtime;
+    uint64_t exec_dev;
+    uint64_t exec_ino;
+    uint64_t exec_mtime;
+
+    /* Everything generated code may depend on */
+    uint64_t anchor;
+    uint64_t buffer;
+    uint64_t prologue_size;
+    uint64_t guest_base;
+    uint64_t host_cpuinfo;
+    uint32_t cpu_model_crc;
+
+    uint32_t nr_entries;
+    uint64_t image_offset;
+    uint64_t image_size;
+} TBCacheHeader;
+
+typedef struct TBCacheEntry {
+    /* Lookup key */
+    uint64_t pc;
+    uint64_t cs_base;
+    uint32_t flags;
+    uint32_t cflags;
+
+    /* Offset of the TranslationBlock from the start of the buffer */
+    uint64_t tb_offset;
+
+    /* The file and offset the guest code was mapped from */
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t file_offset;
+    uint32_t size;
+    uint32_t crc;
+} TBCacheEntry;
+
+/* Path of the cache file, NULL if the cache is disabled */
+static char *tb_cache_path;
+/* Header of this process; on load, compared with the one of the file */
+static TBCacheHeader tb_cache_hdr;
+/* Header read from the cache file by tb_cache_init, if valid */
+static TBCacheHeader tb_cache_file_hdr;
+static bool tb_cache_file_valid;
+
+/* Cached TBs that have not been linked yet, protected by mmap_lock */
+static TBCacheEntry *tb_cache_entries;
+static GHashTable *tb_cache_index;
+/* Translations past this point are not in the cache file */
+static void *tb_cache_image_end;
+/* The image only covers the first region of code_gen_buffer */
+static void *tb_cache_region_end;
+
+/* Host memory map, re-read when guest mappings change */
+static IntervalTreeRoot *tb_cache_maps;
+static bool tb_cache_maps_stale;
+
+static guint tb_cache_entry_hash(gconstpointer key)
+{
+    const TBCacheEntry *e = key;
+
+    return tb_hash_func(e->pc, e->pc, e->flags, e->cs_base, e->cflags);
+}
+
+static gboolean tb_cache_entry_equal(gconstpointer a, gconstpointer b)
+{
+    const TBCacheEntry *ea = a;
+    const TBCacheEntry *eb = b;
+
+    return ea->pc == eb->pc && ea->cs_base == eb->cs_base &&
+           ea->flags == eb->flags && ea->cflags == eb->cflags;
+}
+
+static uint64_t tb_cache_mtime(const struct stat *st)
+{
+    return st->st_mtim.tv_sec * NANOSECONDS_PER_SECOND + st->st_mtim.tv_nsec;
+}
+
+static bool tb_cache_read(int fd, void *buf, size_t len, off_t offset)
+{
+    while (len) {
+        ssize_t ret = pread(fd, buf, len, offset);
+
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret <= 0) {
+            return false;
+        }
+        buf += ret;
+        len -= ret;
+        offset += ret;
+    }
+    return true;
+}
+
+static bool tb_cache_write(int fd, const void *buf, size_t len, off_t offset)
+{
+    while (len) {
+        ssize_t ret = pwrite(fd, buf, len, offset);
+
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret <= 0) {
+            return false;
+        }
+        buf += ret;
+        len -= ret;
+        offset += ret;
+    }
+    return true;
+}
+
+/* Only trust what no other user could have written. */
+static bool tb_cache_check_owner(const char *path, const struct stat *st)
+{
+    if (st->st_uid != geteuid()) {
+        warn_report("translation cache %s ignored: not owned by the "
+                    "current user", path);
+        return false;
+    }
+    if (st->st_mode & (S_IWGRP | S_IWOTH)) {
+        warn_report("translation cache %s ignored: writable by other users",
+                    path);
+        return false;
+    }
+    return true;
+}
+
+static int tb_cache_open(void)
+{
+    struct stat st;
+    int fd;
+
+    fd = open(tb_cache_path, O_RDONLY | O_NOFOLLOW);
+    if (fd < 0) {
+        return -1;
+    }
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) ||
+        !tb_cache_check_owner(tb_cache_path, &st)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void tb_cache_init(const char *dir, int execfd)
+{
+    struct stat st;
+    int fd;
+
+#ifdef CONFIG_TCG_INTERPRETER
+    warn_report("translation cache is not supported by TCI");
+    return;
+#endif
+
+    /* The directory may come from the environment of an unprivileged user */
+    if (qemu_getauxval(AT_SECURE)) {
+        warn_report("translation cache disabled for setuid programs");
+        return;
+    }
+
+    if (mkdir(dir, 0700) < 0 && errno != EEXIST) {
+        warn_report("translation cache disabled: %s: %s", dir,
+                    strerror(errno));
+        return;
+    }
+    if (stat(dir, &st) < 0) {
+        warn_report("translation cache disabled: %s: %s", dir,
+                    strerror(errno));
+        return;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        warn_report("translation cache disabled: %s is not a directory", dir);
+        return;
+    }
+    if (!tb_cache_check_owner(dir, &st)) {
+        return;
+    }
+
+    if (fstat(execfd, &st) < 0) {
+        warn_report("translation cache disabled: %s", strerror(errno));
+        return;
+    }
+    tb_cache_hdr.exec_dev = st.st_dev;
+    tb_cache_hdr.exec_ino = st.st_ino;
+    tb_cache_hdr.exec_mtime = tb_cache_mtime(&st);
+
+    if (stat("/proc/self/exe", &st) < 0) {
+        warn_report("translation cache disabled: %s", strerror(errno));
+        return;
+    }
+    tb_cache_hdr.qemu_dev = st.st_dev;
+    tb_cache_hdr.qemu_ino = st.st_ino;
+    tb_cache_hdr.qemu_mtime = tb_cache_mtime(&st);
+
+    tb_cache_path = g_strdup_printf("%s/%s-%" PRIx64 "-%" PRIx64 ".tbc", dir,
+                                    TARGET_NAME, tb_cache_hdr.exec_dev,
+                                    tb_cache_hdr.exec_ino);
+
+    fd = tb_cache_open();
+    if (fd < 0) {
+        return;
+    }
+    if (tb_cache_read(fd, &tb_cache_file_hdr, sizeof(tb_cache_file_hdr), 0) &&
+        !memcmp(tb_cache_file_hdr.magic, TB_CACHE_MAGIC,
+                sizeof(tb_cache_file_hdr.magic)) &&
+        tb_cache_file_hdr.qemu_dev == tb_cache_hdr.qemu_dev &&
+        tb_cache_file_hdr.qemu_ino == tb_cache_hdr.qemu_ino &&
+        tb_cache_file_hdr.qemu_mtime == tb_cache_hdr.qemu_mtime &&
+        tb_cache_file_hdr.exec_dev == tb_cache_hdr.exec_dev &&
+        tb_cache_file_hdr.exec_ino == tb_cache_hdr.exec_ino &&
+        tb_cache_file_hdr.exec_mtime == tb_cache_hdr.exec_mtime) {
+        tb_cache_file_valid = true;
+        /* Ask for the buffer where the cached code was generated */
+        tcg_set_code_gen_buffer_hint((void *)tb_cache_file_hdr.buffer);
+    }
+    close(fd);
+}
+
+/* Map the image of the file in place; called with a validated header */
+static bool tb_cache_map_image(int fd, const TBCacheHeader *hdr)
+{
+    void *buffer = (void *)hdr->buffer;
+    size_t prologue_size = hdr->prologue_size;
+    g_autofree uint8_t *prologue = g_malloc(prologue_size);
+
+    /* The image starts with the prologue, which must be identical */
+    if (!tb_cache_read(fd, prologue, prologue_size, hdr->image_offset) ||
+        memcmp(prologue, buffer, prologue_size)) {
+        return false;
+    }
+
+    qemu_thread_jit_write();
+
+    /*
+     * Map the file privately so that only the pages that are executed
+     * are read.  The mapping also covers the prologue, which compared
+     * equal above.  Fall back to reading the image, e.g. on noexec
+     * mounts.
+     */
+    if (mmap(buffer, ROUND_UP(hdr->image_size, qemu_real_host_page_size()),
+             PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_FIXED,
+             fd, hdr->image_offset) == MAP_FAILED &&
+        !tb_cache_read(fd, buffer + prologue_size,
+                       hdr->image_size - prologue_size,
+                       hdr->image_offset + prologue_size)) {
+        /* Whatever was read is unreachable, and overwritten later */
+        return false;
+    }
+
+    flush_idcache_range((uintptr_t)tcg_splitwx_to_rx(buffer),
+                        (uintptr_t)buffer, hdr->image_size);
+    return true;
+}
+
+void tb_cache_load(const char *cpu_model)
+{
+    TCGContext *s = tcg_ctx;
+    void *buffer = tcg_splitwx_to_rw((const void *)tcg_qemu_tb_exec);
+    const TBCacheHeader *hdr = &tb_cache_file_hdr;
+    size_t entries_size;
+    uint32_t i;
+    int fd;
+
+    if (!tb_cache_path) {
+        return;
+    }
+    if (tcg_splitwx_diff) {
+        warn_report("translation cache is not supported with split w^x");
+        g_clear_pointer(&tb_cache_path, g_free);
+        return;
+    }
+
+    memcpy(tb_cache_hdr.magic, TB_CACHE_MAGIC, sizeof(tb_cache_hdr.magic));
+    tb_cache_hdr.anchor = (uintptr_t)tb_gen_code;
+    tb_cache_hdr.buffer = (uintptr_t)buffer;
+    tb_cache_hdr.prologue_size = s->code_gen_buffer - buffer;
+    tb_cache_hdr.guest_base = guest_base;
+#ifdef CPUINFO_ALWAYS
+    tb_cache_hdr.host_cpuinfo = cpuinfo;
+#endif
+    tb_cache_hdr.cpu_model_crc = crc32c(0xffffffff, (const uint8_t *)cpu_model,
+                                        strlen(cpu_model));
+    tb_cache_image_end = s->code_gen_buffer;
+    tb_cache_region_end = s->code_gen_buffer + s->code_gen_buffer_size;
+
+    if (!tb_cache_file_valid ||
+        hdr->anchor != tb_cache_hdr.anchor ||
+        hdr->buffer != tb_cache_hdr.buffer ||
+        hdr->prologue_size != tb_cache_hdr.prologue_size ||
+        hdr->guest_base != tb_cache_hdr.guest_base ||
+        hdr->host_cpuinfo != tb_cache_hdr.host_cpuinfo ||
+        hdr->cpu_model_crc != tb_cache_hdr.cpu_model_crc ||
+        hdr->image_size <= hdr->prologue_size ||
+        buffer + hdr->image_size > tb_cache_region_end ||
+        !QEMU_IS_ALIGNED(hdr->image_offset, qemu_real_host_page_size())) {
+        return;
+    }
+
+    fd = tb_cache_open();
+    if (fd < 0) {
+        return;
+    }
+
+    entries_size = hdr->nr_entries * sizeof(TBCacheEntry);
+    tb_cache_entries = g_malloc(entries_size);
+    if (!tb_cache_read(fd, tb_cache_entries, entries_size, sizeof(*hdr)) ||
+        !tb_cache_map_image(fd, hdr)) {
+        g_clear_pointer(&tb_cache_entries, g_free);
+        close(fd);
+        return;
+    }
+    close(fd);
+
+    tb_cache_index = g_hash_table_new(tb_cache_entry_hash,
+                                      tb_cache_entry_equal);
+    for (i = 0; i < hdr->nr_entries; i++) {
+        TBCacheEntry *e = &tb_cache_entries[i];
+
+        if (e->tb_offset >= hdr->prologue_size &&
+            e->tb_offset + sizeof(TranslationBlock) <= hdr->image_size &&
+            QEMU_IS_ALIGNED(e->tb_offset, CODE_GEN_ALIGN)) {
+            g_hash_table_insert(tb_cache_index, e, e);
+        }
+    }
+
+    tb_cache_image_end = (void *)ROUND_UP((uintptr_t)buffer + hdr->image_size,
+                                          CODE_GEN_ALIGN);
+    qatomic_set(&s->code_gen_ptr, tb_cache_image_end);
+    trace_tb_cache_load(hdr->nr_entries, hdr->image_size);
+}
+
+/* Called when the guest address space changes; mmap_lock held */
+void tb_cache_maps_changed(void)
+{
+    tb_cache_maps_stale = true;
+}
+
+/*
+ * Return the file mapping that contains the @size bytes of guest code at
+ * @pc, and in @offset the file offset of @pc.
+ */
+static MapInfo *tb_cache_find_map(vaddr pc, uint32_t size, uint64_t *offset)
+{
+    uintptr_t host = (uintptr_t)g2h_untagged(pc);
+    IntervalTreeNode *n;
+    MapInfo *info;
+
+    if (!tb_cache_maps || tb_cache_maps_stale) {
+        if (tb_cache_maps) {
+            free_self_maps(tb_cache_maps);
+        }
+        tb_cache_maps = read_self_maps();
+        tb_cache_maps_stale = false;
+    }
+    if (!tb_cache_maps) {
+        return NULL;
+    }
+
+    n = interval_tree_iter_first(tb_cache_maps, host, host);
+    if (!n) {
+        return NULL;
+    }
+    info = container_of(n, MapInfo, itree);
+    if (!info->inode || host + size - 1 > n->last) {
+        return NULL;
+    }
+    *offset = info->offset + (host - n->start);
+    return info;
+}
+
+/* Called with mmap_lock held, on a miss in tb_ctx.htable */
+TranslationBlock *tb_cache_lookup(vaddr pc, uint64_t cs_base,
+                                  uint32_t flags, uint32_t cflags)
+{
+    TBCacheEntry key = {
+        .pc = pc, .cs_base = cs_base, .flags = flags, .cflags = cflags,
+    };
+    TranslationBlock *tb, *existing_tb;
+    TBCacheEntry *e;
+    MapInfo *info;
+    uint64_t offset;
+    int n;
+
+    assert_memory_lock();
+
+    if (!tb_cache_index) {
+        return NULL;
+    }
+    e = g_hash_table_lookup(tb_cache_index, &key);
+    if (!e) {
+        return NULL;
+    }
+    /* Whatever happens next, the cached TB is linked at most once */
+    g_hash_table_remove(tb_cache_index, e);
+
+    tb = tcg_splitwx_to_rw((const void *)tcg_qemu_tb_exec) + e->tb_offset;
+    if (tb_page_addr0(tb) != pc || tb->cs_base != cs_base ||
+        tb->flags != flags || tb->cflags != cflags || tb->size != e->size ||
+        (!(cflags & CF_PCREL) && tb->pc != pc)) {
+        return NULL;
+    }
+
+    info = tb_cache_find_map(pc, tb->size, &offset);
+    if (!info || info->dev != e->dev || info->inode != e->ino ||
+        offset != e->file_offset ||
+        !page_check_range(pc, tb->size, PAGE_EXEC)) {
+        trace_tb_cache_reject(pc);
+        return NULL;
+    }
+
+    /*
+     * Write-protect the code like translation does before checking it,
+     * so that a later write invalidates the TB.
+     */
+    tb_lock_page0(pc);
+    if (tb_page_addr1(tb) != -1) {
+        tb_lock_page1(pc, tb_page_addr1(tb));
+    }
+    if (crc32c(0xffffffff, g2h_untagged(pc), tb->size) != e->crc) {
+        trace_tb_cache_reject(pc);
+        return NULL;
+    }
+
+    /* Reset the state that refers to TBs of the writing process */
+    qemu_spin_init(&tb->jmp_lock);
+    tb->jmp_list_head = (uintptr_t)NULL;
+    for (n = 0; n < 2; n++) {
+        tb->jmp_list_next[n] = (uintptr_t)NULL;
+        tb->jmp_dest[n] = (uintptr_t)NULL;
+        if (tb->jmp_reset_offset[n] != TB_JMP_OFFSET_INVALID) {
+            tb_reset_jump(tb, n);
+        }
+    }
+    memset(&tb->itree.rb, 0, sizeof(tb->itree.rb));
+
+    trace_tb_cache_hit(pc, tb);
+    perf_report_code(pc, tb, tb->tc.ptr);
+
+    tcg_tb_insert(tb);
+    existing_tb = tb_link_page(tb);
+    if (unlikely(existing_tb != tb)) {
+        tcg_tb_remove(tb);
+        return existing_tb;
+    }
+    return tb;
+}
+
+/* Called from tb_flush(), which discards the cached code */
+void tb_cache_flush(void)
+{
+    if (!tb_cache_path) {
+        return;
+    }
+    g_clear_pointer(&tb_cache_index, g_hash_table_destroy);
+    g_clear_pointer(&tb_cache_entries, g_free);
+    tb_cache_image_end = (void *)tb_cache_hdr.buffer +
+                         tb_cache_hdr.prologue_size;
+}
+
+static gboolean tb_cache_save_tb(gpointer key, gpointer value, gpointer data)
+{
+    TranslationBlock *tb = value;
+    GArray *entries = data;
+    vaddr pc = tb_page_addr0(tb);
+    TBCacheEntry e = {
+        .pc = pc,
+        .cs_base = tb->cs_base,
+        .flags = tb->flags,
+        .cflags = tb_cflags(tb),
+        .tb_offset = (void *)tb - tcg_splitwx_to_rw((const void *)
+                                                    tcg_qemu_tb_exec),
+        .size = tb->size,
+    };
+    MapInfo *info;
+
+    if ((e.cflags & CF_INVALID) || tb->region != 0) {
+        return false;
+    }
+    /* Only code mapped from a file can be found again by the next process */
+    info = tb_cache_find_map(pc, tb->size, &e.file_offset);
+    if (!info || !page_check_range(pc, tb->size, PAGE_EXEC)) {
+        return false;
+    }
+    e.dev = info->dev;
+    e.ino = info->inode;
+    e.crc = crc32c(0xffffffff, g2h_untagged(pc), tb->size);
+    g_array_append_val(entries, e);
+    return false;
+}
+
+void tb_cache_save(void)
+{
+    TCGContext *s = tcg_ctx;
+    void *buffer = (void *)tb_cache_hdr.buffer;
+    void *end;
+    g_autoptr(GArray) entries = NULL;
+    g_autofree char *tmp = NULL;
+    TBCacheHeader hdr;
+    size_t entries_size;
+    bool ok;
+    int fd;
+
+    if (!tb_cache_path || !buffer) {
+        return;
+    }
+
+    mmap_lock();
+    end = qatomic_read(&s->code_gen_ptr);
+    if (end < buffer || end > tb_cache_region_end) {
+        /* Translation has moved on to another region */
+        end = tb_cache_region_end;
+    }
+
+    /*
+     * Rewriting the file costs about as much as the code it holds; skip it
+     * unless this process added a significant amount of code.
+     */
+    if (tb_cache_index &&
+        (end - tb_cache_image_end) * 8 < tb_cache_image_end - buffer) {
+        mmap_unlock();
+        return;
+    }
+
+    entries = g_array_new(false, false, sizeof(TBCacheEntry));
+    tb_cache_maps_stale = true;
+    tcg_tb_foreach(tb_cache_save_tb, entries);
+    if (!entries->len) {
+        mmap_unlock();
+        return;
+    }
+
+    hdr = tb_cache_hdr;
+    hdr.nr_entries = entries->len;
+    entries_size = entries->len * sizeof(TBCacheEntry);
+    hdr.image_offset = ROUND_UP(sizeof(hdr) + entries_size,
+                                qemu_real_host_page_size());
+    hdr.image_size = end - buffer;
+
+    /* Concurrent processes each write their own file, the last one wins */
+    tmp = g_strdup_printf("%s.XXXXXX", tb_cache_path);
+    fd = g_mkstemp_full(tmp, O_RDWR, 0600);
+    if (fd < 0) {
+        mmap_unlock();
+        return;
+    }
+    ok = tb_cache_write(fd, &hdr, sizeof(hdr), 0) &&
+         tb_cache_write(fd, entries->data, entries_size, sizeof(hdr)) &&
+         tb_cache_write(fd, buffer, hdr.image_size, hdr.image_offset);
+    mmap_unlock();
+
+    close(fd);
+    if (!ok || rename(tmp, tb_cache_path) < 0) {
+        warn_report("could not write translation cache %s", tb_cache_path);
+        unlink(tmp);
+        return;
+    }
+    trace_tb_cache_save(hdr.nr_entries, hdr.image_size);
+}
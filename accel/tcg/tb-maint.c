@@ -20,6 +20,7 @@
 #include "qemu/osdep.h"
 #include "qemu/interval-tree.h"
 #include "qemu/qtree.h"
+#include "qemu/bitmap.h"
 #include "exec/cputlb.h"
 #include "exec/log.h"
 #include "exec/exec-all.h"
@@ -56,11 +57,50 @@ static bool tb_cmp(const void *ap, const void *bp)
             tb_page_addr1(a) == tb_page_addr1(b));
 }
 
+/*
+ * Hashes of the TBs thrown away by a flush or an eviction, so that
+ * tb_link_page can tell how much code had to be translated again.
+ * Collisions make the resulting count approximate.
+ */
+#define TB_DISCARDED_BITS 20
+#define TB_DISCARDED_SIZE (1u << TB_DISCARDED_BITS)
+
+static unsigned long *tb_discarded;
+
 void tb_htable_init(void)
 {
     unsigned int mode = QHT_MODE_AUTO_RESIZE;
 
     qht_init(&tb_ctx.htable, tb_cmp, CODE_GEN_HTABLE_SIZE, mode);
+    tb_discarded = bitmap_new(TB_DISCARDED_SIZE);
+}
+
+static uint32_t tb_hash(const TranslationBlock *tb)
+{
+    uint32_t cflags = tb_cflags(tb) & ~CF_INVALID;
+
+    return tb_hash_func(tb_page_addr0(tb), (cflags & CF_PCREL ? 0 : tb->pc),
+                        tb->flags, tb->cs_base, cflags);
+}
+
+static void tb_mark_discarded(const TranslationBlock *tb)
+{
+    /* TBs that were never linked, or already invalidated, do not count */
+    if (tb_page_addr0(tb) != -1 && !(tb_cflags(tb) & CF_INVALID)) {
+        set_bit_atomic(tb_hash(tb) & (TB_DISCARDED_SIZE - 1), tb_discarded);
+    }
+}
+
+static void tb_count_retranslation(uint32_t h)
+{
+    unsigned long nr = h & (TB_DISCARDED_SIZE - 1);
+    unsigned long *p = &tb_discarded[BIT_WORD(nr)];
+    unsigned long mask = BIT_MASK(nr);
+
+    if (unlikely(qatomic_read(p) & mask) &&
+        (qatomic_fetch_and(p, ~mask) & mask)) {
+        qatomic_inc(&tb_ctx.tb_retranslate_count);
+    }
 }
 
 typedef struct PageDesc PageDesc;
@@ -183,8 +223,44 @@ struct PageDesc {
     QemuSpin lock;
     /* list of TBs intersecting this ram page */
     uintptr_t first_tb;
+    /* parts of the page holding translated code, see code_bitmap_range */
+    uint64_t code_bitmap;
 };
 
+/*
+ * Return the bits of PageDesc.code_bitmap covering [@start, @last],
+ * which must be within a single page.  Each bit stands for 1/64th of
+ * the page, i.e. a 64-byte cache line with 4 KiB pages.  The bitmap may
+ * have stale bits set, but never misses a line with translated code.
+ */
+static uint64_t code_bitmap_range(tb_page_addr_t start, tb_page_addr_t last)
+{
+    unsigned shift = TARGET_PAGE_BITS - 6;
+    unsigned first = (start & ~TARGET_PAGE_MASK) >> shift;
+    unsigned final = (last & ~TARGET_PAGE_MASK) >> shift;
+
+    return MAKE_64BIT_MASK(first, final - first + 1);
+}
+
+/* Return the range of page @n of @tb that the TB's code covers. */
+static void tb_page_range(const TranslationBlock *tb, unsigned int n,
+                          tb_page_addr_t *pstart, tb_page_addr_t *plast)
+{
+    tb_page_addr_t tb_start, tb_last;
+
+    /* NOTE: this is subtle as a TB may span two physical pages */
+    tb_start = tb_page_addr0(tb);
+    tb_last = tb_start + tb->size - 1;
+    if (n == 0) {
+        tb_last = MIN(tb_last, tb_start | ~TARGET_PAGE_MASK);
+    } else {
+        tb_start = tb_page_addr1(tb);
+        tb_last = tb_start + (tb_last & ~TARGET_PAGE_MASK);
+    }
+    *pstart = tb_start;
+    *plast = tb_last;
+}
+
 void page_table_config_init(void)
 {
     uint32_t v_l1_bits;
@@ -664,6 +740,7 @@ static void tb_remove_all_1(int level, void **lp)
         for (i = 0; i < V_L2_SIZE; ++i) {
             page_lock(&pd[i]);
             pd[i].first_tb = (uintptr_t)NULL;
+            pd[i].code_bitmap = 0;
             page_unlock(&pd[i]);
         }
     } else {
@@ -691,6 +768,7 @@ static void tb_remove_all(void)
 static void tb_page_add(PageDesc *p, TranslationBlock *tb, unsigned int n)
 {
     bool page_already_protected;
+    tb_page_addr_t start, last;
 
     assert_page_locked(p);
 
@@ -698,6 +776,9 @@ static void tb_page_add(PageDesc *p, TranslationBlock *tb, unsigned int n)
     page_already_protected = p->first_tb != 0;
     p->first_tb = (uintptr_t)tb | n;
 
+    tb_page_range(tb, n, &start, &last);
+    p->code_bitmap |= code_bitmap_range(start, last);
+
     /*
      * If some code is already present, then the pages are already
      * protected. So we handle the case where only the first TB is
@@ -733,6 +814,10 @@ static void tb_page_remove(PageDesc *pd, TranslationBlock *tb)
     PAGE_FOR_EACH_TB(unused, unused, pd, tb1, n1) {
         if (tb1 == tb) {
             *pprev = tb1->page_next[n1];
+            /* Other TBs may share the lines of @tb; keep its bits. */
+            if (!pd->first_tb) {
+                pd->code_bitmap = 0;
+            }
             return;
         }
         pprev = &tb1->page_next[n1];
@@ -755,6 +840,13 @@ static void tb_remove(TranslationBlock *tb)
 }
 #endif /* CONFIG_USER_ONLY */
 
+static gboolean tb_mark_discarded_iter(gpointer key, gpointer value,
+                                       gpointer data)
+{
+    tb_mark_discarded(value);
+    return false;
+}
+
 /* flush all the translation blocks */
 static void do_tb_flush(CPUState *cpu, run_on_cpu_data tb_flush_count)
 {
@@ -771,10 +863,13 @@ static void do_tb_flush(CPUState *cpu, run_on_cpu_data tb_flush_count)
         tcg_flush_jmp_cache(cpu);
     }
 
+    tcg_tb_foreach(tb_mark_discarded_iter, NULL);
     qht_reset_size(&tb_ctx.htable, CODE_GEN_HTABLE_SIZE);
     tb_remove_all();
 
     tcg_region_reset_all();
+    tb_cache_flush();
+    hot_trace_reset();
     /* XXX: flush processor icache at this point if cache flush is expensive */
     qatomic_inc(&tb_ctx.tb_flush_count);
 
@@ -902,7 +997,8 @@ static void tb_jmp_cache_inval_tb(TranslationBlock *tb)
  * In !user-mode, if @rm_from_page_list is set, call with the TB's pages'
  * locks held.
  */
-static void do_tb_phys_invalidate(TranslationBlock *tb, bool rm_from_page_list)
+static void do_tb_phys_invalidate(TranslationBlock *tb, bool rm_from_page_list,
+                                  bool inval_jmp_cache)
 {
     uint32_t h;
     tb_page_addr_t phys_pc;
@@ -929,7 +1025,9 @@ static void do_tb_phys_invalidate(TranslationBlock *tb, bool rm_from_page_list)
     }
 
     /* remove the TB from the hash list */
-    tb_jmp_cache_inval_tb(tb);
+    if (inval_jmp_cache) {
+        tb_jmp_cache_inval_tb(tb);
+    }
 
     /* suppress this TB from the two jump lists */
     tb_remove_from_jmp_list(tb, 0);
@@ -945,7 +1043,7 @@ static void do_tb_phys_invalidate(TranslationBlock *tb, bool rm_from_page_list)
 static void tb_phys_invalidate__locked(TranslationBlock *tb)
 {
     qemu_thread_jit_write();
-    do_tb_phys_invalidate(tb, true);
+    do_tb_phys_invalidate(tb, true, true);
     qemu_thread_jit_execute();
 }
 
@@ -957,10 +1055,78 @@ void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
 {
     if (page_addr == -1 && tb_page_addr0(tb) != -1) {
         tb_lock_pages(tb);
-        do_tb_phys_invalidate(tb, true);
+        do_tb_phys_invalidate(tb, true, true);
+        tb_unlock_pages(tb);
+    } else {
+        do_tb_phys_invalidate(tb, false, true);
+    }
+}
+
+static void tb_evict_one(gpointer data, gpointer user_data)
+{
+    TranslationBlock *tb = data;
+
+    tb_mark_discarded(tb);
+    /* The jump caches have been flushed by do_tb_evict. */
+    if (tb_page_addr0(tb) != -1) {
+        tb_lock_pages(tb);
+        do_tb_phys_invalidate(tb, true, false);
         tb_unlock_pages(tb);
     } else {
-        do_tb_phys_invalidate(tb, false);
+        do_tb_phys_invalidate(tb, false, false);
+    }
+    qatomic_inc(&tb_ctx.tb_evicted_count);
+}
+
+static unsigned tb_evict_generation(void)
+{
+    return qatomic_read(&tb_ctx.tb_flush_count) +
+           qatomic_read(&tb_ctx.tb_evict_count);
+}
+
+/* make room in code_gen_buffer by evicting a cold region */
+static void do_tb_evict(CPUState *cpu, run_on_cpu_data tb_evict_gen)
+{
+    CPUState *cs;
+    ssize_t victim;
+
+    mmap_lock();
+    /* If room has been made on request of another CPU, just retry. */
+    if (tb_evict_generation() != tb_evict_gen.host_int) {
+        mmap_unlock();
+        return;
+    }
+
+    CPU_FOREACH(cs) {
+        tcg_flush_jmp_cache(cs);
+    }
+
+    qemu_thread_jit_write();
+    victim = tcg_region_evict(tb_evict_one, NULL);
+    qemu_thread_jit_execute();
+
+    if (victim < 0) {
+        /* Every region is in use or hot: fall back to a full flush. */
+        do_tb_flush(cpu, RUN_ON_CPU_HOST_INT(tb_ctx.tb_flush_count));
+    } else {
+        /* Unlinked entries of the persistent TB cache live in region 0. */
+        if (victim == 0) {
+            tb_cache_flush();
+        }
+        hot_trace_reset();
+        qatomic_inc(&tb_ctx.tb_evict_count);
+    }
+    mmap_unlock();
+}
+
+void tb_evict(CPUState *cpu)
+{
+    unsigned gen = tb_evict_generation();
+
+    if (cpu_in_serial_context(cpu)) {
+        do_tb_evict(cpu, RUN_ON_CPU_HOST_INT(gen));
+    } else {
+        async_safe_run_on_cpu(cpu, do_tb_evict, RUN_ON_CPU_HOST_INT(gen));
     }
 }
 
@@ -995,6 +1161,8 @@ TranslationBlock *tb_link_page(TranslationBlock *tb)
         return existing_tb;
     }
 
+    tb_count_retranslation(h);
+
     tb_unlock_pages(tb);
     return tb;
 }
@@ -1102,6 +1270,7 @@ tb_invalidate_phys_page_range__locked(struct page_collection *pages,
 {
     TranslationBlock *tb;
     PageForEachNext n;
+    bool invalidated = false;
 #ifdef TARGET_HAS_PRECISE_SMC
     bool current_tb_modified = false;
     TranslationBlock *current_tb = retaddr ? tcg_tb_lookup(retaddr) : NULL;
@@ -1117,15 +1286,7 @@ tb_invalidate_phys_page_range__locked(struct page_collection *pages,
     PAGE_FOR_EACH_TB(start, last, p, tb, n) {
         tb_page_addr_t tb_start, tb_last;
 
-        /* NOTE: this is subtle as a TB may span two physical pages */
-        tb_start = tb_page_addr0(tb);
-        tb_last = tb_start + tb->size - 1;
-        if (n == 0) {
-            tb_last = MIN(tb_last, tb_start | ~TARGET_PAGE_MASK);
-        } else {
-            tb_start = tb_page_addr1(tb);
-            tb_last = tb_start + (tb_last & ~TARGET_PAGE_MASK);
-        }
+        tb_page_range(tb, n, &tb_start, &tb_last);
         if (!(tb_last < start || tb_start > last)) {
 #ifdef TARGET_HAS_PRECISE_SMC
             if (current_tb == tb &&
@@ -1142,6 +1303,18 @@ tb_invalidate_phys_page_range__locked(struct page_collection *pages,
             }
 #endif /* TARGET_HAS_PRECISE_SMC */
             tb_phys_invalidate__locked(tb);
+            invalidated = true;
+        }
+    }
+
+    /* Drop the bits of the lines that no longer hold any code. */
+    if (invalidated) {
+        p->code_bitmap = 0;
+        PAGE_FOR_EACH_TB(start, last, p, tb, n) {
+            tb_page_addr_t tb_start, tb_last;
+
+            tb_page_range(tb, n, &tb_start, &tb_last);
+            p->code_bitmap |= code_bitmap_range(tb_start, tb_last);
         }
     }
 
@@ -1221,6 +1394,27 @@ void tb_invalidate_phys_range_fast(ram_addr_t ram_addr,
                                    uintptr_t retaddr)
 {
     struct page_collection *pages;
+    PageDesc *p;
+    uint64_t code;
+
+    p = page_find(ram_addr >> TARGET_PAGE_BITS);
+    if (!p) {
+        return;
+    }
+
+    /*
+     * Most writes to a page with code, e.g. by a guest JIT that keeps
+     * data next to its code, do not touch translated bytes.  Check the
+     * code bitmap before locking the page collection and walking the
+     * page's TBs.  The page lock orders this against tb_link_page.
+     */
+    page_lock(p);
+    code = p->code_bitmap & code_bitmap_range(ram_addr, ram_addr + size - 1);
+    page_unlock(p);
+    if (!code) {
+        qatomic_set(&tb_ctx.tb_smc_skip_count, tb_ctx.tb_smc_skip_count + 1);
+        return;
+    }
 
     pages = page_collection_lock(ram_addr, ram_addr + size - 1);
     tb_invalidate_phys_page_fast__locked(pages, ram_addr, size, retaddr);
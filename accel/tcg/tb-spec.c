@@ -0,0 +1,232 @@
+/*
+ * Speculative translation for linux-user
+ *
+ * Each vCPU thread translates the code it is about to run inline, in
+ * tb_gen_code(), and waits for the result.  With speculative translation,
+ * the destinations of the direct jumps out of every new TranslationBlock
+ * are queued to a background thread, which translates them and publishes
+ * them in tb_ctx.htable.  When the vCPU leaves the TB through one of
+ * those jumps, tb_lookup() usually finds the destination already there
+ * and chains to it.
+ *
+ * The destination is translated with the flags of the TB it was found
+ * in, while the vCPU that queued it keeps running.  Only targets whose
+ * translator reads nothing else of the vCPU state than fields fixed at
+ * realize set TranslatorOps.spec_translate, so the translation does not
+ * race with the vCPU; if the flags differ by the time the vCPU gets
+ * there, the speculative TB is simply not used.  The most recent
+ * requests are served first, the oldest ones are dropped when the queue
+ * is full, and speculation stops TB_SPEC_MAX_DEPTH jumps away from code
+ * that a vCPU translated, so that the thread does not run away from the
+ * guest.
+ *
+ * Translation is still serialized by mmap_lock.  The background thread
+ * must never leave through cpu_loop_exit(), which would longjmp into a
+ * vCPU's execution loop.  So it only translates code whose page and the
+ * following one are executable, and it gives up instead of evicting
+ * when the code buffer is full.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/rcu.h"
+#include "qemu/thread.h"
+#include "exec/exec-all.h"
+#include "exec/page-protection.h"
+#include "exec/translation-block.h"
+#include "tcg/startup.h"
+#include "user/tb-spec.h"
+#include "internal-common.h"
+#include "internal-target.h"
+#include "trace.h"
+
+#define TB_SPEC_QUEUE_SIZE  64
+#define TB_SPEC_MAX_DEPTH   2
+
+typedef struct TBSpecRequest {
+    CPUState *cpu;
+    vaddr pc;
+    uint64_t cs_base;
+    uint32_t flags;
+    uint32_t cflags;
+    int depth;
+} TBSpecRequest;
+
+static struct {
+    QemuMutex lock;
+    QemuCond work;          /* a request was queued */
+    QemuCond idle;          /* the request for @busy is done */
+    QemuThread thread;
+    TBSpecRequest queue[TB_SPEC_QUEUE_SIZE];
+    unsigned head;
+    unsigned count;
+    CPUState *busy;         /* vCPU of the request being translated */
+    bool enabled;
+    bool started;
+} tb_spec;
+
+/* Depth of the request being translated by this thread; 0 for vCPUs. */
+static __thread int tb_spec_depth;
+
+static TBSpecRequest *tb_spec_entry(unsigned i)
+{
+    return &tb_spec.queue[(tb_spec.head + i) % TB_SPEC_QUEUE_SIZE];
+}
+
+static void tb_spec_translate(const TBSpecRequest *r)
+{
+    TranslationBlock *tb = NULL;
+
+    tb_spec_depth = r->depth;
+
+    mmap_lock();
+    /*
+     * The TB may span two pages.  If either is not executable, translating
+     * would deliver SIGSEGV; leave that to the vCPU.
+     */
+    if (!page_check_range(r->pc & TARGET_PAGE_MASK, 2 * TARGET_PAGE_SIZE,
+                          PAGE_EXEC)) {
+        mmap_unlock();
+        return;
+    }
+
+    WITH_RCU_READ_LOCK_GUARD() {
+        tb = tb_htable_lookup(r->cpu, r->pc, r->cs_base, r->flags, r->cflags);
+    }
+    if (!tb) {
+        tb = tb_gen_code_speculative(r->cpu, r->pc, r->cs_base,
+                                     r->flags, r->cflags);
+        trace_tb_spec_translate(r->pc, r->depth, tb);
+    }
+    mmap_unlock();
+}
+
+static void *tb_spec_thread(void *arg)
+{
+    rcu_register_thread();
+    tcg_register_thread();
+
+    qemu_mutex_lock(&tb_spec.lock);
+    while (true) {
+        TBSpecRequest r;
+
+        while (tb_spec.count == 0) {
+            qemu_cond_wait(&tb_spec.work, &tb_spec.lock);
+        }
+        r = *tb_spec_entry(--tb_spec.count);
+        tb_spec.busy = r.cpu;
+        qemu_mutex_unlock(&tb_spec.lock);
+
+        tb_spec_translate(&r);
+
+        qemu_mutex_lock(&tb_spec.lock);
+        tb_spec.busy = NULL;
+        qemu_cond_broadcast(&tb_spec.idle);
+    }
+    return NULL;
+}
+
+/* Called with mmap_lock held, at the end of the translation of @tb. */
+void tb_spec_queue(CPUState *cpu, const TranslationBlock *tb,
+                   const vaddr *dest, int n)
+{
+    uint32_t cflags = tb_cflags(tb);
+    int depth = tb_spec_depth + 1;
+    int i;
+
+    if (!tb_spec.enabled || n == 0 || depth > TB_SPEC_MAX_DEPTH ||
+        tb_page_addr0(tb) == -1 ||
+        (cflags & (CF_COUNT_MASK | CF_NO_GOTO_TB | CF_SINGLE_STEP |
+                   CF_MEMI_ONLY | CF_NOIRQ | CF_BP_PAGE))) {
+        return;
+    }
+
+    qemu_mutex_lock(&tb_spec.lock);
+    if (!tb_spec.started) {
+        tb_spec.started = true;
+        qemu_thread_create(&tb_spec.thread, "tb-spec", tb_spec_thread,
+                           NULL, QEMU_THREAD_DETACHED);
+    }
+    for (i = 0; i < n; i++) {
+        TBSpecRequest *r;
+
+        if (tb_spec.count == TB_SPEC_QUEUE_SIZE) {
+            /* Drop the oldest request.  */
+            tb_spec.head = (tb_spec.head + 1) % TB_SPEC_QUEUE_SIZE;
+            tb_spec.count--;
+        }
+        r = tb_spec_entry(tb_spec.count++);
+        r->cpu = cpu;
+        r->pc = dest[i];
+        r->cs_base = tb->cs_base;
+        r->flags = tb->flags;
+        r->cflags = cflags;
+        r->depth = depth;
+        trace_tb_spec_queue(dest[i], depth);
+    }
+    qemu_cond_signal(&tb_spec.work);
+    qemu_mutex_unlock(&tb_spec.lock);
+}
+
+/*
+ * Called before @cpu goes away: drop its requests and wait until
+ * the background thread is done with it.
+ */
+void tb_spec_cpu_unrealize(CPUState *cpu)
+{
+    unsigned i, j;
+
+    if (!tb_spec.enabled) {
+        return;
+    }
+
+    qemu_mutex_lock(&tb_spec.lock);
+    for (i = j = 0; i < tb_spec.count; i++) {
+        TBSpecRequest *r = tb_spec_entry(i);
+
+        if (r->cpu != cpu) {
+            *tb_spec_entry(j++) = *r;
+        }
+    }
+    tb_spec.count = j;
+    while (tb_spec.busy == cpu) {
+        qemu_cond_wait(&tb_spec.idle, &tb_spec.lock);
+    }
+    qemu_mutex_unlock(&tb_spec.lock);
+}
+
+void tb_spec_enable(void)
+{
+    qemu_mutex_init(&tb_spec.lock);
+    qemu_cond_init(&tb_spec.work);
+    qemu_cond_init(&tb_spec.idle);
+    tb_spec.enabled = true;
+}
+
+void tb_spec_fork_start(void)
+{
+    if (tb_spec.enabled) {
+        qemu_mutex_lock(&tb_spec.lock);
+    }
+}
+
+void tb_spec_fork_end(bool child)
+{
+    if (!tb_spec.enabled) {
+        return;
+    }
+    if (child) {
+        /*
+         * The thread and the vCPUs of the requests are gone.  The thread
+         * may have been waiting on the conditions, so start them afresh.
+         */
+        qemu_cond_init(&tb_spec.work);
+        qemu_cond_init(&tb_spec.idle);
+        tb_spec.head = 0;
+        tb_spec.count = 0;
+        tb_spec.busy = NULL;
+        tb_spec.started = false;
+    }
+    qemu_mutex_unlock(&tb_spec.lock);
+}
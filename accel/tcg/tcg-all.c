@@ -47,6 +47,7 @@ struct TCGState {
     bool one_insn_per_tb;
     int splitwx_enabled;
     unsigned long tb_size;
+    uint32_t hot_trace_threshold;
 };
 typedef struct TCGState TCGState;
 
@@ -99,6 +100,7 @@ static void tcg_accel_instance_init(Object *obj)
 
 bool mttcg_enabled;
 bool one_insn_per_tb;
+uint32_t hot_trace_threshold;
 
 static int tcg_init_machine(MachineState *ms)
 {
@@ -111,6 +113,7 @@ static int tcg_init_machine(MachineState *ms)
 
     tcg_allowed = true;
     mttcg_enabled = s->mttcg_enabled;
+    hot_trace_threshold = s->hot_trace_threshold;
 
     page_init();
     tb_htable_init();
@@ -181,6 +184,30 @@ static void tcg_set_tb_size(Object *obj, Visitor *v,
     s->tb_size = value;
 }
 
+static void tcg_get_hot_trace_threshold(Object *obj, Visitor *v,
+                                        const char *name, void *opaque,
+                                        Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value = s->hot_trace_threshold;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void tcg_set_hot_trace_threshold(Object *obj, Visitor *v,
+                                        const char *name, void *opaque,
+                                        Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+
+    s->hot_trace_threshold = value;
+}
+
 static bool tcg_get_splitwx(Object *obj, Error **errp)
 {
     TCGState *s = TCG_STATE(obj);
@@ -242,6 +269,12 @@ static void tcg_accel_class_init(ObjectClass *oc, void *data)
     object_class_property_set_description(oc, "tb-size",
         "TCG translation block cache size");
 
+    object_class_property_add(oc, "hot-trace-threshold", "int",
+        tcg_get_hot_trace_threshold, tcg_set_hot_trace_threshold,
+        NULL, NULL);
+    object_class_property_set_description(oc, "hot-trace-threshold",
+        "Executions after which a TB is retranslated as a trace (0: never)");
+
     object_class_property_add_bool(oc, "split-wx",
         tcg_get_splitwx, tcg_set_splitwx);
     object_class_property_set_description(oc, "split-wx",
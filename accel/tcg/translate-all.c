@@ -283,10 +283,15 @@ static int setjmp_gen_code(CPUArchState *env, TranslationBlock *tb,
     return tcg_gen_code(tcg_ctx, tb, pc);
 }
 
-/* Called with mmap_lock held for user mode emulation.  */
-TranslationBlock *tb_gen_code(CPUState *cpu,
-                              vaddr pc, uint64_t cs_base,
-                              uint32_t flags, int cflags)
+/*
+ * Called with mmap_lock held for user mode emulation.
+ * If @speculative, return NULL instead of leaving through cpu_loop_exit()
+ * when the code buffer is full; the caller does not run on @cpu's thread.
+ */
+static TranslationBlock *do_tb_gen_code(CPUState *cpu,
+                                        vaddr pc, uint64_t cs_base,
+                                        uint32_t flags, int cflags,
+                                        bool speculative)
 {
     CPUArchState *env = cpu_env(cpu);
     TranslationBlock *tb, *existing_tb;
@@ -304,6 +309,11 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     if (phys_pc == -1) {
         /* Generate a one-shot TB with 1 insn in it */
         cflags = (cflags & ~CF_COUNT_MASK) | 1;
+    } else {
+        tb = tb_cache_lookup(pc, cs_base, flags, cflags);
+        if (tb) {
+            return tb;
+        }
     }
 
     max_insns = cflags & CF_COUNT_MASK;
@@ -316,10 +326,14 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     assert_no_pages_locked();
     tb = tcg_tb_alloc(tcg_ctx);
     if (unlikely(!tb)) {
-        /* flush must be done */
-        tb_flush(cpu);
+        if (speculative) {
+            /* leave the eviction to the next vCPU that needs the space */
+            return NULL;
+        }
+        /* evict a cold region, or flush if there is none */
+        tb_evict(cpu);
         mmap_unlock();
-        /* Make the execution loop process the flush as soon as possible.  */
+        /* Make the execution loop process the eviction as soon as possible.  */
         cpu->exception_index = EXCP_INTERRUPT;
         cpu_loop_exit(cpu);
     }
@@ -563,6 +577,27 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     return tb;
 }
 
+TranslationBlock *tb_gen_code(CPUState *cpu,
+                              vaddr pc, uint64_t cs_base,
+                              uint32_t flags, int cflags)
+{
+    return do_tb_gen_code(cpu, pc, cs_base, flags, cflags, false);
+}
+
+#ifdef CONFIG_USER_ONLY
+/*
+ * Called with mmap_lock held, by a thread other than @cpu's.  The caller
+ * has checked that the code at @pc is executable, so translation does
+ * not fault.  Return NULL if the code buffer is full.
+ */
+TranslationBlock *tb_gen_code_speculative(CPUState *cpu,
+                                          vaddr pc, uint64_t cs_base,
+                                          uint32_t flags, int cflags)
+{
+    return do_tb_gen_code(cpu, pc, cs_base, flags, cflags, true);
+}
+#endif
+
 /* user-mode: call with mmap_lock held */
 void tb_check_watchpoint(CPUState *cpu, uintptr_t retaddr)
 {
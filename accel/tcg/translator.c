@@ -15,7 +15,10 @@
 #include "exec/cpu_ldst.h"
 #include "exec/plugin-gen.h"
 #include "exec/cpu_ldst.h"
+#include "exec/helper-proto-common.h"
 #include "tcg/tcg-op-common.h"
+#include "tb-hash.h"
+#include "internal-common.h"
 #include "internal-target.h"
 #include "disas/disas.h"
 
@@ -102,6 +105,81 @@ static void gen_tb_end(const TranslationBlock *tb, uint32_t cflags,
     }
 }
 
+/*
+ * Hot traces.  When the target supports them and hot_trace_threshold is
+ * set, every TB counts its executions in hot_trace_counters, indexed by
+ * a hash of the TB.  Once the count reaches the threshold, the TB is
+ * invalidated, and the next lookup retranslates it as a trace: a
+ * superblock that continues through forward jumps and branches (see
+ * translator_trace_jump), with a side exit at each branch.  This lets
+ * the optimizer and the register allocator see the whole path, and
+ * removes the chaining between its blocks.
+ *
+ * The counters are not updated atomically; losing a few increments to
+ * a race only delays the retranslation.  The array is static so that
+ * its address is the same in every process, see tb-cache.c.
+ */
+#define HOT_TRACE_BITS 16
+
+static uint32_t hot_trace_counters[1 << HOT_TRACE_BITS];
+
+void HELPER(hot_trace)(void *ptr)
+{
+    TranslationBlock *tb = ptr;
+
+    mmap_lock();
+    tb_phys_invalidate(tb, -1);
+    mmap_unlock();
+}
+
+static uint32_t *hot_trace_counter(DisasContextBase *db,
+                                   const TranslatorOps *ops)
+{
+    TranslationBlock *tb = db->tb;
+    uint32_t cflags = tb_cflags(tb);
+    uint32_t h;
+
+    if (!ops->hot_traces || !hot_trace_threshold ||
+        db->max_insns == 1 || tb_page_addr0(tb) == -1 ||
+        (cflags & (CF_NO_GOTO_TB | CF_SINGLE_STEP | CF_BP_PAGE))) {
+        return NULL;
+    }
+    h = tb_hash_func(tb_page_addr0(tb), db->pc_first,
+                     tb->flags, tb->cs_base, cflags);
+    return &hot_trace_counters[h & ((1 << HOT_TRACE_BITS) - 1)];
+}
+
+/*
+ * Called when TBs are thrown away by a flush or an eviction, so that
+ * the code they are retranslated to starts counting from zero again.
+ * The counters are hashed, so this also forgets the counts of the TBs
+ * that survive an eviction; they only need to warm up again.
+ */
+void hot_trace_reset(void)
+{
+    memset(hot_trace_counters, 0, sizeof(hot_trace_counters));
+}
+
+static void gen_hot_trace_count(DisasContextBase *db, uint32_t *counter)
+{
+    TCGv_ptr ptr = tcg_constant_ptr(counter);
+    TCGv_i32 count = tcg_temp_new_i32();
+    TCGLabel *cold = gen_new_label();
+
+    tcg_gen_ld_i32(count, ptr, 0);
+    tcg_gen_addi_i32(count, count, 1);
+    tcg_gen_st_i32(count, ptr, 0);
+    tcg_gen_brcondi_i32(TCG_COND_LTU, count, hot_trace_threshold, cold);
+    gen_helper_hot_trace(tcg_constant_ptr(db->tb));
+    gen_set_label(cold);
+}
+
+bool translator_trace_jump(DisasContextBase *db, vaddr dest)
+{
+    return db->trace && dest > db->pc_next && is_same_page(db, dest) &&
+           db->num_insns < db->max_insns && !tcg_op_buf_full();
+}
+
 bool translator_use_goto_tb(DisasContextBase *db, vaddr dest)
 {
     /* Suppress goto_tb if requested. */
@@ -113,6 +191,20 @@ bool translator_use_goto_tb(DisasContextBase *db, vaddr dest)
     return ((db->pc_first ^ dest) & TARGET_PAGE_MASK) == 0;
 }
 
+void translator_add_jump_dest(DisasContextBase *db, vaddr dest)
+{
+    int i;
+
+    for (i = 0; i < db->nb_jump_dest; i++) {
+        if (db->jump_dest[i] == dest) {
+            return;
+        }
+    }
+    if (db->nb_jump_dest < ARRAY_SIZE(db->jump_dest)) {
+        db->jump_dest[db->nb_jump_dest++] = dest;
+    }
+}
+
 void translator_loop(CPUState *cpu, TranslationBlock *tb, int *max_insns,
                      vaddr pc, void *host_pc, const TranslatorOps *ops,
                      DisasContextBase *db)
@@ -120,6 +212,7 @@ void translator_loop(CPUState *cpu, TranslationBlock *tb, int *max_insns,
     uint32_t cflags = tb_cflags(tb);
     TCGOp *icount_start_insn;
     TCGOp *first_insn_start = NULL;
+    uint32_t *hot_counter;
     bool plugin_enabled;
 
     /* Initialize DisasContext */
@@ -136,12 +229,20 @@ void translator_loop(CPUState *cpu, TranslationBlock *tb, int *max_insns,
     db->host_addr[1] = NULL;
     db->record_start = 0;
     db->record_len = 0;
+    db->nb_jump_dest = 0;
+
+    hot_counter = hot_trace_counter(db, ops);
+    db->trace = hot_counter &&
+                qatomic_read(hot_counter) >= hot_trace_threshold;
 
     ops->init_disas_context(db, cpu);
     tcg_debug_assert(db->is_jmp == DISAS_NEXT);  /* no early exit */
 
     /* Start translating.  */
     icount_start_insn = gen_tb_start(db, cflags);
+    if (hot_counter && !db->trace) {
+        gen_hot_trace_count(db, hot_counter);
+    }
     ops->tb_start(db, cpu);
     tcg_debug_assert(db->is_jmp == DISAS_NEXT);  /* no early exit */
 
@@ -195,10 +296,19 @@ void translator_loop(CPUState *cpu, TranslationBlock *tb, int *max_insns,
         }
     }
 
+    /* A TB that ends on its own falls through to the next insn.  */
+    if (db->is_jmp == DISAS_TOO_MANY) {
+        translator_add_jump_dest(db, db->pc_next);
+    }
+
     /* Emit code to exit the TB, as indicated by db->is_jmp.  */
     ops->tb_stop(db, cpu);
     gen_tb_end(tb, cflags, icount_start_insn, db->num_insns);
 
+    if (ops->spec_translate) {
+        tb_spec_queue(cpu, tb, db->jump_dest, db->nb_jump_dest);
+    }
+
     /*
      * Manage can_do_io for the translation block: set to false before
      * the first insn and set to true before the last insn.
@@ -520,6 +520,7 @@ void page_set_flags(target_ulong start, target_ulong last, int flags)
     if (!flags || reset) {
         page_reset_target_data(start, last);
         inval_tb |= pageflags_unset(start, last);
+        tb_cache_maps_changed();
     }
     if (flags) {
         inval_tb |= pageflags_set_clear(start, last, flags,
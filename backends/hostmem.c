@@ -17,6 +17,7 @@
 #include "qapi/qapi-builtin-visit.h"
 #include "qapi/visitor.h"
 #include "qemu/config-file.h"
+#include "qemu/error-report.h"
 #include "qom/object_interfaces.h"
 #include "qemu/mmap-alloc.h"
 #include "qemu/madvise.h"
@@ -256,6 +257,41 @@ static void host_memory_backend_set_prealloc(Object *obj, bool value,
     }
 }
 
+static bool host_memory_backend_get_prealloc_background(Object *obj,
+                                                       Error **errp)
+{
+    HostMemoryBackend *backend = MEMORY_BACKEND(obj);
+
+    return backend->prealloc_background;
+}
+
+static void host_memory_backend_set_prealloc_background(Object *obj,
+                                                        bool value,
+                                                        Error **errp)
+{
+    HostMemoryBackend *backend = MEMORY_BACKEND(obj);
+
+    if (host_memory_backend_mr_inited(backend)) {
+        error_setg(errp, "cannot change property value");
+        return;
+    }
+    backend->prealloc_background = value;
+}
+
+static void host_memory_backend_get_prealloc_populated(Object *obj,
+    Visitor *v, const char *name, void *opaque, Error **errp)
+{
+    HostMemoryBackend *backend = MEMORY_BACKEND(obj);
+    uint64_t value = 0;
+
+    if (backend->prealloc_job) {
+        value = qemu_prealloc_job_get_progress(backend->prealloc_job, NULL);
+    } else if (backend->prealloc && host_memory_backend_mr_inited(backend)) {
+        value = memory_region_size(&backend->mr);
+    }
+    visit_type_size(v, name, &value, errp);
+}
+
 static void host_memory_backend_get_prealloc_threads(Object *obj, Visitor *v,
     const char *name, void *opaque, Error **errp)
 {
@@ -329,6 +365,18 @@ size_t host_memory_backend_pagesize(HostMemoryBackend *memdev)
     return pagesize;
 }
 
+/* Called from the last background preallocation thread to exit. */
+static void host_memory_backend_prealloc_done(void *opaque, int ret)
+{
+    HostMemoryBackend *backend = opaque;
+
+    if (ret) {
+        error_report("%s: background preallocation failed: %s",
+                     memory_region_name(&backend->mr), strerror(-ret));
+    }
+    ram_block_discard_disable(false);
+}
+
 static void
 host_memory_backend_memory_complete(UserCreatable *uc, Error **errp)
 {
@@ -422,15 +470,57 @@ host_memory_backend_memory_complete(UserCreatable *uc, Error **errp)
      * This is necessary to guarantee memory is allocated with
      * specified NUMA policy in place.
      */
-    if (backend->prealloc && !qemu_prealloc_mem(memory_region_get_fd(&backend->mr),
-                                                ptr, sz,
-                                                backend->prealloc_threads,
-                                                backend->prealloc_context,
-                                                async, errp)) {
+    if (backend->prealloc && backend->prealloc_background) {
+        /*
+         * Let the machine start while the memory is being preallocated;
+         * whatever the guest touches first is faulted in on demand.
+         * Discarding memory behind the threads' back would just fault it
+         * in again, so RAM discards stay disabled until they are done.
+         */
+        if (ram_block_discard_disable(true)) {
+            error_setg(errp, "prealloc-background cannot be used while RAM"
+                       " discards are required");
+            return;
+        }
+        if (!qemu_prealloc_mem_background(memory_region_get_fd(&backend->mr),
+                                          ptr, sz, backend->prealloc_threads,
+                                          backend->prealloc_context,
+                                          host_memory_backend_prealloc_done,
+                                          backend, &backend->prealloc_job,
+                                          errp)) {
+            ram_block_discard_disable(false);
+            return;
+        }
+        if (!backend->prealloc_job) {
+            ram_block_discard_disable(false);
+        }
+    } else if (backend->prealloc &&
+               !qemu_prealloc_mem(memory_region_get_fd(&backend->mr),
+                                  ptr, sz, backend->prealloc_threads,
+                                  backend->prealloc_context, async, errp)) {
         return;
     }
 }
 
+/*
+ * Stop any background preallocation; the memory goes away with the
+ * backend's children, so this must be called when the backend is unparented.
+ * Incoming migration also calls it before it lets userfaultfd fill the
+ * memory, see ram_block_cancel_prealloc().
+ */
+void host_memory_backend_cancel_prealloc(HostMemoryBackend *backend)
+{
+    if (backend->prealloc_job) {
+        qemu_prealloc_job_finish(backend->prealloc_job, true, NULL);
+        backend->prealloc_job = NULL;
+    }
+}
+
+static void host_memory_backend_unparent(Object *obj)
+{
+    host_memory_backend_cancel_prealloc(MEMORY_BACKEND(obj));
+}
+
 static bool
 host_memory_backend_can_be_deleted(UserCreatable *uc)
 {
@@ -507,6 +597,7 @@ host_memory_backend_class_init(ObjectClass *oc, void *data)
 
     ucc->complete = host_memory_backend_memory_complete;
     ucc->can_be_deleted = host_memory_backend_can_be_deleted;
+    oc->unparent = host_memory_backend_unparent;
 
     object_class_property_add_bool(oc, "merge",
         host_memory_backend_get_merge,
@@ -534,6 +625,16 @@ host_memory_backend_class_init(ObjectClass *oc, void *data)
         object_property_allow_set_link, OBJ_PROP_LINK_STRONG);
     object_class_property_set_description(oc, "prealloc-context",
         "Context to use for creating CPU threads for preallocation");
+    object_class_property_add_bool(oc, "prealloc-background",
+        host_memory_backend_get_prealloc_background,
+        host_memory_backend_set_prealloc_background);
+    object_class_property_set_description(oc, "prealloc-background",
+        "Keep preallocating in the background after the machine starts");
+    object_class_property_add(oc, "prealloc-populated", "size",
+        host_memory_backend_get_prealloc_populated,
+        NULL, NULL, NULL);
+    object_class_property_set_description(oc, "prealloc-populated",
+        "Amount of memory preallocated so far");
     object_class_property_add(oc, "size", "int",
         host_memory_backend_get_size,
         host_memory_backend_set_size,
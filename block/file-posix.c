@@ -32,6 +32,9 @@
 #include "qemu/option.h"
 #include "qemu/units.h"
 #include "qemu/memalign.h"
+#include "qemu/lockable.h"
+#include "qemu/rcu_queue.h"
+#include "exec/memory.h" /* for ram_block_discard_disable() */
 #include "trace.h"
 #include "block/thread-pool.h"
 #include "qemu/iov.h"
@@ -134,6 +137,17 @@
 #define RAW_LOCK_PERM_BASE             100
 #define RAW_LOCK_SHARED_BASE           200
 
+/*
+ * With io-uring-fixed, the io_uring rings of an AioContext that the file and
+ * the memory registered with raw_register_buf() are registered with.
+ */
+typedef struct RawIoUringRings {
+    AioContext *ctx;            /* referenced while registered */
+    LuringState *ring;
+    LuringState *iopoll_ring;   /* NULL if io-uring-iopoll was off */
+    QSLIST_ENTRY(RawIoUringRings) next;
+} RawIoUringRings;
+
 typedef struct BDRVRawState {
     int fd;
     bool use_lock;
@@ -161,6 +175,9 @@ typedef struct BDRVRawState {
     bool use_linux_aio:1;
     bool has_laio_fdsync:1;
     bool use_linux_io_uring:1;
+    bool use_io_uring_fixed:1;
+    /* Cleared from any thread if polling does not work, not a bitfield */
+    bool use_io_uring_iopoll;
     int page_cache_inconsistent; /* errno from fdatasync failure */
     bool has_fallocate;
     bool needs_alignment;
@@ -174,6 +191,16 @@ typedef struct BDRVRawState {
     } stats;
 
     PRManager *pr_mgr;
+
+    /*
+     * With io-uring-fixed, the memory registered with raw_register_buf()
+     * and the rings that it and the file are registered with.  Rings are
+     * added the first time the node submits from their AioContext and
+     * only removed on close, so they can be looked up without the lock.
+     */
+    QemuMutex io_uring_lock;
+    GHashTable *io_uring_bufs;  /* host -> size */
+    QSLIST_HEAD(, RawIoUringRings) io_uring_rings;
 } BDRVRawState;
 
 typedef struct BDRVRawReopenState {
@@ -561,6 +588,18 @@ static QemuOptsList raw_runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "AIO max batch size (0 = auto handled by AIO backend, default: 0)",
         },
+#ifdef CONFIG_LINUX_IO_URING
+        {
+            .name = "io-uring-fixed",
+            .type = QEMU_OPT_BOOL,
+            .help = "register the file and guest RAM with io_uring (default: off)",
+        },
+        {
+            .name = "io-uring-iopoll",
+            .type = QEMU_OPT_BOOL,
+            .help = "poll for io_uring completions (default: off)",
+        },
+#endif
         {
             .name = "locking",
             .type = QEMU_OPT_STRING,
@@ -638,6 +677,18 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
     s->use_linux_aio = (aio == BLOCKDEV_AIO_OPTIONS_NATIVE);
 #ifdef CONFIG_LINUX_IO_URING
     s->use_linux_io_uring = (aio == BLOCKDEV_AIO_OPTIONS_IO_URING);
+    s->use_io_uring_fixed = qemu_opt_get_bool(opts, "io-uring-fixed", false);
+    if (s->use_io_uring_fixed && !s->use_linux_io_uring) {
+        error_setg(errp, "io-uring-fixed requires aio=io_uring");
+        ret = -EINVAL;
+        goto fail;
+    }
+    s->use_io_uring_iopoll = qemu_opt_get_bool(opts, "io-uring-iopoll", false);
+    if (s->use_io_uring_iopoll && !s->use_linux_io_uring) {
+        error_setg(errp, "io-uring-iopoll requires aio=io_uring");
+        ret = -EINVAL;
+        goto fail;
+    }
 #endif
 
     s->aio_max_batch = qemu_opt_get_number(opts, "aio-max-batch", 0);
@@ -731,7 +782,15 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
     }
 #endif /* !defined(CONFIG_LINUX_AIO) */
 
-#ifndef CONFIG_LINUX_IO_URING
+#ifdef CONFIG_LINUX_IO_URING
+    /* Polled I/O bypasses the page cache, like Linux AIO */
+    if (s->use_io_uring_iopoll && !(s->open_flags & O_DIRECT)) {
+        error_setg(errp, "io-uring-iopoll requires cache.direct=on, which "
+                         "was not specified.");
+        ret = -EINVAL;
+        goto fail;
+    }
+#else
     if (s->use_linux_io_uring) {
         error_setg(errp, "aio=io_uring was specified, but is not supported "
                          "in this build.");
@@ -809,6 +868,14 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
         /* When extending regular files, we get zeros from the OS */
         bs->supported_truncate_flags = BDRV_REQ_ZERO_WRITE;
     }
+
+#ifdef CONFIG_LINUX_IO_URING
+    if (s->use_io_uring_fixed) {
+        qemu_mutex_init(&s->io_uring_lock);
+        s->io_uring_bufs = g_hash_table_new(NULL, NULL);
+    }
+#endif
+
     ret = 0;
 fail:
     if (ret < 0 && s->fd != -1) {
@@ -2451,8 +2518,99 @@ static inline bool raw_check_linux_io_uring(BDRVRawState *s)
         s->use_linux_io_uring = false;
         return false;
     }
+
+    if (qatomic_read(&s->use_io_uring_iopoll) &&
+        unlikely(!aio_setup_linux_io_uring_iopoll(ctx, &local_err))) {
+        error_reportf_err(local_err, "Unable to use polled io_uring "
+                                     "completions, falling back to "
+                                     "interrupts: ");
+        qatomic_set(&s->use_io_uring_iopoll, false);
+    }
     return true;
 }
+
+static void raw_io_uring_fixed_register(BDRVRawState *s, LuringState *ring)
+{
+    GHashTableIter iter;
+    gpointer host, size;
+
+    luring_register_fd(ring, s->fd);
+    g_hash_table_iter_init(&iter, s->io_uring_bufs);
+    while (g_hash_table_iter_next(&iter, &host, &size)) {
+        luring_register_buf(ring, host, GPOINTER_TO_SIZE(size));
+    }
+}
+
+/*
+ * With io-uring-fixed, register the file and the memory of @s with the
+ * rings of the current AioContext, unless that was done before.  Must be
+ * called after raw_check_linux_io_uring().
+ */
+static void raw_io_uring_fixed_attach(BDRVRawState *s)
+{
+    AioContext *ctx = qemu_get_current_aio_context();
+    RawIoUringRings *r;
+
+    QSLIST_FOREACH_RCU(r, &s->io_uring_rings, next) {
+        if (r->ctx == ctx) {
+            return;
+        }
+    }
+
+    QEMU_LOCK_GUARD(&s->io_uring_lock);
+
+    QSLIST_FOREACH(r, &s->io_uring_rings, next) {
+        if (r->ctx == ctx) {
+            return;
+        }
+    }
+
+    r = g_new0(RawIoUringRings, 1);
+    r->ctx = ctx;
+    aio_context_ref(ctx);
+    r->ring = aio_get_linux_io_uring(ctx);
+    raw_io_uring_fixed_register(s, r->ring);
+    if (qatomic_read(&s->use_io_uring_iopoll)) {
+        r->iopoll_ring = aio_get_linux_io_uring_iopoll(ctx);
+        raw_io_uring_fixed_register(s, r->iopoll_ring);
+    }
+    QSLIST_INSERT_HEAD_RCU(&s->io_uring_rings, r, next);
+}
+
+/* Drop all io-uring-fixed registrations of @s, before s->fd is closed */
+static void raw_io_uring_fixed_detach_all(BDRVRawState *s)
+{
+    RawIoUringRings *r;
+    GHashTableIter iter;
+    gpointer host, size;
+
+    while ((r = QSLIST_FIRST(&s->io_uring_rings))) {
+        QSLIST_REMOVE_HEAD(&s->io_uring_rings, next);
+
+        g_hash_table_iter_init(&iter, s->io_uring_bufs);
+        while (g_hash_table_iter_next(&iter, &host, &size)) {
+            luring_unregister_buf(r->ring, host, GPOINTER_TO_SIZE(size));
+            if (r->iopoll_ring) {
+                luring_unregister_buf(r->iopoll_ring, host,
+                                      GPOINTER_TO_SIZE(size));
+            }
+        }
+        luring_unregister_fd(r->ring, s->fd);
+        if (r->iopoll_ring) {
+            luring_unregister_fd(r->iopoll_ring, s->fd);
+        }
+
+        aio_context_unref(r->ctx);
+        g_free(r);
+    }
+
+    if (g_hash_table_size(s->io_uring_bufs)) {
+        ram_block_discard_disable(false);
+    }
+    g_hash_table_destroy(s->io_uring_bufs);
+    s->io_uring_bufs = NULL;
+    qemu_mutex_destroy(&s->io_uring_lock);
+}
 #endif
 
 #ifdef CONFIG_LINUX_AIO
@@ -2507,8 +2665,21 @@ static int coroutine_fn raw_co_prw(BlockDriverState *bs, int64_t *offset_ptr,
         type |= QEMU_AIO_MISALIGNED;
 #ifdef CONFIG_LINUX_IO_URING
     } else if (raw_check_linux_io_uring(s)) {
+        bool iopoll;
+
         assert(qiov->size == bytes);
-        ret = luring_co_submit(bs, s->fd, offset, qiov, type);
+        if (s->use_io_uring_fixed) {
+            raw_io_uring_fixed_attach(s);
+        }
+        iopoll = qatomic_read(&s->use_io_uring_iopoll);
+        ret = luring_co_submit(bs, s->fd, offset, qiov, type, iopoll);
+        if (ret == -EOPNOTSUPP && iopoll) {
+            /* The file system or the device driver cannot poll */
+            warn_report_once("io_uring polled I/O is not supported for '%s', "
+                             "falling back to interrupts", bs->filename);
+            qatomic_set(&s->use_io_uring_iopoll, false);
+            ret = luring_co_submit(bs, s->fd, offset, qiov, type, false);
+        }
         goto out;
 #endif
 #ifdef CONFIG_LINUX_AIO
@@ -2600,7 +2771,7 @@ static int coroutine_fn raw_co_flush_to_disk(BlockDriverState *bs)
 
 #ifdef CONFIG_LINUX_IO_URING
     if (raw_check_linux_io_uring(s)) {
-        return luring_co_submit(bs, s->fd, 0, NULL, QEMU_AIO_FLUSH);
+        return luring_co_submit(bs, s->fd, 0, NULL, QEMU_AIO_FLUSH, false);
     }
 #endif
 #ifdef CONFIG_LINUX_AIO
@@ -2615,6 +2786,12 @@ static void raw_close(BlockDriverState *bs)
 {
     BDRVRawState *s = bs->opaque;
 
+#ifdef CONFIG_LINUX_IO_URING
+    if (s->io_uring_bufs) {
+        raw_io_uring_fixed_detach_all(s);
+    }
+#endif
+
     if (s->fd >= 0) {
 #if defined(CONFIG_BLKZONED)
         g_free(bs->wps);
@@ -2624,6 +2801,79 @@ static void raw_close(BlockDriverState *bs)
     }
 }
 
+static bool raw_register_buf(BlockDriverState *bs, void *host, size_t size,
+                             Error **errp)
+{
+#ifdef CONFIG_LINUX_IO_URING
+    BDRVRawState *s = bs->opaque;
+    RawIoUringRings *r;
+    int ret;
+
+    if (!s->io_uring_bufs) {
+        return true;
+    }
+
+    QEMU_LOCK_GUARD(&s->io_uring_lock);
+
+    if (g_hash_table_contains(s->io_uring_bufs, host)) {
+        return true;
+    }
+
+    /*
+     * Registered buffers are pinned, so discarding their memory would not
+     * free anything.  Like vfio, refuse discards while they exist.  If
+     * something else relies on discards, keep using unregistered buffers.
+     */
+    if (!g_hash_table_size(s->io_uring_bufs)) {
+        ret = ram_block_discard_disable(true);
+        if (ret < 0) {
+            warn_report_once("Not registering guest memory for '%s' with "
+                             "io_uring, RAM discards cannot be disabled: %s",
+                             bs->filename, strerror(-ret));
+            return true;
+        }
+    }
+
+    g_hash_table_insert(s->io_uring_bufs, host, GSIZE_TO_POINTER(size));
+    QSLIST_FOREACH(r, &s->io_uring_rings, next) {
+        luring_register_buf(r->ring, host, size);
+        if (r->iopoll_ring) {
+            luring_register_buf(r->iopoll_ring, host, size);
+        }
+    }
+#endif
+    return true;
+}
+
+static void raw_unregister_buf(BlockDriverState *bs, void *host, size_t size)
+{
+#ifdef CONFIG_LINUX_IO_URING
+    BDRVRawState *s = bs->opaque;
+    RawIoUringRings *r;
+
+    if (!s->io_uring_bufs) {
+        return;
+    }
+
+    QEMU_LOCK_GUARD(&s->io_uring_lock);
+
+    /* bs may have been attached after the memory was registered */
+    if (!g_hash_table_remove(s->io_uring_bufs, host)) {
+        return;
+    }
+
+    QSLIST_FOREACH(r, &s->io_uring_rings, next) {
+        luring_unregister_buf(r->ring, host, size);
+        if (r->iopoll_ring) {
+            luring_unregister_buf(r->iopoll_ring, host, size);
+        }
+    }
+    if (!g_hash_table_size(s->io_uring_bufs)) {
+        ram_block_discard_disable(false);
+    }
+#endif
+}
+
 /**
  * Truncates the given regular file @fd to @offset and, when growing, fills the
  * new space according to @prealloc.
@@ -3809,6 +4059,21 @@ static void raw_set_perm(BlockDriverState *bs, uint64_t perm, uint64_t shared)
     /* For reopen, we have already switched to the new fd (.bdrv_set_perm is
      * called after .bdrv_reopen_commit) */
     if (s->perm_change_fd && s->fd != s->perm_change_fd) {
+#ifdef CONFIG_LINUX_IO_URING
+        if (s->io_uring_bufs) {
+            RawIoUringRings *r;
+
+            QEMU_LOCK_GUARD(&s->io_uring_lock);
+            QSLIST_FOREACH(r, &s->io_uring_rings, next) {
+                luring_unregister_fd(r->ring, s->fd);
+                luring_register_fd(r->ring, s->perm_change_fd);
+                if (r->iopoll_ring) {
+                    luring_unregister_fd(r->iopoll_ring, s->fd);
+                    luring_register_fd(r->iopoll_ring, s->perm_change_fd);
+                }
+            }
+        }
+#endif
         qemu_close(s->fd);
         s->fd = s->perm_change_fd;
         s->open_flags = s->perm_change_flags;
@@ -3902,6 +4167,8 @@ BlockDriver bdrv_file = {
     .bdrv_co_preadv         = raw_co_preadv,
     .bdrv_co_pwritev        = raw_co_pwritev,
     .bdrv_co_flush_to_disk  = raw_co_flush_to_disk,
+    .bdrv_register_buf      = raw_register_buf,
+    .bdrv_unregister_buf    = raw_unregister_buf,
     .bdrv_co_pdiscard       = raw_co_pdiscard,
     .bdrv_co_copy_range_from = raw_co_copy_range_from,
     .bdrv_co_copy_range_to  = raw_co_copy_range_to,
@@ -4266,6 +4533,8 @@ static BlockDriver bdrv_host_device = {
     .bdrv_co_preadv         = raw_co_preadv,
     .bdrv_co_pwritev        = raw_co_pwritev,
     .bdrv_co_flush_to_disk  = raw_co_flush_to_disk,
+    .bdrv_register_buf      = raw_register_buf,
+    .bdrv_unregister_buf    = raw_unregister_buf,
     .bdrv_co_pdiscard       = hdev_co_pdiscard,
     .bdrv_co_copy_range_from = raw_co_copy_range_from,
     .bdrv_co_copy_range_to  = raw_co_copy_range_to,
@@ -14,8 +14,12 @@
 #include "qemu/queue.h"
 #include "block/block.h"
 #include "block/raw-aio.h"
+#include "qemu/bitmap.h"
 #include "qemu/coroutine.h"
 #include "qemu/defer-call.h"
+#include "qemu/error-report.h"
+#include "qemu/lockable.h"
+#include "qemu/units.h"
 #include "qapi/error.h"
 #include "sysemu/block-backend.h"
 #include "trace.h"
@@ -26,6 +30,26 @@
 /* io_uring ring size */
 #define MAX_ENTRIES 128
 
+/* Size of the registered file and buffer tables of each ring */
+#define LURING_MAX_FIXED_FILES      64
+#define LURING_MAX_FIXED_BUFS       1024
+#define LURING_MAX_FIXED_REGIONS    32
+
+/* The kernel does not accept registered buffers larger than this */
+#define LURING_FIXED_BUF_SIZE       (1 * GiB)
+
+/*
+ * A memory region registered with luring_register_buf().  It is split into
+ * LURING_FIXED_BUF_SIZE chunks that take consecutive registered buffer
+ * indexes, starting at @first.
+ */
+typedef struct LuringFixedRegion {
+    void *host;
+    size_t size;        /* 0 if the entry is unused, set last */
+    unsigned int first;
+    unsigned int refcnt;
+} LuringFixedRegion;
+
 typedef struct LuringAIOCB {
     Coroutine *co;
     struct io_uring_sqe sqeq;
@@ -54,10 +78,32 @@ struct LuringState {
 
     struct io_uring ring;
 
+    /*
+     * Created with IORING_SETUP_IOPOLL: completions are not signalled, but
+     * must be polled for with luring_iopoll().
+     */
+    bool iopoll;
+
     /* No locking required, only accessed from AioContext home thread */
     LuringQueue io_q;
 
     QEMUBH *completion_bh;
+
+    /*
+     * Files and buffers registered with luring_register_fd() and
+     * luring_register_buf().  The tables are only set up with the kernel
+     * once something is registered, so that nothing changes for rings
+     * that are not asked to.  They are written under fixed_lock by
+     * whichever thread registers, but read locklessly when submitting.
+     */
+    QemuMutex fixed_lock;
+    bool fixed_setup;
+    bool has_fixed_files;
+    bool has_fixed_bufs;
+    int fixed_fds[LURING_MAX_FIXED_FILES];      /* -1 if unused */
+    LuringFixedRegion fixed_regions[LURING_MAX_FIXED_REGIONS];
+    unsigned int fixed_nr_regions;
+    DECLARE_BITMAP(fixed_bufs_used, LURING_MAX_FIXED_BUFS);
 };
 
 /**
@@ -102,12 +148,28 @@ static void luring_resubmit_short_read(LuringState *s, LuringAIOCB *luringcb,
 
     /* Update sqe */
     luringcb->sqeq.off += nread;
-    luringcb->sqeq.addr = (uintptr_t)luringcb->resubmit_qiov.iov;
-    luringcb->sqeq.len = luringcb->resubmit_qiov.niov;
+    if (luringcb->sqeq.opcode == IORING_OP_READ_FIXED) {
+        luringcb->sqeq.addr += nread;
+        luringcb->sqeq.len -= nread;
+    } else {
+        luringcb->sqeq.addr = (uintptr_t)luringcb->resubmit_qiov.iov;
+        luringcb->sqeq.len = luringcb->resubmit_qiov.niov;
+    }
 
     luring_resubmit(s, luringcb);
 }
 
+/*
+ * Let the kernel check the device for completions of requests on an
+ * IOPOLL ring.  This does not block.
+ */
+static void luring_iopoll(LuringState *s)
+{
+    if (s->iopoll && s->io_q.in_flight && !io_uring_cq_ready(&s->ring)) {
+        io_uring_enter(s->ring.ring_fd, 0, 0, IORING_ENTER_GETEVENTS, NULL);
+    }
+}
+
 /**
  * luring_process_completions:
  * @s: AIO state
@@ -128,6 +190,8 @@ static void luring_process_completions(LuringState *s)
 
     defer_call_begin();
 
+    luring_iopoll(s);
+
     /*
      * Request completion callbacks can run the nested event loop.
      * Schedule ourselves so the nested event loop will "see" remaining
@@ -221,7 +285,15 @@ end:
         }
     }
 
-    qemu_bh_cancel(s->completion_bh);
+    /*
+     * Nothing tells us about completions on an IOPOLL ring.  Keep the BH
+     * scheduled while requests are in flight so that the event loop does
+     * not block and polls again in its next iteration.  Busy polling in
+     * aio_poll() gets to them first through qemu_luring_poll_cb().
+     */
+    if (!s->iopoll || !s->io_q.in_flight) {
+        qemu_bh_cancel(s->completion_bh);
+    }
 
     defer_call_end();
 }
@@ -295,6 +367,7 @@ static bool qemu_luring_poll_cb(void *opaque)
 {
     LuringState *s = opaque;
 
+    luring_iopoll(s);
     return io_uring_cq_ready(&s->ring);
 }
 
@@ -323,6 +396,63 @@ static void luring_deferred_fn(void *opaque)
     }
 }
 
+/*
+ * Returns the index of @fd in the registered file table of @s, or -1 if
+ * it is not registered there.
+ */
+static int luring_fixed_file(LuringState *s, int fd)
+{
+    int i;
+
+    if (!s->has_fixed_files) {
+        return -1;
+    }
+
+    for (i = 0; i < LURING_MAX_FIXED_FILES; i++) {
+        if (qatomic_read(&s->fixed_fds[i]) == fd) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Returns the index of the registered buffer of @s that contains all of
+ * @qiov, or -1 if there is none.  Only single-element vectors can use
+ * IORING_OP_READ_FIXED/IORING_OP_WRITE_FIXED.
+ */
+static int luring_fixed_buf(LuringState *s, QEMUIOVector *qiov)
+{
+    uintptr_t base, end;
+    unsigned int i, nr;
+
+    if (!s->has_fixed_bufs || qiov->niov != 1) {
+        return -1;
+    }
+
+    base = (uintptr_t)qiov->iov[0].iov_base;
+    end = base + qiov->iov[0].iov_len;
+
+    nr = qatomic_read(&s->fixed_nr_regions);
+    for (i = 0; i < nr; i++) {
+        LuringFixedRegion *r = &s->fixed_regions[i];
+        size_t size = qatomic_load_acquire(&r->size);
+        uintptr_t host = (uintptr_t)r->host;
+        uint64_t idx;
+
+        if (!size || base < host || end > host + size) {
+            continue;
+        }
+
+        idx = (base - host) / LURING_FIXED_BUF_SIZE;
+        if ((end - 1 - host) / LURING_FIXED_BUF_SIZE != idx) {
+            return -1;
+        }
+        return r->first + idx;
+    }
+    return -1;
+}
+
 /**
  * luring_do_submit:
  * @fd: file descriptor for I/O
@@ -339,9 +469,25 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
 {
     int ret;
     struct io_uring_sqe *sqes = &luringcb->sqeq;
+    int fixed_fd = -1, fixed_buf = -1;
+
+    if (qatomic_load_acquire(&s->fixed_setup)) {
+        fixed_fd = luring_fixed_file(s, fd);
+        if (fixed_fd >= 0) {
+            fd = fixed_fd;
+        }
+        if (type == QEMU_AIO_WRITE || type == QEMU_AIO_READ) {
+            fixed_buf = luring_fixed_buf(s, luringcb->qiov);
+        }
+    }
 
     switch (type) {
     case QEMU_AIO_WRITE:
+        if (fixed_buf >= 0) {
+            io_uring_prep_write_fixed(sqes, fd, luringcb->qiov->iov[0].iov_base,
+                                      luringcb->qiov->size, offset, fixed_buf);
+            break;
+        }
         io_uring_prep_writev(sqes, fd, luringcb->qiov->iov,
                              luringcb->qiov->niov, offset);
         break;
@@ -350,6 +496,11 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
                              luringcb->qiov->niov, offset);
         break;
     case QEMU_AIO_READ:
+        if (fixed_buf >= 0) {
+            io_uring_prep_read_fixed(sqes, fd, luringcb->qiov->iov[0].iov_base,
+                                     luringcb->qiov->size, offset, fixed_buf);
+            break;
+        }
         io_uring_prep_readv(sqes, fd, luringcb->qiov->iov,
                             luringcb->qiov->niov, offset);
         break;
@@ -361,6 +512,9 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
                         __func__, type);
         abort();
     }
+    if (fixed_fd >= 0) {
+        sqes->flags |= IOSQE_FIXED_FILE;
+    }
     io_uring_sqe_set_data(sqes, luringcb);
 
     QSIMPLEQ_INSERT_TAIL(&s->io_q.submit_queue, luringcb, next);
@@ -380,11 +534,19 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
 }
 
 int coroutine_fn luring_co_submit(BlockDriverState *bs, int fd, uint64_t offset,
-                                  QEMUIOVector *qiov, int type)
+                                  QEMUIOVector *qiov, int type, bool iopoll)
 {
     int ret;
     AioContext *ctx = qemu_get_current_aio_context();
-    LuringState *s = aio_get_linux_io_uring(ctx);
+    LuringState *s;
+
+    /* IOPOLL rings cannot do anything but reads and writes */
+    if (iopoll && (type == QEMU_AIO_READ || type == QEMU_AIO_WRITE)) {
+        s = aio_get_linux_io_uring_iopoll(ctx);
+    } else {
+        s = aio_get_linux_io_uring(ctx);
+    }
+
     LuringAIOCB luringcb = {
         .co         = qemu_coroutine_self(),
         .ret        = -EINPROGRESS,
@@ -422,15 +584,261 @@ void luring_attach_aio_context(LuringState *s, AioContext *new_context)
                        qemu_luring_poll_cb, qemu_luring_poll_ready, s);
 }
 
-LuringState *luring_init(Error **errp)
+/* Set up the registered file and buffer tables of @s */
+static void luring_fixed_setup_locked(LuringState *s)
 {
-    int rc;
+    int files_ret, bufs_ret = -ENOTSUP;
+
+    if (s->fixed_setup) {
+        return;
+    }
+
+    /* All entries are -1, so this only sizes the table */
+    files_ret = io_uring_register_files(&s->ring, s->fixed_fds,
+                                        LURING_MAX_FIXED_FILES);
+    s->has_fixed_files = files_ret == 0;
+
+#ifdef CONFIG_LINUX_IO_URING_FIXED_BUFFERS
+    bufs_ret = io_uring_register_buffers_sparse(&s->ring,
+                                                LURING_MAX_FIXED_BUFS);
+    s->has_fixed_bufs = bufs_ret == 0;
+#endif
+
+    trace_luring_fixed_setup(s, files_ret, bufs_ret);
+    qatomic_store_release(&s->fixed_setup, true);
+}
+
+/*
+ * Register or unregister the @nr_bufs buffers of @host starting at index
+ * @first with @s.  Returns the number of buffers that were updated.
+ */
+static unsigned int luring_fixed_update_bufs_locked(LuringState *s,
+                                                    void *host, size_t size,
+                                                    unsigned int first,
+                                                    unsigned int nr_bufs,
+                                                    bool add)
+{
+#ifdef CONFIG_LINUX_IO_URING_FIXED_BUFFERS
+    unsigned int i;
+    int ret;
+
+    for (i = 0; i < nr_bufs; i++) {
+        size_t offset = (size_t)i * LURING_FIXED_BUF_SIZE;
+        struct iovec iov = { };
+
+        if (add) {
+            iov.iov_base = (uint8_t *)host + offset;
+            iov.iov_len = MIN(size - offset, LURING_FIXED_BUF_SIZE);
+        }
+
+        ret = io_uring_register_buffers_update_tag(&s->ring, first + i, &iov,
+                                                   NULL, 1);
+        if (ret < 0) {
+            trace_luring_fixed_buf_failed(s, first + i, ret);
+            break;
+        }
+    }
+    return i;
+#else
+    return 0;
+#endif
+}
+
+/*
+ * Register @fd with @s so that requests for it are submitted with
+ * IOSQE_FIXED_FILE, which saves looking up the file for every request.
+ * If this fails, requests simply use @fd as it is.  The ring holds a
+ * reference to the file, so luring_unregister_fd() must be called before
+ * @fd is closed.
+ */
+void luring_register_fd(LuringState *s, int fd)
+{
+    int i;
+
+    QEMU_LOCK_GUARD(&s->fixed_lock);
+
+    luring_fixed_setup_locked(s);
+    if (!s->has_fixed_files) {
+        return;
+    }
+
+    for (i = 0; i < LURING_MAX_FIXED_FILES; i++) {
+        if (s->fixed_fds[i] < 0) {
+            break;
+        }
+    }
+    if (i == LURING_MAX_FIXED_FILES ||
+        io_uring_register_files_update(&s->ring, i, &fd, 1) != 1) {
+        trace_luring_register_fd(s, fd, -1);
+        return;
+    }
+
+    trace_luring_register_fd(s, fd, i);
+    qatomic_set(&s->fixed_fds[i], fd);
+}
+
+void luring_unregister_fd(LuringState *s, int fd)
+{
+    int i, none = -1;
+
+    QEMU_LOCK_GUARD(&s->fixed_lock);
+
+    for (i = 0; i < LURING_MAX_FIXED_FILES; i++) {
+        if (s->fixed_fds[i] == fd) {
+            break;
+        }
+    }
+    if (i == LURING_MAX_FIXED_FILES) {
+        return;
+    }
+
+    trace_luring_unregister_fd(s, fd, i);
+    qatomic_set(&s->fixed_fds[i], -1);
+    io_uring_register_files_update(&s->ring, i, &none, 1);
+}
+
+/*
+ * Register the memory at @host with @s, so that requests whose buffer lies
+ * inside it can use IORING_OP_READ_FIXED/IORING_OP_WRITE_FIXED and the
+ * kernel does not need to pin the pages for each request.  Note that
+ * registering pins all of the memory, so the caller must make sure that
+ * nothing discards it.  If this fails, requests simply use plain
+ * readv/writev.  Registering the same memory more than once only takes a
+ * reference.
+ */
+void luring_register_buf(LuringState *s, void *host, size_t size)
+{
+    LuringFixedRegion *r = NULL;
+    unsigned long nr_bufs, first;
+    unsigned int i;
+
+    if (!size) {
+        return;
+    }
+
+    QEMU_LOCK_GUARD(&s->fixed_lock);
+
+    luring_fixed_setup_locked(s);
+    if (!s->has_fixed_bufs) {
+        return;
+    }
+
+    for (i = 0; i < LURING_MAX_FIXED_REGIONS; i++) {
+        LuringFixedRegion *cur = &s->fixed_regions[i];
+
+        if (cur->size == size && cur->host == host) {
+            cur->refcnt++;
+            return;
+        }
+        if (!cur->size && !r) {
+            r = cur;
+        }
+    }
+
+    nr_bufs = DIV_ROUND_UP(size, LURING_FIXED_BUF_SIZE);
+    first = bitmap_find_next_zero_area(s->fixed_bufs_used,
+                                       LURING_MAX_FIXED_BUFS, 0, nr_bufs, 0);
+    if (!r || first >= LURING_MAX_FIXED_BUFS) {
+        trace_luring_register_buf(s, host, size, -1);
+        return;
+    }
+
+    i = luring_fixed_update_bufs_locked(s, host, size, first, nr_bufs, true);
+    if (i < nr_bufs) {
+        /* Only use regions that are registered completely */
+        luring_fixed_update_bufs_locked(s, host, size, first, i, false);
+        trace_luring_register_buf(s, host, size, -1);
+        return;
+    }
+
+    trace_luring_register_buf(s, host, size, first);
+    bitmap_set(s->fixed_bufs_used, first, nr_bufs);
+    r->host = host;
+    r->first = first;
+    r->refcnt = 1;
+    qatomic_store_release(&r->size, size);
+
+    i = r - s->fixed_regions;
+    if (i >= s->fixed_nr_regions) {
+        qatomic_set(&s->fixed_nr_regions, i + 1);
+    }
+}
+
+void luring_unregister_buf(LuringState *s, void *host, size_t size)
+{
+    LuringFixedRegion *r;
+    unsigned long nr_bufs;
+    unsigned int i;
+
+    if (!size) {
+        return;
+    }
+
+    QEMU_LOCK_GUARD(&s->fixed_lock);
+
+    for (i = 0; i < LURING_MAX_FIXED_REGIONS; i++) {
+        r = &s->fixed_regions[i];
+        if (r->size == size && r->host == host) {
+            break;
+        }
+    }
+    if (i == LURING_MAX_FIXED_REGIONS || --r->refcnt) {
+        return;
+    }
+
+    nr_bufs = DIV_ROUND_UP(size, LURING_FIXED_BUF_SIZE);
+    qatomic_set(&r->size, 0);
+    luring_fixed_update_bufs_locked(s, host, size, r->first, nr_bufs, false);
+    bitmap_clear(s->fixed_bufs_used, r->first, nr_bufs);
+}
+
+/*
+ * Set up @ring with a kernel thread that polls the submission queue, so
+ * that submitting requests usually does not need a system call.
+ */
+static int luring_queue_init_sqpoll(struct io_uring *ring, AioContext *ctx,
+                                    unsigned flags)
+{
+#ifdef CONFIG_LINUX_IO_URING_SQPOLL
+    struct io_uring_params p = {
+        .flags = flags | IORING_SETUP_SQPOLL,
+        .sq_thread_idle = ctx->io_uring_sqpoll_idle,
+    };
+
+    if (ctx->io_uring_sqpoll_cpu >= 0) {
+        p.flags |= IORING_SETUP_SQ_AFF;
+        p.sq_thread_cpu = ctx->io_uring_sqpoll_cpu;
+    }
+
+    return io_uring_queue_init_params(MAX_ENTRIES, ring, &p);
+#else
+    return -ENOTSUP;
+#endif
+}
+
+LuringState *luring_init(AioContext *ctx, bool iopoll, Error **errp)
+{
+    int rc = -EINVAL;
     LuringState *s = g_new0(LuringState, 1);
     struct io_uring *ring = &s->ring;
+    unsigned flags = iopoll ? IORING_SETUP_IOPOLL : 0;
+    int i;
 
     trace_luring_init_state(s, sizeof(*s));
 
-    rc = io_uring_queue_init(MAX_ENTRIES, ring, 0);
+    s->iopoll = iopoll;
+    if (ctx->io_uring_sqpoll) {
+        rc = luring_queue_init_sqpoll(ring, ctx, flags);
+        trace_luring_init_sqpoll(s, rc);
+        if (rc < 0) {
+            warn_report_once("Unable to use io_uring SQPOLL, falling back "
+                             "to normal submission: %s", strerror(-rc));
+        }
+    }
+
+    if (rc < 0) {
+        rc = io_uring_queue_init(MAX_ENTRIES, ring, flags);
+    }
     if (rc < 0) {
         error_setg_errno(errp, -rc, "failed to init linux io_uring ring");
         g_free(s);
@@ -438,13 +846,20 @@ LuringState *luring_init(Error **errp)
     }
 
     ioq_init(&s->io_q);
+
+    qemu_mutex_init(&s->fixed_lock);
+    for (i = 0; i < LURING_MAX_FIXED_FILES; i++) {
+        s->fixed_fds[i] = -1;
+    }
     return s;
 
 }
 
 void luring_cleanup(LuringState *s)
 {
+    /* This also drops the registered files and buffers */
     io_uring_queue_exit(&s->ring);
+    qemu_mutex_destroy(&s->fixed_lock);
     trace_luring_cleanup_state(s);
     g_free(s);
 }
@@ -49,11 +49,14 @@ typedef struct BDRVNVMeState BDRVNVMeState;
 #define INDEX_ADMIN     0
 #define INDEX_IO(n)     (1 + n)
 
-/* This driver shares a single MSIX IRQ for the admin and I/O queues */
-enum {
-    MSIX_SHARED_IRQ_IDX = 0,
-    MSIX_IRQ_COUNT = 1
-};
+/*
+ * Each queue uses the MSIX IRQ with the same index.  If the device has a
+ * single IRQ, the admin queue and the only I/O queue share it.
+ */
+#define MSIX_SHARED_IRQ_IDX 0
+
+/* Upper bound for the "queues" option */
+#define NVME_MAX_IO_QUEUES 64
 
 typedef struct {
     int32_t  head, tail;
@@ -79,6 +82,13 @@ typedef struct {
     BDRVNVMeState   *s;
     int             index;
 
+    /*
+     * AioContext that processes the completions, NULL until one claims
+     * the queue.  Written under BDRVNVMeState.queue_lock, read locklessly
+     * by nvme_get_io_queue().
+     */
+    AioContext      *aio_context;
+
     /* Fields protected by BQL */
     uint8_t     *prp_list_pages;
 
@@ -95,6 +105,12 @@ typedef struct {
     QEMUBH      *completion_bh;
 } NVMeQueuePair;
 
+typedef struct {
+    EventNotifier   notifier;
+    BDRVNVMeState   *s;
+    unsigned        vector;
+} NVMeIrq;
+
 struct BDRVNVMeState {
     AioContext *aio_context;
     QEMUVFIOState *vfio;
@@ -114,7 +130,17 @@ struct BDRVNVMeState {
     /* How many uint32_t elements does each doorbell entry take. */
     size_t doorbell_scale;
     bool write_cache_supported;
-    EventNotifier irq_notifier[MSIX_IRQ_COUNT];
+
+    /* MSIX IRQs, [0]: admin queue, [n]: I/O queue n */
+    NVMeIrq *irqs;
+    unsigned nr_irqs;
+
+    /* Number of I/O queues to create, may be capped by the controller */
+    unsigned max_io_queues;
+
+    /* Protects claiming and releasing I/O queues */
+    QemuMutex queue_lock;
+    unsigned claimed_io_queues;
 
     uint64_t nsze; /* Namespace size reported by identify command */
     int nsid;      /* The namespace id to read/write data. */
@@ -143,6 +169,7 @@ struct BDRVNVMeState {
 
 #define NVME_BLOCK_OPT_DEVICE "device"
 #define NVME_BLOCK_OPT_NAMESPACE "namespace"
+#define NVME_BLOCK_OPT_QUEUES "queues"
 
 static void nvme_process_completion_bh(void *opaque);
 
@@ -160,6 +187,11 @@ static QemuOptsList runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "NVMe namespace",
         },
+        {
+            .name = NVME_BLOCK_OPT_QUEUES,
+            .type = QEMU_OPT_NUMBER,
+            .help = "Maximum number of I/O queue pairs",
+        },
         { /* end of list */ }
     },
 };
@@ -217,6 +249,16 @@ static void nvme_free_req_queue_cb(void *opaque)
     qemu_mutex_unlock(&q->lock);
 }
 
+/* MSIX IRQ used by queue @idx */
+static unsigned nvme_queue_vector(BDRVNVMeState *s, unsigned idx)
+{
+    return s->nr_irqs > 1 ? idx : MSIX_SHARED_IRQ_IDX;
+}
+
+/*
+ * Create queue pair @idx.  Its completions are processed in @aio_context,
+ * or, if that is NULL, in the AioContext that claims it later.
+ */
 static NVMeQueuePair *nvme_create_queue_pair(BDRVNVMeState *s,
                                              AioContext *aio_context,
                                              unsigned idx, size_t size,
@@ -234,7 +276,7 @@ static NVMeQueuePair *nvme_create_queue_pair(BDRVNVMeState *s,
         return NULL;
     }
     trace_nvme_create_queue_pair(idx, q, size, aio_context,
-                                 event_notifier_get_fd(s->irq_notifier));
+        event_notifier_get_fd(&s->irqs[nvme_queue_vector(s, idx)].notifier));
     bytes = QEMU_ALIGN_UP(s->page_size * NVME_NUM_REQS,
                           qemu_real_host_page_size());
     q->prp_list_pages = qemu_try_memalign(qemu_real_host_page_size(), bytes);
@@ -247,7 +289,11 @@ static NVMeQueuePair *nvme_create_queue_pair(BDRVNVMeState *s,
     q->s = s;
     q->index = idx;
     qemu_co_queue_init(&q->free_req_queue);
-    q->completion_bh = aio_bh_new(aio_context, nvme_process_completion_bh, q);
+    if (aio_context) {
+        q->aio_context = aio_context;
+        q->completion_bh = aio_bh_new(aio_context,
+                                      nvme_process_completion_bh, q);
+    }
     r = qemu_vfio_dma_map(s->vfio, q->prp_list_pages, bytes,
                           false, &prp_list_iova, errp);
     if (r) {
@@ -344,7 +390,7 @@ static void nvme_put_free_req_locked(NVMeQueuePair *q, NVMeRequest *req)
 static void nvme_wake_free_req_locked(NVMeQueuePair *q)
 {
     if (!qemu_co_queue_empty(&q->free_req_queue)) {
-        replay_bh_schedule_oneshot_event(q->s->aio_context,
+        replay_bh_schedule_oneshot_event(q->aio_context,
                 nvme_free_req_queue_cb, q);
     }
 }
@@ -454,6 +500,8 @@ static void nvme_process_completion_bh(void *opaque)
 {
     NVMeQueuePair *q = opaque;
 
+    QEMU_LOCK_GUARD(&q->lock);
+
     /*
      * We're being invoked because a nvme_process_completion() cb() function
      * called aio_poll(). The callback may be waiting for further completions
@@ -625,18 +673,22 @@ out:
     return ret;
 }
 
-static void nvme_poll_queue(NVMeQueuePair *q)
+/*
+ * Do an early check for completions.  q->lock isn't needed because this is
+ * only a hint; nvme_process_completion() checks again under the lock.
+ */
+static bool nvme_queue_has_completions(NVMeQueuePair *q)
 {
     const size_t cqe_offset = q->cq.head * NVME_CQ_ENTRY_BYTES;
     NvmeCqe *cqe = (NvmeCqe *)&q->cq.queue[cqe_offset];
 
+    return (le16_to_cpu(cqe->status) & 0x1) != q->cq_phase;
+}
+
+static void nvme_poll_queue(NVMeQueuePair *q)
+{
     trace_nvme_poll_queue(q->s, q->index);
-    /*
-     * Do an early check for completions. q->lock isn't needed because
-     * nvme_process_completion() only runs in the event loop thread and
-     * cannot race with itself.
-     */
-    if ((le16_to_cpu(cqe->status) & 0x1) == q->cq_phase) {
+    if (!nvme_queue_has_completions(q)) {
         return;
     }
 
@@ -647,23 +699,25 @@ static void nvme_poll_queue(NVMeQueuePair *q)
     qemu_mutex_unlock(&q->lock);
 }
 
-static void nvme_poll_queues(BDRVNVMeState *s)
+/* Poll the queues that use the IRQ of @irq */
+static void nvme_poll_queues(NVMeIrq *irq)
 {
-    int i;
+    BDRVNVMeState *s = irq->s;
 
-    for (i = 0; i < s->queue_count; i++) {
-        nvme_poll_queue(s->queues[i]);
+    for (unsigned i = 0; i < s->queue_count; i++) {
+        if (nvme_queue_vector(s, i) == irq->vector) {
+            nvme_poll_queue(s->queues[i]);
+        }
     }
 }
 
 static void nvme_handle_event(EventNotifier *n)
 {
-    BDRVNVMeState *s = container_of(n, BDRVNVMeState,
-                                    irq_notifier[MSIX_SHARED_IRQ_IDX]);
+    NVMeIrq *irq = container_of(n, NVMeIrq, notifier);
 
-    trace_nvme_handle_event(s);
+    trace_nvme_handle_event(irq->s, irq->vector);
     event_notifier_test_and_clear(n);
-    nvme_poll_queues(s);
+    nvme_poll_queues(irq);
 }
 
 static bool nvme_add_io_queue(BlockDriverState *bs, Error **errp)
@@ -674,8 +728,16 @@ static bool nvme_add_io_queue(BlockDriverState *bs, Error **errp)
     NvmeCmd cmd;
     unsigned queue_size = NVME_QUEUE_SIZE;
 
+    unsigned vector = nvme_queue_vector(s, n);
+
     assert(n <= UINT16_MAX);
-    q = nvme_create_queue_pair(s, bdrv_get_aio_context(bs),
+    /*
+     * A queue that shares the admin queue's IRQ has its completions
+     * processed in the same AioContext; the others are claimed later by
+     * the AioContexts that submit requests.
+     */
+    q = nvme_create_queue_pair(s, vector == MSIX_SHARED_IRQ_IDX ?
+                               bdrv_get_aio_context(bs) : NULL,
                                n, queue_size, errp);
     if (!q) {
         return false;
@@ -684,7 +746,7 @@ static bool nvme_add_io_queue(BlockDriverState *bs, Error **errp)
         .opcode = NVME_ADM_CMD_CREATE_CQ,
         .dptr.prp1 = cpu_to_le64(q->cq.iova),
         .cdw10 = cpu_to_le32(((queue_size - 1) << 16) | n),
-        .cdw11 = cpu_to_le32(NVME_CQ_IEN | NVME_CQ_PC),
+        .cdw11 = cpu_to_le32((vector << 16) | NVME_CQ_IEN | NVME_CQ_PC),
     };
     if (nvme_admin_cmd_sync(bs, &cmd)) {
         error_setg(errp, "Failed to create CQ io queue [%u]", n);
@@ -703,6 +765,9 @@ static bool nvme_add_io_queue(BlockDriverState *bs, Error **errp)
     s->queues = g_renew(NVMeQueuePair *, s->queues, n + 1);
     s->queues[n] = q;
     s->queue_count++;
+    if (q->aio_context) {
+        s->claimed_io_queues++;
+    }
     return true;
 out_error:
     nvme_free_queue_pair(q);
@@ -711,21 +776,12 @@ out_error:
 
 static bool nvme_poll_cb(void *opaque)
 {
-    EventNotifier *e = opaque;
-    BDRVNVMeState *s = container_of(e, BDRVNVMeState,
-                                    irq_notifier[MSIX_SHARED_IRQ_IDX]);
-    int i;
+    NVMeIrq *irq = container_of(opaque, NVMeIrq, notifier);
+    BDRVNVMeState *s = irq->s;
 
-    for (i = 0; i < s->queue_count; i++) {
-        NVMeQueuePair *q = s->queues[i];
-        const size_t cqe_offset = q->cq.head * NVME_CQ_ENTRY_BYTES;
-        NvmeCqe *cqe = (NvmeCqe *)&q->cq.queue[cqe_offset];
-
-        /*
-         * q->lock isn't needed because nvme_process_completion() only runs in
-         * the event loop thread and cannot race with itself.
-         */
-        if ((le16_to_cpu(cqe->status) & 0x1) != q->cq_phase) {
+    for (unsigned i = 0; i < s->queue_count; i++) {
+        if (nvme_queue_vector(s, i) == irq->vector &&
+            nvme_queue_has_completions(s->queues[i])) {
             return true;
         }
     }
@@ -734,35 +790,162 @@ static bool nvme_poll_cb(void *opaque)
 
 static void nvme_poll_ready(EventNotifier *e)
 {
-    BDRVNVMeState *s = container_of(e, BDRVNVMeState,
-                                    irq_notifier[MSIX_SHARED_IRQ_IDX]);
+    nvme_poll_queues(container_of(e, NVMeIrq, notifier));
+}
+
+/* Called with s->queue_lock held, from @ctx's thread */
+static void nvme_claim_io_queue(NVMeQueuePair *q, AioContext *ctx)
+{
+    BDRVNVMeState *s = q->s;
 
-    nvme_poll_queues(s);
+    trace_nvme_claim_io_queue(s, q->index, ctx);
+    q->completion_bh = aio_bh_new(ctx, nvme_process_completion_bh, q);
+    aio_set_event_notifier(ctx, &s->irqs[q->index].notifier,
+                           nvme_handle_event, nvme_poll_cb,
+                           nvme_poll_ready);
+    s->claimed_io_queues++;
+    qatomic_store_release(&q->aio_context, ctx);
+}
+
+/* Runs in the AioContext that claimed @q, with no requests in flight */
+static void nvme_release_io_queue_bh(void *opaque)
+{
+    NVMeQueuePair *q = opaque;
+    BDRVNVMeState *s = q->s;
+    AioContext *ctx = q->aio_context;
+
+    assert(ctx == qemu_get_current_aio_context());
+    trace_nvme_release_io_queue(s, q->index, ctx);
+    aio_set_event_notifier(ctx, &s->irqs[q->index].notifier,
+                           NULL, NULL, NULL);
+    qemu_bh_delete(q->completion_bh);
+    q->completion_bh = NULL;
+
+    QEMU_LOCK_GUARD(&s->queue_lock);
+    s->claimed_io_queues--;
+    qatomic_set(&q->aio_context, NULL);
+}
+
+/*
+ * Release the I/O queues claimed by AioContexts, so that no handler is
+ * left behind in an AioContext that may go away.  The queues that share
+ * the admin queue's IRQ stay with the BlockDriverState's AioContext.
+ *
+ * This is only done on close and when the BlockDriverState changes
+ * AioContext.  A device that submits requests from several iothreads
+ * moves its nodes back to the main loop when it stops, before those
+ * iothreads can go away.
+ *
+ * Must be called from the main loop with no requests in flight, so that
+ * no queue is claimed meanwhile.  The handlers are removed in their own
+ * AioContext.
+ */
+static void nvme_release_io_queues(BDRVNVMeState *s)
+{
+    GLOBAL_STATE_CODE();
+
+    for (unsigned i = INDEX_IO(0); i < s->queue_count; i++) {
+        NVMeQueuePair *q = s->queues[i];
+        AioContext *ctx = qatomic_read(&q->aio_context);
+
+        if (ctx && nvme_queue_vector(s, i) != MSIX_SHARED_IRQ_IDX) {
+            aio_wait_bh_oneshot(ctx, nvme_release_io_queue_bh, q);
+        }
+    }
+}
+
+/*
+ * Return the I/O queue pair for requests submitted from the current
+ * AioContext.  As long as there are unclaimed queue pairs, each
+ * AioContext claims one and processes its completions itself; further
+ * AioContexts share the claimed queue pairs.
+ */
+static NVMeQueuePair *nvme_get_io_queue(BDRVNVMeState *s)
+{
+    AioContext *ctx = qemu_get_current_aio_context();
+    unsigned n_io = s->queue_count - 1;
+    unsigned i;
+
+    assert(n_io > 0);
+    for (i = INDEX_IO(0); i < s->queue_count; i++) {
+        if (qatomic_load_acquire(&s->queues[i]->aio_context) == ctx) {
+            return s->queues[i];
+        }
+    }
+
+    if (qatomic_read(&s->claimed_io_queues) < n_io) {
+        QEMU_LOCK_GUARD(&s->queue_lock);
+
+        for (i = INDEX_IO(0); i < s->queue_count; i++) {
+            NVMeQueuePair *q = s->queues[i];
+
+            if (!q->aio_context) {
+                nvme_claim_io_queue(q, ctx);
+                return q;
+            }
+        }
+    }
+
+    return s->queues[INDEX_IO(g_direct_hash(ctx) % n_io)];
+}
+
+static bool nvme_add_io_queues(BlockDriverState *bs, Error **errp)
+{
+    BDRVNVMeState *s = bs->opaque;
+    unsigned n = s->max_io_queues;
+
+    if (n > 1) {
+        NvmeCmd cmd = {
+            .opcode = NVME_ADM_CMD_SET_FEATURES,
+            .cdw10 = cpu_to_le32(NVME_NUMBER_OF_QUEUES),
+            .cdw11 = cpu_to_le32(((n - 1) << 16) | (n - 1)),
+        };
+
+        if (nvme_admin_cmd_sync(bs, &cmd)) {
+            warn_report("NVMe: Failed to set the number of queues, "
+                        "using a single I/O queue");
+            n = 1;
+        }
+    }
+
+    if (!nvme_add_io_queue(bs, errp)) {
+        return false;
+    }
+
+    /* The controller may grant fewer queues than requested */
+    while (s->queue_count <= n) {
+        Error *local_err = NULL;
+
+        if (!nvme_add_io_queue(bs, &local_err)) {
+            warn_reportf_err(local_err, "NVMe: Using %u I/O queues: ",
+                             s->queue_count - 1);
+            break;
+        }
+    }
+    return true;
 }
 
 static int nvme_init(BlockDriverState *bs, const char *device, int namespace,
-                     Error **errp)
+                     unsigned queues, Error **errp)
 {
     BDRVNVMeState *s = bs->opaque;
     NVMeQueuePair *q;
     AioContext *aio_context = bdrv_get_aio_context(bs);
+    g_autofree EventNotifier **notifiers = NULL;
     int ret;
     uint64_t cap;
     uint32_t ver;
     uint64_t timeout_ms;
     uint64_t deadline, now;
+    unsigned max_queues;
     volatile NvmeBar *regs = NULL;
 
     qemu_co_mutex_init(&s->dma_map_lock);
     qemu_co_queue_init(&s->dma_flush_queue);
+    qemu_mutex_init(&s->queue_lock);
     s->device = g_strdup(device);
     s->nsid = namespace;
     s->aio_context = bdrv_get_aio_context(bs);
-    ret = event_notifier_init(&s->irq_notifier[MSIX_SHARED_IRQ_IDX], 0);
-    if (ret) {
-        error_setg(errp, "Failed to init event notifier");
-        return ret;
-    }
 
     s->vfio = qemu_vfio_open_pci(device, errp);
     if (!s->vfio) {
@@ -805,6 +988,34 @@ static int nvme_init(BlockDriverState *bs, const char *device, int namespace,
     bs->bl.request_alignment = s->page_size;
     timeout_ms = MIN(500 * NVME_CAP_TO(cap), 30000);
 
+    /*
+     * Give each I/O queue an IRQ of its own if the device has enough;
+     * otherwise fall back to one I/O queue sharing the admin queue's IRQ.
+     * The doorbells of all queues must fit in the mapped area, too.
+     */
+    ret = qemu_vfio_pci_get_irq_count(s->vfio, VFIO_PCI_MSIX_IRQ_INDEX, errp);
+    if (ret < 0) {
+        goto out;
+    }
+    max_queues = NVME_DOORBELL_SIZE /
+                 (s->doorbell_scale * 2 * sizeof(uint32_t));
+    max_queues = MIN(queues, MAX(max_queues, 2) - 1);
+    s->nr_irqs = ret > 1 ? MIN((unsigned)ret, 1 + max_queues) : 1;
+    s->max_io_queues = MAX(s->nr_irqs - 1, 1);
+
+    s->irqs = g_new0(NVMeIrq, s->nr_irqs);
+    notifiers = g_new(EventNotifier *, s->nr_irqs);
+    for (unsigned i = 0; i < s->nr_irqs; i++) {
+        s->irqs[i].s = s;
+        s->irqs[i].vector = i;
+        notifiers[i] = &s->irqs[i].notifier;
+        ret = event_notifier_init(notifiers[i], 0);
+        if (ret) {
+            error_setg(errp, "Failed to init event notifier");
+            goto out;
+        }
+    }
+
     ver = le32_to_cpu(regs->vs);
     trace_nvme_controller_spec_version(extract32(ver, 16, 16),
                                        extract32(ver, 8, 8),
@@ -865,13 +1076,13 @@ static int nvme_init(BlockDriverState *bs, const char *device, int namespace,
         }
     }
 
-    ret = qemu_vfio_pci_init_irq(s->vfio, s->irq_notifier,
-                                 VFIO_PCI_MSIX_IRQ_INDEX, errp);
+    ret = qemu_vfio_pci_init_irqs(s->vfio, notifiers, s->nr_irqs,
+                                  VFIO_PCI_MSIX_IRQ_INDEX, errp);
     if (ret) {
         goto out;
     }
     aio_set_event_notifier(bdrv_get_aio_context(bs),
-                           &s->irq_notifier[MSIX_SHARED_IRQ_IDX],
+                           &s->irqs[MSIX_SHARED_IRQ_IDX].notifier,
                            nvme_handle_event, nvme_poll_cb,
                            nvme_poll_ready);
 
@@ -881,7 +1092,7 @@ static int nvme_init(BlockDriverState *bs, const char *device, int namespace,
     }
 
     /* Set up command queues. */
-    if (!nvme_add_io_queue(bs, errp)) {
+    if (!nvme_add_io_queues(bs, errp)) {
         ret = -EIO;
     }
 out:
@@ -952,14 +1163,21 @@ static void nvme_close(BlockDriverState *bs)
 {
     BDRVNVMeState *s = bs->opaque;
 
+    nvme_release_io_queues(s);
     for (unsigned i = 0; i < s->queue_count; ++i) {
         nvme_free_queue_pair(s->queues[i]);
     }
     g_free(s->queues);
-    aio_set_event_notifier(bdrv_get_aio_context(bs),
-                           &s->irq_notifier[MSIX_SHARED_IRQ_IDX],
-                           NULL, NULL, NULL);
-    event_notifier_cleanup(&s->irq_notifier[MSIX_SHARED_IRQ_IDX]);
+    if (s->irqs) {
+        aio_set_event_notifier(bdrv_get_aio_context(bs),
+                               &s->irqs[MSIX_SHARED_IRQ_IDX].notifier,
+                               NULL, NULL, NULL);
+    }
+    for (unsigned i = 0; i < s->nr_irqs; i++) {
+        event_notifier_cleanup(&s->irqs[i].notifier);
+    }
+    g_free(s->irqs);
+    qemu_mutex_destroy(&s->queue_lock);
     qemu_vfio_pci_unmap_bar(s->vfio, 0, s->bar0_wo_map,
                             0, sizeof(NvmeBar) + NVME_DOORBELL_SIZE);
     qemu_vfio_close(s->vfio);
@@ -973,6 +1191,7 @@ static int nvme_open(BlockDriverState *bs, QDict *options, int flags,
     const char *device;
     QemuOpts *opts;
     int namespace;
+    uint64_t queues;
     int ret;
     BDRVNVMeState *s = bs->opaque;
 
@@ -988,7 +1207,14 @@ static int nvme_open(BlockDriverState *bs, QDict *options, int flags,
     }
 
     namespace = qemu_opt_get_number(opts, NVME_BLOCK_OPT_NAMESPACE, 1);
-    ret = nvme_init(bs, device, namespace, errp);
+    queues = qemu_opt_get_number(opts, NVME_BLOCK_OPT_QUEUES, 1);
+    if (queues < 1 || queues > NVME_MAX_IO_QUEUES) {
+        error_setg(errp, "'" NVME_BLOCK_OPT_QUEUES "' must be between 1 and %d",
+                   NVME_MAX_IO_QUEUES);
+        qemu_opts_del(opts);
+        return -EINVAL;
+    }
+    ret = nvme_init(bs, device, namespace, queues, errp);
     qemu_opts_del(opts);
     if (ret) {
         goto fail;
@@ -1172,14 +1398,29 @@ static void nvme_rw_cb_bh(void *opaque)
 static void nvme_rw_cb(void *opaque, int ret)
 {
     NVMeCoData *data = opaque;
-    data->ret = ret;
-    if (!data->co) {
-        /* The rw coroutine hasn't yielded, don't try to enter. */
-        return;
-    }
+
+    /*
+     * On a shared queue pair, this runs in the thread of the AioContext
+     * that claimed it.  Pairs with qatomic_load_acquire() in nvme_co_wait().
+     */
+    qatomic_store_release(&data->ret, ret);
     replay_bh_schedule_oneshot_event(data->ctx, nvme_rw_cb_bh, data);
 }
 
+/*
+ * Wait until nvme_rw_cb_bh() enters the coroutine.  The callback may run
+ * in another thread before the coroutine gets here, so data->co is set
+ * before the request is submitted and the coroutine always yields.  The
+ * bottom half runs in data->ctx, so it cannot enter the coroutine before
+ * that.
+ */
+static void coroutine_fn nvme_co_wait(NVMeCoData *data)
+{
+    do {
+        qemu_coroutine_yield();
+    } while (qatomic_load_acquire(&data->ret) == -EINPROGRESS);
+}
+
 static coroutine_fn int nvme_co_prw_aligned(BlockDriverState *bs,
                                             uint64_t offset, uint64_t bytes,
                                             QEMUIOVector *qiov,
@@ -1188,7 +1429,7 @@ static coroutine_fn int nvme_co_prw_aligned(BlockDriverState *bs,
 {
     int r;
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[INDEX_IO(0)];
+    NVMeQueuePair *ioq;
     NVMeRequest *req;
 
     uint32_t cdw12 = (((bytes >> s->blkshift) - 1) & 0xFFFF) |
@@ -1201,12 +1442,13 @@ static coroutine_fn int nvme_co_prw_aligned(BlockDriverState *bs,
         .cdw12 = cpu_to_le32(cdw12),
     };
     NVMeCoData data = {
-        .ctx = bdrv_get_aio_context(bs),
+        .co = qemu_coroutine_self(),
+        .ctx = qemu_get_current_aio_context(),
         .ret = -EINPROGRESS,
     };
 
     trace_nvme_prw_aligned(s, is_write, offset, bytes, flags, qiov->niov);
-    assert(s->queue_count > 1);
+    ioq = nvme_get_io_queue(s);
     req = nvme_get_free_req(ioq);
     assert(req);
 
@@ -1218,11 +1460,7 @@ static coroutine_fn int nvme_co_prw_aligned(BlockDriverState *bs,
         return r;
     }
     nvme_submit_command(ioq, req, &cmd, nvme_rw_cb, &data);
-
-    data.co = qemu_coroutine_self();
-    while (data.ret == -EINPROGRESS) {
-        qemu_coroutine_yield();
-    }
+    nvme_co_wait(&data);
 
     qemu_co_mutex_lock(&s->dma_map_lock);
     r = nvme_cmd_unmap_qiov(bs, qiov);
@@ -1309,26 +1547,23 @@ static coroutine_fn int nvme_co_pwritev(BlockDriverState *bs,
 static coroutine_fn int nvme_co_flush(BlockDriverState *bs)
 {
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[INDEX_IO(0)];
+    NVMeQueuePair *ioq;
     NVMeRequest *req;
     NvmeCmd cmd = {
         .opcode = NVME_CMD_FLUSH,
         .nsid = cpu_to_le32(s->nsid),
     };
     NVMeCoData data = {
-        .ctx = bdrv_get_aio_context(bs),
+        .co = qemu_coroutine_self(),
+        .ctx = qemu_get_current_aio_context(),
         .ret = -EINPROGRESS,
     };
 
-    assert(s->queue_count > 1);
+    ioq = nvme_get_io_queue(s);
     req = nvme_get_free_req(ioq);
     assert(req);
     nvme_submit_command(ioq, req, &cmd, nvme_rw_cb, &data);
-
-    data.co = qemu_coroutine_self();
-    if (data.ret == -EINPROGRESS) {
-        qemu_coroutine_yield();
-    }
+    nvme_co_wait(&data);
 
     return data.ret;
 }
@@ -1340,7 +1575,7 @@ static coroutine_fn int nvme_co_pwrite_zeroes(BlockDriverState *bs,
                                               BdrvRequestFlags flags)
 {
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[INDEX_IO(0)];
+    NVMeQueuePair *ioq;
     NVMeRequest *req;
     uint32_t cdw12;
 
@@ -1367,7 +1602,8 @@ static coroutine_fn int nvme_co_pwrite_zeroes(BlockDriverState *bs,
     };
 
     NVMeCoData data = {
-        .ctx = bdrv_get_aio_context(bs),
+        .co = qemu_coroutine_self(),
+        .ctx = qemu_get_current_aio_context(),
         .ret = -EINPROGRESS,
     };
 
@@ -1382,16 +1618,12 @@ static coroutine_fn int nvme_co_pwrite_zeroes(BlockDriverState *bs,
     cmd.cdw12 = cpu_to_le32(cdw12);
 
     trace_nvme_write_zeroes(s, offset, bytes, flags);
-    assert(s->queue_count > 1);
+    ioq = nvme_get_io_queue(s);
     req = nvme_get_free_req(ioq);
     assert(req);
 
     nvme_submit_command(ioq, req, &cmd, nvme_rw_cb, &data);
-
-    data.co = qemu_coroutine_self();
-    while (data.ret == -EINPROGRESS) {
-        qemu_coroutine_yield();
-    }
+    nvme_co_wait(&data);
 
     trace_nvme_rw_done(s, true, offset, bytes, data.ret);
     return data.ret;
@@ -1403,7 +1635,7 @@ static int coroutine_fn nvme_co_pdiscard(BlockDriverState *bs,
                                          int64_t bytes)
 {
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[INDEX_IO(0)];
+    NVMeQueuePair *ioq;
     NVMeRequest *req;
     QEMU_AUTO_VFREE NvmeDsmRange *buf = NULL;
     QEMUIOVector local_qiov;
@@ -1417,7 +1649,8 @@ static int coroutine_fn nvme_co_pdiscard(BlockDriverState *bs,
     };
 
     NVMeCoData data = {
-        .ctx = bdrv_get_aio_context(bs),
+        .co = qemu_coroutine_self(),
+        .ctx = qemu_get_current_aio_context(),
         .ret = -EINPROGRESS,
     };
 
@@ -1425,8 +1658,6 @@ static int coroutine_fn nvme_co_pdiscard(BlockDriverState *bs,
         return -ENOTSUP;
     }
 
-    assert(s->queue_count > 1);
-
     /*
      * Filling the @buf requires @offset and @bytes to satisfy restrictions
      * defined in nvme_refresh_limits().
@@ -1447,6 +1678,7 @@ static int coroutine_fn nvme_co_pdiscard(BlockDriverState *bs,
     qemu_iovec_init(&local_qiov, 1);
     qemu_iovec_add(&local_qiov, buf, 4096);
 
+    ioq = nvme_get_io_queue(s);
     req = nvme_get_free_req(ioq);
     assert(req);
 
@@ -1462,11 +1694,7 @@ static int coroutine_fn nvme_co_pdiscard(BlockDriverState *bs,
     trace_nvme_dsm(s, offset, bytes);
 
     nvme_submit_command(ioq, req, &cmd, nvme_rw_cb, &data);
-
-    data.co = qemu_coroutine_self();
-    while (data.ret == -EINPROGRESS) {
-        qemu_coroutine_yield();
-    }
+    nvme_co_wait(&data);
 
     qemu_co_mutex_lock(&s->dma_map_lock);
     ret = nvme_cmd_unmap_qiov(bs, &local_qiov);
@@ -1547,15 +1775,20 @@ static void nvme_detach_aio_context(BlockDriverState *bs)
 {
     BDRVNVMeState *s = bs->opaque;
 
+    nvme_release_io_queues(s);
+
     for (unsigned i = 0; i < s->queue_count; i++) {
         NVMeQueuePair *q = s->queues[i];
 
-        qemu_bh_delete(q->completion_bh);
-        q->completion_bh = NULL;
+        if (nvme_queue_vector(s, i) == MSIX_SHARED_IRQ_IDX) {
+            qemu_bh_delete(q->completion_bh);
+            q->completion_bh = NULL;
+            q->aio_context = NULL;
+        }
     }
 
     aio_set_event_notifier(bdrv_get_aio_context(bs),
-                           &s->irq_notifier[MSIX_SHARED_IRQ_IDX],
+                           &s->irqs[MSIX_SHARED_IRQ_IDX].notifier,
                            NULL, NULL, NULL);
 }
 
@@ -1565,15 +1798,19 @@ static void nvme_attach_aio_context(BlockDriverState *bs,
     BDRVNVMeState *s = bs->opaque;
 
     s->aio_context = new_context;
-    aio_set_event_notifier(new_context, &s->irq_notifier[MSIX_SHARED_IRQ_IDX],
+    aio_set_event_notifier(new_context,
+                           &s->irqs[MSIX_SHARED_IRQ_IDX].notifier,
                            nvme_handle_event, nvme_poll_cb,
                            nvme_poll_ready);
 
     for (unsigned i = 0; i < s->queue_count; i++) {
         NVMeQueuePair *q = s->queues[i];
 
-        q->completion_bh =
-            aio_bh_new(new_context, nvme_process_completion_bh, q);
+        if (nvme_queue_vector(s, i) == MSIX_SHARED_IRQ_IDX) {
+            q->completion_bh =
+                aio_bh_new(new_context, nvme_process_completion_bh, q);
+            qatomic_store_release(&q->aio_context, new_context);
+        }
     }
 }
 
@@ -1620,15 +1620,29 @@ do_alloc_cluster_offset(BlockDriverState *bs, uint64_t guest_offset,
     /* Allocate new clusters */
     trace_qcow2_cluster_alloc_phys(qemu_coroutine_self());
     if (*host_offset == INV_OFFSET) {
-        int64_t cluster_offset =
-            qcow2_alloc_clusters(bs, *nb_clusters * s->cluster_size);
+        int64_t cluster_offset;
+
+        if (s->alloc_reserve_size) {
+            cluster_offset = qcow2_alloc_reserved_clusters(bs, *nb_clusters);
+        } else {
+            cluster_offset =
+                qcow2_alloc_clusters(bs, *nb_clusters * s->cluster_size);
+        }
         if (cluster_offset < 0) {
             return cluster_offset;
         }
         *host_offset = cluster_offset;
         return 0;
     } else {
-        int64_t ret = qcow2_alloc_clusters_at(bs, *host_offset, *nb_clusters);
+        int64_t ret;
+
+        ret = qcow2_alloc_reserved_clusters_at(bs, *host_offset, *nb_clusters);
+        if (ret > 0) {
+            *nb_clusters = ret;
+            return 0;
+        }
+
+        ret = qcow2_alloc_clusters_at(bs, *host_offset, *nb_clusters);
         if (ret < 0) {
             return ret;
         }
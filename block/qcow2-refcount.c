@@ -1065,6 +1065,105 @@ int64_t coroutine_fn qcow2_alloc_clusters_at(BlockDriverState *bs, uint64_t offs
     return i;
 }
 
+/*
+ * Allocate @nb_clusters contiguous clusters for guest data.
+ *
+ * With the alloc-reserve-size option, clusters are not refcounted one
+ * request at a time, but taken from a larger extent that has been
+ * allocated in one go.  This keeps refcount block lookups and updates
+ * (and the I/O they may need) out of most allocating writes, which all
+ * run under s->lock.  Clusters left in the reserve have a refcount of 1
+ * and show up as leaked if the image is not closed cleanly.  For that
+ * reason, version 3 images are marked dirty while they have a reserve, so
+ * that the leaks are repaired the next time the image is opened.
+ *
+ * Returns the offset of the first cluster, or -errno.
+ */
+int64_t coroutine_fn qcow2_alloc_reserved_clusters(BlockDriverState *bs,
+                                                   uint64_t nb_clusters)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t reserve;
+    int64_t offset;
+
+    if (nb_clusters > s->reserved_clusters) {
+        qcow2_release_reserved_clusters(bs);
+
+        if (s->qcow_version >= 3) {
+            int ret = qcow2_mark_dirty(bs);
+            if (ret < 0) {
+                return ret;
+            }
+        }
+
+        reserve = MAX(s->alloc_reserve_size >> s->cluster_bits, nb_clusters);
+        offset = qcow2_alloc_clusters(bs, reserve << s->cluster_bits);
+        if (offset < 0 && reserve > nb_clusters) {
+            /* Maybe there is just no room left for the whole reserve */
+            reserve = nb_clusters;
+            offset = qcow2_alloc_clusters(bs, reserve << s->cluster_bits);
+        }
+        if (offset < 0) {
+            return offset;
+        }
+
+        trace_qcow2_alloc_reserve_refill(bs, offset, reserve);
+        s->reserved_offset = offset;
+        s->reserved_clusters = reserve;
+    }
+
+    offset = s->reserved_offset;
+    s->reserved_offset += nb_clusters << s->cluster_bits;
+    s->reserved_clusters -= nb_clusters;
+
+    return offset;
+}
+
+/*
+ * Take up to @nb_clusters clusters at @offset from the allocation reserve,
+ * so that an allocation which ended at @offset can be extended.
+ *
+ * Returns the number of clusters taken, which is 0 if the reserve does not
+ * start at @offset.
+ */
+uint64_t coroutine_fn qcow2_alloc_reserved_clusters_at(BlockDriverState *bs,
+                                                       uint64_t offset,
+                                                       uint64_t nb_clusters)
+{
+    BDRVQcow2State *s = bs->opaque;
+
+    if (!s->reserved_clusters || offset != s->reserved_offset) {
+        return 0;
+    }
+
+    nb_clusters = MIN(nb_clusters, s->reserved_clusters);
+    s->reserved_offset += nb_clusters << s->cluster_bits;
+    s->reserved_clusters -= nb_clusters;
+
+    return nb_clusters;
+}
+
+/*
+ * Give back the clusters left in the allocation reserve.  This must be
+ * done before anything that expects all refcounted clusters to be in use
+ * (closing or shrinking the image, checking its refcounts).
+ */
+void qcow2_release_reserved_clusters(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+
+    if (!s->reserved_clusters) {
+        return;
+    }
+
+    trace_qcow2_alloc_reserve_release(bs, s->reserved_offset,
+                                      s->reserved_clusters);
+    qcow2_free_clusters(bs, s->reserved_offset,
+                        s->reserved_clusters << s->cluster_bits,
+                        QCOW2_DISCARD_NEVER);
+    s->reserved_clusters = 0;
+}
+
 /* only used to allocate compressed sectors. We try to allocate
    contiguous sectors. size must be <= cluster_size */
 int64_t coroutine_fn GRAPH_RDLOCK qcow2_alloc_bytes(BlockDriverState *bs, int size)
@@ -128,6 +128,9 @@
 
 #define DEFAULT_CLUSTER_SIZE 65536
 
+/* Upper limit for the alloc-reserve-size option */
+#define QCOW2_MAX_ALLOC_RESERVE_SIZE (1 * GiB)
+
 #define QCOW2_OPT_DATA_FILE "data-file"
 #define QCOW2_OPT_LAZY_REFCOUNTS "lazy-refcounts"
 #define QCOW2_OPT_DISCARD_REQUEST "pass-discard-request"
@@ -150,6 +153,7 @@
 #define QCOW2_OPT_L2_CACHE_ENTRY_SIZE "l2-cache-entry-size"
 #define QCOW2_OPT_REFCOUNT_CACHE_SIZE "refcount-cache-size"
 #define QCOW2_OPT_CACHE_CLEAN_INTERVAL "cache-clean-interval"
+#define QCOW2_OPT_ALLOC_RESERVE_SIZE "alloc-reserve-size"
 
 typedef struct QCowHeader {
     uint32_t magic;
@@ -357,6 +361,14 @@ typedef struct BDRVQcow2State {
     uint64_t free_cluster_index;
     uint64_t free_byte_offset;
 
+    /*
+     * Data clusters that are already refcounted but not used yet, see
+     * qcow2_alloc_reserved_clusters()
+     */
+    uint64_t alloc_reserve_size;
+    uint64_t reserved_offset;
+    uint64_t reserved_clusters;
+
     CoMutex lock;
 
     Qcow2CryptoHeaderExtension crypto_header; /* QCow2 header extension */
@@ -873,6 +885,15 @@ int64_t GRAPH_RDLOCK coroutine_fn
 qcow2_alloc_clusters_at(BlockDriverState *bs, uint64_t offset,
                         int64_t nb_clusters);
 
+int64_t GRAPH_RDLOCK coroutine_fn
+qcow2_alloc_reserved_clusters(BlockDriverState *bs, uint64_t nb_clusters);
+
+uint64_t GRAPH_RDLOCK coroutine_fn
+qcow2_alloc_reserved_clusters_at(BlockDriverState *bs, uint64_t offset,
+                                 uint64_t nb_clusters);
+
+void GRAPH_RDLOCK qcow2_release_reserved_clusters(BlockDriverState *bs);
+
 int64_t coroutine_fn GRAPH_RDLOCK qcow2_alloc_bytes(BlockDriverState *bs, int size);
 void GRAPH_RDLOCK qcow2_free_clusters(BlockDriverState *bs,
                                       int64_t offset, int64_t size,
@@ -499,9 +499,17 @@ bool net_tx_pkt_add_raw_fragment_pci(struct NetTxPkt *pkt, PCIDevice *pci_dev,
     return true;
 }
 
-static void net_tx_pkt_do_sw_csum(struct NetTxPkt *pkt,
-                                  struct iovec *iov, uint32_t iov_len,
-                                  uint16_t csl)
+/*
+ * Fill in the L4 checksum of the packet in @iov, whose L4 header and payload
+ * are @csl bytes long.  Only the first @csum_len of those bytes are read from
+ * @iov; @data_cntr is the partial checksum of the remaining ones, summed
+ * starting at offset @csum_len.  The pseudo header consists of whole 16-bit
+ * words, so it does not change how @data_cntr lines up.
+ */
+static void net_tx_pkt_do_sw_csum_partial(struct NetTxPkt *pkt,
+                                          struct iovec *iov, uint32_t iov_len,
+                                          uint16_t csl, uint16_t csum_len,
+                                          uint32_t data_cntr)
 {
     uint32_t csum_cntr;
     uint16_t csum = 0;
@@ -528,14 +536,22 @@ static void net_tx_pkt_do_sw_csum(struct NetTxPkt *pkt,
     }
 
     /* data checksum */
-    csum_cntr +=
-        net_checksum_add_iov(iov, iov_len, pkt->virt_hdr.csum_start, csl, cso);
+    csum_cntr += net_checksum_add_iov(iov, iov_len, pkt->virt_hdr.csum_start,
+                                      csum_len, cso);
+    csum_cntr += data_cntr;
 
     /* Put the checksum obtained into the packet */
     csum = cpu_to_be16(net_checksum_finish_nozero(csum_cntr));
     iov_from_buf(iov, iov_len, csum_offset, &csum, sizeof csum);
 }
 
+static void net_tx_pkt_do_sw_csum(struct NetTxPkt *pkt,
+                                  struct iovec *iov, uint32_t iov_len,
+                                  uint16_t csl)
+{
+    net_tx_pkt_do_sw_csum_partial(pkt, iov, iov_len, csl, csl, 0);
+}
+
 #define NET_MAX_FRAG_SG_LIST (64)
 
 static size_t net_tx_pkt_fetch_fragment(struct NetTxPkt *pkt,
@@ -576,6 +592,40 @@ static size_t net_tx_pkt_fetch_fragment(struct NetTxPkt *pkt,
     return fetched;
 }
 
+/*
+ * Like net_tx_pkt_fetch_fragment(), but copy the payload into @buf and
+ * checksum it on the way.  @seq is the offset of the payload within the
+ * L4 checksummed data.
+ */
+static size_t net_tx_pkt_copy_fragment(struct NetTxPkt *pkt,
+    int *src_idx, size_t *src_offset, size_t src_len,
+    uint8_t *buf, int seq, uint32_t *csum_cntr)
+{
+    size_t fetched = 0;
+    struct iovec *src = pkt->vec;
+
+    *csum_cntr = 0;
+    while (fetched < src_len &&
+           *src_idx != (pkt->payload_frags + NET_TX_PKT_PL_START_FRAG)) {
+        size_t len = MIN(src[*src_idx].iov_len - *src_offset,
+                         src_len - fetched);
+
+        *csum_cntr += net_checksum_copy_cont(len, buf + fetched,
+                                             src[*src_idx].iov_base +
+                                             *src_offset,
+                                             seq + fetched);
+        *src_offset += len;
+        fetched += len;
+
+        if (*src_offset == src[*src_idx].iov_len) {
+            *src_offset = 0;
+            (*src_idx)++;
+        }
+    }
+
+    return fetched;
+}
+
 static void net_tx_pkt_sendv(
     void *opaque, const struct iovec *iov, int iov_cnt,
     const struct iovec *virt_iov, int virt_iov_cnt)
@@ -733,6 +783,8 @@ static bool net_tx_pkt_do_sw_fragmentation(struct NetTxPkt *pkt,
     int src_idx, dst_idx, pl_idx;
     size_t src_offset;
     size_t fragment_offset = 0;
+    g_autofree uint8_t *payload = NULL;
+    uint32_t payload_cntr = 0;
     struct virtio_net_hdr virt_hdr = {
         .flags = pkt->virt_hdr.flags & VIRTIO_NET_HDR_F_NEEDS_CSUM ?
                  VIRTIO_NET_HDR_F_DATA_VALID : 0
@@ -751,6 +803,12 @@ static bool net_tx_pkt_do_sw_fragmentation(struct NetTxPkt *pkt,
                                           &src_idx, &src_offset, &src_len)) {
             return false;
         }
+        /*
+         * Every segment needs its payload checksummed.  Copying it into a
+         * bounce buffer lets the copy and the checksum share one pass over
+         * guest memory, and the segment is sent with a single payload iov.
+         */
+        payload = g_malloc(src_len);
         break;
 
     case VIRTIO_NET_HDR_GSO_UDP:
@@ -768,8 +826,17 @@ static bool net_tx_pkt_do_sw_fragmentation(struct NetTxPkt *pkt,
     /* Put as much data as possible and send */
     while (true) {
         dst_idx = pl_idx;
-        fragment_len = net_tx_pkt_fetch_fragment(pkt,
-            &src_idx, &src_offset, src_len, fragment, &dst_idx);
+        if (payload) {
+            fragment_len = net_tx_pkt_copy_fragment(pkt,
+                &src_idx, &src_offset, src_len, payload, l4hdr_len,
+                &payload_cntr);
+            fragment[dst_idx].iov_base = payload;
+            fragment[dst_idx].iov_len = fragment_len;
+            dst_idx++;
+        } else {
+            fragment_len = net_tx_pkt_fetch_fragment(pkt,
+                &src_idx, &src_offset, src_len, fragment, &dst_idx);
+        }
         if (!fragment_len) {
             break;
         }
@@ -778,9 +845,11 @@ static bool net_tx_pkt_do_sw_fragmentation(struct NetTxPkt *pkt,
         case VIRTIO_NET_HDR_GSO_TCPV4:
         case VIRTIO_NET_HDR_GSO_TCPV6:
             net_tx_pkt_tcp_fragment_fix(pkt, fragment, fragment_len, gso_type);
-            net_tx_pkt_do_sw_csum(pkt, fragment + NET_TX_PKT_L2HDR_FRAG,
-                                  dst_idx - NET_TX_PKT_L2HDR_FRAG,
-                                  l4hdr_len + fragment_len);
+            net_tx_pkt_do_sw_csum_partial(pkt,
+                                          fragment + NET_TX_PKT_L2HDR_FRAG,
+                                          dst_idx - NET_TX_PKT_L2HDR_FRAG,
+                                          l4hdr_len + fragment_len,
+                                          l4hdr_len, payload_cntr);
             break;
 
         case VIRTIO_NET_HDR_GSO_UDP:
@@ -13,7 +13,9 @@
 
 #include "qemu/osdep.h"
 #include "qemu/atomic.h"
+#include "qemu/defer-call.h"
 #include "qemu/iov.h"
+#include "qemu/lockable.h"
 #include "qemu/log.h"
 #include "qemu/main-loop.h"
 #include "qemu/module.h"
@@ -31,6 +33,7 @@
 #include "net/vhost_net.h"
 #include "net/announce.h"
 #include "hw/virtio/virtio-bus.h"
+#include "hw/virtio/iothread-vq-mapping.h"
 #include "qapi/error.h"
 #include "qapi/qapi-events-net.h"
 #include "hw/qdev-properties.h"
@@ -41,6 +44,8 @@
 #include "standard-headers/linux/ethtool.h"
 #include "sysemu/sysemu.h"
 #include "sysemu/replay.h"
+#include "sysemu/iothread.h"
+#include "block/aio-wait.h"
 #include "trace.h"
 #include "monitor/qdev.h"
 #include "monitor/monitor.h"
@@ -124,6 +129,18 @@ static int vq2q(int queue_index)
     return queue_index / 2;
 }
 
+/* Notify the guest from the main loop or from the IOThread of a queue pair */
+static void virtio_net_notify(VirtIONet *n, VirtQueue *vq)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+
+    if (qemu_in_iothread()) {
+        virtio_notify_irqfd(vdev, vq);
+    } else {
+        virtio_notify(vdev, vq);
+    }
+}
+
 static void flush_or_purge_queued_packets(NetClientState *nc)
 {
     if (!nc->peer) {
@@ -200,7 +217,9 @@ static void virtio_net_set_config(VirtIODevice *vdev, const uint8_t *config)
     if (!virtio_vdev_has_feature(vdev, VIRTIO_NET_F_CTRL_MAC_ADDR) &&
         !virtio_vdev_has_feature(vdev, VIRTIO_F_VERSION_1) &&
         memcmp(netcfg.mac, n->mac, ETH_ALEN)) {
-        memcpy(n->mac, netcfg.mac, ETH_ALEN);
+        WITH_QEMU_LOCK_GUARD(&n->rx_filter_lock) {
+            memcpy(n->mac, netcfg.mac, ETH_ALEN);
+        }
         qemu_format_nic_info_str(qemu_get_queue(n->nic), n->mac);
     }
 
@@ -378,10 +397,14 @@ static void virtio_net_drop_tx_queue_data(VirtIODevice *vdev, VirtQueue *vq)
 {
     unsigned int dropped = virtqueue_drop_all(vq);
     if (dropped) {
-        virtio_notify(vdev, vq);
+        virtio_net_notify(VIRTIO_NET(vdev), vq);
     }
 }
 
+static void virtio_net_dataplane_update(VirtIONet *n, uint8_t status,
+                                        bool attach);
+static void virtio_net_dataplane_sync(VirtIONet *n);
+
 static void virtio_net_set_status(struct VirtIODevice *vdev, uint8_t status)
 {
     VirtIONet *n = VIRTIO_NET(vdev);
@@ -389,6 +412,9 @@ static void virtio_net_set_status(struct VirtIODevice *vdev, uint8_t status)
     int i;
     uint8_t queue_status;
 
+    /* Queue pairs that stop are processed in the main loop from now on */
+    virtio_net_dataplane_update(n, status, false);
+
     virtio_net_vnet_endian_status(n, status);
     virtio_net_vhost_status(n, status);
 
@@ -397,6 +423,11 @@ static void virtio_net_set_status(struct VirtIODevice *vdev, uint8_t status)
         bool queue_started;
         q = &n->vqs[i];
 
+        /* Keeps running in its IOThread, nothing changes for it */
+        if (q->ctx) {
+            continue;
+        }
+
         if ((!n->multiqueue && i != 0) || i >= n->curr_queue_pairs) {
             queue_status = 0;
         } else {
@@ -437,6 +468,8 @@ static void virtio_net_set_status(struct VirtIODevice *vdev, uint8_t status)
             }
         }
     }
+
+    virtio_net_dataplane_update(n, status, true);
 }
 
 static void virtio_net_set_link_status(NetClientState *nc)
@@ -791,6 +824,18 @@ static uint64_t virtio_net_get_features(VirtIODevice *vdev, uint64_t features,
         virtio_clear_feature(&features, VIRTIO_NET_F_GUEST_USO6);
     }
 
+    if (n->queue_aio_context) {
+        /*
+         * Software RSS and RSC share state across queue pairs, and queue
+         * reset would have to stop the IOThread, so none of them can be
+         * used when queue pairs run in different IOThreads.
+         */
+        virtio_clear_feature(&features, VIRTIO_NET_F_RSS);
+        virtio_clear_feature(&features, VIRTIO_NET_F_HASH_REPORT);
+        virtio_clear_feature(&features, VIRTIO_NET_F_RSC_EXT);
+        virtio_clear_feature(&features, VIRTIO_F_RING_RESET);
+    }
+
     if (!get_vhost_net(nc->peer)) {
         return features;
     }
@@ -998,7 +1043,9 @@ static void virtio_net_set_features(VirtIODevice *vdev, uint64_t features)
     }
 
     if (!virtio_has_feature(features, VIRTIO_NET_F_CTRL_VLAN)) {
-        memset(n->vlans, 0xff, MAX_VLAN >> 3);
+        WITH_QEMU_LOCK_GUARD(&n->rx_filter_lock) {
+            memset(n->vlans, 0xff, MAX_VLAN >> 3);
+        }
     }
 
     if (virtio_has_feature(features, VIRTIO_NET_F_STANDBY)) {
@@ -1027,20 +1074,22 @@ static int virtio_net_handle_rx_mode(VirtIONet *n, uint8_t cmd,
         return VIRTIO_NET_ERR;
     }
 
-    if (cmd == VIRTIO_NET_CTRL_RX_PROMISC) {
-        n->promisc = on;
-    } else if (cmd == VIRTIO_NET_CTRL_RX_ALLMULTI) {
-        n->allmulti = on;
-    } else if (cmd == VIRTIO_NET_CTRL_RX_ALLUNI) {
-        n->alluni = on;
-    } else if (cmd == VIRTIO_NET_CTRL_RX_NOMULTI) {
-        n->nomulti = on;
-    } else if (cmd == VIRTIO_NET_CTRL_RX_NOUNI) {
-        n->nouni = on;
-    } else if (cmd == VIRTIO_NET_CTRL_RX_NOBCAST) {
-        n->nobcast = on;
-    } else {
-        return VIRTIO_NET_ERR;
+    WITH_QEMU_LOCK_GUARD(&n->rx_filter_lock) {
+        if (cmd == VIRTIO_NET_CTRL_RX_PROMISC) {
+            n->promisc = on;
+        } else if (cmd == VIRTIO_NET_CTRL_RX_ALLMULTI) {
+            n->allmulti = on;
+        } else if (cmd == VIRTIO_NET_CTRL_RX_ALLUNI) {
+            n->alluni = on;
+        } else if (cmd == VIRTIO_NET_CTRL_RX_NOMULTI) {
+            n->nomulti = on;
+        } else if (cmd == VIRTIO_NET_CTRL_RX_NOUNI) {
+            n->nouni = on;
+        } else if (cmd == VIRTIO_NET_CTRL_RX_NOBCAST) {
+            n->nobcast = on;
+        } else {
+            return VIRTIO_NET_ERR;
+        }
     }
 
     rxfilter_notify(nc);
@@ -1102,11 +1151,16 @@ static int virtio_net_handle_mac(VirtIONet *n, uint8_t cmd,
     NetClientState *nc = qemu_get_queue(n->nic);
 
     if (cmd == VIRTIO_NET_CTRL_MAC_ADDR_SET) {
-        if (iov_size(iov, iov_cnt) != sizeof(n->mac)) {
+        uint8_t mac[ETH_ALEN];
+
+        if (iov_size(iov, iov_cnt) != sizeof(mac)) {
             return VIRTIO_NET_ERR;
         }
-        s = iov_to_buf(iov, iov_cnt, 0, &n->mac, sizeof(n->mac));
-        assert(s == sizeof(n->mac));
+        s = iov_to_buf(iov, iov_cnt, 0, mac, sizeof(mac));
+        assert(s == sizeof(mac));
+        WITH_QEMU_LOCK_GUARD(&n->rx_filter_lock) {
+            memcpy(n->mac, mac, sizeof(mac));
+        }
         qemu_format_nic_info_str(qemu_get_queue(n->nic), n->mac);
         rxfilter_notify(nc);
 
@@ -1174,11 +1228,13 @@ static int virtio_net_handle_mac(VirtIONet *n, uint8_t cmd,
         multi_overflow = 1;
     }
 
-    n->mac_table.in_use = in_use;
-    n->mac_table.first_multi = first_multi;
-    n->mac_table.uni_overflow = uni_overflow;
-    n->mac_table.multi_overflow = multi_overflow;
-    memcpy(n->mac_table.macs, macs, MAC_TABLE_ENTRIES * ETH_ALEN);
+    WITH_QEMU_LOCK_GUARD(&n->rx_filter_lock) {
+        n->mac_table.in_use = in_use;
+        n->mac_table.first_multi = first_multi;
+        n->mac_table.uni_overflow = uni_overflow;
+        n->mac_table.multi_overflow = multi_overflow;
+        memcpy(n->mac_table.macs, macs, MAC_TABLE_ENTRIES * ETH_ALEN);
+    }
     g_free(macs);
     rxfilter_notify(nc);
 
@@ -1206,12 +1262,15 @@ static int virtio_net_handle_vlan_table(VirtIONet *n, uint8_t cmd,
     if (vid >= MAX_VLAN)
         return VIRTIO_NET_ERR;
 
-    if (cmd == VIRTIO_NET_CTRL_VLAN_ADD)
-        n->vlans[vid >> 5] |= (1U << (vid & 0x1f));
-    else if (cmd == VIRTIO_NET_CTRL_VLAN_DEL)
-        n->vlans[vid >> 5] &= ~(1U << (vid & 0x1f));
-    else
-        return VIRTIO_NET_ERR;
+    WITH_QEMU_LOCK_GUARD(&n->rx_filter_lock) {
+        if (cmd == VIRTIO_NET_CTRL_VLAN_ADD) {
+            n->vlans[vid >> 5] |= (1U << (vid & 0x1f));
+        } else if (cmd == VIRTIO_NET_CTRL_VLAN_DEL) {
+            n->vlans[vid >> 5] &= ~(1U << (vid & 0x1f));
+        } else {
+            return VIRTIO_NET_ERR;
+        }
+    }
 
     rxfilter_notify(nc);
 
@@ -1491,7 +1550,7 @@ static int virtio_net_handle_mq(VirtIONet *n, uint8_t cmd,
                                 struct iovec *iov, unsigned int iov_cnt)
 {
     VirtIODevice *vdev = VIRTIO_DEVICE(n);
-    uint16_t queue_pairs;
+    uint16_t queue_pairs, old_queue_pairs;
     NetClientState *nc = qemu_get_queue(n->nic);
 
     virtio_net_disable_rss(n);
@@ -1524,6 +1583,7 @@ static int virtio_net_handle_mq(VirtIONet *n, uint8_t cmd,
         return VIRTIO_NET_ERR;
     }
 
+    old_queue_pairs = n->curr_queue_pairs;
     n->curr_queue_pairs = queue_pairs;
     if (nc->peer && nc->peer->info->type == NET_CLIENT_DRIVER_VHOST_VDPA) {
         /*
@@ -1532,10 +1592,19 @@ static int virtio_net_handle_mq(VirtIONet *n, uint8_t cmd,
          */
         return VIRTIO_NET_OK;
     }
-    /* stop the backend before changing the number of queue_pairs to avoid handling a
-     * disabled queue */
-    virtio_net_set_status(vdev, vdev->status);
-    virtio_net_set_queue_pairs(n);
+    if (queue_pairs < old_queue_pairs) {
+        /* stop the backend before changing the number of queue_pairs to avoid handling a
+         * disabled queue */
+        virtio_net_set_status(vdev, vdev->status);
+        virtio_net_set_queue_pairs(n);
+    } else {
+        /*
+         * Enable the backends before the new queue pairs start, which may
+         * move them to an IOThread.
+         */
+        virtio_net_set_queue_pairs(n);
+        virtio_net_set_status(vdev, vdev->status);
+    }
 
     return VIRTIO_NET_OK;
 }
@@ -1585,6 +1654,7 @@ size_t virtio_net_handle_ctrl_iov(VirtIODevice *vdev,
 
 static void virtio_net_handle_ctrl(VirtIODevice *vdev, VirtQueue *vq)
 {
+    VirtIONet *n = VIRTIO_NET(vdev);
     VirtQueueElement *elem;
 
     for (;;) {
@@ -1597,6 +1667,8 @@ static void virtio_net_handle_ctrl(VirtIODevice *vdev, VirtQueue *vq)
         written = virtio_net_handle_ctrl_iov(vdev, elem->in_sg, elem->in_num,
                                              elem->out_sg, elem->out_num);
         if (written > 0) {
+            virtio_net_dataplane_sync(n);
+
             virtqueue_push(vq, elem, written);
             virtio_notify(vdev, vq);
             g_free(elem);
@@ -1731,6 +1803,8 @@ static int receive_filter(VirtIONet *n, const uint8_t *buf, int size)
     uint8_t *ptr = (uint8_t *)buf;
     int i;
 
+    QEMU_LOCK_GUARD(&n->rx_filter_lock);
+
     if (n->promisc)
         return 1;
 
@@ -2023,7 +2097,7 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
     }
 
     virtqueue_flush(q->rx_vq, i);
-    virtio_notify(vdev, q->rx_vq);
+    virtio_net_notify(n, q->rx_vq);
 
     return size;
 
@@ -2654,13 +2728,12 @@ static void virtio_net_tx_complete(NetClientState *nc, ssize_t len)
 {
     VirtIONet *n = qemu_get_nic_opaque(nc);
     VirtIONetQueue *q = virtio_net_get_subqueue(nc);
-    VirtIODevice *vdev = VIRTIO_DEVICE(n);
     int ret;
 
     virtqueue_push(q->tx_vq, q->async_tx.elem, 0);
-    virtio_notify(vdev, q->tx_vq);
+    virtio_net_notify(n, q->tx_vq);
 
-    g_free(q->async_tx.elem);
+    virtqueue_element_free(q->tx_vq, q->async_tx.elem);
     q->async_tx.elem = NULL;
 
     virtio_queue_set_notification(q->tx_vq, 1);
@@ -2683,13 +2756,101 @@ static void virtio_net_tx_complete(NetClientState *nc, ssize_t len)
 }
 
 /* TX */
+
+/* Maximum number of TX elements popped from the virtqueue at once */
+#define VIRTIO_NET_TX_POP_BATCH 32
+
+/*
+ * Send the packet in @elem.  Returns 0 if the element has been completed,
+ * -EBUSY if it is in flight in q->async_tx, or -EINVAL if the device has been
+ * marked broken.
+ */
+static int virtio_net_flush_tx_elem(VirtIONetQueue *q, VirtQueueElement *elem)
+{
+    VirtIONet *n = q->n;
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    int queue_index = vq2q(virtio_get_queue_index(q->tx_vq));
+    ssize_t ret;
+    unsigned int out_num;
+    struct iovec sg[VIRTQUEUE_MAX_SIZE], sg2[VIRTQUEUE_MAX_SIZE + 1], *out_sg;
+    struct virtio_net_hdr vhdr;
+
+    out_num = elem->out_num;
+    out_sg = elem->out_sg;
+    if (out_num < 1) {
+        virtio_error(vdev, "virtio-net header not in first element");
+        goto detach;
+    }
+
+    if (n->needs_vnet_hdr_swap) {
+        if (iov_to_buf(out_sg, out_num, 0, &vhdr, sizeof(vhdr)) <
+            sizeof(vhdr)) {
+            virtio_error(vdev, "virtio-net header incorrect");
+            goto detach;
+        }
+        virtio_net_hdr_swap(vdev, &vhdr);
+        sg2[0].iov_base = &vhdr;
+        sg2[0].iov_len = sizeof(vhdr);
+        out_num = iov_copy(&sg2[1], ARRAY_SIZE(sg2) - 1, out_sg, out_num,
+                           sizeof(vhdr), -1);
+        if (out_num == VIRTQUEUE_MAX_SIZE) {
+            goto drop;
+        }
+        out_num += 1;
+        out_sg = sg2;
+    }
+    /*
+     * If host wants to see the guest header as is, we can
+     * pass it on unchanged. Otherwise, copy just the parts
+     * that host is interested in.
+     */
+    assert(n->host_hdr_len <= n->guest_hdr_len);
+    if (n->host_hdr_len != n->guest_hdr_len) {
+        if (iov_size(out_sg, out_num) < n->guest_hdr_len) {
+            virtio_error(vdev, "virtio-net header is invalid");
+            goto detach;
+        }
+        unsigned sg_num = iov_copy(sg, ARRAY_SIZE(sg),
+                                   out_sg, out_num,
+                                   0, n->host_hdr_len);
+        sg_num += iov_copy(sg + sg_num, ARRAY_SIZE(sg) - sg_num,
+                         out_sg, out_num,
+                         n->guest_hdr_len, -1);
+        out_num = sg_num;
+        out_sg = sg;
+
+        if (out_num < 1) {
+            virtio_error(vdev, "virtio-net nothing to send");
+            goto detach;
+        }
+    }
+
+    ret = qemu_sendv_packet_async(qemu_get_subqueue(n->nic, queue_index),
+                                  out_sg, out_num, virtio_net_tx_complete);
+    if (ret == 0) {
+        virtio_queue_set_notification(q->tx_vq, 0);
+        q->async_tx.elem = elem;
+        return -EBUSY;
+    }
+
+drop:
+    virtqueue_push(q->tx_vq, elem, 0);
+    virtio_net_notify(n, q->tx_vq);
+    virtqueue_element_free(q->tx_vq, elem);
+    return 0;
+
+detach:
+    virtqueue_detach_element(q->tx_vq, elem, 0);
+    virtqueue_element_free(q->tx_vq, elem);
+    return -EINVAL;
+}
+
 static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
 {
     VirtIONet *n = q->n;
     VirtIODevice *vdev = VIRTIO_DEVICE(n);
-    VirtQueueElement *elem;
+    void *elems[VIRTIO_NET_TX_POP_BATCH];
     int32_t num_packets = 0;
-    int queue_index = vq2q(virtio_get_queue_index(q->tx_vq));
     if (!(vdev->status & VIRTIO_CONFIG_S_DRIVER_OK)) {
         return num_packets;
     }
@@ -2699,90 +2860,36 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
         return num_packets;
     }
 
-    for (;;) {
-        ssize_t ret;
-        unsigned int out_num;
-        struct iovec sg[VIRTQUEUE_MAX_SIZE], sg2[VIRTQUEUE_MAX_SIZE + 1], *out_sg;
-        struct virtio_net_hdr vhdr;
+    while (num_packets < n->tx_burst) {
+        unsigned int num_elems, i;
 
-        elem = virtqueue_pop(q->tx_vq, sizeof(VirtQueueElement));
-        if (!elem) {
+        num_elems = virtqueue_pop_batch(q->tx_vq, sizeof(VirtQueueElement),
+                                        elems,
+                                        MIN(VIRTIO_NET_TX_POP_BATCH,
+                                            n->tx_burst - num_packets));
+        if (!num_elems) {
             break;
         }
 
-        out_num = elem->out_num;
-        out_sg = elem->out_sg;
-        if (out_num < 1) {
-            virtio_error(vdev, "virtio-net header not in first element");
-            goto detach;
-        }
-
-        if (n->needs_vnet_hdr_swap) {
-            if (iov_to_buf(out_sg, out_num, 0, &vhdr, sizeof(vhdr)) <
-                sizeof(vhdr)) {
-                virtio_error(vdev, "virtio-net header incorrect");
-                goto detach;
-            }
-            virtio_net_hdr_swap(vdev, &vhdr);
-            sg2[0].iov_base = &vhdr;
-            sg2[0].iov_len = sizeof(vhdr);
-            out_num = iov_copy(&sg2[1], ARRAY_SIZE(sg2) - 1, out_sg, out_num,
-                               sizeof(vhdr), -1);
-            if (out_num == VIRTQUEUE_MAX_SIZE) {
-                goto drop;
+        /* Let the backend hand the batch to the host in one go */
+        defer_call_begin();
+        for (i = 0; i < num_elems; i++) {
+            int ret = virtio_net_flush_tx_elem(q, elems[i]);
+
+            if (ret < 0) {
+                /* Give back the rest of the batch, newest first */
+                while (--num_elems > i) {
+                    virtqueue_unpop(q->tx_vq, elems[num_elems], 0);
+                    virtqueue_element_free(q->tx_vq, elems[num_elems]);
+                }
+                defer_call_end();
+                return ret;
             }
-            out_num += 1;
-            out_sg = sg2;
-        }
-        /*
-         * If host wants to see the guest header as is, we can
-         * pass it on unchanged. Otherwise, copy just the parts
-         * that host is interested in.
-         */
-        assert(n->host_hdr_len <= n->guest_hdr_len);
-        if (n->host_hdr_len != n->guest_hdr_len) {
-            if (iov_size(out_sg, out_num) < n->guest_hdr_len) {
-                virtio_error(vdev, "virtio-net header is invalid");
-                goto detach;
-            }
-            unsigned sg_num = iov_copy(sg, ARRAY_SIZE(sg),
-                                       out_sg, out_num,
-                                       0, n->host_hdr_len);
-            sg_num += iov_copy(sg + sg_num, ARRAY_SIZE(sg) - sg_num,
-                             out_sg, out_num,
-                             n->guest_hdr_len, -1);
-            out_num = sg_num;
-            out_sg = sg;
-
-            if (out_num < 1) {
-                virtio_error(vdev, "virtio-net nothing to send");
-                goto detach;
-            }
-        }
-
-        ret = qemu_sendv_packet_async(qemu_get_subqueue(n->nic, queue_index),
-                                      out_sg, out_num, virtio_net_tx_complete);
-        if (ret == 0) {
-            virtio_queue_set_notification(q->tx_vq, 0);
-            q->async_tx.elem = elem;
-            return -EBUSY;
-        }
-
-drop:
-        virtqueue_push(q->tx_vq, elem, 0);
-        virtio_notify(vdev, q->tx_vq);
-        g_free(elem);
-
-        if (++num_packets >= n->tx_burst) {
-            break;
+            num_packets++;
         }
+        defer_call_end();
     }
     return num_packets;
-
-detach:
-    virtqueue_detach_element(q->tx_vq, elem, 0);
-    g_free(elem);
-    return -EINVAL;
 }
 
 static void virtio_net_tx_timer(void *opaque);
@@ -2941,30 +3048,81 @@ static void virtio_net_tx_bh(void *opaque)
     }
 }
 
+static bool virtio_net_tx_timer_mode(VirtIONet *n)
+{
+    return n->net_conf.tx && !strcmp(n->net_conf.tx, "timer");
+}
+
+/* Create the TX timer or BH of @q in @ctx, or in the main loop if NULL */
+static void virtio_net_queue_tx_new(VirtIONetQueue *q, AioContext *ctx)
+{
+    MemReentrancyGuard *guard = &DEVICE(q->n)->mem_reentrancy_guard;
+
+    if (virtio_net_tx_timer_mode(q->n)) {
+        if (ctx) {
+            q->tx_timer = aio_timer_new(ctx, QEMU_CLOCK_VIRTUAL, SCALE_NS,
+                                        virtio_net_tx_timer, q);
+        } else {
+            q->tx_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL,
+                                       virtio_net_tx_timer, q);
+        }
+    } else {
+        if (ctx) {
+            q->tx_bh = aio_bh_new_guarded(ctx, virtio_net_tx_bh, q, guard);
+        } else {
+            q->tx_bh = qemu_bh_new_guarded(virtio_net_tx_bh, q, guard);
+        }
+    }
+}
+
+static void virtio_net_queue_tx_free(VirtIONetQueue *q)
+{
+    if (q->tx_timer) {
+        timer_free(q->tx_timer);
+        q->tx_timer = NULL;
+    } else {
+        qemu_bh_delete(q->tx_bh);
+        q->tx_bh = NULL;
+    }
+}
+
+/* Re-arm the TX timer or BH of @q after it has been re-created */
+static void virtio_net_queue_tx_kick(VirtIONetQueue *q)
+{
+    VirtIONet *n = q->n;
+
+    if (!q->tx_waiting || !VIRTIO_DEVICE(n)->vm_running) {
+        return;
+    }
+
+    if (q->tx_timer) {
+        timer_mod(q->tx_timer,
+                  qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + n->tx_timeout);
+    } else {
+        replay_bh_schedule_event(q->tx_bh);
+    }
+}
+
 static void virtio_net_add_queue(VirtIONet *n, int index)
 {
     VirtIODevice *vdev = VIRTIO_DEVICE(n);
 
+    n->vqs[index].n = n;
     n->vqs[index].rx_vq = virtio_add_queue(vdev, n->net_conf.rx_queue_size,
                                            virtio_net_handle_rx);
 
-    if (n->net_conf.tx && !strcmp(n->net_conf.tx, "timer")) {
+    if (virtio_net_tx_timer_mode(n)) {
         n->vqs[index].tx_vq =
             virtio_add_queue(vdev, n->net_conf.tx_queue_size,
                              virtio_net_handle_tx_timer);
-        n->vqs[index].tx_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL,
-                                              virtio_net_tx_timer,
-                                              &n->vqs[index]);
     } else {
         n->vqs[index].tx_vq =
             virtio_add_queue(vdev, n->net_conf.tx_queue_size,
                              virtio_net_handle_tx_bh);
-        n->vqs[index].tx_bh = qemu_bh_new_guarded(virtio_net_tx_bh, &n->vqs[index],
-                                                  &DEVICE(vdev)->mem_reentrancy_guard);
     }
+    virtio_net_queue_tx_new(&n->vqs[index], NULL);
 
     n->vqs[index].tx_waiting = 0;
-    n->vqs[index].n = n;
 }
 
 static void virtio_net_del_queue(VirtIONet *n, int index)
@@ -2973,18 +3131,301 @@ static void virtio_net_del_queue(VirtIONet *n, int index)
     VirtIONetQueue *q = &n->vqs[index];
     NetClientState *nc = qemu_get_subqueue(n->nic, index);
 
+    assert(!q->ctx);
+
     qemu_purge_queued_packets(nc);
 
     virtio_del_queue(vdev, index * 2);
+    virtio_net_queue_tx_free(q);
+    q->tx_waiting = 0;
+    virtio_del_queue(vdev, index * 2 + 1);
+}
+
+/*
+ * Dataplane: with iothread-vq-mapping, each running queue pair is processed
+ * in its IOThread together with the I/O handlers of its backend.  A queue
+ * pair only moves when it starts or stops, e.g. on status changes or when
+ * the guest changes the number of queue pairs.
+ *
+ * The control virtqueue stays in the main loop.  The RX filter state that
+ * its commands change is read by the IOThreads under rx_filter_lock, so a
+ * packet is always checked against a whole filter, either the old or the
+ * new one.  Each command waits for the IOThreads before it is
+ * acknowledged, so it applies to all packets received after that.
+ */
+
+/* Context: BH in the IOThread of @q */
+static void virtio_net_queue_attach_bh(void *opaque)
+{
+    VirtIONetQueue *q = opaque;
+    NetClientState *nc = qemu_get_subqueue(q->n->nic, q - q->n->vqs);
+
+    virtio_net_queue_tx_new(q, q->ctx);
+    qemu_set_aio_context(nc->peer, q->ctx);
+
+    virtio_queue_aio_attach_host_notifier_no_poll(q->rx_vq, q->ctx);
     if (q->tx_timer) {
-        timer_free(q->tx_timer);
-        q->tx_timer = NULL;
+        /* The timer batches packets, polling would just spin until it fires */
+        virtio_queue_aio_attach_host_notifier_no_poll(q->tx_vq, q->ctx);
     } else {
-        qemu_bh_delete(q->tx_bh);
-        q->tx_bh = NULL;
+        virtio_queue_aio_attach_host_notifier(q->tx_vq, q->ctx);
     }
-    q->tx_waiting = 0;
-    virtio_del_queue(vdev, index * 2 + 1);
+
+    virtio_net_queue_tx_kick(q);
+}
+
+/* Context: BH in the IOThread of @q */
+static void virtio_net_queue_detach_bh(void *opaque)
+{
+    VirtIONetQueue *q = opaque;
+    NetClientState *nc = qemu_get_subqueue(q->n->nic, q - q->n->vqs);
+
+    virtio_queue_aio_detach_host_notifier(q->rx_vq, q->ctx);
+    virtio_queue_aio_detach_host_notifier(q->tx_vq, q->ctx);
+    virtio_net_queue_tx_free(q);
+    qemu_set_aio_context(nc->peer, NULL);
+}
+
+/* Move queue pair @index to @ctx.  Context: BQL held */
+static void virtio_net_queue_attach(VirtIONet *n, int index, AioContext *ctx)
+{
+    VirtIONetQueue *q = &n->vqs[index];
+    NetClientState *nc = qemu_get_subqueue(n->nic, index);
+
+    assert(!q->ctx);
+
+    if (!nc->peer) {
+        return;
+    }
+    /* A filter may have been added while the device was stopped */
+    if (!qemu_can_set_aio_context(nc->peer)) {
+        warn_report_once("virtio-net: netdev '%s' cannot run in an IOThread, "
+                         "processing its queues in the main loop",
+                         nc->peer->name);
+        return;
+    }
+
+    trace_virtio_net_queue_aio_context(n, index, ctx);
+
+    event_notifier_set_handler(virtio_queue_get_host_notifier(q->rx_vq), NULL);
+    event_notifier_set_handler(virtio_queue_get_host_notifier(q->tx_vq), NULL);
+    virtio_net_queue_tx_free(q);
+
+    q->ctx = ctx;
+    aio_wait_bh_oneshot(ctx, virtio_net_queue_attach_bh, q);
+}
+
+/* Move queue pair @index back to the main loop.  Context: BQL held */
+static void virtio_net_queue_detach(VirtIONet *n, int index)
+{
+    VirtIONetQueue *q = &n->vqs[index];
+    EventNotifier *rx_notifier = virtio_queue_get_host_notifier(q->rx_vq);
+    EventNotifier *tx_notifier = virtio_queue_get_host_notifier(q->tx_vq);
+
+    if (!q->ctx) {
+        return;
+    }
+
+    trace_virtio_net_queue_aio_context(n, index, NULL);
+
+    aio_wait_bh_oneshot(q->ctx, virtio_net_queue_detach_bh, q);
+    q->ctx = NULL;
+
+    virtio_net_queue_tx_new(q, NULL);
+
+    /*
+     * Polling may have left TX notifications disabled; the main loop does not
+     * poll, so turn them back on unless the TX timer or BH is pending anyway.
+     */
+    if (!q->tx_waiting) {
+        virtio_queue_set_notification(q->tx_vq, 1);
+    }
+    event_notifier_set_handler(rx_notifier, virtio_queue_host_notifier_read);
+    event_notifier_set_handler(tx_notifier, virtio_queue_host_notifier_read);
+
+    /* Pick up kicks that arrived while no handler was attached */
+    event_notifier_set(rx_notifier);
+    event_notifier_set(tx_notifier);
+
+    virtio_net_queue_tx_kick(q);
+}
+
+/* The IOThread for queue pair @index with @status, NULL for the main loop */
+static AioContext *virtio_net_queue_dataplane_ctx(VirtIONet *n, int index,
+                                                  uint8_t status)
+{
+    AioContext *ctx;
+
+    if (!n->dataplane_started ||
+        (!n->multiqueue && index != 0) || index >= n->curr_queue_pairs ||
+        !virtio_net_started(n, status)) {
+        return NULL;
+    }
+
+    ctx = n->queue_aio_context[index];
+    return ctx == qemu_get_aio_context() ? NULL : ctx;
+}
+
+/*
+ * Move the queue pairs that change AioContext with @status: with @attach
+ * false, those that stop go back to the main loop; with @attach true, those
+ * that start go to their IOThread.  Context: BQL held
+ */
+static void virtio_net_dataplane_update(VirtIONet *n, uint8_t status,
+                                        bool attach)
+{
+    int i;
+
+    for (i = 0; i < n->max_queue_pairs; i++) {
+        AioContext *ctx = virtio_net_queue_dataplane_ctx(n, i, status);
+        VirtIONetQueue *q = &n->vqs[i];
+
+        if (attach) {
+            if (ctx && !q->ctx) {
+                virtio_net_queue_attach(n, i, ctx);
+            }
+        } else if (q->ctx && q->ctx != ctx) {
+            virtio_net_queue_detach(n, i);
+        }
+    }
+}
+
+static void virtio_net_dataplane_sync_bh(void *opaque)
+{
+}
+
+/*
+ * Wait until the IOThreads are done with the packets they were processing,
+ * so that they see the state set by a control command.  Context: BQL held
+ */
+static void virtio_net_dataplane_sync(VirtIONet *n)
+{
+    int i;
+
+    for (i = 0; i < n->max_queue_pairs; i++) {
+        if (n->vqs[i].ctx) {
+            aio_wait_bh_oneshot(n->vqs[i].ctx, virtio_net_dataplane_sync_bh,
+                                NULL);
+        }
+    }
+}
+
+/* Context: BQL held */
+static int virtio_net_start_ioeventfd(VirtIODevice *vdev)
+{
+    VirtIONet *n = VIRTIO_NET(vdev);
+    BusState *qbus = qdev_get_parent_bus(DEVICE(vdev));
+    VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    int r;
+
+    r = virtio_device_start_ioeventfd_impl(vdev);
+    if (r < 0 || !n->queue_aio_context) {
+        return r;
+    }
+
+    /*
+     * IOThreads notify the guest through irqfds.  Masking them is left to
+     * the transport, virtio_net_guest_notifier_mask() is only for vhost.
+     */
+    vdev->use_guest_notifier_mask = false;
+    r = k->set_guest_notifiers(qbus->parent, virtio_get_num_queues(vdev),
+                               true);
+    if (r < 0) {
+        warn_report("virtio-net: failed to set guest notifiers (%d), "
+                    "processing all queues in the main loop", r);
+        vdev->use_guest_notifier_mask = true;
+        return 0;
+    }
+
+    n->dataplane_started = true;
+    virtio_net_dataplane_update(n, vdev->status, true);
+    return 0;
+}
+
+/* Context: BQL held */
+static void virtio_net_stop_ioeventfd(VirtIODevice *vdev)
+{
+    VirtIONet *n = VIRTIO_NET(vdev);
+    BusState *qbus = qdev_get_parent_bus(DEVICE(vdev));
+    VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    bool dataplane_started = n->dataplane_started;
+
+    if (dataplane_started) {
+        n->dataplane_started = false;
+        virtio_net_dataplane_update(n, vdev->status, false);
+    }
+
+    virtio_device_stop_ioeventfd_impl(vdev);
+
+    if (dataplane_started) {
+        k->set_guest_notifiers(qbus->parent, virtio_get_num_queues(vdev),
+                               false);
+        vdev->use_guest_notifier_mask = true;
+    }
+}
+
+/* Context: BQL held */
+static void virtio_net_queue_aio_context_cleanup(VirtIONet *n)
+{
+    assert(!n->dataplane_started);
+
+    if (n->queue_aio_context) {
+        iothread_vq_mapping_cleanup(n->net_conf.iothread_vq_mapping_list);
+        g_free(n->queue_aio_context);
+        n->queue_aio_context = NULL;
+    }
+}
+
+/* Context: BQL held */
+static bool virtio_net_queue_aio_context_init(VirtIONet *n, Error **errp)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    BusState *qbus = qdev_get_parent_bus(DEVICE(vdev));
+    VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    int i;
+
+    if (!k->set_guest_notifiers || !k->ioeventfd_assign) {
+        error_setg(errp,
+                   "device is incompatible with iothread-vq-mapping "
+                   "(transport does not support notifiers)");
+        return false;
+    }
+    if (!virtio_device_ioeventfd_enabled(vdev)) {
+        error_setg(errp, "ioeventfd is required for iothread-vq-mapping");
+        return false;
+    }
+
+    n->queue_aio_context = g_new(AioContext *, n->max_queue_pairs);
+    if (!iothread_vq_mapping_apply(n->net_conf.iothread_vq_mapping_list,
+                                   n->queue_aio_context, n->max_queue_pairs,
+                                   errp)) {
+        g_free(n->queue_aio_context);
+        n->queue_aio_context = NULL;
+        return false;
+    }
+
+    for (i = 0; i < n->max_queue_pairs; i++) {
+        NetClientState *peer = n->nic_conf.peers.ncs[i];
+
+        if (!peer) {
+            error_setg(errp, "iothread-vq-mapping requires a netdev");
+            goto fail;
+        }
+        if (get_vhost_net(peer)) {
+            error_setg(errp, "iothread-vq-mapping cannot be used with vhost");
+            goto fail;
+        }
+        if (!qemu_can_set_aio_context(peer)) {
+            error_setg(errp, "netdev '%s' does not support iothread-vq-mapping",
+                       peer->name);
+            goto fail;
+        }
+    }
+    return true;
+
+fail:
+    virtio_net_queue_aio_context_cleanup(n);
+    return false;
 }
 
 static void virtio_net_change_num_queue_pairs(VirtIONet *n, int new_max_queue_pairs)
@@ -3366,6 +3807,15 @@ static bool virtio_net_guest_notifier_pending(VirtIODevice *vdev, int idx)
 {
     VirtIONet *n = VIRTIO_NET(vdev);
     NetClientState *nc;
+
+    if (n->dataplane_started) {
+        EventNotifier *notifier = idx == VIRTIO_CONFIG_IRQ_IDX ?
+            virtio_config_get_guest_notifier(vdev) :
+            virtio_queue_get_guest_notifier(virtio_get_queue(vdev, idx));
+
+        return event_notifier_test_and_clear(notifier);
+    }
+
     assert(n->vhost_started);
     if (!n->multiqueue && idx == 2) {
         /* Must guard against invalid features and bogus queue index
@@ -3684,11 +4134,18 @@ static void virtio_net_device_realize(DeviceState *dev, Error **errp)
         virtio_cleanup(vdev);
         return;
     }
+
+    if (n->net_conf.iothread_vq_mapping_list &&
+        !virtio_net_queue_aio_context_init(n, errp)) {
+        virtio_cleanup(vdev);
+        return;
+    }
+
     n->vqs = g_new0(VirtIONetQueue, n->max_queue_pairs);
     n->curr_queue_pairs = 1;
     n->tx_timeout = n->net_conf.txtimer;
 
-    if (n->net_conf.tx && strcmp(n->net_conf.tx, "timer")
+    if (n->net_conf.tx && !virtio_net_tx_timer_mode(n)
                        && strcmp(n->net_conf.tx, "bh")) {
         warn_report("virtio-net: "
                     "Unknown option tx=%s, valid options: \"timer\" \"bh\"",
@@ -3744,6 +4201,7 @@ static void virtio_net_device_realize(DeviceState *dev, Error **errp)
     n->mac_table.macs = g_malloc0(MAC_TABLE_ENTRIES * ETH_ALEN);
 
     n->vlans = g_malloc0(MAX_VLAN >> 3);
+    qemu_mutex_init(&n->rx_filter_lock);
 
     nc = qemu_get_queue(n->nic);
     nc->rxfilter_notify_enabled = 1;
@@ -3784,6 +4242,7 @@ static void virtio_net_device_unrealize(DeviceState *dev)
 
     g_free(n->mac_table.macs);
     g_free(n->vlans);
+    qemu_mutex_destroy(&n->rx_filter_lock);
 
     if (n->failover) {
         qobject_unref(n->primary_opts);
@@ -3805,6 +4264,7 @@ static void virtio_net_device_unrealize(DeviceState *dev)
     virtio_net_rsc_cleanup(n);
     g_free(n->rss_data.indirections_table);
     net_rx_pkt_uninit(n->rx_pkt);
+    virtio_net_queue_aio_context_cleanup(n);
     virtio_cleanup(vdev);
 }
 
@@ -3813,6 +4273,7 @@ static void virtio_net_reset(VirtIODevice *vdev)
     VirtIONet *n = VIRTIO_NET(vdev);
     int i;
 
+    qemu_mutex_lock(&n->rx_filter_lock);
     /* Reset back to compatibility mode */
     n->promisc = 1;
     n->allmulti = 0;
@@ -3820,11 +4281,6 @@ static void virtio_net_reset(VirtIODevice *vdev)
     n->nomulti = 0;
     n->nouni = 0;
     n->nobcast = 0;
-    /* multiqueue is disabled by default */
-    n->curr_queue_pairs = 1;
-    timer_del(n->announce_timer.tm);
-    n->announce_timer.round = 0;
-    n->status &= ~VIRTIO_NET_S_ANNOUNCE;
 
     /* Flush any MAC and VLAN filter table state */
     n->mac_table.in_use = 0;
@@ -3833,8 +4289,15 @@ static void virtio_net_reset(VirtIODevice *vdev)
     n->mac_table.uni_overflow = 0;
     memset(n->mac_table.macs, 0, MAC_TABLE_ENTRIES * ETH_ALEN);
     memcpy(&n->mac[0], &n->nic->conf->macaddr, sizeof(n->mac));
-    qemu_format_nic_info_str(qemu_get_queue(n->nic), n->mac);
     memset(n->vlans, 0, MAX_VLAN >> 3);
+    qemu_mutex_unlock(&n->rx_filter_lock);
+    qemu_format_nic_info_str(qemu_get_queue(n->nic), n->mac);
+
+    /* multiqueue is disabled by default */
+    n->curr_queue_pairs = 1;
+    timer_del(n->announce_timer.tm);
+    n->announce_timer.round = 0;
+    n->status &= ~VIRTIO_NET_S_ANNOUNCE;
 
     /* Flush any async TX */
     for (i = 0;  i < n->max_queue_pairs; i++) {
@@ -3969,6 +4432,8 @@ static Property virtio_net_properties[] = {
                        TX_TIMER_INTERVAL),
     DEFINE_PROP_INT32("x-txburst", VirtIONet, net_conf.txburst, TX_BURST),
     DEFINE_PROP_STRING("tx", VirtIONet, net_conf.tx),
+    DEFINE_PROP_IOTHREAD_VQ_MAPPING_LIST("iothread-vq-mapping", VirtIONet,
+                                         net_conf.iothread_vq_mapping_list),
     DEFINE_PROP_UINT16("rx_queue_size", VirtIONet, net_conf.rx_queue_size,
                        VIRTIO_NET_RX_QUEUE_DEFAULT_SIZE),
     DEFINE_PROP_UINT16("tx_queue_size", VirtIONet, net_conf.tx_queue_size,
@@ -4007,6 +4472,8 @@ static void virtio_net_class_init(ObjectClass *klass, void *data)
     vdc->queue_reset = virtio_net_queue_reset;
     vdc->queue_enable = virtio_net_queue_enable;
     vdc->set_status = virtio_net_set_status;
+    vdc->start_ioeventfd = virtio_net_start_ioeventfd;
+    vdc->stop_ioeventfd = virtio_net_stop_ioeventfd;
     vdc->guest_notifier_mask = virtio_net_guest_notifier_mask;
     vdc->guest_notifier_pending = virtio_net_guest_notifier_pending;
     vdc->legacy_features |= (0x1 << VIRTIO_NET_F_GSO);
@@ -153,6 +153,11 @@ struct VirtQueue
     EventNotifier host_notifier;
     bool host_notifier_enabled;
     QLIST_ENTRY(VirtQueue) node;
+
+    /* Free elements for virtqueue_pop_batch(), see virtqueue_element_free() */
+    void **elem_pool;
+    unsigned int elem_pool_len;
+    size_t elem_pool_sz;
 };
 
 const char *virtio_device_names[] = {
@@ -867,7 +872,8 @@ void virtqueue_unpop(VirtQueue *vq, const VirtQueueElement *elem,
 {
 
     if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
-        virtqueue_packed_rewind(vq, 1);
+        /* virtqueue_packed_pop() consumed one slot per chained descriptor */
+        virtqueue_packed_rewind(vq, elem->ndescs);
     } else {
         virtqueue_split_rewind(vq, 1);
     }
@@ -1648,32 +1654,119 @@ void virtqueue_map(VirtIODevice *vdev, VirtQueueElement *elem)
                                                                         false);
 }
 
-static void *virtqueue_alloc_element(size_t sz, unsigned out_num, unsigned in_num)
+/*
+ * Elements are laid out as the @sz bytes of the device's request struct
+ * followed by the in/out address and sg arrays.  The total size only depends
+ * on the total number of sg entries.
+ */
+static size_t virtqueue_element_size(size_t sz, unsigned out_num,
+                                     unsigned in_num)
 {
     VirtQueueElement *elem;
+    size_t in_addr_ofs = QEMU_ALIGN_UP(sz, __alignof__(elem->in_addr[0]));
+    size_t out_addr_end = in_addr_ofs +
+                          (in_num + out_num) * sizeof(elem->in_addr[0]);
+    size_t in_sg_ofs = QEMU_ALIGN_UP(out_addr_end, __alignof__(elem->in_sg[0]));
+
+    return in_sg_ofs + (in_num + out_num) * sizeof(elem->in_sg[0]);
+}
+
+static void virtqueue_init_element(VirtQueueElement *elem, size_t sz,
+                                   unsigned out_num, unsigned in_num)
+{
     size_t in_addr_ofs = QEMU_ALIGN_UP(sz, __alignof__(elem->in_addr[0]));
     size_t out_addr_ofs = in_addr_ofs + in_num * sizeof(elem->in_addr[0]);
     size_t out_addr_end = out_addr_ofs + out_num * sizeof(elem->out_addr[0]);
     size_t in_sg_ofs = QEMU_ALIGN_UP(out_addr_end, __alignof__(elem->in_sg[0]));
     size_t out_sg_ofs = in_sg_ofs + in_num * sizeof(elem->in_sg[0]);
-    size_t out_sg_end = out_sg_ofs + out_num * sizeof(elem->out_sg[0]);
 
-    assert(sz >= sizeof(VirtQueueElement));
-    elem = g_malloc(out_sg_end);
-    trace_virtqueue_alloc_element(elem, sz, in_num, out_num);
     elem->out_num = out_num;
     elem->in_num = in_num;
     elem->in_addr = (void *)elem + in_addr_ofs;
     elem->out_addr = (void *)elem + out_addr_ofs;
     elem->in_sg = (void *)elem + in_sg_ofs;
     elem->out_sg = (void *)elem + out_sg_ofs;
+}
+
+static void *virtqueue_alloc_element(size_t sz, unsigned out_num, unsigned in_num)
+{
+    VirtQueueElement *elem;
+
+    assert(sz >= sizeof(VirtQueueElement));
+    elem = g_malloc(virtqueue_element_size(sz, out_num, in_num));
+    trace_virtqueue_alloc_element(elem, sz, in_num, out_num);
+    virtqueue_init_element(elem, sz, out_num, in_num);
+    elem->pooled = false;
     return elem;
 }
 
-static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
+/*
+ * Like virtqueue_alloc_element(), but take the element from @vq's pool.
+ * Pooled elements all have the same size, big enough for
+ * VIRTQUEUE_POOL_ELEM_SG descriptors; larger chains fall back to g_malloc().
+ */
+static void *virtqueue_alloc_element_pooled(VirtQueue *vq, size_t sz,
+                                            unsigned out_num, unsigned in_num)
+{
+    VirtQueueElement *elem;
+
+    if (out_num + in_num > VIRTQUEUE_POOL_ELEM_SG ||
+        (vq->elem_pool_sz && vq->elem_pool_sz != sz)) {
+        return virtqueue_alloc_element(sz, out_num, in_num);
+    }
+
+    assert(sz >= sizeof(VirtQueueElement));
+    vq->elem_pool_sz = sz;
+    if (vq->elem_pool_len) {
+        elem = vq->elem_pool[--vq->elem_pool_len];
+    } else {
+        elem = g_malloc(virtqueue_element_size(sz, VIRTQUEUE_POOL_ELEM_SG, 0));
+    }
+    trace_virtqueue_alloc_element(elem, sz, in_num, out_num);
+    virtqueue_init_element(elem, sz, out_num, in_num);
+    elem->pooled = true;
+    return elem;
+}
+
+/* Free an element returned by virtqueue_pop() or virtqueue_pop_batch() */
+void virtqueue_element_free(VirtQueue *vq, void *opaque)
+{
+    VirtQueueElement *elem = opaque;
+
+    /* Once the queue is deleted its pool is gone */
+    if (elem->pooled && vq->vring.num_default) {
+        if (!vq->elem_pool) {
+            vq->elem_pool = g_new(void *, VIRTQUEUE_POOL_SIZE);
+        }
+        if (vq->elem_pool_len < VIRTQUEUE_POOL_SIZE) {
+            vq->elem_pool[vq->elem_pool_len++] = elem;
+            return;
+        }
+    }
+    g_free(elem);
+}
+
+static void virtqueue_element_pool_destroy(VirtQueue *vq)
+{
+    while (vq->elem_pool_len) {
+        g_free(vq->elem_pool[--vq->elem_pool_len]);
+    }
+    g_free(vq->elem_pool);
+    vq->elem_pool = NULL;
+    vq->elem_pool_sz = 0;
+}
+
+/*
+ * Pop the descriptor chain at last_avail_idx, which the caller has checked is
+ * available.  The caller also updates the avail event.
+ *
+ * Called within rcu_read_lock().
+ */
+static void *virtqueue_split_pop_rcu(VirtQueue *vq, size_t sz,
+                                     VRingMemoryRegionCaches *caches,
+                                     bool pooled)
 {
     unsigned int i, head, max, idx;
-    VRingMemoryRegionCaches *caches;
     MemoryRegionCache indirect_desc_cache;
     MemoryRegionCache *desc_cache;
     int64_t len;
@@ -1687,14 +1780,6 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
 
     address_space_cache_init_empty(&indirect_desc_cache);
 
-    RCU_READ_LOCK_GUARD();
-    if (virtio_queue_empty_rcu(vq)) {
-        goto done;
-    }
-    /* Needed after virtio_queue_empty(), see comment in
-     * virtqueue_num_heads(). */
-    smp_rmb();
-
     /* When we start there are none of either input nor output. */
     out_num = in_num = elem_entries = 0;
 
@@ -1709,13 +1794,8 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
         goto done;
     }
 
-    if (virtio_vdev_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX)) {
-        vring_set_avail_event(vq, vq->last_avail_idx);
-    }
-
     i = head;
 
-    caches = vring_get_region_caches(vq);
     if (!caches) {
         virtio_error(vdev, "Region caches not initialized");
         goto done;
@@ -1784,7 +1864,11 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
     }
 
     /* Now copy what we have collected and mapped */
-    elem = virtqueue_alloc_element(sz, out_num, in_num);
+    if (pooled) {
+        elem = virtqueue_alloc_element_pooled(vq, sz, out_num, in_num);
+    } else {
+        elem = virtqueue_alloc_element(sz, out_num, in_num);
+    }
     elem->index = head;
     elem->ndescs = 1;
     for (i = 0; i < out_num; i++) {
@@ -1816,10 +1900,37 @@ err_undo_map:
     goto done;
 }
 
-static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
+static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
+{
+    VirtQueueElement *elem;
+
+    RCU_READ_LOCK_GUARD();
+    if (virtio_queue_empty_rcu(vq)) {
+        return NULL;
+    }
+    /* Needed after virtio_queue_empty(), see comment in
+     * virtqueue_num_heads(). */
+    smp_rmb();
+
+    elem = virtqueue_split_pop_rcu(vq, sz, vring_get_region_caches(vq), false);
+
+    if (virtio_vdev_has_feature(vq->vdev, VIRTIO_RING_F_EVENT_IDX)) {
+        vring_set_avail_event(vq, vq->last_avail_idx);
+    }
+    return elem;
+}
+
+/*
+ * Pop the descriptor chain at last_avail_idx, which the caller has checked is
+ * available.
+ *
+ * Called within rcu_read_lock().
+ */
+static void *virtqueue_packed_pop_rcu(VirtQueue *vq, size_t sz,
+                                      VRingMemoryRegionCaches *caches,
+                                      bool pooled)
 {
     unsigned int i, max;
-    VRingMemoryRegionCaches *caches;
     MemoryRegionCache indirect_desc_cache;
     MemoryRegionCache *desc_cache;
     int64_t len;
@@ -1834,11 +1945,6 @@ static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
 
     address_space_cache_init_empty(&indirect_desc_cache);
 
-    RCU_READ_LOCK_GUARD();
-    if (virtio_queue_packed_empty_rcu(vq)) {
-        goto done;
-    }
-
     /* When we start there are none of either input nor output. */
     out_num = in_num = elem_entries = 0;
 
@@ -1851,7 +1957,6 @@ static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
 
     i = vq->last_avail_idx;
 
-    caches = vring_get_region_caches(vq);
     if (!caches) {
         virtio_error(vdev, "Region caches not initialized");
         goto done;
@@ -1924,7 +2029,11 @@ static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
     }
 
     /* Now copy what we have collected and mapped */
-    elem = virtqueue_alloc_element(sz, out_num, in_num);
+    if (pooled) {
+        elem = virtqueue_alloc_element_pooled(vq, sz, out_num, in_num);
+    } else {
+        elem = virtqueue_alloc_element(sz, out_num, in_num);
+    }
     for (i = 0; i < out_num; i++) {
         elem->out_addr[i] = addr[i];
         elem->out_sg[i] = iov[i];
@@ -1965,6 +2074,17 @@ err_undo_map:
     goto done;
 }
 
+static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
+{
+    RCU_READ_LOCK_GUARD();
+    if (virtio_queue_packed_empty_rcu(vq)) {
+        return NULL;
+    }
+
+    return virtqueue_packed_pop_rcu(vq, sz, vring_get_region_caches(vq),
+                                    false);
+}
+
 void *virtqueue_pop(VirtQueue *vq, size_t sz)
 {
     if (virtio_device_disabled(vq->vdev)) {
@@ -1978,6 +2098,85 @@ void *virtqueue_pop(VirtQueue *vq, size_t sz)
     }
 }
 
+static unsigned int virtqueue_split_pop_batch(VirtQueue *vq, size_t sz,
+                                              void **elems, unsigned int max)
+{
+    VRingMemoryRegionCaches *caches;
+    unsigned int n = 0;
+    int num_heads;
+
+    RCU_READ_LOCK_GUARD();
+    if (virtio_queue_empty_rcu(vq)) {
+        return 0;
+    }
+
+    /* Read the avail index and the region caches once for the whole batch */
+    num_heads = virtqueue_num_heads(vq, vq->last_avail_idx);
+    if (num_heads <= 0) {
+        return 0;
+    }
+    max = MIN(max, num_heads);
+    caches = vring_get_region_caches(vq);
+
+    while (n < max) {
+        void *elem = virtqueue_split_pop_rcu(vq, sz, caches, true);
+        if (!elem) {
+            break;
+        }
+        elems[n++] = elem;
+    }
+
+    if (virtio_vdev_has_feature(vq->vdev, VIRTIO_RING_F_EVENT_IDX)) {
+        vring_set_avail_event(vq, vq->last_avail_idx);
+    }
+    return n;
+}
+
+static unsigned int virtqueue_packed_pop_batch(VirtQueue *vq, size_t sz,
+                                               void **elems, unsigned int max)
+{
+    VRingMemoryRegionCaches *caches;
+    unsigned int n = 0;
+
+    RCU_READ_LOCK_GUARD();
+    caches = vring_get_region_caches(vq);
+
+    while (n < max && !virtio_queue_packed_empty_rcu(vq)) {
+        void *elem = virtqueue_packed_pop_rcu(vq, sz, caches, true);
+        if (!elem) {
+            break;
+        }
+        elems[n++] = elem;
+    }
+    return n;
+}
+
+/*
+ * Pop up to @max elements into @elems and return how many were popped.  This
+ * is cheaper than calling virtqueue_pop() @max times because the avail ring
+ * index, the region caches and the avail event are only accessed once per
+ * batch.  The elements must be released with virtqueue_element_free() from the
+ * thread that pops them.
+ */
+unsigned int virtqueue_pop_batch(VirtQueue *vq, size_t sz, void **elems,
+                                 unsigned int max)
+{
+    unsigned int n;
+
+    if (virtio_device_disabled(vq->vdev)) {
+        return 0;
+    }
+
+    if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
+        n = virtqueue_packed_pop_batch(vq, sz, elems, max);
+    } else {
+        n = virtqueue_split_pop_batch(vq, sz, elems, max);
+    }
+
+    trace_virtqueue_pop_batch(vq, max, n);
+    return n;
+}
+
 static unsigned int virtqueue_packed_drop_all(VirtQueue *vq)
 {
     VRingMemoryRegionCaches *caches;
@@ -2557,6 +2756,7 @@ void virtio_delete_queue(VirtQueue *vq)
     vq->handle_output = NULL;
     g_free(vq->used_elems);
     vq->used_elems = NULL;
+    virtqueue_element_pool_destroy(vq);
     virtio_virtqueue_reset_region_cache(vq);
 }
 
@@ -4010,7 +4210,7 @@ static Property virtio_properties[] = {
     DEFINE_PROP_END_OF_LIST(),
 };
 
-static int virtio_device_start_ioeventfd_impl(VirtIODevice *vdev)
+int virtio_device_start_ioeventfd_impl(VirtIODevice *vdev)
 {
     VirtioBusState *qbus = VIRTIO_BUS(qdev_get_parent_bus(DEVICE(vdev)));
     int i, n, r, err;
@@ -4080,7 +4280,7 @@ int virtio_device_start_ioeventfd(VirtIODevice *vdev)
     return virtio_bus_start_ioeventfd(vbus);
 }
 
-static void virtio_device_stop_ioeventfd_impl(VirtIODevice *vdev)
+void virtio_device_stop_ioeventfd_impl(VirtIODevice *vdev)
 {
     VirtioBusState *qbus = VIRTIO_BUS(qdev_get_parent_bus(DEVICE(vdev)));
     int n, r;
@@ -214,6 +214,9 @@ struct AioContext {
 #ifdef CONFIG_LINUX_IO_URING
     LuringState *linux_io_uring;
 
+    /* Ring with polled completions (IORING_SETUP_IOPOLL) for O_DIRECT I/O */
+    LuringState *linux_io_uring_iopoll;
+
     /* State for file descriptor monitoring using Linux io_uring */
     struct io_uring fdmon_io_uring;
     AioHandlerSList submit_list;
@@ -236,6 +239,11 @@ struct AioContext {
     /* AIO engine parameters */
     int64_t aio_max_batch;  /* maximum number of requests in a batch */
 
+    /* io_uring parameters, used when the LuringState is created */
+    bool io_uring_sqpoll;           /* submit from a kernel thread */
+    int64_t io_uring_sqpoll_idle;   /* its idle time in ms, 0 for default */
+    int64_t io_uring_sqpoll_cpu;    /* CPU it is bound to, or -1 */
+
     /*
      * List of handlers participating in userspace polling.  Protected by
      * ctx->list_lock.  Iterated and modified mostly by the event loop thread
@@ -387,6 +395,12 @@ int aio_bh_poll(AioContext *ctx);
  * invoked.  This can create an infinite loop if a bottom half handler
  * schedules itself.
  *
+ * Within a defer_call_begin()/defer_call_end() section, the event loop is
+ * only woken up at the end of the section, once for all the bottom halves
+ * scheduled in the same AioContext.  Code that blocks until a bottom half
+ * in another thread has run must therefore call aio_notify() itself, as
+ * aio_wait_bh_oneshot() does.
+ *
  * @bh: The bottom half to be scheduled.
  */
 void qemu_bh_schedule(QEMUBH *bh);
@@ -513,6 +527,12 @@ LuringState *aio_setup_linux_io_uring(AioContext *ctx, Error **errp);
 
 /* Return the LuringState bound to this AioContext */
 LuringState *aio_get_linux_io_uring(AioContext *ctx);
+
+/* Setup the polled completion LuringState bound to this AioContext */
+LuringState *aio_setup_linux_io_uring_iopoll(AioContext *ctx, Error **errp);
+
+/* Return the polled completion LuringState bound to this AioContext */
+LuringState *aio_get_linux_io_uring_iopoll(AioContext *ctx);
 /**
  * aio_timer_new_with_attrs:
  * @ctx: the aio context
@@ -712,6 +732,22 @@ void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
  */
 void aio_context_set_aio_params(AioContext *ctx, int64_t max_batch);
 
+/**
+ * aio_context_set_io_uring_params:
+ * @ctx: the aio context
+ * @sqpoll: whether the block layer io_uring uses a kernel submission thread
+ * @sqpoll_idle: how long the submission thread polls before it goes to
+ *               sleep, in milliseconds, 0 means that the kernel default
+ *               is used
+ * @sqpoll_cpu: the CPU that the submission thread is bound to, -1 means
+ *              that it is not bound
+ *
+ * The parameters take effect when the io_uring of @ctx is set up, i.e. on
+ * the first request that uses it.
+ */
+void aio_context_set_io_uring_params(AioContext *ctx, bool sqpoll,
+                                     int64_t sqpoll_idle, int64_t sqpoll_cpu);
+
 /**
  * aio_context_set_thread_pool_params:
  * @ctx: the aio context
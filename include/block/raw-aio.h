@@ -66,14 +66,23 @@ void laio_attach_aio_context(LinuxAioState *s, AioContext *new_context);
 #endif
 /* io_uring.c - Linux io_uring implementation */
 #ifdef CONFIG_LINUX_IO_URING
-LuringState *luring_init(Error **errp);
+LuringState *luring_init(AioContext *ctx, bool iopoll, Error **errp);
 void luring_cleanup(LuringState *s);
 
-/* luring_co_submit: submit I/O requests in the thread's current AioContext. */
+/*
+ * luring_co_submit: submit I/O requests in the thread's current AioContext.
+ * With @iopoll, reads and writes go to its ring with polled completions.
+ */
 int coroutine_fn luring_co_submit(BlockDriverState *bs, int fd, uint64_t offset,
-                                  QEMUIOVector *qiov, int type);
+                                  QEMUIOVector *qiov, int type, bool iopoll);
 void luring_detach_aio_context(LuringState *s, AioContext *old_context);
 void luring_attach_aio_context(LuringState *s, AioContext *new_context);
+
+/* Registered files and buffers of one ring; can be called from any thread */
+void luring_register_fd(LuringState *s, int fd);
+void luring_unregister_fd(LuringState *s, int fd);
+void luring_register_buf(LuringState *s, void *host, size_t size);
+void luring_unregister_buf(LuringState *s, void *host, size_t size);
 #endif
 
 #ifdef _WIN32
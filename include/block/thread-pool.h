@@ -19,6 +19,7 @@
 #define QEMU_THREAD_POOL_H
 
 #include "block/aio.h"
+#include "qapi/qapi-types-misc.h"
 
 #define THREAD_POOL_MAX_THREADS_DEFAULT         64
 
@@ -39,5 +40,6 @@ int coroutine_fn thread_pool_submit_co(ThreadPoolFunc *func, void *arg);
 void thread_pool_submit(ThreadPoolFunc *func, void *arg);
 
 void thread_pool_update_params(ThreadPool *pool, struct AioContext *ctx);
+void thread_pool_get_stats(ThreadPool *pool, ThreadPoolStats *stats);
 
 #endif
@@ -2531,6 +2531,17 @@ void memory_region_transaction_begin(void);
  */
 void memory_region_transaction_commit(void);
 
+/**
+ * memory_region_transaction_set_check: Check FlatView updates on commit
+ *
+ * Test hook.  When enabled, every FlatView that a commit updates
+ * incrementally is compared with a full render of its root, and QEMU
+ * aborts if they differ.
+ *
+ * @enable: whether to check the updates
+ */
+void memory_region_transaction_set_check(bool enable);
+
 /**
  * memory_listener_register: register callbacks to be called when memory
  *                           sections are mapped or unmapped into an address
@@ -58,7 +58,12 @@ static inline void clear_bmap_set(RAMBlock *rb, uint64_t start,
 {
     uint8_t shift = rb->clear_bmap_shift;
 
-    bitmap_set(rb->clear_bmap, start >> shift, clear_bmap_size(npages, shift));
+    /*
+     * Parallel dirty bitmap sync may set bits for different ranges of
+     * the same RAMBlock concurrently, see ramblock_sync_dirty_bitmap_all().
+     */
+    bitmap_set_atomic(rb->clear_bmap, start >> shift,
+                      clear_bmap_size(npages, shift));
 }
 
 /**
@@ -88,6 +88,8 @@ struct TranslationBlock {
     /* size of target code for this block (1 <= size <= TARGET_PAGE_SIZE) */
     uint16_t size;
     uint16_t icount;
+    /* index of the code_gen_buffer region holding this TB */
+    uint32_t region;
 
     struct tb_tc tc;
 
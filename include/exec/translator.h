@@ -76,6 +76,9 @@ typedef enum DisasJumpType {
  * @fake_insn: True if translator_fake_ldb used.
  * @insn_start: The last op emitted by the insn_start hook,
  *              which is expected to be INDEX_op_insn_start.
+ * @jump_dest: Destinations of the direct jumps out of this TB, as passed
+ *             to translator_add_jump_dest().
+ * @nb_jump_dest: Number of valid entries in @jump_dest.
  *
  * Architecture-agnostic disassembly context.
  */
@@ -89,8 +92,11 @@ struct DisasContextBase {
     bool singlestep_enabled;
     bool plugin_enabled;
     bool fake_insn;
+    bool trace;
     struct TCGOp *insn_start;
     void *host_addr[2];
+    vaddr jump_dest[2];
+    int nb_jump_dest;
 
     /*
      * Record insn data that we cannot read directly from host memory.
@@ -128,6 +134,17 @@ struct DisasContextBase {
  *
  * @disas_log:
  *      Print instruction disassembly to log.
+ *
+ * @hot_traces:
+ *      The target calls translator_trace_jump() on direct jumps and
+ *      branches, so that hot TBs can be retranslated as traces.
+ *
+ * @spec_translate:
+ *      The translator reads no vCPU state other than tb->flags,
+ *      tb->cs_base and fields that do not change after realize, so
+ *      that the destinations of its direct jumps can be translated by
+ *      another thread while the vCPU runs.  The target passes those
+ *      destinations to translator_add_jump_dest().
  */
 typedef struct TranslatorOps {
     void (*init_disas_context)(DisasContextBase *db, CPUState *cpu);
@@ -136,6 +153,8 @@ typedef struct TranslatorOps {
     void (*translate_insn)(DisasContextBase *db, CPUState *cpu);
     void (*tb_stop)(DisasContextBase *db, CPUState *cpu);
     bool (*disas_log)(const DisasContextBase *db, CPUState *cpu, FILE *f);
+    bool hot_traces;
+    bool spec_translate;
 } TranslatorOps;
 
 /**
@@ -174,6 +193,29 @@ void translator_loop(CPUState *cpu, TranslationBlock *tb, int *max_insns,
  */
 bool translator_use_goto_tb(DisasContextBase *db, vaddr dest);
 
+/**
+ * translator_add_jump_dest
+ * @db: Disassembly context
+ * @dest: target pc of a direct jump out of the current TB
+ *
+ * Record @dest for speculative translation, see
+ * #TranslatorOps::spec_translate.
+ */
+void translator_add_jump_dest(DisasContextBase *db, vaddr dest);
+
+/**
+ * translator_trace_jump
+ * @db: Disassembly context
+ * @dest: target pc of a direct jump, or the fall-through of a branch
+ *
+ * Return true if translation may continue at @dest instead of ending
+ * the TB.  This only happens when retranslating a hot TB as a trace,
+ * and only for a @dest past the end of the current insn, on the same
+ * page as the start of the TB.  For a conditional branch, the target
+ * then emits a side exit for the path not followed.
+ */
+bool translator_trace_jump(DisasContextBase *db, vaddr dest);
+
 /**
  * translator_io_start
  * @db: Disassembly context
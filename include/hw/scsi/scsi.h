@@ -33,6 +33,7 @@ struct SCSIRequest {
     uint64_t          residual;
     SCSICommand       cmd;
     NotifierList      cancel_notifiers;
+    AioContext        *ctx;
 
     /* Note:
      * - fields before sense are initialized by scsi_req_alloc;
@@ -77,9 +78,11 @@ struct SCSIDevice
     uint32_t sense_len;
 
     /*
-     * The requests list is only accessed from the AioContext that executes
-     * requests or from the main loop when IOThread processing is stopped.
+     * Requests may run in different AioContexts (one per HBA queue), so
+     * the requests list is protected by requests_lock.  Each request must
+     * only be processed in its own req->ctx.
      */
+    QemuMutex requests_lock;
     QTAILQ_HEAD(, SCSIRequest) requests;
 
     uint32_t channel;
@@ -20,6 +20,7 @@
 #include "net/announce.h"
 #include "qemu/option_int.h"
 #include "qom/object.h"
+#include "qapi/qapi-types-virtio.h"
 
 #include "ebpf/ebpf_rss.h"
 
@@ -56,6 +57,7 @@ typedef struct virtio_net_conf
     char *duplex_str;
     uint8_t duplex;
     char *primary_id_str;
+    IOThreadVirtQueueMappingList *iothread_vq_mapping_list;
 } virtio_net_conf;
 
 /* Coalesced packets type & status */
@@ -161,6 +163,7 @@ typedef struct VirtIONetQueue {
         VirtQueueElement *elem;
     } async_tx;
     struct VirtIONet *n;
+    AioContext *ctx; /* IOThread processing the queue pair, NULL for main */
 } VirtIONetQueue;
 
 struct VirtIONet {
@@ -227,6 +230,13 @@ struct VirtIONet {
     struct EBPFRSSContext ebpf_rss;
     uint32_t nr_ebpf_rss_fds;
     char **ebpf_rss_fds;
+    AioContext **queue_aio_context; /* per queue pair, iothread-vq-mapping */
+    bool dataplane_started;
+    /*
+     * Protects the RX filter state (mac, the rx-mode flags, mac_table and
+     * vlans), which IOThreads read while the main loop may change it.
+     */
+    QemuMutex rx_filter_lock;
 };
 
 size_t virtio_net_handle_ctrl_iov(VirtIODevice *vdev,
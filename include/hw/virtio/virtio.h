@@ -62,6 +62,13 @@ typedef struct VirtQueue VirtQueue;
 
 #define VIRTQUEUE_MAX_SIZE 1024
 
+/*
+ * virtqueue_pop_batch() keeps up to VIRTQUEUE_POOL_SIZE freed elements per
+ * virtqueue for reuse, each with room for VIRTQUEUE_POOL_ELEM_SG descriptors.
+ */
+#define VIRTQUEUE_POOL_SIZE 64
+#define VIRTQUEUE_POOL_ELEM_SG 32
+
 typedef struct VirtQueueElement
 {
     unsigned int index;
@@ -71,6 +78,8 @@ typedef struct VirtQueueElement
     unsigned int in_num;
     /* Element has been processed (VIRTIO_F_IN_ORDER) */
     bool in_order_filled;
+    /* Allocated by virtqueue_pop_batch(), see virtqueue_element_free() */
+    bool pooled;
     hwaddr *in_addr;
     hwaddr *out_addr;
     struct iovec *in_sg;
@@ -267,6 +276,9 @@ void virtqueue_fill(VirtQueue *vq, const VirtQueueElement *elem,
 
 void virtqueue_map(VirtIODevice *vdev, VirtQueueElement *elem);
 void *virtqueue_pop(VirtQueue *vq, size_t sz);
+unsigned int virtqueue_pop_batch(VirtQueue *vq, size_t sz, void **elems,
+                                 unsigned int max);
+void virtqueue_element_free(VirtQueue *vq, void *elem);
 unsigned int virtqueue_drop_all(VirtQueue *vq);
 void *qemu_get_virtqueue_element(VirtIODevice *vdev, QEMUFile *f, size_t sz);
 void qemu_put_virtqueue_element(VirtIODevice *vdev, QEMUFile *f,
@@ -410,6 +422,9 @@ EventNotifier *virtio_queue_get_guest_notifier(VirtQueue *vq);
 void virtio_queue_set_guest_notifier_fd_handler(VirtQueue *vq, bool assign,
                                                 bool with_irqfd);
 int virtio_device_start_ioeventfd(VirtIODevice *vdev);
+/* Default VirtioDeviceClass::start_ioeventfd()/stop_ioeventfd() */
+int virtio_device_start_ioeventfd_impl(VirtIODevice *vdev);
+void virtio_device_stop_ioeventfd_impl(VirtIODevice *vdev);
 int virtio_device_grab_ioeventfd(VirtIODevice *vdev);
 void virtio_device_release_ioeventfd(VirtIODevice *vdev);
 bool virtio_device_ioeventfd_enabled(VirtIODevice *vdev);
@@ -32,6 +32,26 @@ uint16_t net_checksum_tcpudp(uint16_t length, uint16_t proto,
                              uint8_t *addrs, uint8_t *buf);
 void net_checksum_calculate(uint8_t *data, int length, int csum_flag);
 
+/**
+ * net_checksum_copy_cont: copy and checksum in one pass
+ *
+ * @len: number of bytes
+ * @dst: destination buffer
+ * @src: source buffer, must not overlap @dst
+ * @seq: offset of @src within the checksummed data
+ *
+ * Copies @len bytes from @src to @dst and returns the same partial sum as
+ * net_checksum_add_cont(@len, @src, @seq) would.
+ */
+uint32_t net_checksum_copy_cont(int len, uint8_t *dst, const uint8_t *src,
+                                int seq);
+
+/*
+ * Select the next checksum implementation, for testing and benchmarking.
+ * Returns false when the plain C version is already in use.
+ */
+bool test_net_checksum_next_accel(void);
+
 static inline uint32_t
 net_checksum_add(int len, uint8_t *buf)
 {
@@ -717,6 +717,62 @@ bool qemu_prealloc_mem(int fd, char *area, size_t sz, int max_threads,
  */
 bool qemu_finish_async_prealloc_mem(Error **errp);
 
+typedef struct MemPreallocJob MemPreallocJob;
+typedef void MemPreallocDoneFunc(void *opaque, int ret);
+
+/**
+ * qemu_prealloc_mem_background:
+ * @fd: the fd mapped into the area, -1 for anonymous memory
+ * @area: start address of the area to preallocate
+ * @sz: the size of the area to preallocate
+ * @max_threads: maximum number of threads to use
+ * @tc: prealloc context threads pointer, NULL if not in use
+ * @done: called when the preallocation threads are done, may be NULL
+ * @opaque: opaque pointer for @done
+ * @job: returns the background job, or NULL if none was started
+ * @errp: returns an error if this function fails
+ *
+ * Like qemu_prealloc_mem(), but do not wait for the preallocation to
+ * complete: the area can be used right away, and pages that are accessed
+ * before the preallocation threads get to them are faulted in on demand.
+ * This is only possible with MADV_POPULATE_WRITE; otherwise the area is
+ * preallocated synchronously and *@job is set to NULL.
+ *
+ * If a job was started, @done is called exactly once, from the last
+ * preallocation thread to exit, with 0 or the negative errno of the first
+ * failure.  This may happen before this function returns.
+ *
+ * A job that was started must be released with qemu_prealloc_job_finish()
+ * before the area is unmapped.
+ *
+ * Return: true on success, else false setting @errp with error.
+ */
+bool qemu_prealloc_mem_background(int fd, char *area, size_t sz,
+                                  int max_threads, ThreadContext *tc,
+                                  MemPreallocDoneFunc *done, void *opaque,
+                                  MemPreallocJob **job, Error **errp);
+
+/**
+ * qemu_prealloc_job_get_progress:
+ * @job: a job returned by qemu_prealloc_mem_background()
+ * @total: returns the size of the area, may be NULL
+ *
+ * Return: the number of bytes preallocated so far.
+ */
+uint64_t qemu_prealloc_job_get_progress(MemPreallocJob *job, uint64_t *total);
+
+/**
+ * qemu_prealloc_job_finish:
+ * @job: a job returned by qemu_prealloc_mem_background()
+ * @cancel: stop preallocating instead of waiting for completion
+ * @errp: returns an error if the preallocation failed
+ *
+ * Wait for the preallocation threads of @job to exit and free @job.
+ *
+ * Return: true on success, else false setting @errp with error.
+ */
+bool qemu_prealloc_job_finish(MemPreallocJob *job, bool cancel, Error **errp);
+
 /**
  * qemu_get_pid_name:
  * @pid: pid of a process
@@ -86,7 +86,8 @@ struct QEMUTimer {
     QEMUTimerList *timer_list;
     QEMUTimerCB *cb;
     void *opaque;
-    QEMUTimer *next;
+    uint64_t seq;               /* arming order, for equal expire_time */
+    unsigned int heap_index;    /* position in the timer list if pending */
     int attributes;
     int scale;
 };
@@ -26,7 +26,10 @@ void *qemu_vfio_pci_map_bar(QEMUVFIOState *s, int index,
                             Error **errp);
 void qemu_vfio_pci_unmap_bar(QEMUVFIOState *s, int index, void *bar,
                              uint64_t offset, uint64_t size);
+int qemu_vfio_pci_get_irq_count(QEMUVFIOState *s, int irq_type, Error **errp);
 int qemu_vfio_pci_init_irq(QEMUVFIOState *s, EventNotifier *e,
                            int irq_type, Error **errp);
+int qemu_vfio_pci_init_irqs(QEMUVFIOState *s, EventNotifier **e,
+                            unsigned nr_irqs, int irq_type, Error **errp);
 
 #endif
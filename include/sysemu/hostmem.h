@@ -65,6 +65,7 @@ struct HostMemoryBackendClass {
  * @size: amount of memory backend provides
  * @mr: MemoryRegion representing host memory belonging to backend
  * @prealloc_threads: number of threads to be used for preallocatining RAM
+ * @prealloc_job: preallocation still running in the background, if any
  */
 struct HostMemoryBackend {
     /* private */
@@ -73,10 +74,11 @@ struct HostMemoryBackend {
     /* protected */
     uint64_t size;
     bool merge, dump, use_canonical_path;
-    bool prealloc, is_mapped, share, reserve;
+    bool prealloc, prealloc_background, is_mapped, share, reserve;
     bool guest_memfd, aligned;
     uint32_t prealloc_threads;
     ThreadContext *prealloc_context;
+    MemPreallocJob *prealloc_job;
     DECLARE_BITMAP(host_nodes, MAX_NODES + 1);
     HostMemPolicy policy;
 
@@ -90,5 +92,6 @@ void host_memory_backend_set_mapped(HostMemoryBackend *backend, bool mapped);
 bool host_memory_backend_is_mapped(HostMemoryBackend *backend);
 size_t host_memory_backend_pagesize(HostMemoryBackend *memdev);
 char *host_memory_backend_get_name(HostMemoryBackend *backend);
+void host_memory_backend_cancel_prealloc(HostMemoryBackend *backend);
 
 #endif
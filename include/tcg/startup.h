@@ -36,6 +36,15 @@
  */
 void tcg_init(size_t tb_size, int splitwx, unsigned max_cpus);
 
+/**
+ * tcg_set_code_gen_buffer_hint: Suggest an address for the JIT buffer
+ * @hint: preferred start address of the buffer
+ *
+ * Must be called before tcg_init().  The buffer is placed at @hint
+ * if the host has that range available, and anywhere otherwise.
+ */
+void tcg_set_code_gen_buffer_hint(void *hint);
+
 /**
  * tcg_register_thread: Register this thread with the TCG runtime
  *
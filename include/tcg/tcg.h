@@ -759,6 +759,8 @@ void tcg_pool_reset(TCGContext *s);
 TranslationBlock *tcg_tb_alloc(TCGContext *s);
 
 void tcg_region_reset_all(void);
+ssize_t tcg_region_evict(GFunc func, gpointer data);
+extern uint8_t *tcg_region_referenced;
 
 size_t tcg_code_size(void);
 size_t tcg_code_capacity(void);
@@ -0,0 +1,42 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Persistent translation cache for user-mode emulation
+ */
+
+#ifndef USER_TB_CACHE_H
+#define USER_TB_CACHE_H
+
+#ifndef CONFIG_USER_ONLY
+#error Cannot include this header from system emulation
+#endif
+
+/**
+ * tb_cache_init: Enable the persistent translation cache
+ * @dir: directory holding the cache files
+ * @execfd: file descriptor of the guest executable
+ *
+ * Select the cache file for the guest executable and ask for the
+ * translation buffer to be placed where the cached code expects it.
+ * Must be called before the TCG accelerator is initialized.
+ */
+void tb_cache_init(const char *dir, int execfd);
+
+/**
+ * tb_cache_load: Load the persistent translation cache
+ * @cpu_model: the -cpu option the guest CPU was created from
+ *
+ * Must be called after tcg_prologue_init(), before any translation.
+ * Translations from the cache are only used if the buffer, the QEMU
+ * binary, guest_base and the host and guest CPU all match those of
+ * the process that wrote it.
+ */
+void tb_cache_load(const char *cpu_model);
+
+/**
+ * tb_cache_save: Write the translation cache back to disk
+ *
+ * Called when the guest process exits.
+ */
+void tb_cache_save(void);
+
+#endif
@@ -0,0 +1,38 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Speculative translation for user-mode emulation
+ */
+
+#ifndef USER_TB_SPEC_H
+#define USER_TB_SPEC_H
+
+#ifndef CONFIG_USER_ONLY
+#error Cannot include this header from system emulation
+#endif
+
+/**
+ * tb_spec_enable: Enable speculative translation
+ *
+ * Translate the direct jump targets of new TranslationBlocks in a
+ * background thread, so that the vCPU threads usually find them already
+ * translated.  The thread is started when the first target is queued.
+ */
+void tb_spec_enable(void);
+
+/**
+ * tb_spec_fork_start: Prepare the speculative translator for fork()
+ *
+ * Called with mmap_lock held.
+ */
+void tb_spec_fork_start(void);
+
+/**
+ * tb_spec_fork_end: Resume the speculative translator after fork()
+ * @child: true in the child process
+ *
+ * The background thread does not exist in the child; it is started
+ * again on demand.
+ */
+void tb_spec_fork_end(bool child);
+
+#endif
@@ -17,6 +17,7 @@
 #include "qemu/module.h"
 #include "block/aio.h"
 #include "block/block.h"
+#include "block/thread-pool.h"
 #include "sysemu/event-loop-base.h"
 #include "sysemu/iothread.h"
 #include "qapi/error.h"
@@ -103,6 +104,7 @@ static void iothread_instance_init(Object *obj)
     IOThread *iothread = IOTHREAD(obj);
 
     iothread->poll_max_ns = IOTHREAD_POLL_MAX_NS_DEFAULT;
+    iothread->io_uring_sqpoll_cpu = -1;
     iothread->thread_id = -1;
     qemu_sem_init(&iothread->init_done_sem, 0);
     /* By default, we don't run gcontext */
@@ -172,6 +174,10 @@ static void iothread_set_aio_context_params(EventLoopBase *base, Error **errp)
     aio_context_set_aio_params(iothread->ctx,
                                iothread->parent_obj.aio_max_batch);
 
+    aio_context_set_io_uring_params(iothread->ctx, iothread->io_uring_sqpoll,
+                                    iothread->io_uring_sqpoll_idle,
+                                    iothread->io_uring_sqpoll_cpu);
+
     aio_context_set_thread_pool_params(iothread->ctx, base->thread_pool_min,
                                        base->thread_pool_max, errp);
 }
@@ -222,6 +228,7 @@ static void iothread_init(EventLoopBase *base, Error **errp)
 typedef struct {
     const char *name;
     ptrdiff_t offset; /* field's byte offset in IOThread struct */
+    int64_t min; /* smallest accepted value */
 } IOThreadParamInfo;
 
 static IOThreadParamInfo poll_max_ns_info = {
@@ -233,6 +240,12 @@ static IOThreadParamInfo poll_grow_info = {
 static IOThreadParamInfo poll_shrink_info = {
     "poll-shrink", offsetof(IOThread, poll_shrink),
 };
+static IOThreadParamInfo io_uring_sqpoll_idle_info = {
+    "io-uring-sqpoll-idle", offsetof(IOThread, io_uring_sqpoll_idle),
+};
+static IOThreadParamInfo io_uring_sqpoll_cpu_info = {
+    "io-uring-sqpoll-cpu", offsetof(IOThread, io_uring_sqpoll_cpu), -1,
+};
 
 static void iothread_get_param(Object *obj, Visitor *v,
         const char *name, IOThreadParamInfo *info, Error **errp)
@@ -254,9 +267,9 @@ static bool iothread_set_param(Object *obj, Visitor *v,
         return false;
     }
 
-    if (value < 0) {
-        error_setg(errp, "%s value must be in range [0, %" PRId64 "]",
-                   info->name, INT64_MAX);
+    if (value < info->min) {
+        error_setg(errp, "%s value must be in range [%" PRId64 ", %" PRId64 "]",
+                   info->name, info->min, INT64_MAX);
         return false;
     }
 
@@ -292,6 +305,55 @@ static void iothread_set_poll_param(Object *obj, Visitor *v,
     }
 }
 
+static void iothread_update_io_uring_params(IOThread *iothread)
+{
+    if (iothread->ctx) {
+        aio_context_set_io_uring_params(iothread->ctx,
+                                        iothread->io_uring_sqpoll,
+                                        iothread->io_uring_sqpoll_idle,
+                                        iothread->io_uring_sqpoll_cpu);
+    }
+}
+
+static bool iothread_get_io_uring_sqpoll(Object *obj, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+
+    return iothread->io_uring_sqpoll;
+}
+
+static void iothread_set_io_uring_sqpoll(Object *obj, bool value,
+                                         Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+
+    iothread->io_uring_sqpoll = value;
+    iothread_update_io_uring_params(iothread);
+}
+
+static void iothread_set_io_uring_param(Object *obj, Visitor *v,
+        const char *name, void *opaque, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+    IOThreadParamInfo *info = opaque;
+    int64_t *field = (void *)iothread + info->offset;
+    int64_t old = *field;
+
+    if (!iothread_set_param(obj, v, name, info, errp)) {
+        return;
+    }
+
+    /* Both the idle time and the CPU number are 32 bits for the kernel */
+    if (*field > INT32_MAX) {
+        error_setg(errp, "%s value must be in range [0, %" PRId32 "]",
+                   info->name, INT32_MAX);
+        *field = old;
+        return;
+    }
+
+    iothread_update_io_uring_params(iothread);
+}
+
 static void iothread_class_init(ObjectClass *klass, void *class_data)
 {
     EventLoopBaseClass *bc = EVENT_LOOP_BASE_CLASS(klass);
@@ -311,6 +373,17 @@ static void iothread_class_init(ObjectClass *klass, void *class_data)
                               iothread_get_poll_param,
                               iothread_set_poll_param,
                               NULL, &poll_shrink_info);
+    object_class_property_add_bool(klass, "io-uring-sqpoll",
+                                   iothread_get_io_uring_sqpoll,
+                                   iothread_set_io_uring_sqpoll);
+    object_class_property_add(klass, "io-uring-sqpoll-idle", "int",
+                              iothread_get_poll_param,
+                              iothread_set_io_uring_param,
+                              NULL, &io_uring_sqpoll_idle_info);
+    object_class_property_add(klass, "io-uring-sqpoll-cpu", "int",
+                              iothread_get_poll_param,
+                              iothread_set_io_uring_param,
+                              NULL, &io_uring_sqpoll_cpu_info);
 }
 
 static const TypeInfo iothread_info = {
@@ -344,6 +417,7 @@ static int query_one_iothread(Object *object, void *opaque)
     IOThreadInfoList ***tail = opaque;
     IOThreadInfo *info;
     IOThread *iothread;
+    ThreadPool *pool;
 
     iothread = (IOThread *)object_dynamic_cast(object, TYPE_IOTHREAD);
     if (!iothread) {
@@ -358,6 +432,13 @@ static int query_one_iothread(Object *object, void *opaque)
     info->poll_shrink = iothread->poll_shrink;
     info->aio_max_batch = iothread->parent_obj.aio_max_batch;
 
+    /* The pool is created on first use and lives as long as the AioContext */
+    pool = iothread->ctx ? qatomic_read(&iothread->ctx->thread_pool) : NULL;
+    if (pool) {
+        info->thread_pool = g_new0(ThreadPoolStats, 1);
+        thread_pool_get_stats(pool, info->thread_pool);
+    }
+
     QAPI_LIST_APPEND(*tail, info);
     return 0;
 }
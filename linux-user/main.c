@@ -39,6 +39,8 @@
 #include "qemu/module.h"
 #include "qemu/plugin.h"
 #include "user/guest-base.h"
+#include "user/tb-cache.h"
+#include "user/tb-spec.h"
 #include "exec/exec-all.h"
 #include "exec/gdbstub.h"
 #include "gdbstub/user.h"
@@ -71,6 +73,7 @@ char *exec_path;
 char real_exec_path[PATH_MAX];
 
 static bool opt_one_insn_per_tb;
+static unsigned opt_hot_trace_threshold;
 static const char *argv0;
 static const char *gdbstub;
 static envlist_t *envlist;
@@ -144,6 +147,7 @@ void fork_start(void)
 {
     start_exclusive();
     mmap_fork_start();
+    tb_spec_fork_start();
     cpu_list_lock();
     qemu_plugin_user_prefork_lock();
     gdbserver_fork_start();
@@ -154,6 +158,7 @@ void fork_end(pid_t pid)
     bool child = pid == 0;
 
     qemu_plugin_user_postfork(child);
+    tb_spec_fork_end(child);
     mmap_fork_end(child);
     if (child) {
         CPUState *cpu, *next_cpu;
@@ -417,6 +422,14 @@ static void handle_arg_one_insn_per_tb(const char *arg)
     opt_one_insn_per_tb = true;
 }
 
+static void handle_arg_hot_traces(const char *arg)
+{
+    if (qemu_strtoui(arg, NULL, 10, &opt_hot_trace_threshold)) {
+        fprintf(stderr, "Invalid hot trace threshold '%s'\n", arg);
+        exit(EXIT_FAILURE);
+    }
+}
+
 static void handle_arg_strace(const char *arg)
 {
     enable_strace = true;
@@ -451,6 +464,20 @@ static void handle_arg_jitdump(const char *arg)
     perf_enable_jitdump();
 }
 
+static const char *tb_cache_dir;
+
+static void handle_arg_tb_cache(const char *arg)
+{
+    tb_cache_dir = arg;
+}
+
+static bool opt_spec_translate;
+
+static void handle_arg_spec_translate(const char *arg)
+{
+    opt_spec_translate = true;
+}
+
 static QemuPluginList plugins = QTAILQ_HEAD_INITIALIZER(plugins);
 
 #ifdef CONFIG_PLUGIN
@@ -506,6 +533,8 @@ static const struct qemu_argument arg_table[] = {
     {"one-insn-per-tb",
                    "QEMU_ONE_INSN_PER_TB",  false, handle_arg_one_insn_per_tb,
      "",           "run with one guest instruction per emulated TB"},
+    {"hot-traces", "QEMU_HOT_TRACES",  true,  handle_arg_hot_traces,
+     "n",          "retranslate TBs run 'n' times as traces (0: never)"},
     {"strace",     "QEMU_STRACE",      false, handle_arg_strace,
      "",           "log system calls"},
     {"seed",       "QEMU_RAND_SEED",   true,  handle_arg_seed,
@@ -526,6 +555,10 @@ static const struct qemu_argument arg_table[] = {
      "",           "Generate a /tmp/perf-${pid}.map file for perf"},
     {"jitdump",    "QEMU_JITDUMP",     false, handle_arg_jitdump,
      "",           "Generate a jit-${pid}.dump file for perf"},
+    {"tb-cache",   "QEMU_TB_CACHE",    true,  handle_arg_tb_cache,
+     "dir",        "keep translated code across runs in directory 'dir'"},
+    {"spec-translate", "QEMU_SPEC_TRANSLATE", false, handle_arg_spec_translate,
+     "",           "translate jump targets ahead in a background thread"},
     {NULL, NULL, false, NULL, NULL, NULL}
 };
 
@@ -789,6 +822,23 @@ int main(int argc, char **argv, char **envp)
     }
     cpu_type = parse_cpu_option(cpu_model);
 
+    if (tb_cache_dir) {
+        if (QTAILQ_EMPTY(&plugins)) {
+            tb_cache_init(tb_cache_dir, execfd);
+        } else {
+            warn_report("translation cache is not supported with plugins");
+        }
+    }
+
+    if (opt_spec_translate) {
+        if (QTAILQ_EMPTY(&plugins)) {
+            tb_spec_enable();
+        } else {
+            warn_report("speculative translation is not supported "
+                        "with plugins");
+        }
+    }
+
     /* init tcg before creating CPUs */
     {
         AccelState *accel = current_accel();
@@ -797,6 +847,8 @@ int main(int argc, char **argv, char **envp)
         accel_init_interfaces(ac);
         object_property_set_bool(OBJECT(accel), "one-insn-per-tb",
                                  opt_one_insn_per_tb, &error_abort);
+        object_property_set_uint(OBJECT(accel), "hot-trace-threshold",
+                                 opt_hot_trace_threshold, &error_abort);
         ac->init_machine(NULL);
     }
 
@@ -1008,6 +1060,7 @@ int main(int argc, char **argv, char **envp)
        generating the prologue until now so that the prologue can take
        the real value of GUEST_BASE into account.  */
     tcg_prologue_init();
+    tb_cache_load(cpu_model);
 
     target_cpu_copy_regs(env, regs);
 
@@ -0,0 +1,544 @@
+/*
+ * Lazy loading of RAM from mapped-ram migration files
+ *
+ * With the mapped-ram capability every RAM page has a fixed offset in the
+ * migration file, so the destination does not have to read all of RAM
+ * before the guest can run.  Instead, guest RAM is registered with
+ * userfaultfd and each page is read from the file when it is first
+ * touched, while a background thread prefetches the remaining pages.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bitmap.h"
+#include "qemu/error-report.h"
+#include "qemu/lockable.h"
+#include "qemu/main-loop.h"
+#include "qemu/units.h"
+#include "qapi/error.h"
+#include "exec/memory.h"
+#include "exec/ramblock.h"
+#include "exec/target_page.h"
+#include "io/channel-file.h"
+#include "lazy-load.h"
+#include "migration.h"
+#include "ram.h"
+#include "trace.h"
+
+#ifdef CONFIG_LINUX
+
+#include <poll.h>
+#include "qemu/event_notifier.h"
+#include "qemu/thread.h"
+#include "qemu/userfaultfd.h"
+
+/* Amount of RAM the prefetch thread reads and places at once */
+#define LAZY_LOAD_PREFETCH_SIZE (2 * MiB)
+
+typedef struct LazyLoadBlock {
+    RAMBlock *rb;
+    uint8_t *host;
+    ram_addr_t length;
+    size_t pagesize;
+    /* Offset of the pages of the block in the migration file */
+    uint64_t pages_offset;
+    /* Target pages that were written to the file; the others are zero */
+    unsigned long *file_bmap;
+    /* Host pages that nobody started to load yet */
+    unsigned long *pending;
+    /* Host pages that are being read and placed outside the lock */
+    unsigned long *loading;
+    unsigned long nr_pages;
+} LazyLoadBlock;
+
+typedef struct LazyLoadState {
+    /* Our own channel: the incoming one is closed when loadvm completes */
+    QIOChannel *ioc;
+    int uffd;
+    EventNotifier quit;
+    QemuThread fault_thread;
+    QemuThread prefetch_thread;
+    bool prefetch_started;
+    bool stop;
+    bool failed;
+
+    /* Protects blocks and the pending and loading bitmaps */
+    QemuMutex lock;
+    GPtrArray *blocks;
+} LazyLoadState;
+
+static LazyLoadState *lazy_load;
+
+static void lazy_load_error_bh(void *opaque)
+{
+    MigrationIncomingState *mis = migration_incoming_get_current();
+    Error *err = opaque;
+
+    migrate_set_error(migrate_get_current(), err);
+    migrate_set_state(&mis->state, MIGRATION_STATUS_ACTIVE,
+                      MIGRATION_STATUS_FAILED);
+    migrate_set_state(&mis->state, MIGRATION_STATUS_COMPLETED,
+                      MIGRATION_STATUS_FAILED);
+
+    error_report_err(err);
+    if (mis->exit_on_error) {
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * Fail the incoming migration with @err, from any thread.  There is no
+ * source to recover from: guest threads waiting for pages that cannot be
+ * loaded stay blocked, and QEMU exits unless exit-on-error was disabled.
+ */
+static void lazy_load_set_error(LazyLoadState *s, Error *err)
+{
+    if (qatomic_xchg(&s->failed, true)) {
+        error_free(err);
+        return;
+    }
+    error_prepend(&err, "lazy RAM load: ");
+    aio_bh_schedule_oneshot(qemu_get_aio_context(), lazy_load_error_bh, err);
+}
+
+static LazyLoadBlock *lazy_load_find_block(LazyLoadState *s, uint64_t addr)
+{
+    unsigned i;
+
+    for (i = 0; i < s->blocks->len; i++) {
+        LazyLoadBlock *b = g_ptr_array_index(s->blocks, i);
+
+        if (addr >= (uintptr_t)b->host &&
+            addr < (uintptr_t)b->host + b->length) {
+            return b;
+        }
+    }
+    return NULL;
+}
+
+/* Called with s->lock held. */
+static void lazy_load_claim(LazyLoadBlock *b, unsigned long page,
+                            unsigned long count)
+{
+    bitmap_clear(b->pending, page, count);
+    bitmap_set(b->loading, page, count);
+}
+
+/*
+ * Read @count host pages of @b starting at @page from the migration file
+ * into @buf and place them atomically.  The pages must have been claimed
+ * with lazy_load_claim().  Called without s->lock, so that faults can be
+ * served while the prefetch thread reads.
+ */
+static bool lazy_load_place(LazyLoadState *s, LazyLoadBlock *b,
+                            unsigned long page, unsigned long count,
+                            uint8_t *buf)
+{
+    unsigned int tp_bits = qemu_target_page_bits();
+    ram_addr_t offset = (ram_addr_t)page * b->pagesize;
+    size_t size = count * b->pagesize;
+    unsigned long tp_start = offset >> tp_bits;
+    unsigned long tp_end = (offset + size) >> tp_bits;
+    unsigned long tp;
+    Error *local_err = NULL;
+    size_t done = 0;
+
+    if (find_next_bit(b->file_bmap, tp_end, tp_start) >= tp_end) {
+        /* Zero pages are not written to the file */
+        memset(buf, 0, size);
+    } else {
+        while (done < size) {
+            ssize_t ret = qio_channel_pread(s->ioc, (char *)buf + done,
+                                            size - done,
+                                            b->pages_offset + offset + done,
+                                            &local_err);
+            if (ret <= 0) {
+                if (!local_err) {
+                    error_setg(&local_err, "unexpected end of file");
+                }
+                error_prepend(&local_err, "(%s) failed to read page "
+                              RAM_ADDR_FMT ": ", qemu_ram_get_idstr(b->rb),
+                              offset + done);
+                lazy_load_set_error(s, local_err);
+                return false;
+            }
+            done += ret;
+        }
+
+        /* The file may hold stale data where zero pages were skipped */
+        for (tp = tp_start; tp < tp_end; tp++) {
+            if (!test_bit(tp, b->file_bmap)) {
+                memset(buf + ((tp - tp_start) << tp_bits), 0, 1 << tp_bits);
+            }
+        }
+    }
+
+    /* This also wakes up any thread that faulted on the pages meanwhile */
+    if (uffd_copy_page(s->uffd, b->host + offset, buf, size, false)) {
+        error_setg(&local_err, "(%s) failed to place page " RAM_ADDR_FMT,
+                   qemu_ram_get_idstr(b->rb), offset);
+        lazy_load_set_error(s, local_err);
+        return false;
+    }
+
+    WITH_QEMU_LOCK_GUARD(&s->lock) {
+        bitmap_clear(b->loading, page, count);
+    }
+    return true;
+}
+
+static void lazy_load_fault(LazyLoadState *s, uint64_t addr,
+                            uint8_t **buf, size_t *buf_size)
+{
+    LazyLoadBlock *b = NULL;
+    unsigned long page = 0;
+
+    WITH_QEMU_LOCK_GUARD(&s->lock) {
+        b = lazy_load_find_block(s, addr);
+        if (!b) {
+            Error *local_err = NULL;
+
+            error_setg(&local_err, "fault outside guest RAM: %" PRIx64, addr);
+            lazy_load_set_error(s, local_err);
+            return;
+        }
+
+        page = (addr - (uintptr_t)b->host) / b->pagesize;
+        trace_lazy_load_fault(qemu_ram_get_idstr(b->rb), page * b->pagesize,
+                              test_bit(page, b->pending));
+
+        if (!test_bit(page, b->pending)) {
+            if (!test_bit(page, b->loading)) {
+                /* Placed by the prefetch thread since the fault was raised */
+                uffd_wakeup(s->uffd, b->host + page * b->pagesize,
+                            b->pagesize);
+            }
+            /* Otherwise, placing the page wakes the faulting thread up */
+            return;
+        }
+        lazy_load_claim(b, page, 1);
+    }
+
+    if (*buf_size < b->pagesize) {
+        qemu_vfree(*buf);
+        *buf = qemu_memalign(qemu_real_host_page_size(), b->pagesize);
+        *buf_size = b->pagesize;
+    }
+    lazy_load_place(s, b, page, 1, *buf);
+}
+
+static void *lazy_load_fault_thread(void *opaque)
+{
+    LazyLoadState *s = opaque;
+    struct pollfd pfd[2] = {
+        { .fd = s->uffd, .events = POLLIN },
+        { .fd = event_notifier_get_fd(&s->quit), .events = POLLIN },
+    };
+    struct uffd_msg msg;
+    uint8_t *buf = NULL;
+    size_t buf_size = 0;
+
+    while (true) {
+        if (poll(pfd, ARRAY_SIZE(pfd), -1) < 0) {
+            Error *local_err = NULL;
+
+            if (errno == EINTR) {
+                continue;
+            }
+            error_setg_errno(&local_err, errno, "poll failed");
+            lazy_load_set_error(s, local_err);
+            break;
+        }
+
+        if (pfd[1].revents) {
+            break;
+        }
+        if (!(pfd[0].revents & POLLIN) ||
+            uffd_read_events(s->uffd, &msg, 1) != 1) {
+            continue;
+        }
+        if (msg.event != UFFD_EVENT_PAGEFAULT) {
+            continue;
+        }
+        lazy_load_fault(s, msg.arg.pagefault.address, &buf, &buf_size);
+    }
+
+    qemu_vfree(buf);
+    return NULL;
+}
+
+static void lazy_load_cleanup(LazyLoadState *s)
+{
+    unsigned i;
+
+    qatomic_set(&s->stop, true);
+    if (s->prefetch_started) {
+        qemu_thread_join(&s->prefetch_thread);
+    }
+    event_notifier_set(&s->quit);
+    qemu_thread_join(&s->fault_thread);
+
+    for (i = 0; i < s->blocks->len; i++) {
+        LazyLoadBlock *b = g_ptr_array_index(s->blocks, i);
+
+        uffd_unregister_memory(s->uffd, b->host, b->length);
+        g_free(b->file_bmap);
+        g_free(b->pending);
+        g_free(b->loading);
+        g_free(b);
+    }
+    g_ptr_array_free(s->blocks, true);
+
+    uffd_close_fd(s->uffd);
+    event_notifier_cleanup(&s->quit);
+    qemu_mutex_destroy(&s->lock);
+    object_unref(OBJECT(s->ioc));
+    g_free(s);
+}
+
+static void lazy_load_finish_bh(void *opaque)
+{
+    LazyLoadState *s = opaque;
+
+    assert(s == lazy_load);
+    lazy_load = NULL;
+    lazy_load_cleanup(s);
+    trace_lazy_load_finish();
+}
+
+static void *lazy_load_prefetch_thread(void *opaque)
+{
+    LazyLoadState *s = opaque;
+    size_t buf_size = LAZY_LOAD_PREFETCH_SIZE;
+    uint8_t *buf;
+    unsigned i;
+
+    /* No block is added once the prefetch thread runs */
+    for (i = 0; i < s->blocks->len; i++) {
+        LazyLoadBlock *b = g_ptr_array_index(s->blocks, i);
+
+        buf_size = MAX(buf_size, b->pagesize);
+    }
+    buf = qemu_memalign(qemu_real_host_page_size(), buf_size);
+
+    for (i = 0; i < s->blocks->len; i++) {
+        LazyLoadBlock *b = g_ptr_array_index(s->blocks, i);
+        unsigned long run = buf_size / b->pagesize;
+        unsigned long page = 0, end = 0;
+
+        while (!qatomic_read(&s->stop)) {
+            WITH_QEMU_LOCK_GUARD(&s->lock) {
+                page = find_next_bit(b->pending, b->nr_pages, page);
+                if (page < b->nr_pages) {
+                    end = find_next_zero_bit(b->pending,
+                                             MIN(b->nr_pages, page + run),
+                                             page);
+                    lazy_load_claim(b, page, end - page);
+                }
+            }
+            if (page >= b->nr_pages) {
+                break;
+            }
+            if (!lazy_load_place(s, b, page, end - page, buf)) {
+                goto out;
+            }
+            page = end;
+        }
+    }
+
+    if (!qatomic_read(&s->stop) && !qatomic_read(&s->failed)) {
+        aio_bh_schedule_oneshot(qemu_get_aio_context(),
+                                lazy_load_finish_bh, s);
+    }
+out:
+    qemu_vfree(buf);
+    return NULL;
+}
+
+bool lazy_load_supported(Error **errp)
+{
+    uint64_t features;
+
+    if (uffd_query_features(&features)) {
+        error_setg(errp, "userfaultfd is not available");
+        return false;
+    }
+    return true;
+}
+
+static LazyLoadState *lazy_load_new(QEMUFile *f, Error **errp)
+{
+    LazyLoadState *s;
+    QIOChannel *file_ioc = qemu_file_get_ioc(f);
+    QIOChannelFile *ioc;
+    RAMBlock *block;
+    uint64_t features = 0;
+    int uffd;
+
+    /*
+     * RAM is discarded and its pages must stay missing until they are
+     * copied in from the file.  Stop the background preallocation threads
+     * that would fault them in, then give up if something else, such as
+     * a device that pins guest memory, needs discards to be disabled.
+     */
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        ram_block_cancel_prealloc(block);
+    }
+    if (ram_block_discard_is_disabled()) {
+        error_setg(errp, "lazy RAM load cannot be used while RAM discards"
+                   " are disabled");
+        return NULL;
+    }
+
+    /*
+     * The incoming channel is closed as soon as loadvm completes, while
+     * pages keep being read long after that: use a duplicate of its fd.
+     */
+    if (!object_dynamic_cast(OBJECT(file_ioc), TYPE_QIO_CHANNEL_FILE)) {
+        error_setg(errp, "lazy RAM load requires a file migration channel");
+        return NULL;
+    }
+
+    /* Ask for the features needed by hugetlbfs and shmem backed RAM */
+    if (uffd_query_features(&features)) {
+        error_setg(errp, "userfaultfd is not available");
+        return NULL;
+    }
+    features &= UFFD_FEATURE_MISSING_HUGETLBFS | UFFD_FEATURE_MISSING_SHMEM;
+
+    uffd = uffd_create_fd(features, true);
+    if (uffd < 0) {
+        error_setg(errp, "could not create userfaultfd");
+        return NULL;
+    }
+
+    ioc = qio_channel_file_new_dupfd(QIO_CHANNEL_FILE(file_ioc)->fd, errp);
+    if (!ioc) {
+        uffd_close_fd(uffd);
+        return NULL;
+    }
+
+    s = g_new0(LazyLoadState, 1);
+    s->uffd = uffd;
+    s->ioc = QIO_CHANNEL(ioc);
+    s->blocks = g_ptr_array_new();
+    qemu_mutex_init(&s->lock);
+    event_notifier_init(&s->quit, false);
+
+    qemu_thread_create(&s->fault_thread, "mig/dst/lazy",
+                       lazy_load_fault_thread, s, QEMU_THREAD_JOINABLE);
+    return s;
+}
+
+/*
+ * Take over the loading of @block, whose pages listed in @file_bmap are
+ * in the migration file behind @f.  @file_bmap is freed by the lazy
+ * loader.
+ */
+bool lazy_load_add_ramblock(QEMUFile *f, RAMBlock *block,
+                            unsigned long *file_bmap, Error **errp)
+{
+    LazyLoadState *s = lazy_load;
+    LazyLoadBlock *b;
+    uint64_t ioctls;
+
+    if (!s) {
+        s = lazy_load_new(f, errp);
+        if (!s) {
+            g_free(file_bmap);
+            return false;
+        }
+        lazy_load = s;
+    }
+
+    b = g_new0(LazyLoadBlock, 1);
+    b->rb = block;
+    b->host = block->host;
+    b->length = block->used_length;
+    b->pagesize = qemu_ram_pagesize(block);
+    b->pages_offset = block->pages_offset;
+    b->file_bmap = file_bmap;
+    b->nr_pages = b->length / b->pagesize;
+    b->pending = bitmap_new(b->nr_pages);
+    bitmap_set(b->pending, 0, b->nr_pages);
+    b->loading = bitmap_new(b->nr_pages);
+
+    /* Whatever was written at init (ROMs, tables) comes from the file */
+    if (ram_discard_range(block->idstr, 0, b->length)) {
+        error_setg(errp, "(%s) could not discard RAM", block->idstr);
+        goto fail;
+    }
+    if (uffd_register_memory(s->uffd, b->host, b->length,
+                             UFFDIO_REGISTER_MODE_MISSING, &ioctls)) {
+        error_setg(errp, "(%s) could not register RAM with userfaultfd",
+                   block->idstr);
+        goto fail;
+    }
+    if (!(ioctls & BIT(_UFFDIO_COPY))) {
+        uffd_unregister_memory(s->uffd, b->host, b->length);
+        error_setg(errp, "(%s) RAM does not support UFFDIO_COPY",
+                   block->idstr);
+        goto fail;
+    }
+
+    WITH_QEMU_LOCK_GUARD(&s->lock) {
+        g_ptr_array_add(s->blocks, b);
+    }
+
+    trace_lazy_load_add_ramblock(block->idstr, b->length);
+    return true;
+
+fail:
+    g_free(b->file_bmap);
+    g_free(b->pending);
+    g_free(b->loading);
+    g_free(b);
+    return false;
+}
+
+/*
+ * Called once the whole migration stream was loaded.  On success, start
+ * prefetching the pages that have not been touched yet; otherwise stop
+ * serving page faults.
+ */
+void lazy_load_loadvm_done(bool success)
+{
+    LazyLoadState *s = lazy_load;
+
+    if (!s) {
+        return;
+    }
+
+    if (!success) {
+        lazy_load = NULL;
+        lazy_load_cleanup(s);
+        return;
+    }
+
+    s->prefetch_started = true;
+    qemu_thread_create(&s->prefetch_thread, "mig/dst/prefetch",
+                       lazy_load_prefetch_thread, s, QEMU_THREAD_JOINABLE);
+}
+
+#else /* !CONFIG_LINUX */
+
+bool lazy_load_supported(Error **errp)
+{
+    error_setg(errp, "lazy RAM loading requires userfaultfd");
+    return false;
+}
+
+bool lazy_load_add_ramblock(QEMUFile *f, RAMBlock *block,
+                            unsigned long *file_bmap, Error **errp)
+{
+    g_free(file_bmap);
+    return lazy_load_supported(errp);
+}
+
+void lazy_load_loadvm_done(bool success)
+{
+}
+
+#endif /* CONFIG_LINUX */
@@ -0,0 +1,19 @@
+/*
+ * Lazy loading of RAM from mapped-ram migration files
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef QEMU_MIGRATION_LAZY_LOAD_H
+#define QEMU_MIGRATION_LAZY_LOAD_H
+
+#include "exec/cpu-common.h"
+#include "qemu-file.h"
+
+bool lazy_load_supported(Error **errp);
+bool lazy_load_add_ramblock(QEMUFile *f, RAMBlock *block,
+                            unsigned long *file_bmap, Error **errp);
+void lazy_load_loadvm_done(bool success);
+
+#endif
@@ -55,6 +55,15 @@ typedef struct {
      * copy.
      */
     Stat64 dirty_sync_missed_zero_copy;
+    /*
+     * Time in microseconds taken by the last dirty bitmap sync.
+     */
+    Stat64 dirty_sync_time;
+    /*
+     * Part of dirty_sync_time spent merging the dirty memory log into
+     * the migration bitmap.
+     */
+    Stat64 dirty_sync_merge_time;
     /*
      * Number of bytes sent at migration completion stage while the
      * guest is stopped.
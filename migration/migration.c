@@ -46,6 +46,7 @@
 #include "qapi/qmp/qnull.h"
 #include "qemu/rcu.h"
 #include "postcopy-ram.h"
+#include "lazy-load.h"
 #include "qemu/thread.h"
 #include "trace.h"
 #include "exec/target_page.h"
@@ -794,6 +795,7 @@ process_incoming_migration_co(void *opaque)
     mis->loadvm_co = qemu_coroutine_self();
     ret = qemu_loadvm_state(mis->from_src_file);
     mis->loadvm_co = NULL;
+    lazy_load_loadvm_done(ret >= 0);
 
     trace_vmstate_downtime_checkpoint("dst-precopy-loadvm-completed");
 
@@ -1199,6 +1201,10 @@ static void populate_ram_info(MigrationInfo *info, MigrationState *s)
         stat64_get(&mig_stats.dirty_sync_count);
     info->ram->dirty_sync_missed_zero_copy =
         stat64_get(&mig_stats.dirty_sync_missed_zero_copy);
+    info->ram->dirty_sync_time =
+        stat64_get(&mig_stats.dirty_sync_time);
+    info->ram->dirty_sync_merge_time =
+        stat64_get(&mig_stats.dirty_sync_merge_time);
     info->ram->postcopy_requests =
         stat64_get(&mig_stats.postcopy_requests);
     info->ram->page_size = page_size;
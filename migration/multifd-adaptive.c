@@ -0,0 +1,138 @@
+/*
+ * Multifd adaptive compression
+ *
+ * Lets each multifd channel decide, packet by packet, whether running
+ * the configured compression method over the pages is cheaper than
+ * putting them on the wire as they are.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "exec/ramblock.h"
+#include "multifd.h"
+#include "options.h"
+#include "trace.h"
+
+/*
+ * Compressed output above this fraction of the input (in 1/1024
+ * units) is never worth the CPU time, whatever the link speed.
+ */
+#define MULTIFD_ADAPTIVE_MAX_RATIO      973     /* ~95% */
+
+/* Upper bound for the number of packets sent raw between two probes */
+#define MULTIFD_ADAPTIVE_MAX_BACKOFF    64
+
+/* Weight of the newest sample in the moving averages, as 1/2^shift */
+#define MULTIFD_ADAPTIVE_EWMA_SHIFT     2
+
+static uint64_t multifd_adaptive_ewma(uint64_t avg, uint64_t sample)
+{
+    if (!avg) {
+        return sample;
+    }
+    return avg - (avg >> MULTIFD_ADAPTIVE_EWMA_SHIFT) +
+           (sample >> MULTIFD_ADAPTIVE_EWMA_SHIFT);
+}
+
+/*
+ * The compression methods only need two iovs (packet header and
+ * compressed buffer); a packet sent raw needs one per page.
+ */
+uint32_t multifd_adaptive_send_iov_count(uint32_t iov_count)
+{
+    if (!migrate_multifd_adaptive_compression()) {
+        return iov_count;
+    }
+    return MAX(iov_count, multifd_ram_page_count() + 1);
+}
+
+/*
+ * Returns true if the pages of the packet being prepared on @p should
+ * be compressed, false if they should be sent raw.
+ */
+bool multifd_send_adaptive_compress(MultiFDSendParams *p)
+{
+    MultiFDAdaptive *a = &p->adaptive;
+
+    if (!migrate_multifd_adaptive_compression()) {
+        return true;
+    }
+
+    if (a->skip) {
+        a->skip--;
+        a->packets_raw++;
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Fill @p with the normal pages of the packet, uncompressed.  The
+ * packet header must already have been added to the iov.
+ */
+void multifd_send_adaptive_prepare_raw(MultiFDSendParams *p)
+{
+    multifd_send_prepare_iovs(p);
+    p->flags |= MULTIFD_FLAG_NOCOMP;
+    multifd_send_fill_packet(p);
+}
+
+/*
+ * Record that @in bytes of pages were compressed to @out bytes in @ns
+ * nanoseconds, and decide how many of the following packets are sent
+ * raw.  Compression pays off when compressing one KiB and sending the
+ * result takes less time than sending the KiB as is.
+ */
+void multifd_send_adaptive_account_compress(MultiFDSendParams *p,
+                                            uint64_t in, uint64_t out,
+                                            int64_t ns)
+{
+    MultiFDAdaptive *a = &p->adaptive;
+    uint64_t raw_cost, compress_cost;
+    bool profitable;
+
+    if (!migrate_multifd_adaptive_compression() || !in) {
+        return;
+    }
+
+    a->ratio = multifd_adaptive_ewma(a->ratio, out * 1024 / in);
+    a->compress_ns = multifd_adaptive_ewma(a->compress_ns,
+                                           MAX(ns, 0) * 1024 / in);
+
+    raw_cost = a->send_ns;
+    compress_cost = a->compress_ns + a->send_ns * a->ratio / 1024;
+
+    profitable = a->ratio <= MULTIFD_ADAPTIVE_MAX_RATIO &&
+                 (!a->send_ns || compress_cost < raw_cost);
+
+    if (profitable) {
+        a->backoff = 0;
+    } else {
+        /*
+         * Back off exponentially while the data keeps being a bad fit,
+         * so that a channel carrying incompressible pages mostly avoids
+         * the compressor but still notices when that changes.
+         */
+        a->backoff = MIN(MAX(a->backoff * 2, 1), MULTIFD_ADAPTIVE_MAX_BACKOFF);
+        a->skip = a->backoff;
+    }
+
+    trace_multifd_send_adaptive(p->id, profitable, a->ratio,
+                                compress_cost, raw_cost);
+}
+
+/* Record that @bytes were written to the channel of @p in @ns nanoseconds */
+void multifd_send_adaptive_account_send(MultiFDSendParams *p,
+                                        uint64_t bytes, int64_t ns)
+{
+    MultiFDAdaptive *a = &p->adaptive;
+
+    if (!bytes) {
+        return;
+    }
+
+    a->send_ns = multifd_adaptive_ewma(a->send_ns, MAX(ns, 0) * 1024 / bytes);
+}
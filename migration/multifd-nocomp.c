@@ -84,7 +84,7 @@ static void multifd_nocomp_send_cleanup(MultiFDSendParams *p, Error **errp)
     return;
 }
 
-static void multifd_send_prepare_iovs(MultiFDSendParams *p)
+void multifd_send_prepare_iovs(MultiFDSendParams *p)
 {
     MultiFDPages_t *pages = &p->data->u.ram;
     uint32_t page_size = multifd_ram_page_size();
@@ -167,6 +167,16 @@ static int multifd_nocomp_recv(MultiFDRecvParams *p, Error **errp)
 
     multifd_recv_zero_page_process(p);
 
+    return multifd_ram_recv_raw(p, errp);
+}
+
+/*
+ * Read the uncompressed normal pages of a packet straight into guest
+ * memory.  Also used by the compression methods for packets that the
+ * source decided to send uncompressed.
+ */
+int multifd_ram_recv_raw(MultiFDRecvParams *p, Error **errp)
+{
     if (!p->normal_num) {
         return 0;
     }
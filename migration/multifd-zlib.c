@@ -13,6 +13,7 @@
 #include "qemu/osdep.h"
 #include <zlib.h>
 #include "qemu/rcu.h"
+#include "qemu/timer.h"
 #include "exec/ramblock.h"
 #include "exec/target_page.h"
 #include "qapi/error.h"
@@ -61,8 +62,11 @@ static int multifd_zlib_send_setup(MultiFDSendParams *p, Error **errp)
     }
     p->compress_data = z;
 
-    /* Needs 2 IOVs, one for packet header and one for compressed data */
-    p->iov = g_new0(struct iovec, 2);
+    /*
+     * Needs 2 IOVs, one for packet header and one for compressed data,
+     * plus one per page if packets may be sent uncompressed.
+     */
+    p->iov = g_new0(struct iovec, multifd_adaptive_send_iov_count(2));
 
     return 0;
 
@@ -99,6 +103,7 @@ static int multifd_zlib_send_prepare(MultiFDSendParams *p, Error **errp)
     z_stream *zs = &z->zs;
     uint32_t out_size = 0;
     uint32_t page_size = multifd_ram_page_size();
+    int64_t start;
     int ret;
     uint32_t i;
 
@@ -106,6 +111,12 @@ static int multifd_zlib_send_prepare(MultiFDSendParams *p, Error **errp)
         goto out;
     }
 
+    if (!multifd_send_adaptive_compress(p)) {
+        multifd_send_adaptive_prepare_raw(p);
+        return 0;
+    }
+
+    start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
     for (i = 0; i < pages->normal_num; i++) {
         uint32_t available = z->zbuff_len - out_size;
         int flush = Z_NO_FLUSH;
@@ -154,6 +165,10 @@ static int multifd_zlib_send_prepare(MultiFDSendParams *p, Error **errp)
     p->iovs_num++;
     p->next_packet_size = out_size;
 
+    multifd_send_adaptive_account_compress(p,
+        (uint64_t)pages->normal_num * page_size, out_size,
+        qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start);
+
 out:
     p->flags |= MULTIFD_FLAG_ZLIB;
     multifd_send_fill_packet(p);
@@ -183,6 +198,11 @@ static int multifd_zlib_recv_setup(MultiFDRecvParams *p, Error **errp)
         error_setg(errp, "multifd %u: out of memory for zbuff", p->id);
         return -1;
     }
+
+    if (migrate_multifd_adaptive_compression()) {
+        /* For packets that the source sent uncompressed */
+        p->iov = g_new0(struct iovec, multifd_ram_page_count());
+    }
     return 0;
 }
 
@@ -195,6 +215,8 @@ static void multifd_zlib_recv_cleanup(MultiFDRecvParams *p)
     z->zbuff = NULL;
     g_free(p->compress_data);
     p->compress_data = NULL;
+    g_free(p->iov);
+    p->iov = NULL;
 }
 
 static int multifd_zlib_recv(MultiFDRecvParams *p, Error **errp)
@@ -210,6 +232,12 @@ static int multifd_zlib_recv(MultiFDRecvParams *p, Error **errp)
     int ret;
     int i;
 
+    if (flags == MULTIFD_FLAG_NOCOMP &&
+        migrate_multifd_adaptive_compression()) {
+        multifd_recv_zero_page_process(p);
+        return multifd_ram_recv_raw(p, errp);
+    }
+
     if (flags != MULTIFD_FLAG_ZLIB) {
         error_setg(errp, "multifd %u: flags received %x flags expected %x",
                    p->id, flags, MULTIFD_FLAG_ZLIB);
@@ -13,6 +13,7 @@
 #include "qemu/osdep.h"
 #include <zstd.h>
 #include "qemu/rcu.h"
+#include "qemu/timer.h"
 #include "exec/ramblock.h"
 #include "exec/target_page.h"
 #include "qapi/error.h"
@@ -68,8 +69,11 @@ static int multifd_zstd_send_setup(MultiFDSendParams *p, Error **errp)
     }
     p->compress_data = z;
 
-    /* Needs 2 IOVs, one for packet header and one for compressed data */
-    p->iov = g_new0(struct iovec, 2);
+    /*
+     * Needs 2 IOVs, one for packet header and one for compressed data,
+     * plus one per page if packets may be sent uncompressed.
+     */
+    p->iov = g_new0(struct iovec, multifd_adaptive_send_iov_count(2));
     return 0;
 }
 
@@ -92,6 +96,7 @@ static int multifd_zstd_send_prepare(MultiFDSendParams *p, Error **errp)
 {
     MultiFDPages_t *pages = &p->data->u.ram;
     struct zstd_data *z = p->compress_data;
+    int64_t start;
     int ret;
     uint32_t i;
 
@@ -99,6 +104,12 @@ static int multifd_zstd_send_prepare(MultiFDSendParams *p, Error **errp)
         goto out;
     }
 
+    if (!multifd_send_adaptive_compress(p)) {
+        multifd_send_adaptive_prepare_raw(p);
+        return 0;
+    }
+
+    start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
     z->out.dst = z->zbuff;
     z->out.size = z->zbuff_len;
     z->out.pos = 0;
@@ -141,6 +152,10 @@ static int multifd_zstd_send_prepare(MultiFDSendParams *p, Error **errp)
     p->iovs_num++;
     p->next_packet_size = z->out.pos;
 
+    multifd_send_adaptive_account_compress(p,
+        (uint64_t)pages->normal_num * multifd_ram_page_size(), z->out.pos,
+        qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start);
+
 out:
     p->flags |= MULTIFD_FLAG_ZSTD;
     multifd_send_fill_packet(p);
@@ -178,6 +193,11 @@ static int multifd_zstd_recv_setup(MultiFDRecvParams *p, Error **errp)
         error_setg(errp, "multifd %u: out of memory for zbuff", p->id);
         return -1;
     }
+
+    if (migrate_multifd_adaptive_compression()) {
+        /* For packets that the source sent uncompressed */
+        p->iov = g_new0(struct iovec, multifd_ram_page_count());
+    }
     return 0;
 }
 
@@ -191,6 +211,8 @@ static void multifd_zstd_recv_cleanup(MultiFDRecvParams *p)
     z->zbuff = NULL;
     g_free(p->compress_data);
     p->compress_data = NULL;
+    g_free(p->iov);
+    p->iov = NULL;
 }
 
 static int multifd_zstd_recv(MultiFDRecvParams *p, Error **errp)
@@ -204,6 +226,12 @@ static int multifd_zstd_recv(MultiFDRecvParams *p, Error **errp)
     int ret;
     int i;
 
+    if (flags == MULTIFD_FLAG_NOCOMP &&
+        migrate_multifd_adaptive_compression()) {
+        multifd_recv_zero_page_process(p);
+        return multifd_ram_recv_raw(p, errp);
+    }
+
     if (flags != MULTIFD_FLAG_ZSTD) {
         error_setg(errp, "multifd %u: flags received %x flags expected %x",
                    p->id, flags, MULTIFD_FLAG_ZSTD);
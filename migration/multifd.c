@@ -13,6 +13,7 @@
 #include "qemu/osdep.h"
 #include "qemu/cutils.h"
 #include "qemu/rcu.h"
+#include "qemu/timer.h"
 #include "exec/target_page.h"
 #include "sysemu/sysemu.h"
 #include "exec/ramblock.h"
@@ -574,6 +575,7 @@ static void *multifd_send_thread(void *opaque)
     Error *local_err = NULL;
     int ret = 0;
     bool use_packets = multifd_use_packets();
+    bool adaptive = migrate_multifd_adaptive_compression();
 
     thread = migration_threads_add(p->name, qemu_get_thread_id());
 
@@ -600,6 +602,8 @@ static void *multifd_send_thread(void *opaque)
          * qatomic_store_release() in multifd_send().
          */
         if (qatomic_load_acquire(&p->pending_job)) {
+            int64_t write_start = 0;
+
             p->iovs_num = 0;
             assert(!multifd_payload_empty(p->data));
 
@@ -608,6 +612,10 @@ static void *multifd_send_thread(void *opaque)
                 break;
             }
 
+            if (adaptive) {
+                write_start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+            }
+
             if (migrate_mapped_ram()) {
                 ret = file_write_ramblock_iov(p->c, p->iov, p->iovs_num,
                                               &p->data->u.ram, &local_err);
@@ -621,6 +629,12 @@ static void *multifd_send_thread(void *opaque)
                 break;
             }
 
+            if (adaptive) {
+                multifd_send_adaptive_account_send(p,
+                    p->next_packet_size + p->packet_len,
+                    qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - write_start);
+            }
+
             stat64_add(&mig_stats.multifd_bytes,
                        p->next_packet_size + p->packet_len);
 
@@ -671,6 +685,9 @@ out:
     rcu_unregister_thread();
     migration_threads_remove(thread);
     trace_multifd_send_thread_end(p->id, p->packets_sent);
+    if (adaptive) {
+        trace_multifd_send_adaptive_end(p->id, p->adaptive.packets_raw);
+    }
 
     return NULL;
 }
@@ -114,6 +114,26 @@ static inline void multifd_set_payload_type(MultiFDSendData *data,
     data->type = type;
 }
 
+/*
+ * Per channel state for the multifd-adaptive-compression capability.
+ * Costs are kept as exponentially weighted moving averages, expressed
+ * per KiB of uncompressed input so that they can be compared directly.
+ */
+typedef struct {
+    /* compressed size relative to input size, in 1/1024 units */
+    uint32_t ratio;
+    /* time spent compressing, in ns per KiB of input */
+    uint64_t compress_ns;
+    /* time spent writing to the channel, in ns per KiB written */
+    uint64_t send_ns;
+    /* packets still to be sent uncompressed before probing again */
+    uint32_t skip;
+    /* number of packets to skip after the next unprofitable probe */
+    uint32_t backoff;
+    /* packets sent uncompressed because compression did not pay off */
+    uint64_t packets_raw;
+} MultiFDAdaptive;
+
 typedef struct {
     /* Fields are only written at creating/deletion time */
     /* No lock required for them, they are read only */
@@ -168,6 +188,8 @@ typedef struct {
     uint32_t iovs_num;
     /* used for compression methods */
     void *compress_data;
+    /* used by adaptive compression to pick a method for each packet */
+    MultiFDAdaptive adaptive;
 }  MultiFDSendParams;
 
 typedef struct {
@@ -312,6 +334,17 @@ void multifd_send_fill_packet(MultiFDSendParams *p);
 bool multifd_send_prepare_common(MultiFDSendParams *p);
 void multifd_send_zero_page_detect(MultiFDSendParams *p);
 void multifd_recv_zero_page_process(MultiFDRecvParams *p);
+void multifd_send_prepare_iovs(MultiFDSendParams *p);
+int multifd_ram_recv_raw(MultiFDRecvParams *p, Error **errp);
+
+bool multifd_send_adaptive_compress(MultiFDSendParams *p);
+void multifd_send_adaptive_prepare_raw(MultiFDSendParams *p);
+void multifd_send_adaptive_account_compress(MultiFDSendParams *p,
+                                            uint64_t in, uint64_t out,
+                                            int64_t ns);
+void multifd_send_adaptive_account_send(MultiFDSendParams *p,
+                                        uint64_t bytes, int64_t ns);
+uint32_t multifd_adaptive_send_iov_count(uint32_t iov_count);
 
 static inline void multifd_send_prepare_header(MultiFDSendParams *p)
 {
@@ -505,7 +505,10 @@ static int init_range(RAMBlock *rb, void *opaque)
      * like ROMs and any data tables built during init must be zero'd
      * - we're going to get the copy from the source anyway.
      * (Precopy will just overwrite this data, so doesn't need the discard)
+     * The pages must also stay empty until userfaultfd fills them, so
+     * background preallocation has to stop first.
      */
+    ram_block_cancel_prealloc(rb);
     if (ram_discard_range(block_name, 0, length)) {
         return -1;
     }
@@ -40,6 +40,7 @@
 #include "migration/misc.h"
 #include "qemu-file.h"
 #include "postcopy-ram.h"
+#include "lazy-load.h"
 #include "page_cache.h"
 #include "qemu/error-report.h"
 #include "qapi/error.h"
@@ -61,6 +62,7 @@
 #include "options.h"
 #include "sysemu/dirtylimit.h"
 #include "sysemu/kvm.h"
+#include "sysemu/hostmem.h"
 
 #include "hw/boards.h" /* for machine_dump_guest_core() */
 
@@ -352,6 +354,8 @@ struct RAMSrcPageRequest {
 };
 
 /* State of RAM for migration */
+typedef struct RAMSyncPool RAMSyncPool;
+
 struct RAMState {
     /*
      * PageSearchStatus structures for the channels when send pages.
@@ -406,6 +410,8 @@ struct RAMState {
     /* Queue of outstanding page requests from the destination */
     QemuMutex src_page_req_mutex;
     QSIMPLEQ_HEAD(, RAMSrcPageRequest) src_page_requests;
+    /* Workers merging the dirty log, NULL if dirty-sync-threads is 1 */
+    RAMSyncPool *sync_pool;
 
     /*
      * This is only used when postcopy is in recovery phase, to communicate
@@ -922,6 +928,209 @@ static void ramblock_sync_dirty_bitmap(RAMState *rs, RAMBlock *rb)
     rs->num_dirty_pages_period += new_dirty_pages;
 }
 
+/*
+ * With dirty-sync-threads > 1, RAMBlocks are split into chunks of this
+ * size that are merged into the migration bitmap in parallel.  It is a
+ * multiple of BITS_PER_LONG target pages, so no two chunks ever share a
+ * word of a RAMBlock's migration bitmap.
+ */
+#define RAM_SYNC_CHUNK_SIZE (1ULL << 30)
+
+typedef struct {
+    RAMBlock *block;
+    ram_addr_t start;
+    ram_addr_t length;
+} RAMSyncChunk;
+
+typedef struct {
+    RAMSyncChunk *chunks;
+    unsigned int nr_chunks;
+    /* Index of the next chunk to be claimed by a worker */
+    unsigned int next;
+} RAMSyncJob;
+
+typedef struct {
+    QemuThread thread;
+    RAMSyncPool *pool;
+    /* Dirty pages newly found by this worker, reset after each sync */
+    uint64_t new_dirty_pages;
+} RAMSyncWorker;
+
+/*
+ * Worker threads for ramblock_sync_dirty_bitmap_all().  They are created
+ * once per migration, in ram_state_init(), from the value that
+ * dirty-sync-threads has at that time.  For each sync, the migration
+ * thread posts job_sem once per worker and then waits on done_sem as
+ * many times.
+ */
+struct RAMSyncPool {
+    RAMSyncWorker *workers;
+    unsigned int nr_workers;
+    QemuSemaphore job_sem;
+    QemuSemaphore done_sem;
+    RAMSyncJob *job;
+    bool quit;
+};
+
+/* Called with RCU critical section */
+static uint64_t ram_sync_job_run(RAMSyncJob *job)
+{
+    uint64_t new_dirty_pages = 0;
+    unsigned int i;
+
+    while ((i = qatomic_fetch_inc(&job->next)) < job->nr_chunks) {
+        RAMSyncChunk *chunk = &job->chunks[i];
+
+        new_dirty_pages +=
+            cpu_physical_memory_sync_dirty_bitmap(chunk->block, chunk->start,
+                                                  chunk->length);
+    }
+
+    return new_dirty_pages;
+}
+
+static void *ram_sync_thread(void *opaque)
+{
+    RAMSyncWorker *worker = opaque;
+    RAMSyncPool *pool = worker->pool;
+
+    rcu_register_thread();
+    while (true) {
+        qemu_sem_wait(&pool->job_sem);
+        if (qatomic_read(&pool->quit)) {
+            break;
+        }
+        /*
+         * A worker may pick up the job twice if another one is slow to
+         * wake up; the second run finds no chunks left, hence the +=.
+         */
+        WITH_RCU_READ_LOCK_GUARD() {
+            worker->new_dirty_pages += ram_sync_job_run(pool->job);
+        }
+        qemu_sem_post(&pool->done_sem);
+    }
+    rcu_unregister_thread();
+
+    return NULL;
+}
+
+static RAMSyncPool *ram_sync_pool_new(unsigned int nr_threads)
+{
+    RAMSyncPool *pool;
+    unsigned int i;
+
+    /* The migration thread takes part in the work */
+    if (nr_threads <= 1) {
+        return NULL;
+    }
+
+    pool = g_new0(RAMSyncPool, 1);
+    pool->nr_workers = nr_threads - 1;
+    pool->workers = g_new0(RAMSyncWorker, pool->nr_workers);
+    qemu_sem_init(&pool->job_sem, 0);
+    qemu_sem_init(&pool->done_sem, 0);
+    for (i = 0; i < pool->nr_workers; i++) {
+        pool->workers[i].pool = pool;
+        qemu_thread_create(&pool->workers[i].thread, "mig/src/sync",
+                           ram_sync_thread, &pool->workers[i],
+                           QEMU_THREAD_JOINABLE);
+    }
+
+    return pool;
+}
+
+static void ram_sync_pool_free(RAMSyncPool *pool)
+{
+    unsigned int i;
+
+    if (!pool) {
+        return;
+    }
+
+    qatomic_set(&pool->quit, true);
+    for (i = 0; i < pool->nr_workers; i++) {
+        qemu_sem_post(&pool->job_sem);
+    }
+    for (i = 0; i < pool->nr_workers; i++) {
+        qemu_thread_join(&pool->workers[i].thread);
+    }
+    qemu_sem_destroy(&pool->job_sem);
+    qemu_sem_destroy(&pool->done_sem);
+    g_free(pool->workers);
+    g_free(pool);
+}
+
+/*
+ * Merge the dirty memory log of all RAMBlocks into their migration
+ * bitmaps, spreading the work over the workers of rs->sync_pool.  The
+ * calling thread takes part in the work.
+ *
+ * Called with RCU critical section and bitmap_mutex held.
+ */
+static void ramblock_sync_dirty_bitmap_all(RAMState *rs)
+{
+    RAMSyncPool *pool = rs->sync_pool;
+    g_autofree RAMSyncChunk *chunks = NULL;
+    RAMSyncJob job = { 0 };
+    uint64_t new_dirty_pages;
+    unsigned int nr_workers;
+    RAMBlock *block;
+    unsigned int i;
+
+    if (!pool) {
+        RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+            ramblock_sync_dirty_bitmap(rs, block);
+        }
+        return;
+    }
+
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        job.nr_chunks += DIV_ROUND_UP(block->used_length,
+                                      RAM_SYNC_CHUNK_SIZE);
+    }
+
+    chunks = g_new(RAMSyncChunk, job.nr_chunks);
+    i = 0;
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        ram_addr_t start;
+
+        for (start = 0; start < block->used_length;
+             start += RAM_SYNC_CHUNK_SIZE) {
+            chunks[i].block = block;
+            chunks[i].start = start;
+            chunks[i].length = MIN(RAM_SYNC_CHUNK_SIZE,
+                                   block->used_length - start);
+            i++;
+        }
+    }
+    assert(i == job.nr_chunks);
+    job.chunks = chunks;
+
+    /* No point in waking up workers for chunks that don't exist */
+    nr_workers = MIN(pool->nr_workers, job.nr_chunks ? job.nr_chunks - 1 : 0);
+    pool->job = &job;
+    for (i = 0; i < nr_workers; i++) {
+        qemu_sem_post(&pool->job_sem);
+    }
+
+    new_dirty_pages = ram_sync_job_run(&job);
+
+    for (i = 0; i < nr_workers; i++) {
+        qemu_sem_wait(&pool->done_sem);
+    }
+    for (i = 0; i < pool->nr_workers; i++) {
+        new_dirty_pages += pool->workers[i].new_dirty_pages;
+        pool->workers[i].new_dirty_pages = 0;
+    }
+    pool->job = NULL;
+
+    trace_ramblock_sync_dirty_bitmap_all(nr_workers + 1, job.nr_chunks,
+                                         new_dirty_pages);
+
+    rs->migration_dirty_pages += new_dirty_pages;
+    rs->num_dirty_pages_period += new_dirty_pages;
+}
+
 /**
  * ram_pagesize_summary: calculate all the pagesizes of a VM
  *
@@ -1043,8 +1252,8 @@ static void migration_trigger_throttle(RAMState *rs)
 
 static void migration_bitmap_sync(RAMState *rs, bool last_stage)
 {
-    RAMBlock *block;
     int64_t end_time;
+    int64_t sync_start, merge_start = 0, merge_end = 0;
 
     stat64_add(&mig_stats.dirty_sync_count, 1);
 
@@ -1053,18 +1262,22 @@ static void migration_bitmap_sync(RAMState *rs, bool last_stage)
     }
 
     trace_migration_bitmap_sync_start();
+    sync_start = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
     memory_global_dirty_log_sync(last_stage);
 
     WITH_QEMU_LOCK_GUARD(&rs->bitmap_mutex) {
         WITH_RCU_READ_LOCK_GUARD() {
-            RAMBLOCK_FOREACH_NOT_IGNORED(block) {
-                ramblock_sync_dirty_bitmap(rs, block);
-            }
+            merge_start = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
+            ramblock_sync_dirty_bitmap_all(rs);
+            merge_end = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
             stat64_set(&mig_stats.dirty_bytes_last_sync, ram_bytes_remaining());
         }
     }
 
     memory_global_after_dirty_log_sync();
+    stat64_set(&mig_stats.dirty_sync_merge_time, merge_end - merge_start);
+    stat64_set(&mig_stats.dirty_sync_time,
+               qemu_clock_get_us(QEMU_CLOCK_REALTIME) - sync_start);
     trace_migration_bitmap_sync_end(rs->num_dirty_pages_period);
 
     end_time = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
@@ -2223,6 +2436,73 @@ static int ram_save_host_page(RAMState *rs, PageSearchStatus *pss)
     return (res < 0 ? res : pages);
 }
 
+/*
+ * Whether dirty pages can be handed to multifd in batches, see
+ * ram_save_multifd_batch().  This is the case when nothing has to be
+ * done for a page on the migration thread besides queueing it.
+ */
+static bool ram_save_multifd_batch_enabled(void)
+{
+    return migrate_multifd() &&
+           migrate_zero_page_detection() != ZERO_PAGE_DETECTION_LEGACY;
+}
+
+/**
+ * ram_save_multifd_batch: queue a batch of dirty pages to multifd
+ *
+ * Starting at pss->page, which must be dirty, queue all the dirty pages
+ * found in the next multifd packet worth of pages, rounded up to a host
+ * page boundary so that a host page is never split.  Compared to
+ * ram_save_host_page() this avoids going through the page search and
+ * the migration loop once per page: the dirty bits of the whole range
+ * are cleared at once and zero page detection is left to the multifd
+ * channels.
+ *
+ * The caller must be with ram_state.bitmap_mutex held.
+ *
+ * Returns the number of pages queued or negative on error
+ *
+ * @rs: current RAM state
+ * @pss: data about the first page we want to send
+ */
+static int ram_save_multifd_batch(RAMState *rs, PageSearchStatus *pss)
+{
+    RAMBlock *rb = pss->block;
+    unsigned long size = rb->used_length >> TARGET_PAGE_BITS;
+    size_t pagesize_bits = qemu_ram_pagesize(rb) >> TARGET_PAGE_BITS;
+    unsigned long start = pss->page;
+    unsigned long end, page;
+    int pages = 0;
+
+    if (migrate_ram_is_ignored(rb)) {
+        error_report("block %s should not be migrated !", rb->idstr);
+        return 0;
+    }
+
+    end = start + multifd_ram_page_count();
+    if (pagesize_bits > 1) {
+        end = ROUND_UP(end, pagesize_bits);
+    }
+    end = MIN(end, size);
+
+    for (page = find_next_bit(rb->bmap, end, start); page < end;
+         page = find_next_bit(rb->bmap, end, page + 1)) {
+        /* Must be done before sending, see migration_bitmap_clear_dirty() */
+        migration_clear_memory_region_dirty_bitmap(rb, page);
+
+        if (!multifd_queue_page(rb, (ram_addr_t)page << TARGET_PAGE_BITS)) {
+            return -1;
+        }
+        pages++;
+    }
+
+    bitmap_clear(rb->bmap, start, end - start);
+    rs->migration_dirty_pages -= pages;
+    pss->page = end;
+
+    return pages;
+}
+
 /**
  * ram_find_and_save_block: finds a dirty page and sends it to f
  *
@@ -2275,7 +2555,11 @@ static int ram_find_and_save_block(RAMState *rs)
                 }
             }
         }
-        pages = ram_save_host_page(rs, pss);
+        if (ram_save_multifd_batch_enabled()) {
+            pages = ram_save_multifd_batch(rs, pss);
+        } else {
+            pages = ram_save_host_page(rs, pss);
+        }
         if (pages) {
             break;
         }
@@ -2328,6 +2612,7 @@ static void ram_state_cleanup(RAMState **rsp)
 {
     if (*rsp) {
         migration_page_queue_free(*rsp);
+        ram_sync_pool_free((*rsp)->sync_pool);
         qemu_mutex_destroy(&(*rsp)->bitmap_mutex);
         qemu_mutex_destroy(&(*rsp)->src_page_req_mutex);
         g_free(*rsp);
@@ -2636,6 +2921,25 @@ int ram_discard_range(const char *rbname, uint64_t start, size_t length)
     return ram_block_discard_range(rb, start, length);
 }
 
+/**
+ * ram_block_cancel_prealloc: stop the background preallocation of @rb
+ *
+ * Incoming postcopy and mapped-ram lazy load discard the RAM and expect
+ * its pages to stay missing until userfaultfd fills them, so the
+ * prealloc-background threads of the memory backend, if any, must be
+ * stopped before the discard.
+ *
+ * @rb: the RAMBlock
+ */
+void ram_block_cancel_prealloc(RAMBlock *rb)
+{
+    Object *owner = memory_region_owner(rb->mr);
+
+    if (object_dynamic_cast(owner, TYPE_MEMORY_BACKEND)) {
+        host_memory_backend_cancel_prealloc(MEMORY_BACKEND(owner));
+    }
+}
+
 /*
  * For every allocation, we will try not to crash the VM if the
  * allocation failed.
@@ -2710,6 +3014,7 @@ static bool ram_state_init(RAMState **rsp, Error **errp)
      * This must match with the initial values of dirty bitmap.
      */
     (*rsp)->migration_dirty_pages = (*rsp)->ram_bytes_total >> TARGET_PAGE_BITS;
+    (*rsp)->sync_pool = ram_sync_pool_new(migrate_dirty_sync_threads());
     ram_state_reset(*rsp);
 
     return true;
@@ -4000,7 +4305,13 @@ static void parse_ramblock_mapped_ram(QEMUFile *f, RAMBlock *block,
         return;
     }
 
-    if (!read_ramblock_mapped_ram(f, block, num_pages, bitmap, errp)) {
+    if (migrate_mapped_ram_lazy_load()) {
+        /* Pages are read when the guest touches them or in the background */
+        if (!lazy_load_add_ramblock(f, block, g_steal_pointer(&bitmap),
+                                    errp)) {
+            return;
+        }
+    } else if (!read_ramblock_mapped_ram(f, block, num_pages, bitmap, errp)) {
         return;
     }
 
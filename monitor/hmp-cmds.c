@@ -202,6 +202,17 @@ void hmp_info_iothreads(Monitor *mon, const QDict *qdict)
         monitor_printf(mon, "  poll-shrink=%" PRId64 "\n", value->poll_shrink);
         monitor_printf(mon, "  aio-max-batch=%" PRId64 "\n",
                        value->aio_max_batch);
+        if (value->thread_pool) {
+            ThreadPoolStats *tp = value->thread_pool;
+
+            monitor_printf(mon, "  thread-pool: threads=%" PRId64
+                           " queue-depth=%" PRId64
+                           " completed=%" PRId64 "\n",
+                           tp->threads, tp->queue_depth, tp->completed);
+            monitor_printf(mon, "    wait-time-ns=%" PRId64
+                           " run-time-ns=%" PRId64 "\n",
+                           tp->wait_time_ns, tp->run_time_ns);
+        }
     }
 
     qapi_free_IOThreadInfoList(info_list);
@@ -18,27 +18,109 @@
 #include "qemu/osdep.h"
 #include "net/checksum.h"
 #include "net/eth.h"
+#include "host/cpuinfo.h"
 
-uint32_t net_checksum_add_cont(int len, uint8_t *buf, int seq)
+/*
+ * Add the bytes of @src at even offsets to sum[0] and those at odd offsets
+ * to sum[1], and copy @src to @dst unless @dst is NULL.  Returns how many
+ * bytes were processed; accelerated versions only handle whole vectors and
+ * leave the rest to net_checksum_int().
+ */
+typedef size_t (*net_csum_accel_fn)(uint8_t *, const uint8_t *, size_t,
+                                    uint64_t *);
+
+static size_t net_checksum_int(uint8_t *dst, const uint8_t *src, size_t len,
+                               uint64_t sum[2])
+{
+    const uint64_t mask = 0x00ff00ff00ff00ffull;
+    size_t i = 0;
+
+    while (len - i >= 8) {
+        /* A 16-bit field can take 257 additions of 255 */
+        size_t n = MIN((len - i) / 8, 257);
+        uint64_t lo = 0, hi = 0;
+
+        for (; n; n--, i += 8) {
+            uint64_t x = ldq_he_p(src + i);
+
+            if (dst) {
+                stq_he_p(dst + i, x);
+            }
+            lo += x & mask;
+            hi += (x >> 8) & mask;
+        }
+
+        lo = (lo & 0xffff) + ((lo >> 16) & 0xffff) +
+             ((lo >> 32) & 0xffff) + (lo >> 48);
+        hi = (hi & 0xffff) + ((hi >> 16) & 0xffff) +
+             ((hi >> 32) & 0xffff) + (hi >> 48);
+        sum[HOST_BIG_ENDIAN] += lo;
+        sum[!HOST_BIG_ENDIAN] += hi;
+    }
+
+    for (; i < len; i++) {
+        if (dst) {
+            dst[i] = src[i];
+        }
+        sum[i & 1] += src[i];
+    }
+    return len;
+}
+
+#include "host/net-checksum.c.inc"
+
+static net_csum_accel_fn net_checksum_accel;
+static unsigned net_csum_accel_index;
+
+static uint32_t net_checksum_do(uint8_t *dst, const uint8_t *src, int len,
+                                int seq)
 {
-    uint32_t sum1 = 0, sum2 = 0;
-    int i;
+    uint64_t sum[2] = { 0, 0 };
+    size_t done = 0;
 
-    for (i = 0; i < len - 1; i += 2) {
-        sum1 += (uint32_t)buf[i];
-        sum2 += (uint32_t)buf[i + 1];
+    if (len <= 0) {
+        return 0;
     }
-    if (i < len) {
-        sum1 += (uint32_t)buf[i];
+
+    /* Vectors are an even number of bytes, so the parity is unchanged */
+    if (len >= 64) {
+        done = net_checksum_accel(dst, src, len, sum);
     }
+    net_checksum_int(dst ? dst + done : NULL, src + done, len - done, sum);
 
     if (seq & 1) {
-        return sum1 + (sum2 << 8);
+        return sum[0] + (sum[1] << 8);
     } else {
-        return sum2 + (sum1 << 8);
+        return sum[1] + (sum[0] << 8);
     }
 }
 
+uint32_t net_checksum_add_cont(int len, uint8_t *buf, int seq)
+{
+    return net_checksum_do(NULL, buf, len, seq);
+}
+
+uint32_t net_checksum_copy_cont(int len, uint8_t *dst, const uint8_t *src,
+                                int seq)
+{
+    return net_checksum_do(dst, src, len, seq);
+}
+
+bool test_net_checksum_next_accel(void)
+{
+    if (net_csum_accel_index != 0) {
+        net_checksum_accel = net_csum_accel_table[--net_csum_accel_index];
+        return true;
+    }
+    return false;
+}
+
+static void __attribute__((constructor)) net_checksum_init_accel(void)
+{
+    net_csum_accel_index = net_csum_best_accel();
+    net_checksum_accel = net_csum_accel_table[net_csum_accel_index];
+}
+
 uint16_t net_checksum_finish(uint32_t sum)
 {
     while (sum>>16)
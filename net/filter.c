@@ -245,6 +245,12 @@ static void netfilter_complete(UserCreatable *uc, Error **errp)
         return;
     }
 
+    if (ncs[0]->aio_context) {
+        error_setg(errp, "netdev '%s' is running in an IOThread",
+                   nf->netdev_id);
+        return;
+    }
+
     if (strcmp(nf->position, "head") && strcmp(nf->position, "tail")) {
         Object *container;
         Object *obj;
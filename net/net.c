@@ -585,6 +585,39 @@ int qemu_set_vnet_be(NetClientState *nc, bool is_be)
 #endif
 }
 
+/* Whether the I/O handlers of the backend @nc can run in an IOThread */
+bool qemu_can_set_aio_context(NetClientState *nc)
+{
+    /* Net filters always run in the main loop */
+    return nc && nc->info->set_aio_context && QTAILQ_EMPTY(&nc->filters);
+}
+
+/*
+ * Move the I/O handlers of the backend @nc to @ctx, or back to the main loop
+ * if @ctx is NULL.  Packets that @nc receives are then delivered to its peer
+ * in @ctx, so the peer must be ready to be called from there.
+ *
+ * The caller must make sure that the I/O handlers of @nc do not run while
+ * they are moved, for example by calling this from a BH in the new
+ * AioContext while the main loop waits for it.
+ */
+bool qemu_set_aio_context(NetClientState *nc, AioContext *ctx)
+{
+    if (ctx == qemu_get_aio_context()) {
+        ctx = NULL;
+    }
+    if (!nc || ctx == nc->aio_context) {
+        return true;
+    }
+    if (ctx && !qemu_can_set_aio_context(nc)) {
+        return false;
+    }
+
+    nc->info->set_aio_context(nc, ctx);
+    nc->aio_context = ctx;
+    return true;
+}
+
 int qemu_can_receive_packet(NetClientState *nc)
 {
     if (nc->receive_disabled) {
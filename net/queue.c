@@ -23,6 +23,7 @@
 
 #include "qemu/osdep.h"
 #include "net/queue.h"
+#include "qemu/defer-call.h"
 #include "qemu/queue.h"
 #include "net/net.h"
 
@@ -272,9 +273,13 @@ void qemu_net_queue_purge(NetQueue *queue, NetClientState *from)
 
 bool qemu_net_queue_flush(NetQueue *queue)
 {
+    bool flushed = true;
+
     if (queue->delivering)
         return false;
 
+    /* Let the receiver hand the flushed packets to the host in one go */
+    defer_call_begin();
     while (!QTAILQ_EMPTY(&queue->packets)) {
         NetPacket *packet;
         int ret;
@@ -291,7 +296,8 @@ bool qemu_net_queue_flush(NetQueue *queue)
         if (ret == 0) {
             queue->nq_count++;
             QTAILQ_INSERT_HEAD(&queue->packets, packet, entry);
-            return false;
+            flushed = false;
+            break;
         }
 
         if (packet->sent_cb) {
@@ -300,5 +306,6 @@ bool qemu_net_queue_flush(NetQueue *queue)
 
         g_free(packet);
     }
-    return true;
+    defer_call_end();
+    return flushed;
 }
@@ -39,14 +39,23 @@
 #include "sysemu/sysemu.h"
 #include "qapi/error.h"
 #include "qemu/cutils.h"
+#include "qemu/defer-call.h"
 #include "qemu/error-report.h"
+#include "qemu/iov.h"
 #include "qemu/main-loop.h"
 #include "qemu/sockets.h"
+#include "trace.h"
 
 #include "net/tap.h"
 
 #include "net/vhost_net.h"
 
+#ifdef CONFIG_LINUX_IO_URING
+#include <liburing.h>
+#endif
+
+typedef struct TAPUring TAPUring;
+
 typedef struct TAPState {
     NetClientState nc;
     int fd;
@@ -62,6 +71,8 @@ typedef struct TAPState {
     VHostNetState *vhost_net;
     unsigned host_vnet_hdr_len;
     Notifier exit;
+    AioContext *ctx; /* NULL for the main loop */
+    TAPUring *uring; /* NULL unless io-uring=on */
 } TAPState;
 
 static void launch_script(const char *setup_script, const char *ifname,
@@ -70,12 +81,22 @@ static void launch_script(const char *setup_script, const char *ifname,
 static void tap_send(void *opaque);
 static void tap_writable(void *opaque);
 
+static void tap_set_fd_handler(TAPState *s, int fd, IOHandler *io_read,
+                               IOHandler *io_write)
+{
+    if (s->ctx) {
+        aio_set_fd_handler(s->ctx, fd, io_read, io_write, NULL, NULL, s);
+    } else {
+        qemu_set_fd_handler(fd, io_read, io_write, s);
+    }
+}
+
 static void tap_update_fd_handler(TAPState *s)
 {
-    qemu_set_fd_handler(s->fd,
-                        s->read_poll && s->enabled ? tap_send : NULL,
-                        s->write_poll && s->enabled ? tap_writable : NULL,
-                        s);
+    IOHandler *io_read = s->read_poll && s->enabled ? tap_send : NULL;
+    IOHandler *io_write = s->write_poll && s->enabled ? tap_writable : NULL;
+
+    tap_set_fd_handler(s, s->fd, io_read, io_write);
 }
 
 static void tap_read_poll(TAPState *s, bool enable)
@@ -90,12 +111,466 @@ static void tap_write_poll(TAPState *s, bool enable)
     tap_update_fd_handler(s);
 }
 
+static void tap_send_completed(NetClientState *nc, ssize_t len)
+{
+    TAPState *s = DO_UPCAST(TAPState, nc, nc);
+    tap_read_poll(s, true);
+}
+
+/* Pass a packet read from the tap device on to the peer */
+static ssize_t tap_send_packet(TAPState *s, uint8_t *buf, int size)
+{
+    uint8_t min_pkt[ETH_ZLEN];
+    size_t min_pktsz = sizeof(min_pkt);
+
+    if (s->host_vnet_hdr_len && !s->using_vnet_hdr) {
+        buf  += s->host_vnet_hdr_len;
+        size -= s->host_vnet_hdr_len;
+    }
+
+    if (net_peer_needs_padding(&s->nc)) {
+        if (eth_pad_short_frame(min_pkt, &min_pktsz, buf, size)) {
+            buf = min_pkt;
+            size = min_pktsz;
+        }
+    }
+
+    return qemu_send_packet_async(&s->nc, buf, size, tap_send_completed);
+}
+
+#ifdef CONFIG_LINUX_IO_URING
+/*
+ * With io-uring=on, packets are written to and read from the tap device
+ * through an io_uring, so that a batch of packets costs one io_uring_enter()
+ * instead of one writev() or read() per packet.  The tap device still
+ * transfers exactly one packet per write or read request.
+ */
+
+/* Maximum number of packet writes in one submission */
+#define TAP_URING_TX_BATCH 64
+
+/* Maximum number of packets accepted from the peer but not written yet */
+#define TAP_URING_TX_MAX_QUEUED (4 * TAP_URING_TX_BATCH)
+
+/* Number of packet reads submitted when the tap device is readable */
+#define TAP_URING_RX_BATCH 16
+
+#define TAP_URING_ENTRIES (TAP_URING_TX_BATCH + TAP_URING_RX_BATCH)
+
+typedef struct TAPUringReq {
+    struct iovec iov;
+    int ret;
+    bool rx;
+    QSIMPLEQ_ENTRY(TAPUringReq) next;
+} TAPUringReq;
+
+struct TAPUring {
+    struct io_uring ring;
+
+    /* Packets accepted from the peer and not submitted yet, in order */
+    QSIMPLEQ_HEAD(, TAPUringReq) tx_queue;
+    /* The batch of linked writes that has been submitted, in order */
+    QSIMPLEQ_HEAD(, TAPUringReq) tx_inflight;
+    unsigned int tx_queued;     /* packets on tx_queue and tx_inflight */
+    unsigned int tx_pending;    /* writes without a completion */
+    bool tx_blocked;            /* the peer waits for tap_writable() */
+
+    TAPUringReq rx[TAP_URING_RX_BATCH];
+    unsigned int rx_pending;    /* reads without a completion */
+    bool rx_waiting;            /* read_poll is off until rx_pending is 0 */
+
+    bool fail_submit;           /* x-io-uring-fail-submit=on */
+    bool failed;                /* using read() and writev() instead */
+};
+
+static bool tap_uring_active(TAPState *s)
+{
+    return s->uring && !s->uring->failed;
+}
+
+static void tap_uring_tx_retire(TAPState *s);
+static void tap_uring_rx_complete(TAPState *s, TAPUringReq *req);
+static void tap_uring_set_fd_handler(TAPState *s, bool enable);
+
+static void tap_uring_process_completions(TAPState *s)
+{
+    TAPUring *u = s->uring;
+    struct io_uring_cqe *cqe;
+
+    while (io_uring_peek_cqe(&u->ring, &cqe) == 0) {
+        TAPUringReq *req = io_uring_cqe_get_data(cqe);
+
+        io_uring_cqe_seen(&u->ring, cqe);
+        /* A nested submission failed, tap_uring_fail() dropped @req */
+        if (u->failed) {
+            continue;
+        }
+        req->ret = cqe->res;
+
+        if (req->rx) {
+            tap_uring_rx_complete(s, req);
+        } else {
+            u->tx_pending--;
+        }
+    }
+
+    if (!u->tx_pending && !QSIMPLEQ_EMPTY(&u->tx_inflight)) {
+        tap_uring_tx_retire(s);
+    }
+}
+
+static void tap_uring_completion_cb(void *opaque)
+{
+    tap_uring_process_completions(opaque);
+}
+
+/*
+ * Stop using the io_uring after a submission failed.  The requests whose
+ * SQEs did not go out complete with an error: queued packets are dropped,
+ * like writev() errors drop them, and reads are simply not done.  From then
+ * on, packets go through read() and writev().
+ */
+static void tap_uring_fail(TAPState *s, int err)
+{
+    TAPUring *u = s->uring;
+    TAPUringReq *req;
+
+    if (u->failed) {
+        return;
+    }
+
+    warn_report("tap: io_uring submission failed: %s, "
+                "using read() and writev() instead", strerror(err));
+    u->failed = true;
+    tap_uring_set_fd_handler(s, false);
+
+    u->tx_pending = 0;
+    QSIMPLEQ_CONCAT(&u->tx_inflight, &u->tx_queue);
+    while ((req = QSIMPLEQ_FIRST(&u->tx_inflight))) {
+        QSIMPLEQ_REMOVE_HEAD(&u->tx_inflight, next);
+        g_free(req);
+    }
+    u->tx_queued = 0;
+
+    u->rx_pending = 0;
+    if (u->rx_waiting) {
+        u->rx_waiting = false;
+        tap_read_poll(s, true);
+    }
+
+    if (u->tx_blocked) {
+        u->tx_blocked = false;
+        qemu_flush_queued_packets(&s->nc);
+    }
+}
+
+static void tap_uring_submit(TAPState *s)
+{
+    TAPUring *u = s->uring;
+    int ret;
+
+    /*
+     * The tap fd is non-blocking, so the requests complete during
+     * io_uring_submit() already.  The completion queue cannot overflow: it
+     * has twice TAP_URING_ENTRIES entries and no more than that many
+     * requests are ever in flight.
+     */
+    if (u->fail_submit) {
+        ret = -EIO;
+    } else {
+        do {
+            ret = io_uring_submit(&u->ring);
+        } while (ret == -EINTR);
+    }
+    trace_tap_uring_submit(s, ret);
+
+    tap_uring_process_completions(s);
+
+    /*
+     * After a failure, the SQEs stay in the submission queue.  Nothing
+     * would submit them again while requests are pending, so RX and TX
+     * would stall.  Once the completions are processed, the pending
+     * requests are exactly those that did not go out.
+     */
+    if (ret < 0) {
+        tap_uring_fail(s, -ret);
+    }
+}
+
+static void tap_uring_tx_submit(void *opaque)
+{
+    TAPState *s = opaque;
+    TAPUring *u = s->uring;
+    struct io_uring_sqe *sqe, *prev = NULL;
+    TAPUringReq *req;
+
+    /* Linked writes keep packets in order, so submit one batch at a time */
+    if (u->failed || !QSIMPLEQ_EMPTY(&u->tx_inflight) || s->write_poll) {
+        return;
+    }
+
+    while ((req = QSIMPLEQ_FIRST(&u->tx_queue)) &&
+           u->tx_pending < TAP_URING_TX_BATCH) {
+        sqe = io_uring_get_sqe(&u->ring);
+        if (!sqe) {
+            break;
+        }
+        io_uring_prep_writev(sqe, s->fd, &req->iov, 1, 0);
+        io_uring_sqe_set_data(sqe, req);
+        if (prev) {
+            prev->flags |= IOSQE_IO_LINK;
+        }
+        prev = sqe;
+
+        QSIMPLEQ_REMOVE_HEAD(&u->tx_queue, next);
+        QSIMPLEQ_INSERT_TAIL(&u->tx_inflight, req, next);
+        u->tx_pending++;
+    }
+
+    if (prev) {
+        tap_uring_submit(s);
+    }
+}
+
+/* Called when all writes of the batch in tx_inflight have completed */
+static void tap_uring_tx_retire(TAPState *s)
+{
+    TAPUring *u = s->uring;
+    QSIMPLEQ_HEAD(, TAPUringReq) retry = QSIMPLEQ_HEAD_INITIALIZER(retry);
+    TAPUringReq *req;
+    unsigned int done = 0;
+
+    while ((req = QSIMPLEQ_FIRST(&u->tx_inflight))) {
+        QSIMPLEQ_REMOVE_HEAD(&u->tx_inflight, next);
+
+        /*
+         * A full device queue fails a write with -EAGAIN and cancels the
+         * writes linked after it.  Those packets are written again, in
+         * order, once the device is writable.  Other errors drop the
+         * packet, like a failed writev() does.
+         */
+        if (req->ret == -EAGAIN || req->ret == -ECANCELED) {
+            QSIMPLEQ_INSERT_TAIL(&retry, req, next);
+        } else {
+            u->tx_queued--;
+            done++;
+            g_free(req);
+        }
+    }
+    trace_tap_uring_tx_retire(s, done, u->tx_queued);
+
+    if (!QSIMPLEQ_EMPTY(&retry)) {
+        QSIMPLEQ_CONCAT(&retry, &u->tx_queue);
+        QSIMPLEQ_CONCAT(&u->tx_queue, &retry);
+        tap_write_poll(s, true);
+    }
+
+    if (u->tx_blocked && u->tx_queued < TAP_URING_TX_MAX_QUEUED) {
+        u->tx_blocked = false;
+        qemu_flush_queued_packets(&s->nc);
+    }
+
+    tap_uring_tx_submit(s);
+}
+
+static ssize_t tap_uring_receive_iov(TAPState *s, const struct iovec *iov,
+                                     int iovcnt)
+{
+    TAPUring *u = s->uring;
+    size_t hdr_len = s->using_vnet_hdr ? 0 : s->host_vnet_hdr_len;
+    size_t size = iov_size(iov, iovcnt);
+    TAPUringReq *req;
+    uint8_t *buf;
+
+    if (u->tx_queued >= TAP_URING_TX_MAX_QUEUED) {
+        u->tx_blocked = true;
+        return 0;
+    }
+
+    /* The peer may reuse @iov as soon as we return, so copy the packet */
+    req = g_malloc(sizeof(*req) + hdr_len + size);
+    buf = (uint8_t *)(req + 1);
+    memset(buf, 0, hdr_len);
+    iov_to_buf(iov, iovcnt, 0, buf + hdr_len, size);
+    req->iov.iov_base = buf;
+    req->iov.iov_len = hdr_len + size;
+    req->rx = false;
+
+    QSIMPLEQ_INSERT_TAIL(&u->tx_queue, req, next);
+    u->tx_queued++;
+
+    /* Packets sent within one defer_call section share a submission */
+    defer_call(tap_uring_tx_submit, s);
+    return req->iov.iov_len;
+}
+
+static void tap_uring_rx_submit(TAPState *s)
+{
+    TAPUring *u = s->uring;
+    struct io_uring_sqe *sqe;
+    int i;
+
+    if (u->rx_pending) {
+        u->rx_waiting = true;
+        tap_read_poll(s, false);
+        return;
+    }
+
+    /*
+     * Every packet is a short read, which would break a chain of linked
+     * reads, so the reads are not linked.  They run in order during
+     * submission and the ones past the last queued packet fail with
+     * -EAGAIN.
+     */
+    for (i = 0; i < TAP_URING_RX_BATCH; i++) {
+        sqe = io_uring_get_sqe(&u->ring);
+        if (!sqe) {
+            break;
+        }
+        io_uring_prep_readv(sqe, s->fd, &u->rx[i].iov, 1, 0);
+        io_uring_sqe_set_data(sqe, &u->rx[i]);
+        u->rx_pending++;
+    }
+
+    tap_uring_submit(s);
+}
+
+static void tap_uring_rx_complete(TAPState *s, TAPUringReq *req)
+{
+    TAPUring *u = s->uring;
+
+    u->rx_pending--;
+
+    if (req->ret > 0 &&
+        tap_send_packet(s, req->iov.iov_base, req->ret) == 0) {
+        /* tap_send_completed() enables reading again */
+        tap_read_poll(s, false);
+        u->rx_waiting = false;
+    }
+
+    if (!u->rx_pending && u->rx_waiting) {
+        u->rx_waiting = false;
+        tap_read_poll(s, true);
+    }
+}
+
+static void tap_uring_set_fd_handler(TAPState *s, bool enable)
+{
+    tap_set_fd_handler(s, s->uring->ring.ring_fd,
+                       enable ? tap_uring_completion_cb : NULL, NULL);
+}
+
+static bool tap_uring_init(TAPState *s, bool fail_submit, Error **errp)
+{
+    TAPUring *u = g_new0(TAPUring, 1);
+    int ret, i;
+
+    ret = io_uring_queue_init(TAP_URING_ENTRIES, &u->ring, 0);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "failed to init linux io_uring ring");
+        g_free(u);
+        return false;
+    }
+
+    QSIMPLEQ_INIT(&u->tx_queue);
+    QSIMPLEQ_INIT(&u->tx_inflight);
+    for (i = 0; i < TAP_URING_RX_BATCH; i++) {
+        u->rx[i].iov.iov_base = g_malloc(NET_BUFSIZE);
+        u->rx[i].iov.iov_len = NET_BUFSIZE;
+        u->rx[i].rx = true;
+    }
+    u->fail_submit = fail_submit;
+
+    s->uring = u;
+    tap_uring_set_fd_handler(s, true);
+    return true;
+}
+
+static void tap_uring_cleanup(TAPState *s)
+{
+    TAPUring *u = s->uring;
+    struct io_uring_cqe *cqe;
+    TAPUringReq *req;
+    int ret, i;
+
+    tap_uring_set_fd_handler(s, false);
+
+    /* In-flight requests point into the buffers freed below */
+    while (u->tx_pending || u->rx_pending) {
+        ret = io_uring_wait_cqe(&u->ring, &cqe);
+        if (ret == -EINTR) {
+            continue;
+        } else if (ret < 0) {
+            break;
+        }
+        req = io_uring_cqe_get_data(cqe);
+        io_uring_cqe_seen(&u->ring, cqe);
+        if (req->rx) {
+            u->rx_pending--;
+        } else {
+            u->tx_pending--;
+        }
+    }
+
+    QSIMPLEQ_CONCAT(&u->tx_inflight, &u->tx_queue);
+    while ((req = QSIMPLEQ_FIRST(&u->tx_inflight))) {
+        QSIMPLEQ_REMOVE_HEAD(&u->tx_inflight, next);
+        g_free(req);
+    }
+    for (i = 0; i < TAP_URING_RX_BATCH; i++) {
+        g_free(u->rx[i].iov.iov_base);
+    }
+
+    io_uring_queue_exit(&u->ring);
+    g_free(u);
+    s->uring = NULL;
+}
+#else /* !CONFIG_LINUX_IO_URING */
+static bool tap_uring_active(TAPState *s)
+{
+    return false;
+}
+
+static void tap_uring_tx_submit(void *opaque)
+{
+}
+
+static ssize_t tap_uring_receive_iov(TAPState *s, const struct iovec *iov,
+                                     int iovcnt)
+{
+    g_assert_not_reached();
+}
+
+static void tap_uring_rx_submit(TAPState *s)
+{
+    g_assert_not_reached();
+}
+
+static void tap_uring_set_fd_handler(TAPState *s, bool enable)
+{
+}
+
+static bool tap_uring_init(TAPState *s, bool fail_submit, Error **errp)
+{
+    error_setg(errp, "io-uring=on is not supported by this build");
+    return false;
+}
+
+static void tap_uring_cleanup(TAPState *s)
+{
+}
+#endif /* !CONFIG_LINUX_IO_URING */
+
 static void tap_writable(void *opaque)
 {
     TAPState *s = opaque;
 
     tap_write_poll(s, false);
 
+    if (tap_uring_active(s)) {
+        tap_uring_tx_submit(s);
+    }
+
     qemu_flush_queued_packets(&s->nc);
 }
 
@@ -121,6 +596,10 @@ static ssize_t tap_receive_iov(NetClientState *nc, const struct iovec *iov,
     g_autofree struct iovec *iov_copy = NULL;
     struct virtio_net_hdr hdr = { };
 
+    if (tap_uring_active(s)) {
+        return tap_uring_receive_iov(s, iov, iovcnt);
+    }
+
     if (s->host_vnet_hdr_len && !s->using_vnet_hdr) {
         iov_copy = g_new(struct iovec, iovcnt + 1);
         iov_copy[0].iov_base = &hdr;
@@ -150,41 +629,24 @@ ssize_t tap_read_packet(int tapfd, uint8_t *buf, int maxlen)
 }
 #endif
 
-static void tap_send_completed(NetClientState *nc, ssize_t len)
-{
-    TAPState *s = DO_UPCAST(TAPState, nc, nc);
-    tap_read_poll(s, true);
-}
-
 static void tap_send(void *opaque)
 {
     TAPState *s = opaque;
     int size;
     int packets = 0;
 
-    while (true) {
-        uint8_t *buf = s->buf;
-        uint8_t min_pkt[ETH_ZLEN];
-        size_t min_pktsz = sizeof(min_pkt);
+    if (tap_uring_active(s)) {
+        tap_uring_rx_submit(s);
+        return;
+    }
 
+    while (true) {
         size = tap_read_packet(s->fd, s->buf, sizeof(s->buf));
         if (size <= 0) {
             break;
         }
 
-        if (s->host_vnet_hdr_len && !s->using_vnet_hdr) {
-            buf  += s->host_vnet_hdr_len;
-            size -= s->host_vnet_hdr_len;
-        }
-
-        if (net_peer_needs_padding(&s->nc)) {
-            if (eth_pad_short_frame(min_pkt, &min_pktsz, buf, size)) {
-                buf = min_pkt;
-                size = min_pktsz;
-            }
-        }
-
-        size = qemu_send_packet_async(&s->nc, buf, size, tap_send_completed);
+        size = tap_send_packet(s, s->buf, size);
         if (size == 0) {
             tap_read_poll(s, false);
             break;
@@ -303,6 +765,9 @@ static void tap_cleanup(NetClientState *nc)
 
     tap_read_poll(s, false);
     tap_write_poll(s, false);
+    if (s->uring) {
+        tap_uring_cleanup(s);
+    }
     close(s->fd);
     s->fd = -1;
 }
@@ -322,6 +787,24 @@ static bool tap_set_steering_ebpf(NetClientState *nc, int prog_fd)
     return tap_fd_set_steering_ebpf(s->fd, prog_fd) == 0;
 }
 
+static void tap_set_aio_context(NetClientState *nc, AioContext *ctx)
+{
+    TAPState *s = DO_UPCAST(TAPState, nc, nc);
+    assert(nc->info->type == NET_CLIENT_DRIVER_TAP);
+
+    /* Detach from the old context before attaching to the new one */
+    tap_set_fd_handler(s, s->fd, NULL, NULL);
+    if (s->uring) {
+        tap_uring_set_fd_handler(s, false);
+    }
+
+    s->ctx = ctx;
+    tap_update_fd_handler(s);
+    if (tap_uring_active(s)) {
+        tap_uring_set_fd_handler(s, true);
+    }
+}
+
 int tap_get_fd(NetClientState *nc)
 {
     TAPState *s = DO_UPCAST(TAPState, nc, nc);
@@ -347,6 +830,7 @@ static NetClientInfo net_tap_info = {
     .set_vnet_le = tap_set_vnet_le,
     .set_vnet_be = tap_set_vnet_be,
     .set_steering_ebpf = tap_set_steering_ebpf,
+    .set_aio_context = tap_set_aio_context,
 };
 
 static TAPState *net_tap_fd_init(NetClientState *peer,
@@ -724,6 +1208,16 @@ static void net_init_tap_one(const NetdevTapOptions *tap, NetClientState *peer,
         goto failed;
     }
 
+    if (tap->has_io_uring && tap->io_uring) {
+        if (s->vhost_net) {
+            error_setg(errp, "io-uring=on is not supported with vhost");
+            goto failed;
+        }
+        if (!tap_uring_init(s, tap->x_io_uring_fail_submit, errp)) {
+            goto failed;
+        }
+    }
+
     return;
 
 failed:
@@ -183,6 +183,7 @@ DEF("accel", HAS_ARG, QEMU_OPTION_accel,
     "                select accelerator (kvm, xen, hvf, nvmm, whpx or tcg; use 'help' for a list)\n"
     "                igd-passthru=on|off (enable Xen integrated Intel graphics passthrough, default=off)\n"
     "                kernel-irqchip=on|off|split controls accelerated irqchip support (default=on)\n"
+    "                hot-trace-threshold=n (retranslate TCG blocks executed n times as traces)\n"
     "                kvm-shadow-mem=size of KVM shadow MMU in bytes\n"
     "                one-insn-per-tb=on|off (one guest instruction per TCG translation block)\n"
     "                split-wx=on|off (enable TCG split w^x mapping)\n"
@@ -212,6 +213,14 @@ SRST
         non-MSI interrupts. Disabling the in-kernel irqchip completely
         is not recommended except for debugging purposes.
 
+    ``hot-trace-threshold=n``
+        Makes the TCG accelerator count how many times each translation
+        block runs, and retranslate it as a trace once that reaches
+        ``n``. A trace is a single block that continues through forward
+        jumps and branches, and leaves through a side exit when a branch
+        goes the other way. Only some targets (currently RISC-V) form
+        traces. The default is 0, which disables the feature.
+
     ``kvm-shadow-mem=size``
         Defines the size of the KVM shadow MMU.
 
@@ -2831,7 +2840,7 @@ DEF("netdev", HAS_ARG, QEMU_OPTION_netdev,
     "-netdev tap,id=str[,fd=h][,fds=x:y:...:z][,ifname=name][,script=file][,downscript=dfile]\n"
     "         [,br=bridge][,helper=helper][,sndbuf=nbytes][,vnet_hdr=on|off][,vhost=on|off]\n"
     "         [,vhostfd=h][,vhostfds=x:y:...:z][,vhostforce=on|off][,queues=n]\n"
-    "         [,poll-us=n]\n"
+    "         [,poll-us=n][,io-uring=on|off]\n"
     "                configure a host TAP network backend with ID 'str'\n"
     "                connected to a bridge (default=" DEFAULT_BRIDGE_INTERFACE ")\n"
     "                use network scripts 'file' (default=" DEFAULT_NETWORK_SCRIPT ")\n"
@@ -2854,6 +2863,7 @@ DEF("netdev", HAS_ARG, QEMU_OPTION_netdev,
     "                use 'queues=n' to specify the number of queues to be created for multiqueue TAP\n"
     "                use 'poll-us=n' to specify the maximum number of microseconds that could be\n"
     "                spent on busy polling for vhost net\n"
+    "                use 'io-uring=on' to read and write packets in batches through io_uring\n"
     "-netdev bridge,id=str[,br=bridge][,helper=helper]\n"
     "                configure a host TAP network backend with ID 'str' that is\n"
     "                connected to a bridge (default=" DEFAULT_BRIDGE_INTERFACE ")\n"
@@ -5339,6 +5349,22 @@ SRST
 
         The ``prealloc`` boolean option enables memory preallocation.
 
+        Setting the ``prealloc-background`` boolean option to on lets the
+        machine start before preallocation completes. Preallocation then
+        continues in the background, and memory the guest accesses first
+        is allocated on demand; the progress is reported by
+        ``query-memdev``. This requires MADV\_POPULATE\_WRITE, otherwise
+        memory is preallocated before the machine starts as usual.
+        If an allocation fails once the guest is running, QEMU only
+        reports the error: preallocation stops, and the guest may later
+        be killed by SIGBUS when it touches memory that cannot be
+        allocated, just as without ``prealloc``. Until preallocation
+        completes, RAM discards are disabled: balloon inflation and free
+        page reporting have no effect, and virtio-mem devices cannot be
+        created. Preallocation stops early when an incoming migration
+        with postcopy or mapped-ram lazy loading takes over the memory,
+        because those fill the memory on demand.
+
         The ``host-nodes`` option binds the memory range to a list of
         NUMA host nodes.
 
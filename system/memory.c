@@ -50,6 +50,22 @@ static QTAILQ_HEAD(, AddressSpace) address_spaces
 
 static GHashTable *flat_views;
 
+/*
+ * Parts of the memory topology touched by the pending transaction, as a
+ * MemoryRegion * -> GArray of AddrRange map.  The ranges are relative to
+ * the region they are recorded for.  The keys are only compared, never
+ * dereferenced, because a region may be finalized before the commit.
+ */
+static GHashTable *memory_region_update_ranges;
+static unsigned memory_region_nr_update_ranges;
+static bool memory_region_update_all;
+
+/*
+ * Past this many recorded ranges, rendering the whole topology again is
+ * cheaper than working out which parts of it changed.
+ */
+#define MEMORY_REGION_MAX_UPDATE_RANGES 64
+
 typedef struct AddrRange AddrRange;
 
 /*
@@ -101,6 +117,49 @@ static AddrRange addrrange_intersection(AddrRange r1, AddrRange r2)
     return addrrange_make(start, int128_sub(end, start));
 }
 
+/*
+ * Schedule a topology update for the transaction in progress.  The update
+ * is limited to [@addr, @addr + @size) in the address space of @mr, wherever
+ * @mr is mapped; a NULL @mr asks for the whole topology to be rendered again.
+ */
+static void memory_region_update_range(MemoryRegion *mr, hwaddr addr,
+                                       Int128 size)
+{
+    AddrRange range = addrrange_make(int128_make64(addr), size);
+    GArray *ranges;
+
+    memory_region_update_pending = true;
+    if (memory_region_update_all) {
+        return;
+    }
+    if (!mr ||
+        ++memory_region_nr_update_ranges > MEMORY_REGION_MAX_UPDATE_RANGES) {
+        memory_region_update_all = true;
+        return;
+    }
+
+    if (!memory_region_update_ranges) {
+        memory_region_update_ranges =
+            g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
+                                  (GDestroyNotify) g_array_unref);
+    }
+    ranges = g_hash_table_lookup(memory_region_update_ranges, mr);
+    if (!ranges) {
+        ranges = g_array_new(false, false, sizeof(AddrRange));
+        g_hash_table_insert(memory_region_update_ranges, mr, ranges);
+    }
+    g_array_append_val(ranges, range);
+}
+
+static void memory_region_update_range_reset(void)
+{
+    if (memory_region_update_ranges) {
+        g_hash_table_remove_all(memory_region_update_ranges);
+    }
+    memory_region_nr_update_ranges = 0;
+    memory_region_update_all = false;
+}
+
 enum ListenerDirection { Forward, Reverse };
 
 #define MEMORY_LISTENER_CALL_GLOBAL(_callback, _direction, _args...)    \
@@ -607,7 +666,7 @@ static void render_memory_region(FlatView *view,
                                  bool unmergeable)
 {
     MemoryRegion *subregion;
-    unsigned i;
+    unsigned i, lo;
     hwaddr offset_in_region;
     Int128 remain;
     Int128 now;
@@ -660,8 +719,21 @@ static void render_memory_region(FlatView *view,
     fr.nonvolatile = nonvolatile;
     fr.unmergeable = unmergeable;
 
+    /* Skip the ranges that end before the region starts. */
+    i = 0;
+    lo = view->nr;
+    while (i < lo) {
+        unsigned mid = i + (lo - i) / 2;
+
+        if (int128_ge(base, addrrange_end(view->ranges[mid].addr))) {
+            i = mid + 1;
+        } else {
+            lo = mid;
+        }
+    }
+
     /* Render the region itself into any gaps left by the current view. */
-    for (i = 0; i < view->nr && int128_nz(remain); ++i) {
+    for (; i < view->nr && int128_nz(remain); ++i) {
         if (int128_ge(base, addrrange_end(view->ranges[i].addr))) {
             continue;
         }
@@ -749,10 +821,22 @@ static MemoryRegion *memory_region_get_flatview_root(MemoryRegion *mr)
     return NULL;
 }
 
+static void flatview_build_dispatch(FlatView *view)
+{
+    int i;
+
+    view->dispatch = address_space_dispatch_new(view);
+    for (i = 0; i < view->nr; i++) {
+        MemoryRegionSection mrs =
+            section_from_flat_range(&view->ranges[i], view);
+        flatview_add_to_dispatch(view, &mrs);
+    }
+    address_space_dispatch_compact(view->dispatch);
+}
+
 /* Render a memory topology into a list of disjoint absolute ranges. */
 static FlatView *generate_memory_topology(MemoryRegion *mr)
 {
-    int i;
     FlatView *view;
 
     view = flatview_new(mr);
@@ -763,17 +847,244 @@ static FlatView *generate_memory_topology(MemoryRegion *mr)
                              false, false, false);
     }
     flatview_simplify(view);
+    flatview_build_dispatch(view);
+    g_hash_table_replace(flat_views, mr, view);
 
-    view->dispatch = address_space_dispatch_new(view);
-    for (i = 0; i < view->nr; i++) {
-        MemoryRegionSection mrs =
-            section_from_flat_range(&view->ranges[i], view);
-        flatview_add_to_dispatch(view, &mrs);
+    return view;
+}
+
+/*
+ * Collect into @windows the absolute ranges under @mr that are covered by
+ * memory_region_update_ranges.  This walks the tree like
+ * render_memory_region() does, but without rendering anything.  Recorded
+ * ranges are not clipped to the size of their own region, so that a region
+ * that shrank still invalidates the part it used to cover.
+ */
+static void memory_region_collect_update_windows(MemoryRegion *mr,
+                                                 Int128 base,
+                                                 AddrRange clip,
+                                                 GArray *windows)
+{
+    MemoryRegion *subregion;
+    GArray *ranges;
+    AddrRange tmp;
+    unsigned i;
+
+    int128_addto(&base, int128_make64(mr->addr));
+
+    ranges = g_hash_table_lookup(memory_region_update_ranges, mr);
+    for (i = 0; ranges && i < ranges->len; i++) {
+        tmp = addrrange_shift(g_array_index(ranges, AddrRange, i), base);
+        if (int128_nz(tmp.size) && addrrange_intersects(tmp, clip)) {
+            tmp = addrrange_intersection(tmp, clip);
+            g_array_append_val(windows, tmp);
+        }
     }
-    address_space_dispatch_compact(view->dispatch);
-    g_hash_table_replace(flat_views, mr, view);
 
+    if (!mr->enabled) {
+        return;
+    }
+
+    tmp = addrrange_make(base, mr->size);
+    if (!addrrange_intersects(tmp, clip)) {
+        return;
+    }
+    clip = addrrange_intersection(tmp, clip);
+
+    if (mr->alias) {
+        int128_subfrom(&base, int128_make64(mr->alias->addr));
+        int128_subfrom(&base, int128_make64(mr->alias_offset));
+        memory_region_collect_update_windows(mr->alias, base, clip, windows);
+        return;
+    }
+
+    QTAILQ_FOREACH(subregion, &mr->subregions, subregions_link) {
+        memory_region_collect_update_windows(subregion, base, clip, windows);
+    }
+}
+
+static gint addrrange_compare(gconstpointer a, gconstpointer b)
+{
+    const AddrRange *r1 = a, *r2 = b;
+
+    if (int128_lt(r1->start, r2->start)) {
+        return -1;
+    }
+    return int128_gt(r1->start, r2->start);
+}
+
+/* Sort @windows and merge the ones that overlap or touch. */
+static void addrrange_array_merge(GArray *windows)
+{
+    AddrRange *r;
+    unsigned i, n;
+
+    g_array_sort(windows, addrrange_compare);
+
+    r = (AddrRange *)windows->data;
+    for (i = 1, n = 0; i < windows->len; i++) {
+        if (int128_le(r[i].start, addrrange_end(r[n]))) {
+            Int128 end = int128_max(addrrange_end(r[n]), addrrange_end(r[i]));
+            r[n].size = int128_sub(end, r[n].start);
+        } else {
+            r[++n] = r[i];
+        }
+    }
+    if (windows->len) {
+        g_array_set_size(windows, n + 1);
+    }
+}
+
+static bool flatview_equal(FlatView *a, FlatView *b)
+{
+    unsigned i;
+
+    if (a->nr != b->nr) {
+        return false;
+    }
+    for (i = 0; i < a->nr; i++) {
+        if (!flatrange_equal(&a->ranges[i], &b->ranges[i]) ||
+            a->ranges[i].dirty_log_mask != b->ranges[i].dirty_log_mask) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Bring @old_view up to date with the changes recorded by
+ * memory_region_update_range().  Only the parts of the address space that
+ * may have changed are rendered again; the rest is copied from @old_view.
+ * If nothing changed, @old_view itself is reused, so that address spaces
+ * using it can skip the listener updates altogether.
+ */
+static FlatView *update_memory_topology(MemoryRegion *mr, FlatView *old_view)
+{
+    g_autoptr(GArray) windows = g_array_new(false, false, sizeof(AddrRange));
+    FlatView *view;
+    FlatRange *fr, piece;
+    AddrRange *win;
+    unsigned i;
+
+    if (mr && memory_region_update_ranges) {
+        memory_region_collect_update_windows(mr, int128_zero(),
+                                             addrrange_make(int128_zero(),
+                                                            int128_2_64()),
+                                             windows);
+    }
+    addrrange_array_merge(windows);
+
+    /*
+     * Unmergeable ranges are never glued back together, so a window must
+     * not cut one in two: grow it to cover those it touches.
+     */
+    win = (AddrRange *)windows->data;
+    FOR_EACH_FLAT_RANGE(fr, old_view) {
+        if (!fr->unmergeable) {
+            continue;
+        }
+        for (i = 0; i < windows->len; i++) {
+            if (int128_le(fr->addr.start, addrrange_end(win[i])) &&
+                int128_ge(addrrange_end(fr->addr), win[i].start)) {
+                Int128 start = int128_min(win[i].start, fr->addr.start);
+                Int128 end = int128_max(addrrange_end(win[i]),
+                                        addrrange_end(fr->addr));
+
+                win[i] = addrrange_make(start, int128_sub(end, start));
+            }
+        }
+    }
+    addrrange_array_merge(windows);
+    win = (AddrRange *)windows->data;
+
+    trace_flatview_update(old_view, mr, windows->len);
+    if (!windows->len) {
+        goto reuse;
+    }
+
+    view = flatview_new(mr);
+
+    /* Keep whatever lies outside the windows... */
+    i = 0;
+    FOR_EACH_FLAT_RANGE(fr, old_view) {
+        Int128 start = fr->addr.start;
+        Int128 end = addrrange_end(fr->addr);
+
+        while (int128_lt(start, end)) {
+            Int128 stop = end;
+
+            while (i < windows->len &&
+                   int128_le(addrrange_end(win[i]), start)) {
+                i++;
+            }
+            if (i < windows->len) {
+                stop = int128_min(end, win[i].start);
+            }
+            if (int128_lt(start, stop)) {
+                piece = *fr;
+                piece.offset_in_region +=
+                    int128_get64(int128_sub(start, fr->addr.start));
+                piece.addr = addrrange_make(start, int128_sub(stop, start));
+                flatview_insert(view, view->nr, &piece);
+            }
+            if (i == windows->len) {
+                break;
+            }
+            start = int128_max(stop, addrrange_end(win[i]));
+        }
+    }
+
+    /* ... and render the windows again. */
+    for (i = 0; i < windows->len; i++) {
+        render_memory_region(view, mr, int128_zero(), win[i],
+                             false, false, false);
+    }
+    flatview_simplify(view);
+
+    if (flatview_equal(view, old_view)) {
+        flatview_unref(view);
+        goto reuse;
+    }
+
+    flatview_build_dispatch(view);
+    g_hash_table_replace(flat_views, mr, view);
     return view;
+
+reuse:
+    flatview_ref(old_view);
+    g_hash_table_replace(flat_views, mr, old_view);
+    return old_view;
+}
+
+/*
+ * Check an incrementally updated FlatView against a full render of @mr.
+ * This doubles the cost of a commit, so it is only done when a test asks
+ * for it with memory_region_transaction_set_check().
+ */
+static bool flatview_check_updates;
+
+void memory_region_transaction_set_check(bool enable)
+{
+    flatview_check_updates = enable;
+}
+
+static void flatview_check_update(MemoryRegion *mr, FlatView *view)
+{
+    FlatView *full = flatview_new(mr);
+
+    if (mr) {
+        render_memory_region(full, mr, int128_zero(),
+                             addrrange_make(int128_zero(), int128_2_64()),
+                             false, false, false);
+    }
+    flatview_simplify(full);
+
+    if (!flatview_equal(view, full)) {
+        error_report("FlatView for '%s' does not match a full render",
+                     mr ? memory_region_name(mr) : "(null)");
+        abort();
+    }
+    flatview_unref(full);
 }
 
 static void address_space_add_del_ioeventfds(AddressSpace *as,
@@ -1032,24 +1343,42 @@ static void flatviews_init(void)
 
 static void flatviews_reset(void)
 {
+    GHashTable *old_views = flat_views;
     AddressSpace *as;
 
-    if (flat_views) {
-        g_hash_table_unref(flat_views);
-        flat_views = NULL;
-    }
+    flat_views = NULL;
     flatviews_init();
 
-    /* Render unique FVs */
+    /*
+     * Render unique FVs.  A root that already had a FlatView only needs
+     * the parts touched by the transaction to be rendered again.
+     */
     QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
         MemoryRegion *physmr = memory_region_get_flatview_root(as->root);
+        FlatView *old_view = NULL;
 
         if (g_hash_table_lookup(flat_views, physmr)) {
             continue;
         }
 
-        generate_memory_topology(physmr);
+        if (old_views && !memory_region_update_all) {
+            old_view = g_hash_table_lookup(old_views, physmr);
+        }
+        if (old_view) {
+            FlatView *view = update_memory_topology(physmr, old_view);
+
+            if (flatview_check_updates) {
+                flatview_check_update(physmr, view);
+            }
+        } else {
+            generate_memory_topology(physmr);
+        }
     }
+
+    if (old_views) {
+        g_hash_table_unref(old_views);
+    }
+    memory_region_update_range_reset();
 }
 
 static void address_space_set_flatview(AddressSpace *as)
@@ -1097,6 +1426,14 @@ static void address_space_set_flatview(AddressSpace *as)
     }
 }
 
+static bool address_space_flatview_changed(AddressSpace *as)
+{
+    MemoryRegion *physmr = memory_region_get_flatview_root(as->root);
+
+    return address_space_to_flatview(as) !=
+           g_hash_table_lookup(flat_views, physmr);
+}
+
 static void address_space_update_topology(AddressSpace *as)
 {
     MemoryRegion *physmr = memory_region_get_flatview_root(as->root);
@@ -1124,17 +1461,47 @@ void memory_region_transaction_commit(void)
     --memory_region_transaction_depth;
     if (!memory_region_transaction_depth) {
         if (memory_region_update_pending) {
+            g_autoptr(GHashTable) changed = g_hash_table_new(NULL, NULL);
+            MemoryListener *listener;
+
             flatviews_reset();
 
-            MEMORY_LISTENER_CALL_GLOBAL(begin, Forward);
+            /*
+             * Address spaces whose FlatView survived the transaction need
+             * no listener updates at all; listeners expect a full replay
+             * of the sections between begin and commit, so do not even
+             * call those for them.
+             */
+            QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
+                if (address_space_flatview_changed(as)) {
+                    g_hash_table_add(changed, as);
+                }
+            }
+
+            QTAILQ_FOREACH(listener, &memory_listeners, link) {
+                if (listener->begin &&
+                    g_hash_table_contains(changed, listener->address_space)) {
+                    listener->begin(listener);
+                }
+            }
 
             QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
-                address_space_set_flatview(as);
-                address_space_update_ioeventfds(as);
+                if (g_hash_table_contains(changed, as)) {
+                    address_space_set_flatview(as);
+                    address_space_update_ioeventfds(as);
+                } else if (ioeventfd_update_pending) {
+                    address_space_update_ioeventfds(as);
+                }
             }
             memory_region_update_pending = false;
             ioeventfd_update_pending = false;
-            MEMORY_LISTENER_CALL_GLOBAL(commit, Forward);
+
+            QTAILQ_FOREACH(listener, &memory_listeners, link) {
+                if (listener->commit &&
+                    g_hash_table_contains(changed, listener->address_space)) {
+                    listener->commit(listener);
+                }
+            }
         } else if (ioeventfd_update_pending) {
             QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
                 address_space_update_ioeventfds(as);
@@ -2235,7 +2602,9 @@ void memory_region_set_log(MemoryRegion *mr, bool log, unsigned client)
 
     memory_region_transaction_begin();
     mr->dirty_log_mask = (mr->dirty_log_mask & ~mask) | (log * mask);
-    memory_region_update_pending |= mr->enabled;
+    if (mr->enabled) {
+        memory_region_update_range(mr, 0, mr->size);
+    }
     memory_region_transaction_commit();
 }
 
@@ -2365,7 +2734,9 @@ void memory_region_set_readonly(MemoryRegion *mr, bool readonly)
     if (mr->readonly != readonly) {
         memory_region_transaction_begin();
         mr->readonly = readonly;
-        memory_region_update_pending |= mr->enabled;
+        if (mr->enabled) {
+            memory_region_update_range(mr, 0, mr->size);
+        }
         memory_region_transaction_commit();
     }
 }
@@ -2375,7 +2746,9 @@ void memory_region_set_nonvolatile(MemoryRegion *mr, bool nonvolatile)
     if (mr->nonvolatile != nonvolatile) {
         memory_region_transaction_begin();
         mr->nonvolatile = nonvolatile;
-        memory_region_update_pending |= mr->enabled;
+        if (mr->enabled) {
+            memory_region_update_range(mr, 0, mr->size);
+        }
         memory_region_transaction_commit();
     }
 }
@@ -2385,7 +2758,9 @@ void memory_region_rom_device_set_romd(MemoryRegion *mr, bool romd_mode)
     if (mr->romd_mode != romd_mode) {
         memory_region_transaction_begin();
         mr->romd_mode = romd_mode;
-        memory_region_update_pending |= mr->enabled;
+        if (mr->enabled) {
+            memory_region_update_range(mr, 0, mr->size);
+        }
         memory_region_transaction_commit();
     }
 }
@@ -2621,7 +2996,9 @@ static void memory_region_update_container_subregions(MemoryRegion *subregion)
     }
     QTAILQ_INSERT_TAIL(&mr->subregions, subregion, subregions_link);
 done:
-    memory_region_update_pending |= mr->enabled && subregion->enabled;
+    if (mr->enabled && subregion->enabled) {
+        memory_region_update_range(mr, subregion->addr, subregion->size);
+    }
     memory_region_transaction_commit();
 }
 
@@ -2671,10 +3048,24 @@ void memory_region_del_subregion(MemoryRegion *mr,
     }
     QTAILQ_REMOVE(&mr->subregions, subregion, subregions_link);
     memory_region_unref(subregion);
-    memory_region_update_pending |= mr->enabled && subregion->enabled;
+    if (mr->enabled && subregion->enabled) {
+        memory_region_update_range(mr, subregion->addr, subregion->size);
+    }
     memory_region_transaction_commit();
 }
 
+/*
+ * Schedule an update of the first @size bytes of @mr, both where @mr is
+ * mapped in its container and where it is reached through aliases.
+ */
+static void memory_region_update_mapping(MemoryRegion *mr, Int128 size)
+{
+    memory_region_update_range(mr, 0, size);
+    if (mr->container) {
+        memory_region_update_range(mr->container, mr->addr, size);
+    }
+}
+
 void memory_region_set_enabled(MemoryRegion *mr, bool enabled)
 {
     if (enabled == mr->enabled) {
@@ -2682,7 +3073,7 @@ void memory_region_set_enabled(MemoryRegion *mr, bool enabled)
     }
     memory_region_transaction_begin();
     mr->enabled = enabled;
-    memory_region_update_pending = true;
+    memory_region_update_mapping(mr, mr->size);
     memory_region_transaction_commit();
 }
 
@@ -2697,8 +3088,8 @@ void memory_region_set_size(MemoryRegion *mr, uint64_t size)
         return;
     }
     memory_region_transaction_begin();
+    memory_region_update_mapping(mr, int128_max(s, mr->size));
     mr->size = s;
-    memory_region_update_pending = true;
     memory_region_transaction_commit();
 }
 
@@ -2719,8 +3110,14 @@ static void memory_region_readd_subregion(MemoryRegion *mr)
 void memory_region_set_address(MemoryRegion *mr, hwaddr addr)
 {
     if (addr != mr->addr) {
+        memory_region_transaction_begin();
+        if (mr->container && mr->container->enabled && mr->enabled) {
+            /* The new location is recorded when the region is re-added */
+            memory_region_update_range(mr->container, mr->addr, mr->size);
+        }
         mr->addr = addr;
         memory_region_readd_subregion(mr);
+        memory_region_transaction_commit();
     }
 }
 
@@ -2734,7 +3131,9 @@ void memory_region_set_alias_offset(MemoryRegion *mr, hwaddr offset)
 
     memory_region_transaction_begin();
     mr->alias_offset = offset;
-    memory_region_update_pending |= mr->enabled;
+    if (mr->enabled) {
+        memory_region_update_range(mr, 0, mr->size);
+    }
     memory_region_transaction_commit();
 }
 
@@ -2746,7 +3145,9 @@ void memory_region_set_unmergeable(MemoryRegion *mr, bool unmergeable)
 
     memory_region_transaction_begin();
     mr->unmergeable = unmergeable;
-    memory_region_update_pending |= mr->enabled;
+    if (mr->enabled) {
+        memory_region_update_range(mr, 0, mr->size);
+    }
     memory_region_transaction_commit();
 }
 
@@ -2945,7 +3346,7 @@ bool memory_global_dirty_log_start(unsigned int flags, Error **errp)
         }
 
         memory_region_transaction_begin();
-        memory_region_update_pending = true;
+        memory_region_update_range(NULL, 0, int128_zero());
         memory_region_transaction_commit();
     }
     return true;
@@ -2961,7 +3362,7 @@ static void memory_global_dirty_log_do_stop(unsigned int flags)
 
     if (!global_dirty_tracking) {
         memory_region_transaction_begin();
-        memory_region_update_pending = true;
+        memory_region_update_range(NULL, 0, int128_zero());
         memory_region_transaction_commit();
         MEMORY_LISTENER_CALL_GLOBAL(log_global_stop, Reverse);
     }
@@ -245,6 +245,17 @@ static void *qtest_server_send_opaque;
  *
  * Forcibly set the given interrupt pin to the given level.
  *
+ * Memory topology:
+ * """"""""""""""""
+ *
+ * .. code-block:: none
+ *
+ *  > flatview_check on|off
+ *  < OK
+ *
+ * Compare every incrementally updated FlatView with a full render of the
+ * memory regions, and abort on a mismatch.
+ *
  */
 
 static int hex2nib(char ch)
@@ -724,6 +735,11 @@ static void qtest_process_command(CharBackend *chr, gchar **words)
         qtest_send_prefix(chr);
         qtest_sendf(chr, "OK %"PRIi64"\n",
                     (int64_t)qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL));
+    } else if (strcmp(words[0], "flatview_check") == 0) {
+        g_assert(words[1]);
+        memory_region_transaction_set_check(strcmp(words[1], "on") == 0);
+        qtest_send_prefix(chr);
+        qtest_send(chr, "OK\n");
     } else if (strcmp(words[0], "module_load") == 0) {
         Error *local_err = NULL;
         int rv;
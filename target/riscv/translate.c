@@ -116,6 +116,10 @@ typedef struct DisasContext {
     bool frm_valid;
     bool insn_start_updated;
     const GPtrArray *decoders;
+    /* goto_tb slots already used; a trace may have more than two exits */
+    uint8_t goto_tb_used;
+    /* Set by a jump that the trace follows, see translator_trace_jump */
+    target_long trace_diff;
 } DisasContext;
 
 static inline bool has_ext(DisasContext *ctx, uint32_t ext)
@@ -288,7 +292,10 @@ static void gen_goto_tb(DisasContext *ctx, int n, target_long diff)
       * Under itrigger, instruction executes one by one like singlestep,
       * direct block chain benefits will be small.
       */
-    if (translator_use_goto_tb(&ctx->base, dest) && !ctx->itrigger) {
+    if (translator_use_goto_tb(&ctx->base, dest) && !ctx->itrigger &&
+        !(ctx->goto_tb_used & (1 << n))) {
+        ctx->goto_tb_used |= 1 << n;
+        translator_add_jump_dest(&ctx->base, dest);
         /*
          * For pcrel, the pc must always be up-to-date on entry to
          * the linked TB, so that it can use simple additions for all
@@ -572,6 +579,13 @@ static void gen_jal(DisasContext *ctx, int rd, target_ulong imm)
     gen_pc_plus_diff(succ_pc, ctx, ctx->cur_insn_len);
     gen_set_gpr(ctx, rd, succ_pc);
 
+    if ((target_long)imm >= (target_long)ctx->cur_insn_len &&
+        translator_trace_jump(&ctx->base, ctx->base.pc_next + imm)) {
+        /* Keep translating the hot trace at the destination. */
+        ctx->trace_diff = imm;
+        return;
+    }
+
     gen_goto_tb(ctx, 0, imm); /* must use this for safety */
     ctx->base.is_jmp = DISAS_NORETURN;
 }
@@ -1241,6 +1255,8 @@ static void riscv_tr_init_disas_context(DisasContextBase *dcbase, CPUState *cs)
     ctx->zero = tcg_constant_tl(0);
     ctx->virt_inst_excp = false;
     ctx->decoders = cpu->decoders;
+    ctx->goto_tb_used = 0;
+    ctx->trace_diff = 0;
 }
 
 static void riscv_tr_tb_start(DisasContextBase *db, CPUState *cpu)
@@ -1268,7 +1284,12 @@ static void riscv_tr_translate_insn(DisasContextBase *dcbase, CPUState *cpu)
 
     ctx->ol = ctx->xl;
     decode_opc(env, ctx, opcode16);
-    ctx->base.pc_next += ctx->cur_insn_len;
+    if (ctx->trace_diff) {
+        ctx->base.pc_next += ctx->trace_diff;
+        ctx->trace_diff = 0;
+    } else {
+        ctx->base.pc_next += ctx->cur_insn_len;
+    }
 
     /* Only the first insn within a TB is allowed to cross a page boundary. */
     if (ctx->base.is_jmp == DISAS_NEXT) {
@@ -1311,6 +1332,8 @@ static const TranslatorOps riscv_tr_ops = {
     .insn_start         = riscv_tr_insn_start,
     .translate_insn     = riscv_tr_translate_insn,
     .tb_stop            = riscv_tr_tb_stop,
+    .hot_traces         = true,
+    .spec_translate     = true,
 };
 
 void gen_intermediate_code(CPUState *cs, TranslationBlock *tb, int *max_insns,
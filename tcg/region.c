@@ -29,8 +29,10 @@
 #include "qemu/memalign.h"
 #include "qemu/cacheinfo.h"
 #include "qemu/qtree.h"
+#include "qemu/bitmap.h"
 #include "qapi/error.h"
 #include "tcg/tcg.h"
+#include "tcg/startup.h"
 #include "exec/translation-block.h"
 #include "tcg-internal.h"
 #include "host/cpuinfo.h"
@@ -57,6 +59,10 @@ struct tcg_region_tree {
  * dynamically allocate from as demand dictates. Given appropriate region
  * sizing, this minimizes flushes even when some TCG threads generate a lot
  * more code than others.
+ *
+ * Regions are also the unit of eviction: once all of them have been handed
+ * out, tcg_region_evict() picks a cold one with a clock algorithm and makes
+ * it available again, so that a full tb_flush is only a last resort.
  */
 struct tcg_region_state {
     QemuMutex lock;
@@ -72,10 +78,15 @@ struct tcg_region_state {
     /* fields protected by the lock */
     size_t current; /* current region index */
     size_t agg_size_full; /* aggregate size of full regions */
+    size_t clock; /* next eviction candidate */
+    unsigned long *evicted; /* regions emptied by tcg_region_evict */
 };
 
 static struct tcg_region_state region;
 
+/* Preferred address of code_gen_buffer, see tcg_set_code_gen_buffer_hint */
+static void *code_gen_buffer_hint;
+
 /*
  * This is an array of struct tcg_region_tree's, with padding.
  * We use void * to simplify the computation of region_trees[i]; each
@@ -84,6 +95,12 @@ static struct tcg_region_state region;
 static void *region_trees;
 static size_t tree_size;
 
+/*
+ * One "recently executed" byte per region, set by tb_mark_referenced()
+ * and cleared by the clock hand of tcg_region_evict().
+ */
+uint8_t *tcg_region_referenced;
+
 bool in_code_gen_buffer(const void *p)
 {
     /*
@@ -191,10 +208,23 @@ static void tcg_region_trees_init(void)
     }
 }
 
-static struct tcg_region_tree *tc_ptr_to_region_tree(const void *p)
+/* Return the index of the region containing @p, which must be rw. */
+size_t tcg_region_index(const void *p)
 {
-    size_t region_idx;
+    if (p < region.start_aligned) {
+        return 0;
+    } else {
+        ptrdiff_t offset = p - region.start_aligned;
+
+        if (offset > region.stride * (region.n - 1)) {
+            return region.n - 1;
+        }
+        return offset / region.stride;
+    }
+}
 
+static struct tcg_region_tree *tc_ptr_to_region_tree(const void *p)
+{
     /*
      * Like tcg_splitwx_to_rw, with no assert.  The pc may come from
      * a signal handler over which the caller has no control.
@@ -205,19 +235,7 @@ static struct tcg_region_tree *tc_ptr_to_region_tree(const void *p)
             return NULL;
         }
     }
-
-    if (p < region.start_aligned) {
-        region_idx = 0;
-    } else {
-        ptrdiff_t offset = p - region.start_aligned;
-
-        if (offset > region.stride * (region.n - 1)) {
-            region_idx = region.n - 1;
-        } else {
-            region_idx = offset / region.stride;
-        }
-    }
-    return region_trees + region_idx * tree_size;
+    return region_trees + tcg_region_index(p) * tree_size;
 }
 
 void tcg_tb_insert(TranslationBlock *tb)
@@ -261,6 +279,13 @@ TranslationBlock *tcg_tb_lookup(uintptr_t tc_ptr)
     return tb;
 }
 
+static gboolean tcg_region_collect_tb(gpointer key, gpointer value,
+                                      gpointer data)
+{
+    g_ptr_array_add(data, value);
+    return FALSE;
+}
+
 static void tcg_region_tree_lock_all(void)
 {
     size_t i;
@@ -311,17 +336,20 @@ size_t tcg_nb_tbs(void)
     return nb_tbs;
 }
 
+static void tcg_region_tree_reset(struct tcg_region_tree *rt)
+{
+    /* Increment the refcount first so that destroy acts as a reset */
+    q_tree_ref(rt->tree);
+    q_tree_destroy(rt->tree);
+}
+
 static void tcg_region_tree_reset_all(void)
 {
     size_t i;
 
     tcg_region_tree_lock_all();
     for (i = 0; i < region.n; i++) {
-        struct tcg_region_tree *rt = region_trees + i * tree_size;
-
-        /* Increment the refcount first so that destroy acts as a reset */
-        q_tree_ref(rt->tree);
-        q_tree_destroy(rt->tree);
+        tcg_region_tree_reset(region_trees + i * tree_size);
     }
     tcg_region_tree_unlock_all();
 }
@@ -359,11 +387,21 @@ static void tcg_region_assign(TCGContext *s, size_t curr_region)
 
 static bool tcg_region_alloc__locked(TCGContext *s)
 {
-    if (region.current == region.n) {
-        return true;
+    size_t i;
+
+    if (region.current < region.n) {
+        i = region.current++;
+    } else {
+        /* Reuse a region freed by tcg_region_evict, if any */
+        i = find_first_bit(region.evicted, region.n);
+        if (i == region.n) {
+            return true;
+        }
+        clear_bit(i, region.evicted);
     }
-    tcg_region_assign(s, region.current);
-    region.current++;
+    tcg_region_assign(s, i);
+    /* Do not make a freshly filled region the next victim */
+    qatomic_set(&tcg_region_referenced[i], 1);
     return false;
 }
 
@@ -412,6 +450,9 @@ void tcg_region_reset_all(void)
     qemu_mutex_lock(&region.lock);
     region.current = 0;
     region.agg_size_full = 0;
+    region.clock = 0;
+    bitmap_zero(region.evicted, region.n);
+    memset(tcg_region_referenced, 0, region.n);
 
     for (i = 0; i < n_ctxs; i++) {
         TCGContext *s = qatomic_read(&tcg_ctxs[i]);
@@ -422,29 +463,117 @@ void tcg_region_reset_all(void)
     tcg_region_tree_reset_all();
 }
 
+/*
+ * Return true if region @i is currently assigned to a TCG context.
+ * Called with region.lock held.
+ */
+static bool tcg_region_in_use(size_t i)
+{
+    unsigned int n_ctxs = qatomic_read(&tcg_cur_ctxs);
+    unsigned int j;
+
+    for (j = 0; j < n_ctxs; j++) {
+        const TCGContext *s = qatomic_read(&tcg_ctxs[j]);
+
+        if (tcg_region_index(s->code_gen_buffer) == i) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Evict one cold region: a region that is full, not assigned to any
+ * TCG context and whose "referenced" byte is clear.  The clock hand
+ * gives every referenced region a second chance by clearing its byte.
+ *
+ * @func is called on each TB of the victim, before the region's tree
+ * is emptied; it must unlink and invalidate the TB.  The region can
+ * then be handed out again by tcg_region_alloc.
+ *
+ * Returns the index of the evicted region, or -1 if no region can be
+ * evicted and the caller must flush the whole buffer instead.
+ * Call from a safe-work context.
+ */
+ssize_t tcg_region_evict(GFunc func, gpointer data)
+{
+    struct tcg_region_tree *rt;
+    void *start, *end;
+    GPtrArray *tbs;
+    ssize_t victim = -1;
+    size_t i;
+
+    qemu_mutex_lock(&region.lock);
+    for (i = 0; i < 2 * region.n; i++) {
+        size_t r = region.clock;
+
+        region.clock = (r + 1) % region.n;
+        if (r >= region.current || test_bit(r, region.evicted) ||
+            tcg_region_in_use(r)) {
+            continue;
+        }
+        if (qatomic_read(&tcg_region_referenced[r])) {
+            qatomic_set(&tcg_region_referenced[r], 0);
+            continue;
+        }
+        victim = r;
+        break;
+    }
+    if (victim < 0) {
+        qemu_mutex_unlock(&region.lock);
+        return -1;
+    }
+    set_bit(victim, region.evicted);
+    tcg_region_bounds(victim, &start, &end);
+    region.agg_size_full -= end - start - TCG_HIGHWATER;
+    qemu_mutex_unlock(&region.lock);
+
+    /*
+     * Invalidating a TB does not remove it from the region tree,
+     * so the tree can be walked while collecting its TBs.
+     */
+    rt = region_trees + victim * tree_size;
+    tbs = g_ptr_array_new();
+    qemu_mutex_lock(&rt->lock);
+    q_tree_foreach(rt->tree, tcg_region_collect_tb, tbs);
+    qemu_mutex_unlock(&rt->lock);
+
+    g_ptr_array_foreach(tbs, func, data);
+    g_ptr_array_free(tbs, true);
+
+    qemu_mutex_lock(&rt->lock);
+    tcg_region_tree_reset(rt);
+    qemu_mutex_unlock(&rt->lock);
+
+    return victim;
+}
+
 static size_t tcg_n_regions(size_t tb_size, unsigned max_cpus)
 {
+    /*
+     * Aim for regions of at least 2 MB: besides letting vCPU threads
+     * translate in parallel, they are the unit of eviction, so even a
+     * single TCG context uses a few of them.
+     */
+    size_t n_regions = MAX(tb_size / (2 * MiB), 1);
+
 #ifdef CONFIG_USER_ONLY
-    return 1;
+    return MIN(n_regions, 8);
 #else
-    size_t n_regions;
-
     /*
      * It is likely that some vCPUs will translate more code than others,
      * so we first try to set more regions than max_cpus, with those regions
      * being of reasonable size. If that's not possible we make do by evenly
      * dividing the code_gen_buffer among the vCPUs.
      */
-    /* Use a single region if all we have is one vCPU thread */
     if (max_cpus == 1 || !qemu_tcg_mttcg_enabled()) {
-        return 1;
+        return MIN(n_regions, 8);
     }
 
     /*
      * Try to have more regions than max_cpus, with each region being >= 2 MB.
      * If we can't, then just allocate one region per vCPU thread.
      */
-    n_regions = tb_size / (2 * MiB);
     if (n_regions <= max_cpus) {
         return max_cpus;
     }
@@ -556,7 +685,7 @@ static int alloc_code_gen_buffer_anon(size_t size, int prot,
 {
     void *buf;
 
-    buf = mmap(NULL, size, prot, flags, -1, 0);
+    buf = mmap(code_gen_buffer_hint, size, prot, flags, -1, 0);
     if (buf == MAP_FAILED) {
         error_setg_errno(errp, errno,
                          "allocate %zu bytes for jit buffer", size);
@@ -721,6 +850,11 @@ static int alloc_code_gen_buffer(size_t size, int splitwx, Error **errp)
 }
 #endif /* USE_STATIC_CODE_GEN_BUFFER, WIN32, POSIX */
 
+void tcg_set_code_gen_buffer_hint(void *hint)
+{
+    code_gen_buffer_hint = hint;
+}
+
 /*
  * Initializes region partitioning.
  *
@@ -732,12 +866,15 @@ static int alloc_code_gen_buffer(size_t size, int splitwx, Error **errp)
  * code in parallel without synchronization.
  *
  * In system-mode the number of TCG threads is bounded by max_cpus, so we use at
- * least max_cpus regions in MTTCG. In !MTTCG we use a single region.
+ * least max_cpus regions in MTTCG. In !MTTCG we use up to 8 regions, all of
+ * them filled in turn by the single TCG context; they only serve as the unit
+ * of eviction (see tcg_region_evict).
  * Note that the TCG options from the command-line (i.e. -accel accel=tcg,[...])
  * must have been parsed before calling this function, since it calls
  * qemu_tcg_mttcg_enabled().
  *
- * In user-mode we use a single region.  Having multiple regions in user-mode
+ * In user-mode all threads share a single TCG context, which likewise fills
+ * up to 8 regions in turn.  Having one region per thread in user-mode
  * is not supported, because the number of vCPU threads (recall that each thread
  * spawned by the guest corresponds to a vCPU thread) is only bounded by the
  * OS, and usually this number is huge (tens of thousands is not uncommon).
@@ -851,6 +988,8 @@ void tcg_region_init(size_t tb_size, int splitwx, unsigned max_cpus)
     }
 
     tcg_region_trees_init();
+    region.evicted = bitmap_new(region.n);
+    tcg_region_referenced = g_new0(uint8_t, region.n);
 
     /*
      * Leave the initial context initialized to the first region.
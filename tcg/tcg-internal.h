@@ -38,6 +38,7 @@ void tcg_region_init(size_t tb_size, int splitwx, unsigned max_cpus);
 bool tcg_region_alloc(TCGContext *s);
 void tcg_region_initial_alloc(TCGContext *s);
 void tcg_region_prologue_set(TCGContext *s);
+size_t tcg_region_index(const void *p);
 
 static inline void *tcg_call_func(TCGOp *op)
 {
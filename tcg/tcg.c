@@ -1400,6 +1400,7 @@ TranslationBlock *tcg_tb_alloc(TCGContext *s)
     }
     qatomic_set(&s->code_gen_ptr, next);
     s->data_gen_ptr = NULL;
+    tb->region = tcg_region_index(tb);
     return tb;
 }
 
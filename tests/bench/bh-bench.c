@@ -0,0 +1,178 @@
+/*
+ * Cross-thread bottom half scheduling benchmark
+ *
+ * A number of producer threads schedule one-shot bottom halves in an
+ * AioContext that is run by a separate consumer thread, the way vCPU
+ * threads kick IOThreads.  The batched variants schedule several bottom
+ * halves within a defer_call_begin()/defer_call_end() section, as device
+ * emulation does when it processes a virtqueue.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#include "qemu/osdep.h"
+#include "qemu/defer-call.h"
+#include "qemu/thread.h"
+#include "qemu/processor.h"
+#include "qemu/rcu.h"
+#include "qemu/timer.h"
+#include "block/aio.h"
+#include "qapi/error.h"
+
+/* Maximum number of pending bottom halves per producer */
+#define DEPTH       64
+#define DURATION_US (G_USEC_PER_SEC / 2)
+
+struct thread_info {
+    uint64_t scheduled;
+    uint64_t completed;
+} QEMU_ALIGNED(64);
+
+static QemuThread *threads;
+static QemuThread consumer;
+static struct thread_info *th_info;
+static AioContext *ctx;
+static unsigned int n_threads;
+static unsigned int batch;
+static unsigned int n_ready_threads;
+static uint64_t n_polls;
+static bool test_start;
+static bool test_stop;
+
+static void bh_cb(void *opaque)
+{
+    struct thread_info *info = opaque;
+
+    qatomic_set(&info->completed, info->completed + 1);
+}
+
+static void wakeup_cb(void *opaque)
+{
+}
+
+static void *consumer_func(void *arg)
+{
+    rcu_register_thread();
+    ctx = aio_context_new(&error_abort);
+    qemu_set_current_aio_context(ctx);
+    qatomic_inc(&n_ready_threads);
+
+    while (!qatomic_read(&test_stop)) {
+        aio_poll(ctx, true);
+        n_polls++;
+    }
+    while (aio_poll(ctx, false)) {
+        /* drain the remaining bottom halves */
+    }
+
+    aio_context_unref(ctx);
+    rcu_unregister_thread();
+    return NULL;
+}
+
+static void *producer_func(void *arg)
+{
+    struct thread_info *info = arg;
+
+    qatomic_inc(&n_ready_threads);
+    while (!qatomic_read(&test_start)) {
+        cpu_relax();
+    }
+
+    while (!qatomic_read(&test_stop)) {
+        unsigned int i;
+
+        if (info->scheduled - qatomic_read(&info->completed) > DEPTH - batch) {
+            cpu_relax();
+            continue;
+        }
+        defer_call_begin();
+        for (i = 0; i < batch; i++) {
+            aio_bh_schedule_oneshot(ctx, bh_cb, info);
+        }
+        defer_call_end();
+        info->scheduled += batch;
+    }
+    return NULL;
+}
+
+typedef struct {
+    unsigned int n_threads;
+    unsigned int batch;
+} BHBenchParams;
+
+static void test(const void *opaque)
+{
+    const BHBenchParams *params = opaque;
+    uint64_t completed = 0;
+    unsigned int i;
+    double tx;
+
+    n_threads = params->n_threads;
+    batch = params->batch;
+    n_ready_threads = 0;
+    n_polls = 0;
+    test_start = false;
+    test_stop = false;
+
+    th_info = g_new0(struct thread_info, n_threads);
+    threads = g_new(QemuThread, n_threads);
+
+    qemu_thread_create(&consumer, "consumer", consumer_func, NULL,
+                       QEMU_THREAD_JOINABLE);
+    for (i = 0; i < n_threads; i++) {
+        qemu_thread_create(&threads[i], NULL, producer_func, &th_info[i],
+                           QEMU_THREAD_JOINABLE);
+    }
+
+    while (qatomic_read(&n_ready_threads) != n_threads + 1) {
+        cpu_relax();
+    }
+
+    qatomic_set(&test_start, true);
+    g_usleep(DURATION_US);
+    qatomic_set(&test_stop, true);
+
+    for (i = 0; i < n_threads; i++) {
+        qemu_thread_join(&threads[i]);
+    }
+    aio_bh_schedule_oneshot(ctx, wakeup_cb, NULL);
+    qemu_thread_join(&consumer);
+
+    for (i = 0; i < n_threads; i++) {
+        completed += th_info[i].completed;
+    }
+    tx = completed / ((double)DURATION_US / G_USEC_PER_SEC) / 1e6;
+
+    g_test_message("%u producers, batch %2u: %6.2f MBH/s, "
+                   "%6.2f MBH/s/thread, %6.2f BHs per aio_poll",
+                   n_threads, batch, tx, tx / n_threads,
+                   n_polls ? (double)completed / n_polls : 0);
+
+    g_free(threads);
+    g_free(th_info);
+}
+
+int main(int argc, char **argv)
+{
+    static const BHBenchParams params[] = {
+        { 1, 1 }, { 2, 1 }, { 4, 1 },
+        { 1, 16 }, { 2, 16 }, { 4, 16 },
+    };
+
+    g_test_init(&argc, &argv, NULL);
+    init_clocks(NULL);
+
+    for (int i = 0; i < ARRAY_SIZE(params); i++) {
+        g_autofree char *path = NULL;
+
+        if (params[i].batch == 1) {
+            path = g_strdup_printf("/async/bh/schedule/%u",
+                                   params[i].n_threads);
+        } else {
+            path = g_strdup_printf("/async/bh/schedule-batch%u/%u",
+                                   params[i].batch, params[i].n_threads);
+        }
+        g_test_add_data_func(path, &params[i], test);
+    }
+    return g_test_run();
+}
@@ -0,0 +1,99 @@
+/*
+ * Internet checksum speed benchmark
+ *
+ * Runs net_checksum_add_cont() and net_checksum_copy_cont() with every
+ * implementation that the host supports, after checking that they agree
+ * with a plain byte-by-byte sum.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#include "qemu/osdep.h"
+#include "qemu/units.h"
+#include "net/checksum.h"
+
+#define MAX_LEN (64 * KiB)
+
+static uint32_t reference_checksum(int len, const uint8_t *buf, int seq)
+{
+    uint32_t sum1 = 0, sum2 = 0;
+    int i;
+
+    for (i = 0; i < len - 1; i += 2) {
+        sum1 += buf[i];
+        sum2 += buf[i + 1];
+    }
+    if (i < len) {
+        sum1 += buf[i];
+    }
+    return seq & 1 ? sum1 + (sum2 << 8) : sum2 + (sum1 << 8);
+}
+
+static void check(int accel_index, uint8_t *src, uint8_t *dst)
+{
+    for (int i = 0; i < 1000; i++) {
+        int off = g_test_rand_int_range(0, 64);
+        int len = i < 300 ? i : g_test_rand_int_range(0, MAX_LEN - 64);
+        int seq = g_test_rand_int();
+        uint32_t expected = reference_checksum(len, src + off, seq);
+
+        if (net_checksum_add_cont(len, src + off, seq) != expected) {
+            g_error("net_checksum_add_cont #%d: mismatch for len %d",
+                    accel_index, len);
+        }
+        if (net_checksum_copy_cont(len, dst + 1, src + off, seq) != expected ||
+            memcmp(dst + 1, src + off, len)) {
+            g_error("net_checksum_copy_cont #%d: mismatch for len %d",
+                    accel_index, len);
+        }
+    }
+}
+
+static void test(const void *opaque)
+{
+    uint8_t *src = g_malloc(MAX_LEN);
+    uint8_t *dst = g_malloc(MAX_LEN);
+    int accel_index = 0;
+
+    for (size_t i = 0; i < MAX_LEN; i++) {
+        src[i] = g_test_rand_int();
+    }
+
+    do {
+        check(accel_index, src, dst);
+
+        for (size_t len = 64; len <= MAX_LEN; len *= 4) {
+            double total = 0.0, total_copy = 0.0;
+
+            g_test_timer_start();
+            do {
+                net_checksum_add_cont(len, src, 0);
+                total += len;
+            } while (g_test_timer_elapsed() < 0.5);
+            total /= MiB;
+            total /= g_test_timer_last();
+
+            g_test_timer_start();
+            do {
+                net_checksum_copy_cont(len, dst, src, 0);
+                total_copy += len;
+            } while (g_test_timer_elapsed() < 0.5);
+            total_copy /= MiB;
+            total_copy /= g_test_timer_last();
+
+            g_test_message("net_checksum #%d: %6zu bytes %8.0f MB/sec "
+                           "(with copy %8.0f MB/sec)",
+                           accel_index, len, total, total_copy);
+        }
+        accel_index++;
+    } while (test_net_checksum_next_accel());
+
+    g_free(src);
+    g_free(dst);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_data_func("/net/checksum/speed", NULL, test);
+    return g_test_run();
+}
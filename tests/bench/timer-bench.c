@@ -0,0 +1,75 @@
+/*
+ * QEMU timer re-arm speed benchmark
+ *
+ * Arms a number of timers far in the future and measures how long it
+ * takes to move randomly chosen ones to a new random deadline, the way
+ * device models keep re-arming their timers.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#include "qemu/osdep.h"
+#include "qemu/timer.h"
+
+static void timer_cb(void *opaque)
+{
+    g_assert_not_reached();
+}
+
+static void notify_cb(void *opaque, QEMUClockType type)
+{
+}
+
+static void test(const void *opaque)
+{
+    unsigned int n_timers = GPOINTER_TO_UINT(opaque);
+    QEMUTimerListGroup tlg;
+    QEMUTimer *timers = g_new0(QEMUTimer, n_timers);
+    int64_t base = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) +
+                   3600 * NANOSECONDS_PER_SECOND;
+    uint64_t n_mods = 0;
+    unsigned int i;
+
+    timerlistgroup_init(&tlg, notify_cb, NULL);
+    for (i = 0; i < n_timers; i++) {
+        timer_init_full(&timers[i], &tlg, QEMU_CLOCK_REALTIME, SCALE_NS, 0,
+                        timer_cb, NULL);
+        timer_mod_ns(&timers[i],
+                     base + g_test_rand_int_range(0, NANOSECONDS_PER_SECOND));
+    }
+
+    g_test_timer_start();
+    do {
+        for (i = 0; i < 1000; i++) {
+            QEMUTimer *ts = &timers[g_test_rand_int_range(0, n_timers)];
+
+            timer_mod_ns(ts, base +
+                         g_test_rand_int_range(0, NANOSECONDS_PER_SECOND));
+        }
+        n_mods += 1000;
+    } while (g_test_timer_elapsed() < 0.5);
+
+    g_test_message("timer_mod_ns: %6u timers %8.1f ns/re-arm", n_timers,
+                   g_test_timer_last() * 1e9 / n_mods);
+
+    g_assert(timerlistgroup_deadline_ns(&tlg) > 0);
+    for (i = 0; i < n_timers; i++) {
+        timer_del(&timers[i]);
+    }
+    timerlistgroup_deinit(&tlg);
+    g_free(timers);
+}
+
+int main(int argc, char **argv)
+{
+    static const unsigned int n_timers[] = { 10, 100, 1000, 10000 };
+
+    g_test_init(&argc, &argv, NULL);
+    init_clocks(NULL);
+
+    for (int i = 0; i < ARRAY_SIZE(n_timers); i++) {
+        g_autofree char *path = g_strdup_printf("/timer/rearm/%u",
+                                                n_timers[i]);
+        g_test_add_data_func(path, GUINT_TO_POINTER(n_timers[i]), test);
+    }
+    return g_test_run();
+}
@@ -278,6 +278,105 @@ static void test_i440fx_pam(gconstpointer opaque)
     qtest_end();
 }
 
+#define TESTDEV_MMIO 0xe0000000
+
+/* Reads of offset 0 of a pci-testdev BAR0 return the selected test. */
+static void testdev_map(QPCIDevice *dev, uint32_t addr)
+{
+    qpci_config_writel(dev, PCI_BASE_ADDRESS_0, addr);
+}
+
+static void testdev_set_memory(QPCIDevice *dev, bool enable)
+{
+    uint16_t cmd = qpci_config_readw(dev, PCI_COMMAND);
+
+    if (enable) {
+        cmd |= PCI_COMMAND_MEMORY;
+    } else {
+        cmd &= ~PCI_COMMAND_MEMORY;
+    }
+    qpci_config_writew(dev, PCI_COMMAND, cmd);
+}
+
+/*
+ * Move overlapping BARs and PAM aliases around.  With flatview_check on,
+ * every incremental FlatView update is checked against a full render of
+ * the address space, so this mostly has to produce interesting topologies;
+ * the reads check that the expected region ends up on top.
+ */
+static void test_i440fx_flatview(gconstpointer opaque)
+{
+    QPCIBus *bus;
+    QPCIDevice *host, *a, *b;
+
+    qtest_start("-machine pc "
+                "-device pci-testdev,addr=04.0 "
+                "-device pci-testdev,addr=05.0");
+    qtest_flatview_check(global_qtest, true);
+    bus = qpci_new_pc(global_qtest, NULL);
+    host = qpci_device_find(bus, QPCI_DEVFN(0, 0));
+    a = qpci_device_find(bus, QPCI_DEVFN(4, 0));
+    b = qpci_device_find(bus, QPCI_DEVFN(5, 0));
+    g_assert(host != NULL && a != NULL && b != NULL);
+
+    /* Disjoint BARs; select test 1 on a and test 2 on b. */
+    testdev_map(a, TESTDEV_MMIO);
+    testdev_map(b, TESTDEV_MMIO + 0x10000);
+    qpci_device_enable(a);
+    qpci_device_enable(b);
+    writeb(TESTDEV_MMIO, 1);
+    writeb(TESTDEV_MMIO + 0x10000, 2);
+    g_assert_cmphex(readb(TESTDEV_MMIO), ==, 1);
+    g_assert_cmphex(readb(TESTDEV_MMIO + 0x10000), ==, 2);
+
+    /* Same priority: the BAR mapped last shadows the other one. */
+    testdev_map(b, TESTDEV_MMIO + 0x800);
+    g_assert_cmphex(readb(TESTDEV_MMIO), ==, 1);
+    g_assert_cmphex(readb(TESTDEV_MMIO + 0x800), ==, 2);
+
+    testdev_set_memory(b, false);
+    g_assert_cmphex(readb(TESTDEV_MMIO), ==, 1);
+    g_assert_cmphex(readb(TESTDEV_MMIO + 0x800), ==, 0);
+
+    testdev_set_memory(b, true);
+    g_assert_cmphex(readb(TESTDEV_MMIO + 0x800), ==, 2);
+
+    testdev_map(a, TESTDEV_MMIO + 0x800);
+    g_assert_cmphex(readb(TESTDEV_MMIO + 0x800), ==, 1);
+
+    testdev_set_memory(a, false);
+    g_assert_cmphex(readb(TESTDEV_MMIO + 0x800), ==, 2);
+    testdev_set_memory(a, true);
+    g_assert_cmphex(readb(TESTDEV_MMIO + 0x800), ==, 1);
+
+    /*
+     * Below 1 MiB the PCI address space is reached through the PAM
+     * aliases, which shadow it with RAM when reads are enabled.
+     */
+    testdev_map(a, 0xd0000);
+    pam_set(host, 6, 0);
+    g_assert_cmphex(readb(0xd0000), ==, 1);
+
+    pam_set(host, 6, PAM_RE | PAM_WE);
+    write_area(0xd0000, 0xd3fff, 0x42);
+    g_assert(verify_area(0xd0000, 0xd3fff, 0x42));
+
+    pam_set(host, 6, 0);
+    g_assert_cmphex(readb(0xd0000), ==, 1);
+
+    testdev_set_memory(a, false);
+    pam_set(host, 6, PAM_RE);
+    testdev_set_memory(a, true);
+    g_assert(verify_area(0xd0000, 0xd3fff, 0x42));
+    g_assert_cmphex(readb(TESTDEV_MMIO + 0x800), ==, 2);
+
+    g_free(host);
+    g_free(a);
+    g_free(b);
+    qpci_free_pc(bus);
+    qtest_end();
+}
+
 #define BLOB_SIZE ((size_t)65536)
 #define ISA_BIOS_MAXSZ ((size_t)(128 * 1024))
 
@@ -386,6 +485,9 @@ int main(int argc, char **argv)
 
     qtest_add_data_func("i440fx/defaults", &data, test_i440fx_defaults);
     qtest_add_data_func("i440fx/pam", &data, test_i440fx_pam);
+    if (qtest_has_device("pci-testdev")) {
+        qtest_add_data_func("i440fx/flatview", &data, test_i440fx_flatview);
+    }
     add_firmware_test("i440fx/firmware/bios", request_bios);
     add_firmware_test("i440fx/firmware/pflash", request_pflash);
 
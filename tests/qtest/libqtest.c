@@ -989,6 +989,12 @@ void qtest_module_load(QTestState *s, const char *prefix, const char *libname)
     qtest_rsp(s);
 }
 
+void qtest_flatview_check(QTestState *s, bool enable)
+{
+    qtest_sendf(s, "flatview_check %s\n", enable ? "on" : "off");
+    qtest_rsp(s);
+}
+
 static int64_t qtest_clock_rsp(QTestState *s)
 {
     gchar **words;
@@ -355,6 +355,16 @@ char *qtest_vhmp(QTestState *s, const char *fmt, va_list ap)
 
 void qtest_module_load(QTestState *s, const char *prefix, const char *libname);
 
+/**
+ * qtest_flatview_check:
+ * @s: #QTestState instance to operate on.
+ * @enable: true to enable the check, false to disable it.
+ *
+ * Make QEMU compare every incrementally updated FlatView with a full
+ * render of the memory regions, and abort if they differ.
+ */
+void qtest_flatview_check(QTestState *s, bool enable);
+
 /**
  * qtest_get_irq:
  * @s: #QTestState instance to operate on.
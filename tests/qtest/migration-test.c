@@ -2228,6 +2228,46 @@ static void test_precopy_file_mapped_ram(void)
     test_file_common(&args, true);
 }
 
+static void *migrate_mapped_ram_lazy_load_start(QTestState *from,
+                                                QTestState *to)
+{
+    migrate_mapped_ram_start(from, to);
+    migrate_set_capability(to, "mapped-ram-lazy-load", true);
+
+    return NULL;
+}
+
+static void migrate_mapped_ram_lazy_load_end(QTestState *from,
+                                             QTestState *to,
+                                             void *opaque)
+{
+    QDict *rsp;
+
+    /*
+     * The guest has gone through all of its RAM by now, after the incoming
+     * migration completed and closed its channel: the pages must still
+     * have been loaded from the file without errors.
+     */
+    rsp = qtest_qmp_assert_success_ref(to, "{ 'execute': 'query-migrate' }");
+    g_assert_cmpstr(qdict_get_str(rsp, "status"), ==, "completed");
+    g_assert(!qdict_haskey(rsp, "error-desc"));
+    qobject_unref(rsp);
+}
+
+static void test_precopy_file_mapped_ram_lazy_load(void)
+{
+    g_autofree char *uri = g_strdup_printf("file:%s/%s", tmpfs,
+                                           FILE_TEST_FILENAME);
+    MigrateCommon args = {
+        .connect_uri = uri,
+        .listen_uri = "defer",
+        .start_hook = migrate_mapped_ram_lazy_load_start,
+        .finish_hook = migrate_mapped_ram_lazy_load_end,
+    };
+
+    test_file_common(&args, true);
+}
+
 static void *migrate_multifd_mapped_ram_start(QTestState *from, QTestState *to)
 {
     migrate_mapped_ram_start(from, to);
@@ -2390,6 +2430,25 @@ static void test_precopy_tcp_plain(void)
     test_precopy_common(&args);
 }
 
+static void *test_migrate_dirty_sync_threads_start(QTestState *from,
+                                                  QTestState *to)
+{
+    migrate_set_parameter_int(from, "dirty-sync-threads", 4);
+
+    return NULL;
+}
+
+static void test_precopy_tcp_dirty_sync_threads(void)
+{
+    MigrateCommon args = {
+        .listen_uri = "tcp:127.0.0.1:0",
+        .start_hook = test_migrate_dirty_sync_threads_start,
+        .live = true,
+    };
+
+    test_precopy_common(&args);
+}
+
 static void *test_migrate_switchover_ack_start(QTestState *from, QTestState *to)
 {
 
@@ -2885,6 +2944,16 @@ test_migrate_precopy_tcp_multifd_start_zero_page_legacy(QTestState *from,
     return NULL;
 }
 
+static void *
+test_migrate_precopy_tcp_multifd_start_zero_page_multifd(QTestState *from,
+                                                         QTestState *to)
+{
+    test_migrate_precopy_tcp_multifd_start_common(from, to, "none");
+    /* Dirty pages are queued to the channels in batches */
+    migrate_set_parameter_str(from, "zero-page-detection", "multifd");
+    return NULL;
+}
+
 static void *
 test_migration_precopy_tcp_multifd_start_no_zero_page(QTestState *from,
                                                       QTestState *to)
@@ -2918,6 +2987,19 @@ test_migrate_precopy_tcp_multifd_zstd_start(QTestState *from,
 
     return test_migrate_precopy_tcp_multifd_start_common(from, to, "zstd");
 }
+
+static void *
+test_migrate_precopy_tcp_multifd_zstd_adaptive_start(QTestState *from,
+                                                     QTestState *to)
+{
+    /* multifd-adaptive-compression requires multifd */
+    migrate_set_capability(from, "multifd", true);
+    migrate_set_capability(to, "multifd", true);
+    migrate_set_capability(from, "multifd-adaptive-compression", true);
+    migrate_set_capability(to, "multifd-adaptive-compression", true);
+
+    return test_migrate_precopy_tcp_multifd_zstd_start(from, to);
+}
 #endif /* CONFIG_ZSTD */
 
 #ifdef CONFIG_QPL
@@ -2967,6 +3049,21 @@ static void test_multifd_tcp_zero_page_legacy(void)
     test_precopy_common(&args);
 }
 
+static void test_multifd_tcp_zero_page_multifd(void)
+{
+    MigrateCommon args = {
+        .listen_uri = "defer",
+        .start_hook = test_migrate_precopy_tcp_multifd_start_zero_page_multifd,
+        /*
+         * Go through more than one pass, so that pages that were sent
+         * in a batch get dirtied and queued again.
+         */
+        .live = true,
+        .iterations = 2,
+    };
+    test_precopy_common(&args);
+}
+
 static void test_multifd_tcp_no_zero_page(void)
 {
     MigrateCommon args = {
@@ -3015,6 +3112,15 @@ static void test_multifd_tcp_zstd(void)
     };
     test_precopy_common(&args);
 }
+
+static void test_multifd_tcp_zstd_adaptive(void)
+{
+    MigrateCommon args = {
+        .listen_uri = "defer",
+        .start_hook = test_migrate_precopy_tcp_multifd_zstd_adaptive_start,
+    };
+    test_precopy_common(&args);
+}
 #endif
 
 #ifdef CONFIG_QPL
@@ -3805,6 +3911,10 @@ int main(int argc, char **argv)
                        test_precopy_file_mapped_ram);
     migration_test_add("/migration/precopy/file/mapped-ram/live",
                        test_precopy_file_mapped_ram_live);
+    if (has_uffd) {
+        migration_test_add("/migration/precopy/file/mapped-ram/lazy-load",
+                           test_precopy_file_mapped_ram_lazy_load);
+    }
 
     migration_test_add("/migration/multifd/file/mapped-ram",
                        test_multifd_file_mapped_ram);
@@ -3849,6 +3959,8 @@ int main(int argc, char **argv)
 #endif /* CONFIG_GNUTLS */
 
     migration_test_add("/migration/precopy/tcp/plain", test_precopy_tcp_plain);
+    migration_test_add("/migration/precopy/tcp/plain/dirty-sync-threads",
+                       test_precopy_tcp_dirty_sync_threads);
 
     migration_test_add("/migration/precopy/tcp/plain/switchover-ack",
                        test_precopy_tcp_switchover_ack);
@@ -3912,6 +4024,8 @@ int main(int argc, char **argv)
                        test_multifd_tcp_channels_none);
     migration_test_add("/migration/multifd/tcp/plain/zero-page/legacy",
                        test_multifd_tcp_zero_page_legacy);
+    migration_test_add("/migration/multifd/tcp/plain/zero-page/multifd",
+                       test_multifd_tcp_zero_page_multifd);
     migration_test_add("/migration/multifd/tcp/plain/zero-page/none",
                        test_multifd_tcp_no_zero_page);
     migration_test_add("/migration/multifd/tcp/plain/cancel",
@@ -3921,6 +4035,8 @@ int main(int argc, char **argv)
 #ifdef CONFIG_ZSTD
     migration_test_add("/migration/multifd/tcp/plain/zstd",
                        test_multifd_tcp_zstd);
+    migration_test_add("/migration/multifd/tcp/plain/zstd/adaptive",
+                       test_multifd_tcp_zstd_adaptive);
 #endif
 #ifdef CONFIG_QPL
     migration_test_add("/migration/multifd/tcp/plain/qpl",
@@ -14,6 +14,7 @@
 #include "qemu/module.h"
 #include "standard-headers/linux/virtio_blk.h"
 #include "standard-headers/linux/virtio_pci.h"
+#include "standard-headers/linux/virtio_ring.h"
 #include "libqos/qgraph.h"
 #include "libqos/virtio-blk.h"
 
@@ -771,6 +772,254 @@ static void resize(void *obj, void *data, QGuestAllocator *t_alloc)
 
 }
 
+/*
+ * virtio-blk pops all requests of a notification with virtqueue_pop_batch().
+ * Submit several requests per notification on a small ring, so that batches
+ * and descriptor chains keep crossing the end of the ring.
+ */
+#define BATCH_QUEUE_SIZE    16
+#define BATCH_NUM_REQS      4
+#define BATCH_NUM_ROUNDS    16
+
+typedef struct BatchRing {
+    QVirtQueue *vq;
+    bool packed;
+    uint16_t next_desc;
+    uint16_t avail_idx;         /* split ring: next avail->idx */
+    uint16_t used_idx;          /* split ring: last seen used->idx */
+    bool wrap_counter;          /* packed ring: driver ring wrap counter */
+    uint16_t heads[BATCH_NUM_REQS];
+    bool head_wrap[BATCH_NUM_REQS];
+} BatchRing;
+
+static void batch_add_desc(BatchRing *r, uint16_t id, uint64_t addr,
+                           uint32_t len, bool write, bool next)
+{
+    uint64_t desc_addr = r->vq->desc + 16 * r->next_desc;
+    uint16_t flags = (next ? VRING_DESC_F_NEXT : 0) |
+                     (write ? VRING_DESC_F_WRITE : 0);
+
+    if (r->packed) {
+        struct vring_packed_desc desc = {
+            .addr = cpu_to_le64(addr),
+            .len = cpu_to_le32(len),
+            .id = cpu_to_le16(id),
+        };
+
+        flags |= r->wrap_counter ? 1 << VRING_PACKED_DESC_F_AVAIL
+                                 : 1 << VRING_PACKED_DESC_F_USED;
+        desc.flags = cpu_to_le16(flags);
+        memwrite(desc_addr, &desc, sizeof(desc));
+
+        if (++r->next_desc == r->vq->size) {
+            r->next_desc = 0;
+            r->wrap_counter = !r->wrap_counter;
+        }
+    } else {
+        uint16_t next_desc = (r->next_desc + 1) % r->vq->size;
+        struct vring_desc desc = {
+            .addr = cpu_to_le64(addr),
+            .len = cpu_to_le32(len),
+            .flags = cpu_to_le16(flags),
+            .next = cpu_to_le16(next_desc),
+        };
+
+        memwrite(desc_addr, &desc, sizeof(desc));
+        r->next_desc = next_desc;
+    }
+}
+
+/*
+ * Queue a header/data/status chain.  The device only looks at the ring when
+ * it is notified, so the descriptors can be written in order.
+ */
+static void batch_add_req(BatchRing *r, int i, uint64_t req_addr, bool read)
+{
+    uint16_t head = r->next_desc;
+
+    r->heads[i] = head;
+    r->head_wrap[i] = r->wrap_counter;
+
+    batch_add_desc(r, head, req_addr, 16, false, true);
+    batch_add_desc(r, head, req_addr + 16, 512, read, true);
+    batch_add_desc(r, head, req_addr + 528, 1, true, false);
+
+    if (!r->packed) {
+        uint16_t entry = cpu_to_le16(head);
+
+        memwrite(r->vq->avail + 4 + 2 * (r->avail_idx % r->vq->size),
+                 &entry, sizeof(entry));
+        r->avail_idx++;
+    }
+}
+
+static uint16_t batch_readw(uint64_t addr)
+{
+    uint16_t val;
+
+    memread(addr, &val, sizeof(val));
+    return le16_to_cpu(val);
+}
+
+static bool batch_done(BatchRing *r)
+{
+    int i;
+
+    if (!r->packed) {
+        return batch_readw(r->vq->used + 2) == r->avail_idx;
+    }
+
+    /*
+     * All chains have the same length, so the used descriptors land on the
+     * heads of the chains, in whatever order the requests complete.
+     */
+    for (i = 0; i < BATCH_NUM_REQS; i++) {
+        uint16_t flags = batch_readw(r->vq->desc + 16 * r->heads[i] + 14);
+        bool avail = flags & (1 << VRING_PACKED_DESC_F_AVAIL);
+        bool used = flags & (1 << VRING_PACKED_DESC_F_USED);
+
+        if (avail != r->head_wrap[i] || used != r->head_wrap[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Notify the device once for the whole batch and wait for all requests */
+static void batch_run(QTestState *qts, QVirtioDevice *dev, BatchRing *r)
+{
+    gint64 start_time = g_get_monotonic_time();
+    bool seen[BATCH_QUEUE_SIZE] = {};
+    int i, j;
+
+    if (!r->packed) {
+        uint16_t idx = cpu_to_le16(r->avail_idx);
+
+        memwrite(r->vq->avail + 2, &idx, sizeof(idx));
+    }
+    dev->bus->virtqueue_kick(dev, r->vq);
+
+    while (!batch_done(r)) {
+        g_assert(g_get_monotonic_time() - start_time <= QVIRTIO_BLK_TIMEOUT_US);
+        qtest_clock_step(qts, 100);
+    }
+
+    /* Every request is returned exactly once */
+    for (i = 0; i < BATCH_NUM_REQS; i++) {
+        uint32_t id;
+
+        if (r->packed) {
+            id = batch_readw(r->vq->desc + 16 * r->heads[i] + 12);
+        } else {
+            memread(r->vq->used + 4 + 8 * (r->used_idx++ % r->vq->size),
+                    &id, sizeof(id));
+            id = le32_to_cpu(id);
+        }
+
+        for (j = 0; j < BATCH_NUM_REQS && r->heads[j] != id; j++) {
+            /* nothing */
+        }
+        g_assert_cmpint(j, <, BATCH_NUM_REQS);
+        g_assert(!seen[id]);
+        seen[id] = true;
+    }
+}
+
+static void test_batch(QVirtioDevice *dev, QGuestAllocator *alloc,
+                       bool packed)
+{
+    QTestState *qts = global_qtest;
+    BatchRing r = {
+        .packed = packed,
+        .wrap_counter = true,
+    };
+    uint64_t req_addr[BATCH_NUM_REQS];
+    uint64_t features;
+    char *expected = g_malloc(512);
+    char *data = g_malloc(512);
+    int round, i;
+
+    features = qvirtio_get_features(dev);
+    g_assert(features & (1ull << VIRTIO_F_VERSION_1));
+    if (packed) {
+        g_assert(features & (1ull << VIRTIO_F_RING_PACKED));
+    }
+    features = features & ~(QVIRTIO_F_BAD_FEATURE |
+                            (1u << VIRTIO_RING_F_INDIRECT_DESC) |
+                            (1u << VIRTIO_RING_F_EVENT_IDX) |
+                            (1u << VIRTIO_BLK_F_SCSI) |
+                            (packed ? 0 : 1ull << VIRTIO_F_RING_PACKED));
+    qvirtio_set_features(dev, features);
+
+    r.vq = qvirtqueue_setup(dev, alloc, 0);
+    g_assert_cmpint(r.vq->size, ==, BATCH_QUEUE_SIZE);
+    if (packed) {
+        /* qvring_init() has linked the descriptors for a split ring */
+        qtest_memset(qts, r.vq->desc, 0, 16 * r.vq->size);
+    }
+
+    qvirtio_set_driver_ok(dev);
+
+    for (i = 0; i < BATCH_NUM_REQS; i++) {
+        req_addr[i] = guest_alloc(alloc, 16 + 512 + 1);
+    }
+
+    /* Alternate between writing a set of sectors and reading it back */
+    for (round = 0; round < BATCH_NUM_ROUNDS; round++) {
+        bool read = round & 1;
+
+        for (i = 0; i < BATCH_NUM_REQS; i++) {
+            QVirtioBlkReq req = {
+                .type = read ? VIRTIO_BLK_T_IN : VIRTIO_BLK_T_OUT,
+                .ioprio = 1,
+                .sector = (round / 2) * BATCH_NUM_REQS + i,
+            };
+            uint8_t status = 0xFF;
+
+            memset(data, read ? 0 : req.sector + 1, 512);
+            virtio_blk_fix_request(dev, &req);
+            memwrite(req_addr[i], &req, 16);
+            memwrite(req_addr[i] + 16, data, 512);
+            memwrite(req_addr[i] + 528, &status, sizeof(status));
+
+            batch_add_req(&r, i, req_addr[i], read);
+        }
+
+        batch_run(qts, dev, &r);
+
+        for (i = 0; i < BATCH_NUM_REQS; i++) {
+            g_assert_cmpint(readb(req_addr[i] + 528), ==, 0);
+            if (read) {
+                memset(expected, (round / 2) * BATCH_NUM_REQS + i + 1, 512);
+                memread(req_addr[i] + 16, data, 512);
+                g_assert(memcmp(data, expected, 512) == 0);
+            }
+        }
+    }
+
+    for (i = 0; i < BATCH_NUM_REQS; i++) {
+        guest_free(alloc, req_addr[i]);
+    }
+    g_free(expected);
+    g_free(data);
+
+    qvirtqueue_cleanup(dev->bus, r.vq, alloc);
+}
+
+static void batch_split(void *obj, void *data, QGuestAllocator *t_alloc)
+{
+    QVirtioBlkPCI *blk = obj;
+
+    test_batch(&blk->pci_vdev.vdev, t_alloc, false);
+}
+
+static void batch_packed(void *obj, void *data, QGuestAllocator *t_alloc)
+{
+    QVirtioBlkPCI *blk = obj;
+
+    test_batch(&blk->pci_vdev.vdev, t_alloc, true);
+}
+
 static void *virtio_blk_test_setup(GString *cmd_line, void *arg)
 {
     char *tmp_path = drive_create();
@@ -802,6 +1051,12 @@ static void register_virtio_blk_test(void)
     qos_add_test("nxvirtq", "virtio-blk-pci",
                       test_nonexistent_virtqueue, &opts);
     qos_add_test("hotplug", "virtio-blk-pci", pci_hotplug, &opts);
+
+    opts.edge.extra_device_opts = "queue-size=" stringify(BATCH_QUEUE_SIZE);
+    qos_add_test("batch-split", "virtio-blk-pci", batch_split, &opts);
+    opts.edge.extra_device_opts = "packed=on,queue-size="
+                                  stringify(BATCH_QUEUE_SIZE);
+    qos_add_test("batch-packed", "virtio-blk-pci", batch_packed, &opts);
 }
 
 libqos_init(register_virtio_blk_test);
@@ -11,7 +11,9 @@
 #include "libqtest-single.h"
 #include "qemu/iov.h"
 #include "qemu/module.h"
+#include "qapi/error.h"
 #include "qapi/qmp/qdict.h"
+#include "qapi/qmp/qjson.h"
 #include "hw/virtio/virtio-net.h"
 #include "libqos/qgraph.h"
 #include "libqos/virtio-net.h"
@@ -318,6 +320,301 @@ static void *virtio_net_test_setup_nosocket(GString *cmd_line, void *arg)
     return arg;
 }
 
+static void *virtio_net_test_setup_iothread(GString *cmd_line, void *arg)
+{
+    g_string_append(cmd_line, " -netdev hubport,hubid=0,id=hs0 "
+                    "-netdev hubport,hubid=1,id=hs1 "
+                    "-object iothread,id=iothread0 "
+                    "-object iothread,id=iothread1 ");
+    return arg;
+}
+
+static void iothread_vq_mapping_invalid(void *obj, void *data,
+                                        QGuestAllocator *t_alloc)
+{
+    QVirtioPCIDevice *dev = obj;
+    QTestState *qts = dev->pdev->bus->qts;
+    static const struct {
+        const char *netdev;
+        const char *mapping;
+        const char *error;
+    } cases[] = {
+        {
+            "hs1", "[{'iothread': 'nope'}]",
+            "IOThread \"nope\" object does not exist",
+        }, {
+            "hs1", "[{'iothread': 'iothread0'}, {'iothread': 'iothread0'}]",
+            "duplicate IOThread name \"iothread0\"",
+        }, {
+            "hs1", "[{'iothread': 'iothread0', 'vqs': [1]}]",
+            "vq index 1 for IOThread \"iothread0\" must be less than "
+            "num_queues 1",
+        }, {
+            "hs1", "[{'iothread': 'iothread0', 'vqs': [0]}, "
+                   "{'iothread': 'iothread1'}]",
+            "either all items in iothread-vq-mapping must have vqs",
+        }, {
+            "hs1", "[{'iothread': 'iothread0'}]",
+            "netdev 'hs1' does not support iothread-vq-mapping",
+        }, {
+            NULL, "[{'iothread': 'iothread0'}]",
+            "iothread-vq-mapping requires a netdev",
+        },
+    };
+    int i;
+
+    if (dev->pdev->bus->not_hotpluggable) {
+        g_test_skip("pci bus does not support hotplug");
+        return;
+    }
+
+    for (i = 0; i < ARRAY_SIZE(cases); i++) {
+        QDict *args = qdict_new();
+        QDict *err;
+
+        qdict_put_str(args, "driver", "virtio-net-pci");
+        qdict_put_str(args, "id", "net1");
+        qdict_put_str(args, "addr", stringify(PCI_SLOT_HP));
+        if (cases[i].netdev) {
+            qdict_put_str(args, "netdev", cases[i].netdev);
+        }
+        qdict_put_obj(args, "iothread-vq-mapping",
+                      qobject_from_json(cases[i].mapping, &error_abort));
+
+        err = qtest_qmp_assert_failure_ref(qts,
+                  "{'execute': 'device_add', 'arguments': %p}", args);
+        g_assert_nonnull(strstr(qdict_get_str(err, "desc"), cases[i].error));
+        qobject_unref(err);
+    }
+}
+
+static uint8_t ctrl_cmd(QTestState *qts, QVirtioDevice *dev,
+                        QGuestAllocator *alloc, QVirtQueue *vq,
+                        uint8_t class, uint8_t cmd,
+                        const void *data, size_t len)
+{
+    struct virtio_net_ctrl_hdr hdr = {
+        .class = class,
+        .cmd = cmd,
+    };
+    uint8_t ack = 0xFF;
+    uint64_t req_addr;
+    uint32_t free_head;
+
+    req_addr = guest_alloc(alloc, sizeof(hdr) + len + sizeof(ack));
+    memwrite(req_addr, &hdr, sizeof(hdr));
+    memwrite(req_addr + sizeof(hdr), data, len);
+    memwrite(req_addr + sizeof(hdr) + len, &ack, sizeof(ack));
+
+    free_head = qvirtqueue_add(qts, vq, req_addr, sizeof(hdr), false, true);
+    qvirtqueue_add(qts, vq, req_addr + sizeof(hdr), len, false, true);
+    qvirtqueue_add(qts, vq, req_addr + sizeof(hdr) + len, sizeof(ack),
+                   true, false);
+    qvirtqueue_kick(qts, dev, vq, free_head);
+
+    qvirtio_wait_used_elem(qts, dev, vq, free_head, NULL,
+                           QVIRTIO_NET_TIMEOUT_US);
+    ack = readb(req_addr + sizeof(hdr) + len);
+
+    guest_free(alloc, req_addr);
+    return ack;
+}
+
+static void ctrl_set_queue_pairs(QTestState *qts, QVirtioDevice *dev,
+                                 QGuestAllocator *alloc, QVirtQueue *vq,
+                                 uint16_t queue_pairs)
+{
+    struct virtio_net_ctrl_mq mq = {
+        .virtqueue_pairs = cpu_to_le16(queue_pairs),
+    };
+
+    g_assert_cmpint(ctrl_cmd(qts, dev, alloc, vq, VIRTIO_NET_CTRL_MQ,
+                             VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET,
+                             &mq, sizeof(mq)), ==, VIRTIO_NET_OK);
+}
+
+/* The tap device is down, so the packet is dropped once it is sent */
+static void tx_dropped(QTestState *qts, QVirtioDevice *dev,
+                       QGuestAllocator *alloc, QVirtQueue *vq)
+{
+    uint64_t req_addr;
+    uint32_t free_head;
+
+    req_addr = guest_alloc(alloc, 64);
+    qtest_memset(qts, req_addr, 0, 64);
+
+    free_head = qvirtqueue_add(qts, vq, req_addr, 64, false, false);
+    qvirtqueue_kick(qts, dev, vq, free_head);
+
+    qvirtio_wait_used_elem(qts, dev, vq, free_head, NULL,
+                           QVIRTIO_NET_TIMEOUT_US);
+    guest_free(alloc, req_addr);
+}
+
+/*
+ * Change the number of queue pairs, which moves them in and out of their
+ * IOThreads, and check that the queue pairs in use still transmit.
+ */
+static void iothread_vq_mapping_mq(void *obj, void *data,
+                                   QGuestAllocator *t_alloc)
+{
+    QVirtioPCIDevice *dev1 = obj;
+    QPCIBus *bus = dev1->pdev->bus;
+    QTestState *qts = bus->qts;
+    QVirtioPCIDevice *pdev;
+    QVirtioDevice *dev;
+    QVirtQueue *vqs[5];
+    uint8_t promisc = 1;
+    uint64_t features;
+    QDict *rsp;
+    int i;
+
+    if (bus->not_hotpluggable) {
+        g_test_skip("pci bus does not support hotplug");
+        return;
+    }
+
+    rsp = qtest_qmp(qts, "{'execute': 'netdev_add', 'arguments': {"
+                    " 'type': 'tap', 'id': 'tap0', 'queues': 2,"
+                    " 'script': 'no', 'downscript': 'no' } }");
+    if (qdict_haskey(rsp, "error")) {
+        qobject_unref(rsp);
+        g_test_skip("multiqueue tap is not available");
+        return;
+    }
+    qobject_unref(rsp);
+
+    qtest_qmp_device_add(qts, "virtio-net-pci", "net1",
+                         "{'addr': %s, 'netdev': 'tap0', 'mq': true,"
+                         " 'iothread-vq-mapping': [{'iothread': 'iothread0'},"
+                         "                         {'iothread': 'iothread1'}]}",
+                         stringify(PCI_SLOT_HP));
+
+    pdev = virtio_pci_new(bus,
+                          &(QPCIAddress) { .devfn = QPCI_DEVFN(PCI_SLOT_HP, 0) });
+    g_assert_nonnull(pdev);
+    dev = &pdev->vdev;
+
+    qvirtio_pci_device_enable(pdev);
+    qvirtio_start_device(dev);
+
+    features = qvirtio_get_features(dev);
+    g_assert(features & (1ull << VIRTIO_F_VERSION_1));
+    g_assert(features & (1u << VIRTIO_NET_F_MQ));
+    g_assert(features & (1u << VIRTIO_NET_F_CTRL_VQ));
+    g_assert(features & (1u << VIRTIO_NET_F_CTRL_RX));
+    features = features & ~(QVIRTIO_F_BAD_FEATURE |
+                            (1u << VIRTIO_RING_F_INDIRECT_DESC) |
+                            (1u << VIRTIO_RING_F_EVENT_IDX));
+    qvirtio_set_features(dev, features);
+
+    /* rx0, tx0, rx1, tx1 and the control virtqueue */
+    for (i = 0; i < ARRAY_SIZE(vqs); i++) {
+        vqs[i] = qvirtqueue_setup(dev, t_alloc, i);
+    }
+    qvirtio_set_driver_ok(dev);
+
+    tx_dropped(qts, dev, t_alloc, vqs[1]);
+
+    ctrl_set_queue_pairs(qts, dev, t_alloc, vqs[4], 2);
+    tx_dropped(qts, dev, t_alloc, vqs[3]);
+    tx_dropped(qts, dev, t_alloc, vqs[1]);
+
+    /* Does not move any queue pair */
+    g_assert_cmpint(ctrl_cmd(qts, dev, t_alloc, vqs[4], VIRTIO_NET_CTRL_RX,
+                             VIRTIO_NET_CTRL_RX_PROMISC,
+                             &promisc, sizeof(promisc)), ==, VIRTIO_NET_OK);
+    tx_dropped(qts, dev, t_alloc, vqs[3]);
+
+    ctrl_set_queue_pairs(qts, dev, t_alloc, vqs[4], 1);
+    tx_dropped(qts, dev, t_alloc, vqs[1]);
+
+    ctrl_set_queue_pairs(qts, dev, t_alloc, vqs[4], 2);
+    tx_dropped(qts, dev, t_alloc, vqs[3]);
+
+    for (i = 0; i < ARRAY_SIZE(vqs); i++) {
+        qvirtqueue_cleanup(dev->bus, vqs[i], t_alloc);
+    }
+    qvirtio_pci_device_disable(pdev);
+    qos_object_destroy((QOSGraphObject *)pdev);
+
+    if (strcmp(qtest_get_arch(), "i386") == 0 ||
+        strcmp(qtest_get_arch(), "x86_64") == 0) {
+        qpci_unplug_acpi_device_test(qts, "net1", PCI_SLOT_HP);
+    }
+}
+
+/*
+ * With every io_uring submission failing, the tap device must fall back to
+ * writev().  Otherwise it stops accepting packets once
+ * TAP_URING_TX_MAX_QUEUED of them are stuck, and TX stalls.
+ */
+static void tap_io_uring_fallback(void *obj, void *data,
+                                  QGuestAllocator *t_alloc)
+{
+    QVirtioPCIDevice *dev1 = obj;
+    QPCIBus *bus = dev1->pdev->bus;
+    QTestState *qts = bus->qts;
+    QVirtioPCIDevice *pdev;
+    QVirtioDevice *dev;
+    QVirtQueue *rx, *tx;
+    uint64_t features;
+    QDict *rsp;
+    int i;
+
+    if (bus->not_hotpluggable) {
+        g_test_skip("pci bus does not support hotplug");
+        return;
+    }
+
+    rsp = qtest_qmp(qts, "{'execute': 'netdev_add', 'arguments': {"
+                    " 'type': 'tap', 'id': 'tap0', 'io-uring': true,"
+                    " 'x-io-uring-fail-submit': true,"
+                    " 'script': 'no', 'downscript': 'no' } }");
+    if (qdict_haskey(rsp, "error")) {
+        qobject_unref(rsp);
+        g_test_skip("tap with io-uring is not available");
+        return;
+    }
+    qobject_unref(rsp);
+
+    qtest_qmp_device_add(qts, "virtio-net-pci", "net1",
+                         "{'addr': %s, 'netdev': 'tap0'}",
+                         stringify(PCI_SLOT_HP));
+
+    pdev = virtio_pci_new(bus,
+                          &(QPCIAddress) { .devfn = QPCI_DEVFN(PCI_SLOT_HP, 0) });
+    g_assert_nonnull(pdev);
+    dev = &pdev->vdev;
+
+    qvirtio_pci_device_enable(pdev);
+    qvirtio_start_device(dev);
+
+    features = qvirtio_get_features(dev);
+    features = features & ~(QVIRTIO_F_BAD_FEATURE |
+                            (1u << VIRTIO_RING_F_INDIRECT_DESC) |
+                            (1u << VIRTIO_RING_F_EVENT_IDX));
+    qvirtio_set_features(dev, features);
+
+    rx = qvirtqueue_setup(dev, t_alloc, 0);
+    tx = qvirtqueue_setup(dev, t_alloc, 1);
+    qvirtio_set_driver_ok(dev);
+
+    for (i = 0; i < 2 * 256; i++) {
+        tx_dropped(qts, dev, t_alloc, tx);
+    }
+
+    qvirtqueue_cleanup(dev->bus, rx, t_alloc);
+    qvirtqueue_cleanup(dev->bus, tx, t_alloc);
+    qvirtio_pci_device_disable(pdev);
+    qos_object_destroy((QOSGraphObject *)pdev);
+
+    if (strcmp(qtest_get_arch(), "i386") == 0 ||
+        strcmp(qtest_get_arch(), "x86_64") == 0) {
+        qpci_unplug_acpi_device_test(qts, "net1", PCI_SLOT_HP);
+    }
+}
+
 static void register_virtio_net_test(void)
 {
     QOSGraphTestOptions opts = { 0 };
@@ -336,6 +633,15 @@ static void register_virtio_net_test(void)
     qos_add_test("large_tx/uint_max", "virtio-net", large_tx, &opts);
     opts.arg = (gpointer)NET_BUFSIZE;
     qos_add_test("large_tx/net_bufsize", "virtio-net", large_tx, &opts);
+
+    opts.before = virtio_net_test_setup_iothread;
+    opts.arg = NULL;
+    qos_add_test("iothread-vq-mapping/invalid", "virtio-net-pci",
+                 iothread_vq_mapping_invalid, &opts);
+    qos_add_test("iothread-vq-mapping/mq", "virtio-net-pci",
+                 iothread_vq_mapping_mq, &opts);
+    qos_add_test("tap/io-uring-fallback", "virtio-net-pci",
+                 tap_io_uring_fallback, &opts);
 }
 
 libqos_init(register_virtio_net_test);
@@ -0,0 +1,75 @@
+#!/bin/sh
+#
+# Check the persistent translation cache of linux-user: the cache is
+# written with private permissions, reused by the next run, and ignored
+# when it may have been written by somebody else.
+#
+# usage: tb-cache.sh QEMU PROGRAM
+#
+# SPDX-License-Identifier: GPL-2.0-or-later
+
+set -e
+
+qemu=$1
+prog=$2
+dir=$(mktemp -d)
+trap 'chmod -R u+w "$dir"; rm -rf "$dir"' EXIT
+cache=$dir/cache
+
+# Generated code is only reused at the same host addresses
+setarch=
+if setarch "$(uname -m)" -R true 2>/dev/null; then
+    setarch="setarch $(uname -m) -R"
+fi
+
+fail() {
+    echo "FAIL: $*" >&2
+    exit 1
+}
+
+run() {
+    $setarch "$qemu" -tb-cache "$cache" "$prog" > "$dir/out" 2> "$dir/err" ||
+        fail "$prog failed: $(cat "$dir/err")"
+    cmp -s "$dir/out" "$dir/expected" || fail "wrong output"
+}
+
+"$qemu" "$prog" > "$dir/expected"
+
+# Save: the directory and the file are private
+run
+[ "$(stat -c %a "$cache")" = 700 ] || fail "cache directory is not 0700"
+file=$(ls "$cache"/*.tbc)
+[ "$(stat -c %a "$file")" = 600 ] || fail "cache file is not 0600"
+
+# Load: a file that was used is not rewritten unless much code was added
+if [ -n "$setarch" ]; then
+    ino=$(stat -c %i "$file")
+    run
+    [ "$(stat -c %i "$file")" = "$ino" ] || fail "cache was not reused"
+fi
+
+# A file that others can write to is ignored, and replaced
+chmod 666 "$file"
+ino=$(stat -c %i "$file")
+run
+grep -q "writable by other users" "$dir/err" || fail "writable file was used"
+[ "$(stat -c %i "$file")" != "$ino" ] || fail "writable file was kept"
+[ "$(stat -c %a "$file")" = 600 ] || fail "replaced file is not 0600"
+
+# A corrupted file is ignored, and replaced
+printf 'XXXXXXXX' | dd of="$file" conv=notrunc 2>/dev/null
+ino=$(stat -c %i "$file")
+run
+[ "$(stat -c %i "$file")" != "$ino" ] || fail "corrupted file was kept"
+
+# A directory that others can write to disables the cache
+chmod 777 "$cache"
+ino=$(stat -c %i "$file")
+run
+grep -q "writable by other users" "$dir/err" || fail "writable directory was used"
+[ "$(stat -c %i "$file")" = "$ino" ] || fail "writable directory was written"
+chmod 700 "$cache"
+
+# Files owned by other users cannot be created without privileges; the
+# ownership check is the same as for the permissions above.
+echo "PASS"
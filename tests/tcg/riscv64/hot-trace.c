@@ -0,0 +1,95 @@
+/*
+ * Test translation of hot traces (-hot-traces)
+ *
+ * The loops below run often enough for their blocks to be retranslated
+ * as traces, and take both sides of their forward branches so that the
+ * side exits are exercised.  The results are checked against values
+ * computed without data dependent branches.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <assert.h>
+
+#define N 100000
+
+/* Forward conditional branches, each taken some of the time. */
+static long __attribute__((noinline)) branchy(long n)
+{
+    long sum = 0;
+    long i;
+
+    for (i = 0; i < n; i++) {
+        if (i % 3 == 0) {
+            sum += i;
+        } else if (i & 1) {
+            sum -= i;
+        } else {
+            sum += 2 * i;
+        }
+    }
+    return sum;
+}
+
+static long __attribute__((noinline)) branchless(long n)
+{
+    long sum = 0;
+    long i;
+
+    for (i = 0; i < n; i++) {
+        long m3 = -(long)(i % 3 == 0);
+        long odd = -(i & 1);
+
+        sum += (m3 & i) | (~m3 & ((odd & -i) | (~odd & 2 * i)));
+    }
+    return sum;
+}
+
+/* Forward unconditional jumps inside the trace, with an early exit. */
+static long __attribute__((noinline)) jumpy(long n)
+{
+    long x = 0;
+
+    asm volatile("1:\n\t"
+                 "addi %0, %0, 1\n\t"
+                 "j 2f\n\t"
+                 "addi %0, %0, 100\n"
+                 "2:\n\t"
+                 "andi t0, %0, 7\n\t"
+                 "bnez t0, 3f\n\t"
+                 "addi %0, %0, 2\n"
+                 "3:\n\t"
+                 "j 4f\n\t"
+                 "addi %0, %0, 1000\n"
+                 "4:\n\t"
+                 "addi %1, %1, -1\n\t"
+                 "bnez %1, 1b\n"
+                 : "+r"(x), "+r"(n) : : "t0");
+    return x;
+}
+
+static long jumpy_expected(long n)
+{
+    long x = 0;
+    long i;
+
+    for (i = 0; i < n; i++) {
+        x += 1;
+        if ((x & 7) == 0) {
+            x += 2;
+        }
+    }
+    return x;
+}
+
+int main(void)
+{
+    int round;
+
+    /* Repeat, so that the traces translated in the first round are used. */
+    for (round = 0; round < 3; round++) {
+        assert(branchy(N) == branchless(N));
+        assert(jumpy(N) == jumpy_expected(N));
+    }
+    return 0;
+}
@@ -0,0 +1,92 @@
+/*
+ * Test speculative translation (-spec-translate)
+ *
+ * Run branchy code from several threads, so that the background
+ * translator works for vCPUs that are running and that go away, and
+ * from a forked child, where the translator starts again.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <assert.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define NR_THREADS 4
+#define N 20000
+
+/* Many small blocks, linked by forward and backward direct jumps. */
+static long __attribute__((noinline)) work(long seed)
+{
+    long x = seed;
+    long i;
+
+    for (i = 0; i < N; i++) {
+        switch (i & 3) {
+        case 0:
+            x += i;
+            break;
+        case 1:
+            x ^= i << 3;
+            break;
+        case 2:
+            if (x & 1) {
+                x -= 7;
+            } else {
+                x += 5;
+            }
+            break;
+        default:
+            x = (x >> 1) + i;
+            break;
+        }
+    }
+    return x;
+}
+
+static long expected[NR_THREADS];
+
+static void *thread_fn(void *arg)
+{
+    long n = (long)arg;
+
+    assert(work(n) == expected[n]);
+    return NULL;
+}
+
+static void run_threads(void)
+{
+    pthread_t threads[NR_THREADS];
+    long i;
+
+    for (i = 0; i < NR_THREADS; i++) {
+        assert(pthread_create(&threads[i], NULL, thread_fn, (void *)i) == 0);
+    }
+    for (i = 0; i < NR_THREADS; i++) {
+        assert(pthread_join(threads[i], NULL) == 0);
+    }
+}
+
+int main(void)
+{
+    int status;
+    pid_t pid;
+    long i;
+
+    for (i = 0; i < NR_THREADS; i++) {
+        expected[i] = work(i);
+    }
+    run_threads();
+
+    pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) {
+        run_threads();
+        _exit(0);
+    }
+    run_threads();
+    assert(waitpid(pid, &status, 0) == pid);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    return 0;
+}
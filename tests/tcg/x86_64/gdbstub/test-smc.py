@@ -0,0 +1,37 @@
+from __future__ import print_function
+#
+# Check that the SMC test's data writes did not invalidate its code
+#
+# This is launched via tests/guest-debug/run-test.py
+#
+
+import gdb
+import re
+from test_gdbstub import main, report
+
+
+def jit_stat(name):
+    "Return the first number after @name in the output of info jit."
+    out = gdb.execute("monitor info jit", False, True)
+    m = re.search(r"^%s\s+(\d+)" % re.escape(name), out, re.MULTILINE)
+    return int(m.group(1)) if m else None
+
+
+def run_test():
+    "Run the test to its end and check the JIT statistics"
+
+    before = jit_stat("SMC writes skipped")
+    report(before is not None, "info jit reports skipped SMC writes")
+
+    bp = gdb.Breakpoint("_exit", gdb.BP_BREAKPOINT)
+    gdb.execute("c")
+    report(bp.hit_count == 1, "test reached _exit")
+    report(int(gdb.parse_and_eval("$eax")) == 0, "new code was run")
+
+    writes = int(gdb.parse_and_eval("nr_data_writes"))
+    after = jit_stat("SMC writes skipped")
+    report(before is not None and after - before >= writes,
+           "%d data writes skipped invalidation" % writes)
+
+
+main(run_test)
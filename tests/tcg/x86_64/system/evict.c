@@ -0,0 +1,60 @@
+/*
+ * Code cache eviction test
+ *
+ * Run more small functions than their translations can fit in a small
+ * code buffer (-accel tcg,tb-size=8), so that QEMU has to evict regions
+ * of the buffer, and check that every function still returns the right
+ * value, also when it is run again after its translation was evicted.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <stdint.h>
+#include <minilib.h>
+
+#define STUB_SIZE 8
+#define NR_STUBS (64 * 1024)
+#define NR_PASSES 3
+
+typedef uint32_t (*stub_fn)(void);
+
+__attribute__((aligned(4096)))
+static uint8_t stubs[NR_STUBS * STUB_SIZE];
+
+/* mov $val, %eax; ret */
+static void write_stub(uint8_t *p, uint32_t val)
+{
+    p[0] = 0xb8;
+    p[1] = val;
+    p[2] = val >> 8;
+    p[3] = val >> 16;
+    p[4] = val >> 24;
+    p[5] = 0xc3;
+}
+
+int main(void)
+{
+    uint32_t i;
+    int pass;
+
+    for (i = 0; i < NR_STUBS; i++) {
+        write_stub(&stubs[i * STUB_SIZE], i ^ 0x5a5a5a5a);
+    }
+
+    for (pass = 0; pass < NR_PASSES; pass++) {
+        for (i = 0; i < NR_STUBS; i++) {
+            stub_fn fn = (stub_fn)&stubs[i * STUB_SIZE];
+            uint32_t ret = fn();
+
+            if (ret != (i ^ 0x5a5a5a5a)) {
+                ml_printf("FAIL: pass %d: stub %d returned %x\n",
+                          pass, i, ret);
+                return 1;
+            }
+        }
+        ml_printf("pass %d: %d stubs OK\n", pass, NR_STUBS);
+    }
+
+    ml_printf("PASS\n");
+    return 0;
+}
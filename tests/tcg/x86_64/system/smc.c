@@ -0,0 +1,79 @@
+/*
+ * Self-modifying code test
+ *
+ * Keep data on the same page as a translated function and write to it,
+ * which must not disturb the function, then rewrite the function itself
+ * and check that the new code is run.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <stdint.h>
+#include <minilib.h>
+
+#define MEM_PAGE_SIZE 4096
+#define DATA_OFFSET 2048
+
+typedef uint32_t (*code_fn)(void);
+
+__attribute__((aligned(MEM_PAGE_SIZE)))
+static uint8_t page[MEM_PAGE_SIZE];
+
+/* Also read by the gdbstub test */
+uint32_t nr_data_writes = 1000;
+
+/* mov $val, %eax; ret */
+static void write_code(uint8_t *p, uint32_t val)
+{
+    p[0] = 0xb8;
+    p[1] = val;
+    p[2] = val >> 8;
+    p[3] = val >> 16;
+    p[4] = val >> 24;
+    p[5] = 0xc3;
+}
+
+static int check(const char *what, uint32_t expected)
+{
+    uint32_t ret = ((code_fn)page)();
+
+    if (ret != expected) {
+        ml_printf("FAIL: %s: got %d, expected %d\n", what, ret, expected);
+        return 1;
+    }
+    return 0;
+}
+
+int main(void)
+{
+    volatile uint8_t *data = &page[DATA_OFFSET];
+    uint32_t i;
+
+    write_code(page, 1);
+    if (check("first run", 1)) {
+        return 1;
+    }
+
+    /* Writes next to the code, in a different cache line */
+    for (i = 0; i < nr_data_writes; i++) {
+        data[i % 64] = i;
+        if (check("data write", 1)) {
+            return 1;
+        }
+    }
+
+    /* Rewrite the whole function */
+    write_code(page, 2);
+    if (check("code rewrite", 2)) {
+        return 1;
+    }
+
+    /* Patch only the immediate of the translated instruction */
+    page[1] = 3;
+    if (check("code patch", 3)) {
+        return 1;
+    }
+
+    ml_printf("PASS\n");
+    return 0;
+}
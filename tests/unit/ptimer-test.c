@@ -27,19 +27,33 @@ static void ptimer_test_expire_qemu_timers(int64_t expire_time,
                                            QEMUClockType type)
 {
     QEMUTimerList *timer_list = main_loop_tlg.tl[type];
-    QEMUTimer *t = timer_list->active_timers.next;
+    QEMUTimer *t;
+
+    /*
+     * A callback may delete or free other timers, so look for the next
+     * expired timer from the start of the list after each callback.
+     */
+    do {
+        GList *l;
+
+        t = NULL;
+        for (l = timer_list->active_timers; l != NULL; l = l->next) {
+            QEMUTimer *cur = l->data;
+
+            if (cur->expire_time == expire_time) {
+                t = cur;
+                break;
+            }
+        }
 
-    while (t != NULL) {
-        if (t->expire_time == expire_time) {
+        if (t != NULL) {
             timer_del(t);
 
             if (t->cb != NULL) {
                 t->cb(t->opaque);
             }
         }
-
-        t = t->next;
-    }
+    } while (t != NULL);
 }
 
 static void ptimer_test_set_qemu_time_ns(int64_t ns)
@@ -17,6 +17,7 @@
 #include "qemu/sockets.h"
 #include "qemu/error-report.h"
 #include "qemu/coroutine-core.h"
+#include "qemu/defer-call.h"
 #include "qemu/main-loop.h"
 
 static AioContext *ctx;
@@ -122,6 +123,32 @@ static void test_bh_schedule(void)
     qemu_bh_delete(data.bh);
 }
 
+static void test_bh_schedule_deferred(void)
+{
+    BHTestData a = { .n = 0 };
+    BHTestData b = { .n = 0 };
+    a.bh = aio_bh_new(ctx, bh_test_cb, &a);
+    b.bh = aio_bh_new(ctx, bh_test_cb, &b);
+
+    aio_notify_accept(ctx);
+
+    /* The event loop is only kicked at the end of the section */
+    defer_call_begin();
+    qemu_bh_schedule(a.bh);
+    qemu_bh_schedule(b.bh);
+    g_assert(!qatomic_read(&ctx->notified));
+    defer_call_end();
+    g_assert(qatomic_read(&ctx->notified));
+
+    g_assert(aio_poll(ctx, true));
+    g_assert_cmpint(a.n, ==, 1);
+    g_assert_cmpint(b.n, ==, 1);
+
+    g_assert(!aio_poll(ctx, false));
+    qemu_bh_delete(a.bh);
+    qemu_bh_delete(b.bh);
+}
+
 static void test_bh_schedule10(void)
 {
     BHTestData data = { .n = 0, .max = 10 };
@@ -837,6 +864,7 @@ int main(int argc, char **argv)
     g_test_init(&argc, &argv, NULL);
     g_test_add_func("/aio/bh/schedule",             test_bh_schedule);
     g_test_add_func("/aio/bh/schedule10",           test_bh_schedule10);
+    g_test_add_func("/aio/bh/schedule-deferred",    test_bh_schedule_deferred);
     g_test_add_func("/aio/bh/cancel",               test_bh_cancel);
     g_test_add_func("/aio/bh/delete",               test_bh_delete);
     g_test_add_func("/aio/bh/callback-delete/one",  test_bh_delete_from_cb);
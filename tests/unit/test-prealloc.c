@@ -0,0 +1,152 @@
+/*
+ * Background memory preallocation tests
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/madvise.h"
+#include "qemu/units.h"
+#include "qapi/error.h"
+
+typedef struct PreallocDone {
+    int calls;
+    int ret;
+} PreallocDone;
+
+static void prealloc_done(void *opaque, int ret)
+{
+    PreallocDone *done = opaque;
+
+    done->ret = ret;
+    qatomic_inc(&done->calls);
+}
+
+static bool populate_write_supported(void)
+{
+    size_t pagesize = qemu_real_host_page_size();
+    void *area;
+    bool ret;
+
+    area = mmap(NULL, pagesize, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    g_assert(area != MAP_FAILED);
+    ret = !qemu_madvise(area, pagesize, QEMU_MADV_POPULATE_WRITE);
+    munmap(area, pagesize);
+    return ret;
+}
+
+static char *map_anon(size_t size)
+{
+    char *area = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+    g_assert(area != MAP_FAILED);
+    return area;
+}
+
+static void test_prealloc_background(void)
+{
+    const size_t size = 16 * MiB;
+    PreallocDone done = { 0 };
+    MemPreallocJob *job;
+    uint64_t total;
+    char *area;
+
+    if (!populate_write_supported()) {
+        g_test_skip("MADV_POPULATE_WRITE not supported");
+        return;
+    }
+
+    area = map_anon(size);
+    g_assert(qemu_prealloc_mem_background(-1, area, size, 4, NULL,
+                                          prealloc_done, &done, &job,
+                                          &error_abort));
+    g_assert(job != NULL);
+
+    while (qemu_prealloc_job_get_progress(job, &total) < total) {
+        g_usleep(1000);
+    }
+    g_assert_cmpuint(total, ==, size);
+    g_assert(qemu_prealloc_job_finish(job, false, &error_abort));
+    g_assert_cmpint(done.calls, ==, 1);
+    g_assert_cmpint(done.ret, ==, 0);
+
+    munmap(area, size);
+}
+
+static void test_prealloc_background_cancel(void)
+{
+    const size_t size = 256 * MiB;
+    PreallocDone done = { 0 };
+    MemPreallocJob *job;
+    char *area;
+
+    if (!populate_write_supported()) {
+        g_test_skip("MADV_POPULATE_WRITE not supported");
+        return;
+    }
+
+    area = map_anon(size);
+    g_assert(qemu_prealloc_mem_background(-1, area, size, 1, NULL,
+                                          prealloc_done, &done, &job,
+                                          &error_abort));
+    g_assert(job != NULL);
+    g_assert(qemu_prealloc_job_finish(job, true, &error_abort));
+    g_assert_cmpint(done.calls, ==, 1);
+
+    munmap(area, size);
+}
+
+/*
+ * Populating a shared mapping past the end of its file fails with EFAULT,
+ * which must reach both the done callback and the owner of the job.
+ */
+static void test_prealloc_background_failure(void)
+{
+    const size_t size = 4 * MiB;
+    g_autofree char *path = NULL;
+    PreallocDone done = { 0 };
+    Error *local_err = NULL;
+    MemPreallocJob *job;
+    char *area;
+    int fd;
+
+    if (!populate_write_supported()) {
+        g_test_skip("MADV_POPULATE_WRITE not supported");
+        return;
+    }
+
+    fd = g_file_open_tmp("prealloc-XXXXXX", &path, NULL);
+    g_assert(fd >= 0);
+    unlink(path);
+
+    area = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    g_assert(area != MAP_FAILED);
+
+    g_assert(qemu_prealloc_mem_background(fd, area, size, 2, NULL,
+                                          prealloc_done, &done, &job,
+                                          &error_abort));
+    g_assert(job != NULL);
+    g_assert(!qemu_prealloc_job_finish(job, false, &local_err));
+    error_free_or_abort(&local_err);
+    g_assert_cmpint(done.calls, ==, 1);
+    g_assert_cmpint(done.ret, ==, -EFAULT);
+
+    munmap(area, size);
+    close(fd);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/prealloc/background", test_prealloc_background);
+    g_test_add_func("/prealloc/background/cancel",
+                    test_prealloc_background_cancel);
+    g_test_add_func("/prealloc/background/failure",
+                    test_prealloc_background_failure);
+
+    return g_test_run();
+}
@@ -4,6 +4,7 @@
 #include "block/block.h"
 #include "qapi/error.h"
 #include "qemu/timer.h"
+#include "qemu/defer-call.h"
 #include "qemu/error-report.h"
 #include "qemu/main-loop.h"
 
@@ -32,6 +33,14 @@ static int long_cb(void *opaque)
     return 0;
 }
 
+static int sleep_cb(void *opaque)
+{
+    WorkerTestData *data = opaque;
+
+    g_usleep(1000);
+    return qatomic_fetch_inc(&data->n);
+}
+
 static void done_cb(void *opaque, int ret)
 {
     WorkerTestData *data = opaque;
@@ -134,6 +143,73 @@ static void test_submit_many(void)
     }
 }
 
+static void test_submit_batch(void)
+{
+    WorkerTestData data[20];
+    int i;
+
+    /* Requests are only handed to the workers at defer_call_end() */
+    defer_call_begin();
+    for (i = 0; i < 20; i++) {
+        data[i].n = 0;
+        data[i].ret = -EINPROGRESS;
+        data[i].aiocb = thread_pool_submit_aio(worker_cb, &data[i],
+                                               done_cb, &data[i]);
+    }
+    active = 20;
+
+    g_usleep(10000);
+    for (i = 0; i < 20; i++) {
+        g_assert_cmpint(qatomic_read(&data[i].n), ==, 0);
+    }
+
+    /* Requests that were not handed over yet can be canceled at once */
+    data[0].ret = -ECANCELED;
+    bdrv_aio_cancel_async(data[0].aiocb);
+    defer_call_end();
+
+    while (active > 0) {
+        aio_poll(ctx, true);
+    }
+    g_assert_cmpint(data[0].n, ==, 0);
+    g_assert_cmpint(data[0].ret, ==, -ECANCELED);
+    for (i = 1; i < 20; i++) {
+        g_assert(data[i].aiocb == NULL);
+        g_assert_cmpint(data[i].n, ==, 1);
+        g_assert_cmpint(data[i].ret, ==, 0);
+    }
+}
+
+static void test_stats(void)
+{
+    ThreadPool *pool = aio_get_thread_pool(ctx);
+    ThreadPoolStats before, after;
+    WorkerTestData data[10];
+    int i;
+
+    thread_pool_get_stats(pool, &before);
+
+    for (i = 0; i < 10; i++) {
+        data[i].n = 0;
+        data[i].ret = -EINPROGRESS;
+        thread_pool_submit_aio(sleep_cb, &data[i], done_cb, &data[i]);
+    }
+
+    active = 10;
+    while (active > 0) {
+        aio_poll(ctx, true);
+    }
+
+    thread_pool_get_stats(pool, &after);
+    g_assert_cmpint(after.completed - before.completed, ==, 10);
+    g_assert_cmpint(after.run_time_ns - before.run_time_ns, >=,
+                    10 * SCALE_MS);
+    g_assert_cmpint(after.wait_time_ns, >=, before.wait_time_ns);
+    g_assert_cmpint(after.queue_depth, ==, 0);
+    g_assert_cmpint(after.threads, >, 0);
+    g_assert_cmpint(after.threads, <=, THREAD_POOL_MAX_THREADS_DEFAULT);
+}
+
 static void do_test_cancel(bool sync)
 {
     WorkerTestData data[100];
@@ -240,6 +316,8 @@ int main(int argc, char **argv)
     g_test_add_func("/thread-pool/submit-aio", test_submit_aio);
     g_test_add_func("/thread-pool/submit-co", test_submit_co);
     g_test_add_func("/thread-pool/submit-many", test_submit_many);
+    g_test_add_func("/thread-pool/submit-batch", test_submit_batch);
+    g_test_add_func("/thread-pool/stats", test_stats);
     g_test_add_func("/thread-pool/cancel", test_cancel);
     g_test_add_func("/thread-pool/cancel-async", test_cancel_async);
 
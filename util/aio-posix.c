@@ -787,3 +787,12 @@ void aio_context_set_aio_params(AioContext *ctx, int64_t max_batch)
 
     aio_notify(ctx);
 }
+
+void aio_context_set_io_uring_params(AioContext *ctx, bool sqpoll,
+                                     int64_t sqpoll_idle, int64_t sqpoll_cpu)
+{
+    /* Only read when the ring is created, in the AioContext's thread */
+    ctx->io_uring_sqpoll = sqpoll;
+    ctx->io_uring_sqpoll_idle = sqpoll_idle;
+    ctx->io_uring_sqpoll_cpu = sqpoll_cpu;
+}
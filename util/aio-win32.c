@@ -441,3 +441,8 @@ void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
 void aio_context_set_aio_params(AioContext *ctx, int64_t max_batch)
 {
 }
+
+void aio_context_set_io_uring_params(AioContext *ctx, bool sqpoll,
+                                     int64_t sqpoll_idle, int64_t sqpoll_cpu)
+{
+}
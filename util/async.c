@@ -34,6 +34,7 @@
 #include "block/raw-aio.h"
 #include "qemu/coroutine_int.h"
 #include "qemu/coroutine-tls.h"
+#include "qemu/defer-call.h"
 #include "sysemu/cpu-timers.h"
 #include "trace.h"
 
@@ -68,6 +69,11 @@ struct QEMUBH {
     MemReentrancyGuard *reentrancy_guard;
 };
 
+static void aio_notify_deferred(void *opaque)
+{
+    aio_notify(opaque);
+}
+
 /* Called concurrently from any thread */
 static void aio_bh_enqueue(QEMUBH *bh, unsigned new_flags)
 {
@@ -93,7 +99,15 @@ static void aio_bh_enqueue(QEMUBH *bh, unsigned new_flags)
         QSLIST_INSERT_HEAD_ATOMIC(&ctx->bh_list, bh, next);
     }
 
-    aio_notify(ctx);
+    /*
+     * Inside a defer_call_begin()/defer_call_end() section, kick each
+     * target AioContext once at the end of the section rather than once
+     * per bottom half.  The bottom half is already visible; the event loop
+     * only finds out about it later if it is blocked.  A thread that is
+     * itself polling @ctx does not need the kick, because aio_poll() does
+     * not block while a bottom half is scheduled.
+     */
+    defer_call(aio_notify_deferred, ctx);
     if (unlikely(icount_enabled())) {
         /*
          * Workaround for record/replay.
@@ -182,6 +196,16 @@ int aio_bh_poll(AioContext *ctx)
     BHListSlice *s;
     int ret = 0;
 
+    /*
+     * Most calls find nothing to do; skip the atomic exchange and the
+     * slice bookkeeping for them.  A BH that is being enqueued right now
+     * comes with an aio_notify(), so it will be picked up by the next call.
+     */
+    if (QSLIST_EMPTY_RCU(&ctx->bh_list) &&
+        QSIMPLEQ_EMPTY(&ctx->bh_slice_list)) {
+        return 0;
+    }
+
     /* Synchronizes with QSLIST_INSERT_HEAD_ATOMIC in aio_bh_enqueue().  */
     QSLIST_MOVE_ATOMIC(&slice.bh_list, &ctx->bh_list);
 
@@ -384,6 +408,11 @@ aio_ctx_finalize(GSource     *source)
         luring_cleanup(ctx->linux_io_uring);
         ctx->linux_io_uring = NULL;
     }
+    if (ctx->linux_io_uring_iopoll) {
+        luring_detach_aio_context(ctx->linux_io_uring_iopoll, ctx);
+        luring_cleanup(ctx->linux_io_uring_iopoll);
+        ctx->linux_io_uring_iopoll = NULL;
+    }
 #endif
 
     assert(QSLIST_EMPTY(&ctx->scheduled_coroutines));
@@ -468,7 +497,7 @@ LuringState *aio_setup_linux_io_uring(AioContext *ctx, Error **errp)
         return ctx->linux_io_uring;
     }
 
-    ctx->linux_io_uring = luring_init(errp);
+    ctx->linux_io_uring = luring_init(ctx, false, errp);
     if (!ctx->linux_io_uring) {
         return NULL;
     }
@@ -482,6 +511,27 @@ LuringState *aio_get_linux_io_uring(AioContext *ctx)
     assert(ctx->linux_io_uring);
     return ctx->linux_io_uring;
 }
+
+LuringState *aio_setup_linux_io_uring_iopoll(AioContext *ctx, Error **errp)
+{
+    if (ctx->linux_io_uring_iopoll) {
+        return ctx->linux_io_uring_iopoll;
+    }
+
+    ctx->linux_io_uring_iopoll = luring_init(ctx, true, errp);
+    if (!ctx->linux_io_uring_iopoll) {
+        return NULL;
+    }
+
+    luring_attach_aio_context(ctx->linux_io_uring_iopoll, ctx);
+    return ctx->linux_io_uring_iopoll;
+}
+
+LuringState *aio_get_linux_io_uring_iopoll(AioContext *ctx)
+{
+    assert(ctx->linux_io_uring_iopoll);
+    return ctx->linux_io_uring_iopoll;
+}
 #endif
 
 void aio_notify(AioContext *ctx)
@@ -602,6 +652,7 @@ AioContext *aio_context_new(Error **errp)
 
 #ifdef CONFIG_LINUX_IO_URING
     ctx->linux_io_uring = NULL;
+    ctx->linux_io_uring_iopoll = NULL;
 #endif
 
     ctx->thread_pool = NULL;
@@ -615,6 +666,10 @@ AioContext *aio_context_new(Error **errp)
 
     ctx->aio_max_batch = 0;
 
+    ctx->io_uring_sqpoll = false;
+    ctx->io_uring_sqpoll_idle = 0;
+    ctx->io_uring_sqpoll_cpu = -1;
+
     ctx->thread_pool_min = 0;
     ctx->thread_pool_max = THREAD_POOL_MAX_THREADS_DEFAULT;
 
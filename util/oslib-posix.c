@@ -631,6 +631,132 @@ bool qemu_prealloc_mem(int fd, char *area, size_t sz, int max_threads,
     return rv;
 }
 
+/*
+ * Background preallocation threads populate the area in chunks of this
+ * size (rounded up to the page size), so that they can be cancelled and
+ * report progress.
+ */
+#define MEM_PREALLOC_BACKGROUND_CHUNK (64 * MiB)
+
+struct MemPreallocJob {
+    char *area;
+    size_t size;
+    size_t chunk;
+    size_t next;
+    size_t populated;
+    int ret;
+    bool cancel;
+    int num_threads;
+    int running;
+    QemuThread *threads;
+    MemPreallocDoneFunc *done;
+    void *opaque;
+};
+
+static void *do_background_prealloc(void *arg)
+{
+    MemPreallocJob *job = arg;
+    size_t offset, len;
+    int ret;
+
+    while (!qatomic_read(&job->cancel) && !qatomic_read(&job->ret)) {
+        offset = qatomic_fetch_add(&job->next, job->chunk);
+        if (offset >= job->size) {
+            break;
+        }
+
+        len = MIN(job->chunk, job->size - offset);
+        if (qemu_madvise(job->area + offset, len, QEMU_MADV_POPULATE_WRITE)) {
+            ret = -errno;
+            qatomic_cmpxchg(&job->ret, 0, ret);
+            break;
+        }
+        qatomic_add(&job->populated, len);
+    }
+
+    if (qatomic_fetch_dec(&job->running) == 1 && job->done) {
+        job->done(job->opaque, qatomic_read(&job->ret));
+    }
+    return NULL;
+}
+
+bool qemu_prealloc_mem_background(int fd, char *area, size_t sz,
+                                  int max_threads, ThreadContext *tc,
+                                  MemPreallocDoneFunc *done, void *opaque,
+                                  MemPreallocJob **job, Error **errp)
+{
+    size_t hpagesize = qemu_fd_getpagesize(fd);
+    size_t numpages = DIV_ROUND_UP(sz, hpagesize);
+    MemPreallocJob *j;
+    int i;
+
+    *job = NULL;
+
+    /*
+     * Touching the pages needs the SIGBUS handler for the whole duration,
+     * which cannot be left installed while the guest is running.
+     */
+    if (!madv_populate_write_possible(area, hpagesize)) {
+        return qemu_prealloc_mem(fd, area, sz, max_threads, tc, false, errp);
+    }
+
+    j = g_new0(MemPreallocJob, 1);
+    j->area = area;
+    j->size = numpages * hpagesize;
+    j->chunk = QEMU_ALIGN_UP(MEM_PREALLOC_BACKGROUND_CHUNK, hpagesize);
+    j->num_threads = get_memset_num_threads(hpagesize, numpages, max_threads);
+    j->running = j->num_threads;
+    j->threads = g_new0(QemuThread, j->num_threads);
+    j->done = done;
+    j->opaque = opaque;
+
+    for (i = 0; i < j->num_threads; i++) {
+        if (tc) {
+            thread_context_create_thread(tc, &j->threads[i], "touch_pages",
+                                         do_background_prealloc, j,
+                                         QEMU_THREAD_JOINABLE);
+        } else {
+            qemu_thread_create(&j->threads[i], "touch_pages",
+                               do_background_prealloc, j,
+                               QEMU_THREAD_JOINABLE);
+        }
+    }
+
+    *job = j;
+    return true;
+}
+
+uint64_t qemu_prealloc_job_get_progress(MemPreallocJob *job, uint64_t *total)
+{
+    if (total) {
+        *total = job->size;
+    }
+    return qatomic_read(&job->populated);
+}
+
+bool qemu_prealloc_job_finish(MemPreallocJob *job, bool cancel, Error **errp)
+{
+    int i, ret;
+
+    if (cancel) {
+        qatomic_set(&job->cancel, true);
+    }
+    for (i = 0; i < job->num_threads; i++) {
+        qemu_thread_join(&job->threads[i]);
+    }
+
+    ret = job->ret;
+    g_free(job->threads);
+    g_free(job);
+
+    if (ret && !cancel) {
+        error_setg_errno(errp, -ret,
+                         "qemu_prealloc_mem: preallocating memory failed");
+        return false;
+    }
+    return true;
+}
+
 char *qemu_get_pid_name(pid_t pid)
 {
     char *name = NULL;
@@ -284,6 +284,26 @@ bool qemu_finish_async_prealloc_mem(Error **errp)
     return true;
 }
 
+bool qemu_prealloc_mem_background(int fd, char *area, size_t sz,
+                                  int max_threads, ThreadContext *tc,
+                                  MemPreallocDoneFunc *done, void *opaque,
+                                  MemPreallocJob **job, Error **errp)
+{
+    /* background prealloc not supported, preallocate synchronously */
+    *job = NULL;
+    return qemu_prealloc_mem(fd, area, sz, max_threads, tc, false, errp);
+}
+
+uint64_t qemu_prealloc_job_get_progress(MemPreallocJob *job, uint64_t *total)
+{
+    g_assert_not_reached();
+}
+
+bool qemu_prealloc_job_finish(MemPreallocJob *job, bool cancel, Error **errp)
+{
+    g_assert_not_reached();
+}
+
 char *qemu_get_pid_name(pid_t pid)
 {
     /* XXX Implement me */
@@ -66,7 +66,18 @@ static QEMUClock qemu_clocks[QEMU_CLOCK_MAX];
 struct QEMUTimerList {
     QEMUClock *clock;
     QemuMutex active_timers_lock;
-    QEMUTimer *active_timers;
+
+    /*
+     * Pending timers, as a binary min-heap ordered by expire_time and then
+     * by seq.  The seq tie-break keeps timers that expire at the same time
+     * in the order they were armed.  nr_active_timers may be read without
+     * active_timers_lock to check quickly whether the list is empty.
+     */
+    QEMUTimer **active_timers;
+    unsigned int nr_active_timers;
+    unsigned int active_timers_size;
+    uint64_t timers_seq;
+
     QLIST_ENTRY(QEMUTimerList) list;
     QEMUTimerListNotifyCB *notify_cb;
     void *notify_opaque;
@@ -93,6 +104,92 @@ static bool timer_expired_ns(QEMUTimer *timer_head, int64_t current_time)
     return timer_head && (timer_head->expire_time <= current_time);
 }
 
+static bool timer_before(QEMUTimer *a, QEMUTimer *b)
+{
+    return a->expire_time < b->expire_time ||
+           (a->expire_time == b->expire_time && a->seq < b->seq);
+}
+
+/* Return the first timer to expire, or NULL.  Called with the lock held. */
+static QEMUTimer *timerlist_first(QEMUTimerList *timer_list)
+{
+    return timer_list->nr_active_timers ? timer_list->active_timers[0] : NULL;
+}
+
+static void timerlist_heap_set(QEMUTimerList *timer_list, unsigned int i,
+                               QEMUTimer *ts)
+{
+    timer_list->active_timers[i] = ts;
+    ts->heap_index = i;
+}
+
+static void timerlist_sift_up(QEMUTimerList *timer_list, unsigned int i)
+{
+    QEMUTimer *ts = timer_list->active_timers[i];
+
+    while (i > 0) {
+        unsigned int parent = (i - 1) / 2;
+
+        if (!timer_before(ts, timer_list->active_timers[parent])) {
+            break;
+        }
+        timerlist_heap_set(timer_list, i, timer_list->active_timers[parent]);
+        i = parent;
+    }
+    timerlist_heap_set(timer_list, i, ts);
+}
+
+static void timerlist_sift_down(QEMUTimerList *timer_list, unsigned int i)
+{
+    QEMUTimer **heap = timer_list->active_timers;
+    unsigned int n = timer_list->nr_active_timers;
+    QEMUTimer *ts = heap[i];
+
+    for (;;) {
+        unsigned int child = 2 * i + 1;
+
+        if (child >= n) {
+            break;
+        }
+        if (child + 1 < n && timer_before(heap[child + 1], heap[child])) {
+            child++;
+        }
+        if (!timer_before(heap[child], ts)) {
+            break;
+        }
+        timerlist_heap_set(timer_list, i, heap[child]);
+        i = child;
+    }
+    timerlist_heap_set(timer_list, i, ts);
+}
+
+/*
+ * Return the first timer to expire at or below heap index @i among those
+ * that @attr_mask does not exclude.  A matching timer hides its whole
+ * subtree, so only the excluded timers near the top are descended into.
+ */
+static QEMUTimer *timerlist_first_with_attrs(QEMUTimerList *timer_list,
+                                             unsigned int i, int attr_mask)
+{
+    QEMUTimer *ts, *left, *right;
+
+    if (i >= timer_list->nr_active_timers) {
+        return NULL;
+    }
+
+    ts = timer_list->active_timers[i];
+    if (!(ts->attributes & ~attr_mask)) {
+        return ts;
+    }
+
+    left = timerlist_first_with_attrs(timer_list, 2 * i + 1, attr_mask);
+    right = timerlist_first_with_attrs(timer_list, 2 * i + 2, attr_mask);
+    if (!left || (right && timer_before(right, left))) {
+        return right;
+    }
+    return left;
+}
+
 QEMUTimerList *timerlist_new(QEMUClockType type,
                              QEMUTimerListNotifyCB *cb,
                              void *opaque)
@@ -117,6 +214,7 @@ void timerlist_free(QEMUTimerList *timer_list)
         QLIST_REMOVE(timer_list, list);
     }
     qemu_mutex_destroy(&timer_list->active_timers_lock);
+    g_free(timer_list->active_timers);
     g_free(timer_list);
 }
 
@@ -171,7 +269,7 @@ void qemu_clock_enable(QEMUClockType type, bool enabled)
 
 bool timerlist_has_timers(QEMUTimerList *timer_list)
 {
-    return !!qatomic_read(&timer_list->active_timers);
+    return !!qatomic_read(&timer_list->nr_active_timers);
 }
 
 bool qemu_clock_has_timers(QEMUClockType type)
@@ -184,15 +282,15 @@ bool timerlist_expired(QEMUTimerList *timer_list)
 {
     int64_t expire_time;
 
-    if (!qatomic_read(&timer_list->active_timers)) {
+    if (!qatomic_read(&timer_list->nr_active_timers)) {
         return false;
     }
 
     WITH_QEMU_LOCK_GUARD(&timer_list->active_timers_lock) {
-        if (!timer_list->active_timers) {
+        if (!timer_list->nr_active_timers) {
             return false;
         }
-        expire_time = timer_list->active_timers->expire_time;
+        expire_time = timerlist_first(timer_list)->expire_time;
     }
 
     return expire_time <= qemu_clock_get_ns(timer_list->clock->type);
@@ -214,7 +312,7 @@ int64_t timerlist_deadline_ns(QEMUTimerList *timer_list)
     int64_t delta;
     int64_t expire_time;
 
-    if (!qatomic_read(&timer_list->active_timers)) {
+    if (!qatomic_read(&timer_list->nr_active_timers)) {
         return -1;
     }
 
@@ -227,10 +325,10 @@ int64_t timerlist_deadline_ns(QEMUTimerList *timer_list)
      * the caller should notice the change and there is no race condition.
      */
     WITH_QEMU_LOCK_GUARD(&timer_list->active_timers_lock) {
-        if (!timer_list->active_timers) {
+        if (!timer_list->nr_active_timers) {
             return -1;
         }
-        expire_time = timer_list->active_timers->expire_time;
+        expire_time = timerlist_first(timer_list)->expire_time;
     }
 
     delta = expire_time - qemu_clock_get_ns(timer_list->clock->type);
@@ -261,15 +359,12 @@ int64_t qemu_clock_deadline_ns_all(QEMUClockType type, int attr_mask)
     }
 
     QLIST_FOREACH(timer_list, &clock->timerlists, list) {
-        if (!qatomic_read(&timer_list->active_timers)) {
+        if (!qatomic_read(&timer_list->nr_active_timers)) {
             continue;
         }
         qemu_mutex_lock(&timer_list->active_timers_lock);
-        ts = timer_list->active_timers;
         /* Skip all external timers */
-        while (ts && (ts->attributes & ~attr_mask)) {
-            ts = ts->next;
-        }
+        ts = timerlist_first_with_attrs(timer_list, 0, attr_mask);
         if (!ts) {
             qemu_mutex_unlock(&timer_list->active_timers_lock);
             continue;
@@ -380,41 +475,51 @@ void timer_deinit(QEMUTimer *ts)
 
 static void timer_del_locked(QEMUTimerList *timer_list, QEMUTimer *ts)
 {
-    QEMUTimer **pt, *t;
+    unsigned int i = ts->heap_index;
+    unsigned int last;
 
     ts->expire_time = -1;
-    pt = &timer_list->active_timers;
-    for(;;) {
-        t = *pt;
-        if (!t)
-            break;
-        if (t == ts) {
-            qatomic_set(pt, t->next);
-            break;
-        }
-        pt = &t->next;
+    if (i >= timer_list->nr_active_timers ||
+        timer_list->active_timers[i] != ts) {
+        return;
+    }
+
+    last = timer_list->nr_active_timers - 1;
+    qatomic_set(&timer_list->nr_active_timers, last);
+    if (i == last) {
+        return;
+    }
+
+    /* Move the last timer into the hole and restore the heap order */
+    timerlist_heap_set(timer_list, i, timer_list->active_timers[last]);
+    if (i > 0 && timer_before(timer_list->active_timers[i],
+                              timer_list->active_timers[(i - 1) / 2])) {
+        timerlist_sift_up(timer_list, i);
+    } else {
+        timerlist_sift_down(timer_list, i);
     }
 }
 
 static bool timer_mod_ns_locked(QEMUTimerList *timer_list,
                                 QEMUTimer *ts, int64_t expire_time)
 {
-    QEMUTimer **pt, *t;
+    unsigned int i = timer_list->nr_active_timers;
 
-    /* add the timer in the sorted list */
-    pt = &timer_list->active_timers;
-    for (;;) {
-        t = *pt;
-        if (!timer_expired_ns(t, expire_time)) {
-            break;
-        }
-        pt = &t->next;
+    if (i == timer_list->active_timers_size) {
+        timer_list->active_timers_size = MAX(i * 2, 16);
+        timer_list->active_timers = g_renew(QEMUTimer *,
+                                            timer_list->active_timers,
+                                            timer_list->active_timers_size);
     }
+
+    /* add the timer to the heap, after timers with the same expire_time */
     ts->expire_time = MAX(expire_time, 0);
-    ts->next = *pt;
-    qatomic_set(pt, ts);
+    ts->seq = timer_list->timers_seq++;
+    timer_list->active_timers[i] = ts;
+    timerlist_sift_up(timer_list, i);
+    qatomic_set(&timer_list->nr_active_timers, i + 1);
 
-    return pt == &timer_list->active_timers;
+    return ts->heap_index == 0;
 }
 
 static void timerlist_rearm(QEMUTimerList *timer_list)
@@ -506,7 +611,7 @@ bool timerlist_run_timers(QEMUTimerList *timer_list)
     QEMUTimerCB *cb;
     void *opaque;
 
-    if (!qatomic_read(&timer_list->active_timers)) {
+    if (!qatomic_read(&timer_list->nr_active_timers)) {
         return false;
     }
 
@@ -545,7 +650,7 @@ bool timerlist_run_timers(QEMUTimerList *timer_list)
      */
     current_time = qemu_clock_get_ns(timer_list->clock->type);
     qemu_mutex_lock(&timer_list->active_timers_lock);
-    while ((ts = timer_list->active_timers)) {
+    while ((ts = timerlist_first(timer_list))) {
         if (!timer_expired_ns(ts, current_time)) {
             /* No expired timers left.  The checkpoint can be skipped
              * if no timers fired or they were all external.
@@ -565,9 +670,7 @@ bool timerlist_run_timers(QEMUTimerList *timer_list)
         }
 
         /* remove timer from the list before calling the callback */
-        timer_list->active_timers = ts->next;
-        ts->next = NULL;
-        ts->expire_time = -1;
+        timer_del_locked(timer_list, ts);
         cb = ts->cb;
         opaque = ts->opaque;
 
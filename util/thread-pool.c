@@ -19,6 +19,8 @@
 #include "qemu/queue.h"
 #include "qemu/thread.h"
 #include "qemu/coroutine.h"
+#include "qemu/stats64.h"
+#include "qemu/timer.h"
 #include "trace.h"
 #include "block/thread-pool.h"
 #include "qemu/main-loop.h"
@@ -28,6 +30,7 @@ static void do_spawn_thread(ThreadPool *pool);
 typedef struct ThreadPoolElement ThreadPoolElement;
 
 enum ThreadState {
+    THREAD_BATCHED,
     THREAD_QUEUED,
     THREAD_ACTIVE,
     THREAD_DONE,
@@ -39,18 +42,27 @@ struct ThreadPoolElement {
     ThreadPoolFunc *func;
     void *arg;
 
-    /* Moving state out of THREAD_QUEUED is protected by lock.  After
+    /* THREAD_BATCHED is only seen by the thread pool's mother thread.
+     * Moving state out of THREAD_QUEUED is protected by lock.  After
      * that, only the worker thread can write to it.  Reads and writes
      * of state and ret are ordered with memory barriers.
      */
     enum ThreadState state;
     int ret;
 
-    /* Access to this list is protected by lock.  */
+    /* When the request was submitted, for the wait time statistics.  */
+    int64_t submit_ns;
+
+    /* Access to this list is protected by lock while the request is
+     * THREAD_QUEUED.  While it is THREAD_BATCHED, it is on submit_list.
+     */
     QTAILQ_ENTRY(ThreadPoolElement) reqs;
 
     /* This list is only written by the thread pool's mother thread.  */
     QLIST_ENTRY(ThreadPoolElement) all;
+
+    /* Link in done_list, and later in completed.  */
+    ThreadPoolElement *done_next;
 };
 
 struct ThreadPool {
@@ -63,9 +75,24 @@ struct ThreadPool {
 
     /* The following variables are only accessed from one AioContext. */
     QLIST_HEAD(, ThreadPoolElement) head;
+    QTAILQ_HEAD(, ThreadPoolElement) submit_list;
+    ThreadPoolElement *completed;
+
+    /*
+     * Requests that have finished, pushed by the worker threads and taken
+     * as a whole by the completion BH.  Only the push that finds the list
+     * empty needs to schedule the BH.
+     */
+    ThreadPoolElement *done_list;
+
+    /* Statistics, updated by the worker threads */
+    Stat64 completed_reqs;
+    Stat64 wait_ns;
+    Stat64 run_ns;
 
     /* The following variables are protected by lock.  */
     QTAILQ_HEAD(, ThreadPoolElement) request_list;
+    int queued_reqs;
     int cur_threads;
     int idle_threads;
     int new_threads;     /* backlog of threads we need to create */
@@ -74,6 +101,22 @@ struct ThreadPool {
     int max_threads;
 };
 
+/* Hand a finished request over to the completion BH */
+static void thread_pool_push_done(ThreadPool *pool, ThreadPoolElement *req)
+{
+    ThreadPoolElement *old;
+
+    do {
+        old = qatomic_read(&pool->done_list);
+        req->done_next = old;
+    } while (qatomic_cmpxchg(&pool->done_list, old, req) != old);
+
+    /* req may already be gone now, but pool lives until all workers exit */
+    if (!old) {
+        qemu_bh_schedule(pool->completion_bh);
+    }
+}
+
 static void *worker_thread(void *opaque)
 {
     ThreadPool *pool = opaque;
@@ -84,6 +127,7 @@ static void *worker_thread(void *opaque)
 
     while (pool->cur_threads <= pool->max_threads) {
         ThreadPoolElement *req;
+        int64_t start_ns;
         int ret;
 
         if (QTAILQ_EMPTY(&pool->request_list)) {
@@ -105,17 +149,24 @@ static void *worker_thread(void *opaque)
 
         req = QTAILQ_FIRST(&pool->request_list);
         QTAILQ_REMOVE(&pool->request_list, req, reqs);
+        pool->queued_reqs--;
         req->state = THREAD_ACTIVE;
         qemu_mutex_unlock(&pool->lock);
 
+        start_ns = get_clock();
+        stat64_add(&pool->wait_ns, start_ns - req->submit_ns);
+
         ret = req->func(req->arg);
 
+        stat64_add(&pool->run_ns, get_clock() - start_ns);
+        stat64_add(&pool->completed_reqs, 1);
+
         req->ret = ret;
         /* Write ret before state.  */
         smp_wmb();
         req->state = THREAD_DONE;
 
-        qemu_bh_schedule(pool->completion_bh);
+        thread_pool_push_done(pool, req);
         qemu_mutex_lock(&pool->lock);
     }
 
@@ -171,18 +222,43 @@ static void spawn_thread(ThreadPool *pool)
     }
 }
 
+/*
+ * Return the oldest finished request, or NULL.  Whatever the workers
+ * have pushed since the last call is taken in one go and put back in
+ * completion order.
+ */
+static ThreadPoolElement *thread_pool_next_completed(ThreadPool *pool)
+{
+    ThreadPoolElement *elem;
+
+    if (!pool->completed) {
+        ThreadPoolElement *list = qatomic_xchg(&pool->done_list, NULL);
+
+        while (list) {
+            ThreadPoolElement *next = list->done_next;
+
+            list->done_next = pool->completed;
+            pool->completed = list;
+            list = next;
+        }
+    }
+
+    elem = pool->completed;
+    if (elem) {
+        pool->completed = elem->done_next;
+    }
+    return elem;
+}
+
 static void thread_pool_completion_bh(void *opaque)
 {
     ThreadPool *pool = opaque;
-    ThreadPoolElement *elem, *next;
+    ThreadPoolElement *elem;
 
     defer_call_begin(); /* cb() may use defer_call() to coalesce work */
 
-restart:
-    QLIST_FOREACH_SAFE(elem, &pool->head, all, next) {
-        if (elem->state != THREAD_DONE) {
-            continue;
-        }
+    while ((elem = thread_pool_next_completed(pool))) {
+        assert(elem->state == THREAD_DONE);
 
         trace_thread_pool_complete(pool, elem, elem->common.opaque,
                                    elem->ret);
@@ -200,16 +276,12 @@ restart:
             elem->common.cb(elem->common.opaque, elem->ret);
 
             /* We can safely cancel the completion_bh here regardless of someone
-             * else having scheduled it meanwhile because we reenter the
-             * completion function anyway (goto restart).
+             * else having scheduled it meanwhile because we look at done_list
+             * again before leaving the loop.
              */
             qemu_bh_cancel(pool->completion_bh);
-
-            qemu_aio_unref(elem);
-            goto restart;
-        } else {
-            qemu_aio_unref(elem);
         }
+        qemu_aio_unref(elem);
     }
 
     defer_call_end();
@@ -222,15 +294,60 @@ static void thread_pool_cancel(BlockAIOCB *acb)
 
     trace_thread_pool_cancel(elem, elem->common.opaque);
 
-    QEMU_LOCK_GUARD(&pool->lock);
-    if (elem->state == THREAD_QUEUED) {
+    if (elem->state == THREAD_BATCHED) {
+        QTAILQ_REMOVE(&pool->submit_list, elem, reqs);
+    } else {
+        QEMU_LOCK_GUARD(&pool->lock);
+        if (elem->state != THREAD_QUEUED) {
+            return;
+        }
         QTAILQ_REMOVE(&pool->request_list, elem, reqs);
-        qemu_bh_schedule(pool->completion_bh);
+        pool->queued_reqs--;
+    }
 
-        elem->state = THREAD_DONE;
-        elem->ret = -ECANCELED;
+    elem->ret = -ECANCELED;
+    elem->state = THREAD_DONE;
+    thread_pool_push_done(pool, elem);
+}
+
+/*
+ * Move the requests collected on submit_list to the workers, taking the
+ * lock and waking up threads once for the whole batch.
+ */
+static void thread_pool_submit_batch(void *opaque)
+{
+    ThreadPool *pool = opaque;
+    ThreadPoolElement *req;
+    int n = 0;
+
+    if (QTAILQ_EMPTY(&pool->submit_list)) {
+        return;
+    }
+
+    qemu_mutex_lock(&pool->lock);
+    while ((req = QTAILQ_FIRST(&pool->submit_list))) {
+        QTAILQ_REMOVE(&pool->submit_list, req, reqs);
+        req->state = THREAD_QUEUED;
+        QTAILQ_INSERT_TAIL(&pool->request_list, req, reqs);
+        n++;
     }
+    pool->queued_reqs += n;
 
+    for (int i = pool->idle_threads; i < n; i++) {
+        if (pool->cur_threads >= pool->max_threads) {
+            break;
+        }
+        spawn_thread(pool);
+    }
+    qemu_mutex_unlock(&pool->lock);
+
+    trace_thread_pool_submit_batch(pool, n);
+
+    if (n == 1) {
+        qemu_cond_signal(&pool->request_cond);
+    } else {
+        qemu_cond_broadcast(&pool->request_cond);
+    }
 }
 
 static const AIOCBInfo thread_pool_aiocb_info = {
@@ -251,20 +368,17 @@ BlockAIOCB *thread_pool_submit_aio(ThreadPoolFunc *func, void *arg,
     req = qemu_aio_get(&thread_pool_aiocb_info, NULL, cb, opaque);
     req->func = func;
     req->arg = arg;
-    req->state = THREAD_QUEUED;
+    req->state = THREAD_BATCHED;
     req->pool = pool;
+    req->submit_ns = get_clock();
 
     QLIST_INSERT_HEAD(&pool->head, req, all);
+    QTAILQ_INSERT_TAIL(&pool->submit_list, req, reqs);
 
     trace_thread_pool_submit(pool, req, arg);
 
-    qemu_mutex_lock(&pool->lock);
-    if (pool->idle_threads == 0 && pool->cur_threads < pool->max_threads) {
-        spawn_thread(pool);
-    }
-    QTAILQ_INSERT_TAIL(&pool->request_list, req, reqs);
-    qemu_mutex_unlock(&pool->lock);
-    qemu_cond_signal(&pool->request_cond);
+    /* Within a defer_call_begin()/end() section, hand requests over at once */
+    defer_call(thread_pool_submit_batch, pool);
     return &req->common;
 }
 
@@ -337,6 +451,7 @@ static void thread_pool_init_one(ThreadPool *pool, AioContext *ctx)
     pool->new_thread_bh = aio_bh_new(ctx, spawn_thread_bh_fn, pool);
 
     QLIST_INIT(&pool->head);
+    QTAILQ_INIT(&pool->submit_list);
     QTAILQ_INIT(&pool->request_list);
 
     thread_pool_update_params(pool, ctx);
@@ -349,6 +464,18 @@ ThreadPool *thread_pool_new(AioContext *ctx)
     return pool;
 }
 
+void thread_pool_get_stats(ThreadPool *pool, ThreadPoolStats *stats)
+{
+    qemu_mutex_lock(&pool->lock);
+    stats->threads = pool->cur_threads;
+    stats->queue_depth = pool->queued_reqs;
+    qemu_mutex_unlock(&pool->lock);
+
+    stats->completed = stat64_get(&pool->completed_reqs);
+    stats->wait_time_ns = stat64_get(&pool->wait_ns);
+    stats->run_time_ns = stat64_get(&pool->run_ns);
+}
+
 void thread_pool_free(ThreadPool *pool)
 {
     if (!pool) {
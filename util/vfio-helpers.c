@@ -190,16 +190,42 @@ void qemu_vfio_pci_unmap_bar(QEMUVFIOState *s, int index, void *bar,
     }
 }
 
+/**
+ * Return the number of device IRQs of @irq_type, or a negative errno.
+ */
+int qemu_vfio_pci_get_irq_count(QEMUVFIOState *s, int irq_type, Error **errp)
+{
+    struct vfio_irq_info irq_info = { .argsz = sizeof(irq_info) };
+
+    irq_info.index = irq_type;
+    if (ioctl(s->device, VFIO_DEVICE_GET_IRQ_INFO, &irq_info)) {
+        error_setg_errno(errp, errno, "Failed to get device interrupt info");
+        return -errno;
+    }
+    return MIN(irq_info.count, INT_MAX);
+}
+
 /**
  * Initialize device IRQ with @irq_type and register an event notifier.
  */
 int qemu_vfio_pci_init_irq(QEMUVFIOState *s, EventNotifier *e,
                            int irq_type, Error **errp)
+{
+    return qemu_vfio_pci_init_irqs(s, &e, 1, irq_type, errp);
+}
+
+/**
+ * Initialize the first @nr_irqs device IRQs with @irq_type and register
+ * event notifier @e[i] for IRQ i.
+ */
+int qemu_vfio_pci_init_irqs(QEMUVFIOState *s, EventNotifier **e,
+                            unsigned nr_irqs, int irq_type, Error **errp)
 {
     int r;
     struct vfio_irq_set *irq_set;
     size_t irq_set_size;
     struct vfio_irq_info irq_info = { .argsz = sizeof(irq_info) };
+    int *fds;
 
     irq_info.index = irq_type;
     if (ioctl(s->device, VFIO_DEVICE_GET_IRQ_INFO, &irq_info)) {
@@ -210,8 +236,13 @@ int qemu_vfio_pci_init_irq(QEMUVFIOState *s, EventNotifier *e,
         error_setg(errp, "Device interrupt doesn't support eventfd");
         return -EINVAL;
     }
+    if (nr_irqs > irq_info.count) {
+        error_setg(errp, "Device has %u interrupts, %u requested",
+                   irq_info.count, nr_irqs);
+        return -EINVAL;
+    }
 
-    irq_set_size = sizeof(*irq_set) + sizeof(int);
+    irq_set_size = sizeof(*irq_set) + nr_irqs * sizeof(int);
     irq_set = g_malloc0(irq_set_size);
 
     /* Get to a known IRQ state */
@@ -220,10 +251,13 @@ int qemu_vfio_pci_init_irq(QEMUVFIOState *s, EventNotifier *e,
         .flags = VFIO_IRQ_SET_DATA_EVENTFD | VFIO_IRQ_SET_ACTION_TRIGGER,
         .index = irq_info.index,
         .start = 0,
-        .count = 1,
+        .count = nr_irqs,
     };
 
-    *(int *)&irq_set->data = event_notifier_get_fd(e);
+    fds = (int *)&irq_set->data;
+    for (unsigned i = 0; i < nr_irqs; i++) {
+        fds[i] = event_notifier_get_fd(e[i]);
+    }
     r = ioctl(s->device, VFIO_DEVICE_SET_IRQS, irq_set);
     g_free(irq_set);
     if (r) {